@@ -221,7 +221,8 @@ void AdvancedSSR::run_trace_as_pass(
     const AdvancedSSRParams &params,
     const Gbuffer &gbuff,
     VkAccelerationStructureKHR acceleration_struct,
-    bool depth_as)
+    bool depth_as,
+    const gpu::BufferPtr &depth_as_pixel_ids)
 {
   TraceParams config {
     params.normal_mat,
@@ -275,6 +276,9 @@ void AdvancedSSR::run_trace_as_pass(
         gpu::UBOBinding {4, halton_buffer},
         gpu::AccelerationStructBinding {5, acceleration_struct},
         gpu::StorageTextureBinding {6, resources.get_view(input.out)});
+      if (depth_as) {
+        gpu::write_set(set, gpu::SSBOBinding {7, depth_as_pixel_ids});
+      }
       
       auto ext = resources.get_image(input.out)->get_extent();
       cmd.bind_pipeline(pipeline);
@@ -617,14 +621,15 @@ void AdvancedSSR::run(
   rendergraph::ImageResourceId ssr_color,
   rendergraph::ImageResourceId ssr_occlusion,
   VkAccelerationStructureKHR as,
-  bool depth_as)
+  bool depth_as,
+  const gpu::BufferPtr &depth_as_pixel_ids)
 {
   //clear_indirect_params(graph);
   //run_classification_pass(graph, params, gbuff);
   //run_tile_regression_pass(graph, params, gbuff);
   //run_trace_indirect_pass(graph, params, gbuff);
   if (as) {
-    run_trace_as_pass(graph, params, gbuff, as, depth_as);
+    run_trace_as_pass(graph, params, gbuff, as, depth_as, depth_as_pixel_ids);
   } else {
     run_trace_pass(graph, params, gbuff, ssr_occlusion);
   }
@@ -26,7 +26,8 @@ struct AdvancedSSR {
     rendergraph::ImageResourceId ssr_color,
     rendergraph::ImageResourceId ssr_occlusion,
     VkAccelerationStructureKHR as = nullptr,
-    bool depth_as = false);
+    bool depth_as = false,
+    const gpu::BufferPtr &depth_as_pixel_ids = {});
 
   void preintegrate_pdf(rendergraph::RenderGraph &graph);
   void preintegrate_brdf(rendergraph::RenderGraph &graph);
@@ -93,7 +94,8 @@ private:
     const AdvancedSSRParams &params,
     const Gbuffer &gbuff,
     VkAccelerationStructureKHR acceleration_struct,
-    bool depth_as);
+    bool depth_as,
+    const gpu::BufferPtr &depth_as_pixel_ids);
   
   void run_trace_indirect_pass(
     rendergraph::RenderGraph &graph,
@@ -0,0 +1,347 @@
+#include "as_memory.hpp"
+#include "gpu/imgui_context.hpp"
+
+#include <algorithm>
+#include <array>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <set>
+#include <stdexcept>
+#include <vector>
+
+const char *to_string(ASCategory category) {
+  switch (category) {
+    case ASCategory::SceneBLAS: return "Scene BLAS";
+    case ASCategory::SceneTLAS: return "Scene TLAS";
+    case ASCategory::DepthAs: return "DepthAs";
+    case ASCategory::TriangleAS: return "TriangleAS";
+    case ASCategory::TLAS: return "TLAS";
+    default: return "Unknown";
+  }
+}
+
+namespace as_memory {
+
+  constexpr VkBufferUsageFlags STORAGE_USAGE_FLAGS = VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR|VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+  constexpr VkBufferUsageFlags SCRATCH_USAGE_FLAGS = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT|VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+  constexpr uint32_t CATEGORIES_COUNT = uint32_t(ASCategory::Count);
+
+  static uint64_t align_up(uint64_t value, uint64_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+  }
+
+  struct Block {
+    gpu::BufferPtr buffer; //empty for unused slots
+    uint64_t size = 0;
+    uint64_t used = 0;
+    std::map<uint64_t, uint64_t> free_ranges; //offset -> size
+  };
+
+  struct PendingFree {
+    uint32_t block;
+    uint64_t offset;
+    uint64_t size;
+    uint64_t frame;
+  };
+
+  struct CategoryStats {
+    uint64_t storage = 0;
+    uint32_t allocations = 0;
+    uint64_t reserved_scratch = 0;
+  };
+
+  struct ASMemoryState {
+    uint32_t create_block(uint64_t size) {
+      auto slot = std::find_if(blocks.begin(), blocks.end(), [](const Block &block){ return !block.buffer; });
+      if (slot == blocks.end()) {
+        slot = blocks.insert(blocks.end(), Block {});
+      }
+      slot->buffer = gpu::create_buffer(VMA_MEMORY_USAGE_GPU_ONLY, size, STORAGE_USAGE_FLAGS, STORAGE_ALIGNMENT);
+      slot->size = size;
+      slot->used = 0;
+      slot->free_ranges.clear();
+      slot->free_ranges.emplace(0, size);
+      return slot - blocks.begin();
+    }
+
+    bool try_allocate(uint32_t block_id, uint64_t size, uint64_t &out_offset) {
+      auto &block = blocks[block_id];
+      for (auto it = block.free_ranges.begin(); it != block.free_ranges.end(); it++) {
+        if (it->second < size) {
+          continue;
+        }
+        out_offset = it->first;
+        if (it->second > size) {
+          block.free_ranges.emplace(it->first + size, it->second - size);
+        }
+        block.free_ranges.erase(it);
+        block.used += size;
+        return true;
+      }
+      return false;
+    }
+
+    void release_range(const PendingFree &range) {
+      auto &block = blocks[range.block];
+      auto next = block.free_ranges.emplace(range.offset, range.size).first;
+
+      if (next != block.free_ranges.begin()) {
+        auto prev = std::prev(next);
+        if (prev->first + prev->second == next->first) {
+          prev->second += next->second;
+          block.free_ranges.erase(next);
+          next = prev;
+        }
+      }
+      auto after = std::next(next);
+      if (after != block.free_ranges.end() && next->first + next->second == after->first) {
+        next->second += after->second;
+        block.free_ranges.erase(after);
+      }
+
+      block.used -= range.size;
+      //the first block stays for the next allocations
+      if (!block.used && range.block != 0) {
+        block.buffer.release();
+        block.free_ranges.clear();
+        block.size = 0;
+      }
+    }
+
+    void resize_arena(uint64_t size) {
+      vkDeviceWaitIdle(gpu::app_device().api_device());
+      arena = gpu::create_buffer(VMA_MEMORY_USAGE_GPU_ONLY, size, SCRATCH_USAGE_FLAGS, scratch_alignment);
+      arena_size = size;
+      arena_offset = 0;
+    }
+
+    uint64_t get_reserved_sum() const {
+      uint64_t sum = 0;
+      for (const auto &category : stats) {
+        sum += category.reserved_scratch;
+      }
+      return sum;
+    }
+
+    std::vector<Block> blocks;
+    std::vector<PendingFree> pending_frees;
+    std::array<CategoryStats, CATEGORIES_COUNT> stats {};
+
+    gpu::BufferPtr arena;
+    uint64_t arena_size = 0;
+    uint64_t arena_offset = 0;
+    uint64_t arena_peak = 0; //most scratch of one frame, wraps included
+    uint64_t frame_scratch = 0;
+    uint32_t frame_wraps = 0;
+    uint32_t last_frame_wraps = 0;
+    std::multiset<uint64_t> reservations;
+    uint64_t reserved_sum_peak = 0; //arena size without the budget
+
+    uint64_t scratch_alignment = 1;
+    uint64_t frame = 0;
+    uint32_t frames_count = 1;
+  };
+
+  ASMemoryState *g_as_memory = nullptr;
+
+  static ASMemoryState &get_state() {
+    if (!g_as_memory) {
+      throw std::runtime_error {"as_memory is not initialized"};
+    }
+    return *g_as_memory;
+  }
+
+  void init(const rendergraph::RenderGraph &graph) {
+    close();
+
+    g_as_memory = new ASMemoryState {};
+    g_as_memory->frames_count = graph.get_frames_count();
+
+    VkPhysicalDeviceAccelerationStructurePropertiesKHR as_props {};
+    as_props.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_PROPERTIES_KHR;
+
+    VkPhysicalDeviceProperties2 props {};
+    props.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+    props.pNext = &as_props;
+
+    vkGetPhysicalDeviceProperties2(gpu::app_device().api_physical_device(), &props);
+    g_as_memory->scratch_alignment = std::max(as_props.minAccelerationStructureScratchOffsetAlignment, 1u);
+  }
+
+  void close() {
+    if (g_as_memory) {
+      delete g_as_memory;
+    }
+    g_as_memory = nullptr;
+  }
+
+  ASAllocation allocate_storage(ASCategory category, uint64_t size) {
+    auto &state = get_state();
+    size = align_up(std::max(size, uint64_t(1)), STORAGE_ALIGNMENT);
+
+    uint64_t offset = 0;
+    uint32_t block_id = 0;
+    bool found = false;
+    for (; block_id < state.blocks.size() && !found; block_id++) {
+      found = state.blocks[block_id].buffer && state.try_allocate(block_id, size, offset);
+    }
+    if (found) {
+      block_id--;
+    } else {
+      block_id = state.create_block(std::max(size, BLOCK_SIZE));
+      state.try_allocate(block_id, size, offset);
+    }
+
+    auto &stats = state.stats[uint32_t(category)];
+    stats.storage += size;
+    stats.allocations++;
+
+    return ASAllocation {state.blocks[block_id].buffer, offset, size, block_id, category};
+  }
+
+  void free_storage(ASAllocation &allocation) {
+    //owners may outlive close() at exit
+    if (allocation && g_as_memory) {
+      auto &stats = g_as_memory->stats[uint32_t(allocation.category)];
+      stats.storage -= allocation.size;
+      stats.allocations--;
+      g_as_memory->pending_frees.push_back(PendingFree {allocation.block, allocation.offset, allocation.size, g_as_memory->frame});
+    }
+    allocation = ASAllocation {};
+  }
+
+  void reserve_scratch(ASCategory category, uint64_t size) {
+    auto &state = get_state();
+    size = align_up(size, state.scratch_alignment);
+    state.stats[uint32_t(category)].reserved_scratch += size;
+    state.reservations.insert(size);
+    const uint64_t reserved = state.get_reserved_sum();
+    state.reserved_sum_peak = std::max(state.reserved_sum_peak, reserved);
+
+    //the arena does not shrink, owners are recreated with similar sizes
+    const uint64_t arena_size = std::max(*state.reservations.rbegin(), std::min(reserved, SCRATCH_ARENA_BUDGET));
+    if (arena_size > state.arena_size) {
+      state.resize_arena(arena_size);
+    }
+  }
+
+  void release_scratch(ASCategory category, uint64_t size) {
+    if (g_as_memory) {
+      size = align_up(size, g_as_memory->scratch_alignment);
+      auto &reserved = g_as_memory->stats[uint32_t(category)].reserved_scratch;
+      reserved -= std::min(reserved, size);
+
+      auto it = g_as_memory->reservations.find(size);
+      if (it != g_as_memory->reservations.end()) {
+        g_as_memory->reservations.erase(it);
+      }
+    }
+  }
+
+  VkDeviceAddress allocate_init_scratch(uint64_t size) {
+    auto &state = get_state();
+    if (size > state.arena_size) {
+      state.resize_arena(size);
+    } else {
+      vkDeviceWaitIdle(gpu::app_device().api_device());
+    }
+    return state.arena->device_address();
+  }
+
+  VkDeviceAddress allocate_scratch(VkCommandBuffer cmd, uint64_t size) {
+    auto &state = get_state();
+    size = align_up(size, state.scratch_alignment);
+    if (size > state.arena_size) {
+      throw std::runtime_error {"AS scratch arena overflow, the build needs more than was reserved"};
+    }
+
+    //builds of this frame at the start of the arena are done with the scratch
+    if (state.arena_offset + size > state.arena_size) {
+      VkMemoryBarrier barrier {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .pNext = nullptr,
+        .srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR,
+        .dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR|VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR
+      };
+      vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+        0, 1, &barrier, 0, nullptr, 0, nullptr);
+      state.arena_offset = 0;
+      state.frame_wraps++;
+    }
+
+    VkDeviceAddress address = state.arena->device_address() + state.arena_offset;
+    state.arena_offset += size;
+    state.frame_scratch += size;
+    state.arena_peak = std::max(state.arena_peak, state.frame_scratch);
+    return address;
+  }
+
+  void begin_frame() {
+    auto &state = get_state();
+    state.arena_offset = 0;
+    state.frame_scratch = 0;
+    state.last_frame_wraps = state.frame_wraps;
+    state.frame_wraps = 0;
+    state.frame++;
+
+    //frames in flight may still trace structures of freed ranges
+    auto retired = std::stable_partition(state.pending_frees.begin(), state.pending_frees.end(), [&](const PendingFree &range){
+      return range.frame + state.frames_count >= state.frame;
+    });
+    for (auto it = retired; it != state.pending_frees.end(); it++) {
+      state.release_range(*it);
+    }
+    state.pending_frees.erase(retired, state.pending_frees.end());
+  }
+
+  uint64_t get_scratch_alignment() {
+    return get_state().scratch_alignment;
+  }
+
+  static void get_blocks_usage(const ASMemoryState &state, uint32_t &count, uint64_t &size) {
+    count = 0;
+    size = 0;
+    for (const auto &block : state.blocks) {
+      if (block.buffer) {
+        count++;
+        size += block.size;
+      }
+    }
+  }
+
+  void print_report() {
+    auto &state = get_state();
+    uint32_t blocks_count;
+    uint64_t blocks_size;
+    get_blocks_usage(state, blocks_count, blocks_size);
+
+    std::cout << "AS memory : " << blocks_count << " blocks " << (blocks_size >> 10) << " KB, scratch arena " << (state.arena_size >> 10)
+      << " KB (sum of reservations " << (state.reserved_sum_peak >> 10) << " KB), frame peak " << (state.arena_peak >> 10) << " KB, "
+      << state.last_frame_wraps << " wraps last frame\n";
+    for (uint32_t i = 0; i < CATEGORIES_COUNT; i++) {
+      const auto &stats = state.stats[i];
+      std::cout << "  " << to_string(ASCategory(i)) << " : " << stats.allocations << " allocations " << (stats.storage >> 10)
+        << " KB storage, " << (stats.reserved_scratch >> 10) << " KB scratch\n";
+    }
+  }
+
+  void draw_ui() {
+    auto &state = get_state();
+    uint32_t blocks_count;
+    uint64_t blocks_size;
+    get_blocks_usage(state, blocks_count, blocks_size);
+
+    ImGui::Begin("AS memory");
+    ImGui::Text("Blocks %u, %u KB", blocks_count, uint32_t(blocks_size >> 10));
+    ImGui::Text("Scratch arena %u KB, sum of reservations %u KB", uint32_t(state.arena_size >> 10), uint32_t(state.reserved_sum_peak >> 10));
+    ImGui::Text("Frame peak %u KB, wraps %u", uint32_t(state.arena_peak >> 10), state.last_frame_wraps);
+    for (uint32_t i = 0; i < CATEGORIES_COUNT; i++) {
+      const auto &stats = state.stats[i];
+      ImGui::Text("%s: %u KB in %u, scratch %u KB", to_string(ASCategory(i)), uint32_t(stats.storage >> 10), stats.allocations,
+        uint32_t(stats.reserved_scratch >> 10));
+    }
+    ImGui::End();
+  }
+
+}
@@ -0,0 +1,66 @@
+#ifndef AS_MEMORY_HPP_INCLUDED
+#define AS_MEMORY_HPP_INCLUDED
+
+#include "gpu/gpu.hpp"
+#include "rendergraph/rendergraph.hpp"
+
+#include <cstdint>
+
+enum class ASCategory : uint32_t {
+  SceneBLAS,
+  SceneTLAS,
+  DepthAs,
+  TriangleAS,
+  TLAS, //per structure and unified TLASes
+  Count
+};
+
+const char *to_string(ASCategory category);
+
+//range of a storage block, keeps the block alive
+struct ASAllocation {
+  gpu::BufferPtr buffer;
+  uint64_t offset = 0;
+  uint64_t size = 0;
+  uint32_t block = 0;
+  ASCategory category = ASCategory::TLAS;
+
+  explicit operator bool() const { return bool(buffer); }
+  VkBuffer api_buffer() const { return buffer->api_buffer(); }
+};
+
+//Acceleration structure memory. Storage is suballocated from a few large blocks, every AS build takes its scratch from one arena.
+//The arena is a bump allocator reset by begin_frame(), builds of one frame get separate ranges and may overlap on the GPU.
+//It holds the reserved scratch of all users up to SCRATCH_ARENA_BUDGET, but never less than the largest reservation. When a frame
+//runs past the end, allocation wraps to the start after a barrier that waits for the builds recorded before.
+//Builds of different frames reuse the same ranges, like the per structure scratch buffers did, so build sites keep their barriers.
+//Freed storage ranges are reused after the frames in flight are done with them
+namespace as_memory {
+  constexpr uint64_t BLOCK_SIZE = 64ull << 20;
+  constexpr uint64_t STORAGE_ALIGNMENT = 256; //VkAccelerationStructureCreateInfoKHR::offset
+  constexpr uint64_t SCRATCH_ARENA_BUDGET = 32ull << 20;
+
+  void init(const rendergraph::RenderGraph &graph);
+  void close();
+
+  //bigger allocations get a dedicated block
+  ASAllocation allocate_storage(ASCategory category, uint64_t size);
+  void free_storage(ASAllocation &allocation);
+
+  //scratch of all builds of one frame, call at creation. Waits for the device if the arena grows
+  void reserve_scratch(ASCategory category, uint64_t size);
+  void release_scratch(ASCategory category, uint64_t size);
+  //scratch of a build submitted with submit_and_wait. Waits for the device, the arena is free again once the build is waited
+  VkDeviceAddress allocate_init_scratch(uint64_t size);
+  //size is aligned to get_scratch_alignment(). If the frame wraps the arena, records a barrier to cmd. Throws if size is over the arena size
+  VkDeviceAddress allocate_scratch(VkCommandBuffer cmd, uint64_t size);
+  //first call of the frame, before any build is recorded
+  void begin_frame();
+  //minAccelerationStructureScratchOffsetAlignment
+  uint64_t get_scratch_alignment();
+
+  void print_report();
+  void draw_ui();
+}
+
+#endif
@@ -0,0 +1,214 @@
+#include "as_update_policy.hpp"
+#include "imgui_pass.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+//FrameTimer results are get_frames_count() frames old
+static constexpr uint32_t BASELINE_DELAY = 4;
+
+void ASUpdatePolicy::init(uint32_t units_count) {
+  units.assign(units_count, Unit {});
+  rebuild_queue.clear();
+  history.clear();
+  forced = true;
+  frame_translation = 0.f;
+  frame_rotation = 0.f;
+  build_ms = -1.f;
+  trace_ms = -1.f;
+  trace_baseline_ms = -1.f;
+  baseline_delay = 0;
+  trace_cost_wave = false;
+  rebuild_rate = params.max_rebuilds_per_frame;
+}
+
+void ASUpdatePolicy::force_rebuild() {
+  forced = true;
+}
+
+void ASUpdatePolicy::add_camera_motion(const glm::mat4 &camera, const glm::mat4 &prev_camera) {
+  glm::vec3 pos {glm::inverse(camera)[3]};
+  glm::vec3 prev_pos {glm::inverse(prev_camera)[3]};
+  frame_translation += glm::length(pos - prev_pos);
+
+  //angle of the relative rotation
+  glm::mat3 delta = glm::mat3(camera) * glm::transpose(glm::mat3(prev_camera));
+  float cos_angle = 0.5f * (delta[0][0] + delta[1][1] + delta[2][2] - 1.f);
+  frame_rotation += std::acos(std::clamp(cos_angle, -1.f, 1.f));
+}
+
+void ASUpdatePolicy::add_disocclusion(uint32_t unit, float changed_fraction) {
+  units[unit].disocclusion += changed_fraction;
+}
+
+void ASUpdatePolicy::report_build_ms(float ms) {
+  build_ms = ms;
+}
+
+void ASUpdatePolicy::report_trace_ms(float ms) {
+  trace_ms = ms;
+  if (ms < 0.f || baseline_delay > 0 || trace_cost_wave) {
+    return;
+  }
+  //a cheaper view lowers the baseline too
+  trace_baseline_ms = (trace_baseline_ms < 0.f)? ms : std::min(trace_baseline_ms, ms);
+}
+
+void ASUpdatePolicy::queue(uint32_t unit, Reason reason) {
+  if (units[unit].queued) {
+    return;
+  }
+  units[unit].queued = true;
+  units[unit].reason = reason;
+  rebuild_queue.push_back(unit);
+}
+
+void ASUpdatePolicy::reset_unit(uint32_t unit) {
+  units[unit] = Unit {};
+}
+
+uint32_t ASUpdatePolicy::decide(std::vector<ASUpdateDecision> &updates) {
+  FrameStats stats {};
+  stats.build_ms = build_ms;
+  stats.trace_ms = trace_ms;
+
+  for (uint32_t i = 0; i < units.size(); i++) {
+    auto &unit = units[i];
+    unit.translation += frame_translation;
+    unit.rotation += frame_rotation;
+
+    if (unit.refits >= params.max_refits) {
+      queue(i, Reason::Periodic);
+    } else if (unit.translation > params.max_camera_translation || unit.rotation > params.max_camera_rotation) {
+      queue(i, Reason::Camera);
+    } else if (unit.disocclusion > params.max_disocclusion) {
+      queue(i, Reason::Disocclusion);
+    }
+  }
+  frame_translation = 0.f;
+  frame_rotation = 0.f;
+
+  if (trace_baseline_ms > 0.f && trace_ms > trace_baseline_ms * (1.f + params.max_trace_cost_growth)) {
+    for (uint32_t i = 0; i < units.size(); i++) {
+      queue(i, Reason::TraceCost);
+    }
+    trace_baseline_ms = -1.f;
+    trace_cost_wave = true;
+  }
+
+  if (baseline_delay > 0) {
+    baseline_delay--;
+  }
+
+  //build time is measured for the whole update, refits included
+  const uint32_t max_rate = std::max(params.max_rebuilds_per_frame, 1u);
+  if (params.build_budget_ms > 0.f && build_ms > params.build_budget_ms) {
+    rebuild_rate = std::max(rebuild_rate/2u, 1u);
+  } else if (params.build_budget_ms <= 0.f || build_ms < 0.5f * params.build_budget_ms) {
+    rebuild_rate = std::min(rebuild_rate + 1u, max_rate);
+  }
+  rebuild_rate = std::min(rebuild_rate, max_rate);
+
+  if (forced) {
+    for (uint32_t i = 0; i < units.size(); i++) {
+      updates[i] = ASUpdateDecision::Rebuild;
+      reset_unit(i);
+    }
+    rebuild_queue.clear();
+    forced = false;
+    trace_cost_wave = false;
+    trace_baseline_ms = -1.f;
+    baseline_delay = BASELINE_DELAY;
+
+    stats.rebuilds = units.size();
+    stats.reason = Reason::Forced;
+    history.push_back(stats);
+    if (history.size() > HISTORY_SIZE) {
+      history.pop_front();
+    }
+    return stats.rebuilds;
+  }
+
+  while (!rebuild_queue.empty() && stats.rebuilds < rebuild_rate) {
+    uint32_t unit = rebuild_queue.front();
+    rebuild_queue.pop_front();
+
+    if (stats.rebuilds == 0) {
+      stats.reason = units[unit].reason;
+    }
+    updates[unit] = ASUpdateDecision::Rebuild;
+    reset_unit(unit);
+    stats.rebuilds++;
+  }
+
+  //every unit is rebuilt, trace time of the next frames is the new baseline
+  if (trace_cost_wave && rebuild_queue.empty()) {
+    trace_cost_wave = false;
+    trace_baseline_ms = -1.f;
+    baseline_delay = BASELINE_DELAY;
+  }
+
+  for (uint32_t i = 0; i < units.size(); i++) {
+    if (updates[i] == ASUpdateDecision::Refit) {
+      units[i].refits++;
+      stats.refits++;
+    }
+  }
+
+  stats.queued = rebuild_queue.size();
+  history.push_back(stats);
+  if (history.size() > HISTORY_SIZE) {
+    history.pop_front();
+  }
+  return stats.rebuilds;
+}
+
+void ASUpdatePolicy::draw_ui(const char *name) {
+  ImGui::Begin(name);
+  if (history.size()) {
+    const auto &stats = history.back();
+    ImGui::Text("Refits %u rebuilds %u queued %u (%s)", stats.refits, stats.rebuilds, stats.queued, to_string(stats.reason));
+    ImGui::Text("Build %.3f ms trace %.3f ms baseline %.3f ms", stats.build_ms, stats.trace_ms, trace_baseline_ms);
+    ImGui::Text("Rebuild rate %u", rebuild_rate);
+
+    float build_times[HISTORY_SIZE] {};
+    float trace_times[HISTORY_SIZE] {};
+    float rebuilds[HISTORY_SIZE] {};
+    for (uint32_t i = 0; i < history.size(); i++) {
+      build_times[i] = std::max(history[i].build_ms, 0.f);
+      trace_times[i] = std::max(history[i].trace_ms, 0.f);
+      rebuilds[i] = history[i].rebuilds;
+    }
+    ImGui::PlotLines("Build ms", build_times, int(history.size()));
+    ImGui::PlotLines("Trace ms", trace_times, int(history.size()));
+    ImGui::PlotHistogram("Rebuilds", rebuilds, int(history.size()));
+  }
+
+  int max_refits = params.max_refits;
+  int max_rebuilds = params.max_rebuilds_per_frame;
+  ImGui::SliderInt("Max refits", &max_refits, 1, 600);
+  ImGui::SliderInt("Max rebuilds per frame", &max_rebuilds, 1, 256);
+  params.max_refits = max_refits;
+  params.max_rebuilds_per_frame = max_rebuilds;
+  ImGui::SliderFloat("Max camera translation", &params.max_camera_translation, 0.f, 10.f);
+  ImGui::SliderFloat("Max camera rotation", &params.max_camera_rotation, 0.f, 3.14f);
+  ImGui::SliderFloat("Max disocclusion", &params.max_disocclusion, 0.f, 4.f);
+  ImGui::SliderFloat("Max trace cost growth", &params.max_trace_cost_growth, 0.f, 2.f);
+  ImGui::SliderFloat("Build budget ms", &params.build_budget_ms, 0.f, 5.f);
+  if (ImGui::Button("Rebuild all")) {
+    force_rebuild();
+  }
+  ImGui::End();
+}
+
+const char *to_string(ASUpdatePolicy::Reason reason) {
+  switch (reason) {
+  case ASUpdatePolicy::Reason::None: return "none";
+  case ASUpdatePolicy::Reason::Forced: return "forced";
+  case ASUpdatePolicy::Reason::Periodic: return "periodic";
+  case ASUpdatePolicy::Reason::Camera: return "camera";
+  case ASUpdatePolicy::Reason::Disocclusion: return "disocclusion";
+  case ASUpdatePolicy::Reason::TraceCost: return "trace cost";
+  }
+  return "";
+}
@@ -0,0 +1,106 @@
+#ifndef AS_UPDATE_POLICY_HPP_INCLUDED
+#define AS_UPDATE_POLICY_HPP_INCLUDED
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+
+//Refit or rebuild decision for acceleration structures made of independent units (DepthAs tiles, one unit for TriangleAS).
+//Refits keep the old tree topology, so quality proxies accumulate on every unit until it is rebuilt:
+//refit count, camera motion, disoccluded pixels and growth of the measured trace time over the post rebuild baseline.
+//Units over a threshold are queued and rebuilt at most max_rebuilds_per_frame at a time
+struct ASUpdatePolicyParams {
+  uint32_t max_refits = 60;              //periodic rebuild
+  float max_camera_translation = 1.f;    //world units since the unit was rebuilt
+  float max_camera_rotation = 0.2f;      //radians since the unit was rebuilt
+  float max_disocclusion = 0.25f;        //accumulated fraction of changed pixels of the unit
+  float max_trace_cost_growth = 0.2f;    //trace time relative to the baseline, rebuilds every unit
+  uint32_t max_rebuilds_per_frame = 8;   //amortization, units
+  float build_budget_ms = 0.5f;          //rebuild rate is halved while build time is over it, 0 disables
+};
+
+enum class ASUpdateDecision : uint8_t {
+  Skip = 0,
+  Refit = 1,
+  Rebuild = 2
+};
+
+struct ASUpdatePolicy {
+  enum class Reason : uint8_t {
+    None,
+    Forced,
+    Periodic,
+    Camera,
+    Disocclusion,
+    TraceCost
+  };
+
+  struct FrameStats {
+    uint32_t refits = 0;
+    uint32_t rebuilds = 0;
+    uint32_t queued = 0;   //units waiting for a rebuild after this frame
+    Reason reason = Reason::None; //why the first unit rebuilt this frame was queued
+    float build_ms = -1.f; //GPU times reported for this frame, negative if unknown
+    float trace_ms = -1.f;
+  };
+
+  static constexpr uint32_t HISTORY_SIZE = 128;
+
+  void init(uint32_t units_count);
+  //every unit is rebuilt by the next decide(), not limited by the budget
+  void force_rebuild();
+
+  //inputs of the frame, call before decide()
+  void add_camera_motion(const glm::mat4 &camera, const glm::mat4 &prev_camera);
+  void add_disocclusion(uint32_t unit, float changed_fraction);
+  //GPU times, usually a few frames old
+  void report_build_ms(float ms);
+  void report_trace_ms(float ms);
+
+  //updates[i] must be Skip or Refit on input, units picked for a rebuild are set to Rebuild. Returns the number of rebuilt units
+  uint32_t decide(std::vector<ASUpdateDecision> &updates);
+
+  const FrameStats &get_last_stats() const { return history.back(); }
+  const std::deque<FrameStats> &get_history() const { return history; }
+  uint32_t get_rebuild_rate() const { return rebuild_rate; }
+
+  void draw_ui(const char *name);
+
+  ASUpdatePolicyParams params;
+
+private:
+  struct Unit {
+    uint32_t refits = 0;
+    float translation = 0.f;
+    float rotation = 0.f;
+    float disocclusion = 0.f;
+    bool queued = false;
+    Reason reason = Reason::None;
+  };
+
+  void queue(uint32_t unit, Reason reason);
+  void reset_unit(uint32_t unit);
+
+  std::vector<Unit> units;
+  std::deque<uint32_t> rebuild_queue;
+  bool forced = true;
+
+  float frame_translation = 0.f;
+  float frame_rotation = 0.f;
+
+  float build_ms = -1.f;
+  float trace_ms = -1.f;
+  float trace_baseline_ms = -1.f;
+  uint32_t baseline_delay = 0; //frames until trace_ms reflects the last full rebuild
+  bool trace_cost_wave = false; //every unit is queued because of the trace cost
+  uint32_t rebuild_rate = 0;
+
+  std::deque<FrameStats> history;
+};
+
+const char *to_string(ASUpdatePolicy::Reason reason);
+
+#endif
@@ -0,0 +1,736 @@
+#include "benchmarks.hpp"
+#include "scene/cpu_bvh.hpp"
+#include "depth_as_cpu.hpp"
+#include "tree_compressor_cpu.hpp"
+#include "gpu_primitives.hpp"
+#include "gpu_primitives_cpu.hpp"
+#include "gpu_transfer.hpp"
+#include "as_memory.hpp"
+#include "frame_timer.hpp"
+#include "scene_tlas.hpp"
+#include "depth_as.hpp"
+#include "parallel.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <functional>
+#include <random>
+
+using BenchClock = std::chrono::steady_clock;
+
+struct BenchTimings {
+  double min_ms = 0.0;
+  double avg_ms = 0.0;
+};
+
+static BenchTimings measure(uint32_t iterations, const std::function<void()> &cb) {
+  BenchTimings result {1e30, 0.0};
+  for (uint32_t i = 0; i < iterations; i++) {
+    auto start = BenchClock::now();
+    cb();
+    std::chrono::duration<double, std::milli> elapsed = BenchClock::now() - start;
+    result.min_ms = std::min(result.min_ms, elapsed.count());
+    result.avg_ms += elapsed.count()/iterations;
+  }
+  return result;
+}
+
+static void print_timings(const char *name, const BenchTimings &t) {
+  std::cout << "  " << name << ": min " << t.min_ms << " ms, avg " << t.avg_ms << " ms\n";
+}
+
+void bench_scene_loading(gpu::TransferCmdPool &transfer_pool, const std::string &path, uint32_t iterations) {
+  std::cout << "Scene loading benchmark " << path << "\n";
+
+  //first run cooks the cache if needed
+  auto cook_time = measure(1, [&](){
+    scene::load_scene_cached(transfer_pool, path);
+  });
+  gpu::collect_resources();
+
+  auto gltf_time = measure(iterations, [&](){
+    scene::load_tinygltf_scene(transfer_pool, path);
+    gpu::collect_resources();
+  });
+
+  auto cached_time = measure(iterations, [&](){
+    scene::load_scene_cached(transfer_pool, path);
+    gpu::collect_resources();
+  });
+
+  print_timings("first cached load", cook_time);
+  print_timings("tinygltf", gltf_time);
+  print_timings("cached", cached_time);
+  std::cout << "  speedup x" << gltf_time.avg_ms/cached_time.avg_ms << "\n";
+}
+
+void bench_cpu_ray_tracing(gpu::TransferCmdPool &transfer_pool, const std::string &path, uint32_t iterations) {
+  constexpr uint32_t WIDTH = 1024;
+  constexpr uint32_t HEIGHT = 512;
+  std::cout << "CPU ray tracing benchmark " << path << "\n";
+
+  scene::SceneLoadOptions options {};
+  options.for_ray_tracing = false;
+  auto scene = scene::load_scene_cached(transfer_pool, path, options);
+  auto soup = scene::read_scene_triangles(transfer_pool, scene);
+
+  scene::CpuBVH bvh;
+  auto build_time = measure(iterations, [&](){
+    bvh.build(soup);
+  });
+
+  const auto &root = bvh.get_nodes().at(0);
+  const glm::vec3 center = 0.5f * (root.bmin + root.bmax);
+  const float diagonal = glm::length(root.bmax - root.bmin);
+
+  //panorama from the center of the scene
+  std::vector<scene::CpuRay> primary_rays;
+  primary_rays.reserve(WIDTH * HEIGHT);
+  for (uint32_t y = 0; y < HEIGHT; y++) {
+    for (uint32_t x = 0; x < WIDTH; x++) {
+      float phi = 2.f * glm::pi<float>() * (x + 0.5f)/WIDTH;
+      float theta = glm::pi<float>() * (y + 0.5f)/HEIGHT;
+      glm::vec3 dir {std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi)};
+      primary_rays.push_back(scene::CpuRay {center, 0.f, dir, 2.f * diagonal});
+    }
+  }
+
+  std::vector<scene::CpuHit> hits;
+  auto primary_time = measure(iterations, [&](){
+    bvh.closest_hit_parallel(primary_rays, hits);
+  });
+
+  //ambient occlusion like rays from primary hits
+  std::mt19937 rng {1234};
+  std::uniform_real_distribution<float> dist {-1.f, 1.f};
+  std::vector<scene::CpuRay> ao_rays;
+  ao_rays.reserve(hits.size());
+  for (uint32_t i = 0; i < hits.size(); i++) {
+    if (hits[i].triangle == scene::CPU_INVALID_TRIANGLE) {
+      continue;
+    }
+    const glm::vec3 *v = soup.positions.data() + 3 * hits[i].triangle;
+    glm::vec3 normal = glm::normalize(glm::cross(v[1] - v[0], v[2] - v[0]));
+    if (glm::dot(normal, primary_rays[i].dir) > 0.f) {
+      normal = -normal;
+    }
+
+    glm::vec3 dir {dist(rng), dist(rng), dist(rng)};
+    dir = glm::normalize(dir + normal * 1.01f);
+    glm::vec3 origin = primary_rays[i].origin + primary_rays[i].dir * hits[i].t + normal * (1e-4f * diagonal);
+    ao_rays.push_back(scene::CpuRay {origin, 0.f, dir, 0.1f * diagonal});
+  }
+
+  std::vector<uint8_t> occluded;
+  auto ao_time = measure(iterations, [&](){
+    bvh.any_hit_parallel(ao_rays, occluded);
+  });
+
+  uint32_t primary_hits = std::count_if(hits.begin(), hits.end(), [](const auto &hit){ return hit.triangle != scene::CPU_INVALID_TRIANGLE; });
+  uint32_t ao_hits = std::count(occluded.begin(), occluded.end(), 1);
+
+  std::cout << "  " << soup.sources.size() << " triangles, " << bvh.get_nodes().size() << " nodes, depth " << bvh.get_depth() << "\n";
+  print_timings("build", build_time);
+  print_timings("closest hit", primary_time);
+  print_timings("any hit", ao_time);
+  std::cout << "  closest hit " << primary_rays.size()/(primary_time.min_ms * 1e3) << " Mrays/s, " << primary_hits << " hits\n";
+  std::cout << "  any hit " << ao_rays.size()/(ao_time.min_ms * 1e3) << " Mrays/s, " << ao_hits << " hits\n";
+
+  scene = {};
+  gpu::collect_resources();
+}
+
+//view space test scene for bench_depth_as: floor, ceiling, back wall and two spheres
+static bool analytic_scene_trace(const glm::vec3 &origin, const glm::vec3 &dir, float &out_t, glm::vec3 &out_normal) {
+  out_t = 1e30f;
+  auto plane = [&](const glm::vec3 &n, float d) {
+    float denom = glm::dot(n, dir);
+    if (std::abs(denom) < 1e-6f) {
+      return;
+    }
+    float t = -(glm::dot(n, origin) + d)/denom;
+    if (t > 1e-4f && t < out_t) {
+      out_t = t;
+      out_normal = n;
+    }
+  };
+
+  auto sphere = [&](const glm::vec3 &center, float radius) {
+    glm::vec3 oc = origin - center;
+    float b = glm::dot(oc, dir);
+    float c = glm::dot(oc, oc) - radius * radius;
+    float disc = b * b - c;
+    if (disc < 0.f) {
+      return;
+    }
+    float t = -b - std::sqrt(disc);
+    if (t > 1e-4f && t < out_t) {
+      out_t = t;
+      out_normal = glm::normalize(origin + t * dir - center);
+    }
+  };
+
+  plane(glm::vec3{0, 1, 0}, 1.5f);
+  plane(glm::vec3{0, -1, 0}, 3.f);
+  plane(glm::vec3{0, 0, 1}, 15.f);
+  sphere(glm::vec3{-2.f, -0.5f, -6.f}, 1.f);
+  sphere(glm::vec3{2.5f, 0.f, -9.f}, 1.5f);
+  return out_t < 1e30f;
+}
+
+//depth and view space normals of the analytic scene
+static void render_analytic_scene(uint32_t width, uint32_t height, const DepthAsParams &params, DepthImage &depth, std::vector<glm::vec3> &normals) {
+  depth.width = width;
+  depth.height = height;
+  depth.texels.resize(width * height);
+  normals.resize(width * height);
+
+  for (uint32_t y = 0; y < height; y++) {
+    for (uint32_t x = 0; x < width; x++) {
+      glm::vec2 uv = (glm::vec2{x, y} + glm::vec2{0.5f})/glm::vec2{width, height};
+      glm::vec3 dir = glm::normalize(reconstruct_view_vec(uv, 0.5f, params));
+      float t;
+      glm::vec3 normal {0, 0, 1};
+      float z = analytic_scene_trace(glm::vec3{0.f}, dir, t, normal)? t * dir.z : -params.zfar;
+      depth.texels[y * width + x] = encode_depth(std::min(z, -params.znear), params.znear, params.zfar);
+      normals[y * width + x] = normal;
+    }
+  }
+}
+
+void bench_depth_as(uint32_t iterations) {
+  constexpr uint32_t BASE_WIDTH = 1280;
+  constexpr uint32_t BASE_HEIGHT = 720;
+  const float thickness_values[] {0.1f, 0.3f, 1.f};
+
+  std::cout << "Depth AS benchmark\n";
+
+  for (uint32_t mip = 0; mip < 3; mip++) {
+    DepthAsParams params {glm::radians(60.f), float(BASE_WIDTH)/BASE_HEIGHT, 0.05f, 80.f};
+
+    DepthImage depth;
+    std::vector<glm::vec3> normals;
+    render_analytic_scene(BASE_WIDTH >> mip, BASE_HEIGHT >> mip, params, depth, normals);
+
+    for (float thickness : thickness_values) {
+      params.thickness = thickness;
+
+      std::vector<VkAabbPositionsKHR> aabbs;
+      scene::CpuBVH bvh;
+      auto build_time = measure(iterations, [&](){
+        aabbs = build_depth_as_aabbs(depth, params);
+        bvh.build(aabbs);
+      });
+
+      std::vector<DepthAsHit> hits(depth.texels.size());
+      auto trace_time = measure(iterations, [&](){
+        parallel_for(depth.height, [&](uint32_t y) {
+          for (uint32_t x = 0; x < depth.width; x++) {
+            glm::vec2 uv = (glm::vec2{x, y} + glm::vec2{0.5f})/glm::vec2{depth.width, depth.height};
+            auto ray = make_depth_as_reflection_ray(depth, uv, normals[y * depth.width + x], params);
+            hits[y * depth.width + x] = trace_depth_as(bvh, depth, ray, params);
+          }
+        });
+      });
+
+      //a hit is correct if it lands near the analytic reflection hit, only reflections that stay on screen are counted
+      uint32_t expected = 0, valid = 0, correct = 0;
+      for (uint32_t y = 0; y < depth.height; y++) {
+        for (uint32_t x = 0; x < depth.width; x++) {
+          const uint32_t index = y * depth.width + x;
+          glm::vec2 uv = (glm::vec2{x, y} + glm::vec2{0.5f})/glm::vec2{depth.width, depth.height};
+          glm::vec3 pos = reconstruct_view_vec(uv, depth.texels[index], params);
+          glm::vec3 R = glm::normalize(glm::reflect(pos, normals[index]));
+
+          float t;
+          glm::vec3 normal;
+          bool on_screen = analytic_scene_trace(pos, R, t, normal);
+          glm::vec3 target = pos + t * R;
+          glm::vec3 screen = project_view_vec(target, params);
+          on_screen = on_screen && target.z < -params.znear && screen.x >= 0.f && screen.x <= 1.f && screen.y >= 0.f && screen.y <= 1.f;
+
+          expected += on_screen? 1 : 0;
+          valid += hits[index].valid? 1 : 0;
+          if (on_screen && hits[index].valid) {
+            glm::vec3 hit_pos = reconstruct_view_vec(glm::vec2(hits[index].pos), hits[index].pos.z, params);
+            correct += (glm::length(hit_pos - target) < 0.05f * t + 0.05f)? 1 : 0;
+          }
+        }
+      }
+
+      std::cout << "  " << depth.width << "x" << depth.height << " thickness " << thickness << " : "
+        << aabbs.size() << " aabbs, " << bvh.get_nodes().size() << " nodes\n";
+      print_timings("build", build_time);
+      print_timings("trace", trace_time);
+      std::cout << "  " << hits.size()/(trace_time.min_ms * 1e3) << " Mrays/s, valid hits " << valid
+        << ", correct " << correct << " of " << expected << " on screen reflections\n";
+    }
+  }
+}
+
+//Moller-Trumbore, stands in for the intersection shader of the AABB build mode
+static bool intersect_triangle(const scene::CpuRay &ray, const glm::vec3 *v, float &t) {
+  glm::vec3 e1 = v[1] - v[0];
+  glm::vec3 e2 = v[2] - v[0];
+  glm::vec3 p = glm::cross(ray.dir, e2);
+  float det = glm::dot(e1, p);
+  if (std::abs(det) < 1e-12f) {
+    return false;
+  }
+  float inv_det = 1.f/det;
+  glm::vec3 s = ray.origin - v[0];
+  float u = glm::dot(s, p) * inv_det;
+  glm::vec3 q = glm::cross(s, e1);
+  float w = glm::dot(ray.dir, q) * inv_det;
+  t = glm::dot(e2, q) * inv_det;
+  return u >= 0.f && w >= 0.f && u + w <= 1.f && t >= ray.tmin && t <= ray.tmax;
+}
+
+//primary rays against both GbufferCompressor::Geometry modes, AABBs intersect the plane quad in software
+static void bench_tree_compressor_rays(const TreeCompressorResult &result, const DepthAsParams &params, uint32_t width, uint32_t height, uint32_t iterations) {
+  std::vector<scene::CpuRay> rays;
+  rays.reserve(width * height);
+  for (uint32_t y = 0; y < height; y++) {
+    for (uint32_t x = 0; x < width; x++) {
+      glm::vec2 uv = (glm::vec2{x, y} + glm::vec2{0.5f})/glm::vec2{width, height};
+      glm::vec3 dir = glm::normalize(reconstruct_view_vec(uv, 0.f, params));
+      rays.push_back(scene::CpuRay {glm::vec3{0.f}, params.znear, dir, params.zfar});
+    }
+  }
+
+  scene::CpuBVH aabb_bvh;
+  auto aabb_build_time = measure(iterations, [&](){
+    aabb_bvh.build(result.aabbs);
+  });
+
+  std::vector<float> aabb_t(rays.size());
+  auto aabb_trace_time = measure(iterations, [&](){
+    parallel_for(height, [&](uint32_t y){
+      for (uint32_t x = 0; x < width; x++) {
+        const auto &ray = rays[y * width + x];
+        float best_t = -1.f;
+        aabb_bvh.traverse(ray, [&](uint32_t plane, float t_enter) {
+          if (best_t >= 0.f && t_enter > best_t) {
+            return true;
+          }
+          const glm::vec3 *quad = result.triangles.data() + 6 * plane;
+          float t;
+          for (uint32_t i = 0; i < 2; i++) {
+            if (intersect_triangle(ray, quad + 3 * i, t) && (best_t < 0.f || t < best_t)) {
+              best_t = t;
+            }
+          }
+          return true;
+        });
+        aabb_t[y * width + x] = best_t;
+      }
+    });
+  });
+
+  scene::CpuTriangleSoup soup;
+  soup.positions = result.triangles;
+  soup.sources.resize(result.triangles.size()/3);
+  for (uint32_t i = 0; i < soup.sources.size(); i++) {
+    soup.sources[i] = scene::CpuTriangleSoup::Source {i/2, i & 1, 0};
+  }
+
+  scene::CpuBVH triangle_bvh;
+  auto triangle_build_time = measure(iterations, [&](){
+    triangle_bvh.build(soup);
+  });
+
+  std::vector<scene::CpuHit> hits;
+  auto triangle_trace_time = measure(iterations, [&](){
+    triangle_bvh.closest_hit_parallel(rays, hits);
+  });
+
+  uint32_t aabb_hits = std::count_if(aabb_t.begin(), aabb_t.end(), [](float t){ return t >= 0.f; });
+  uint32_t triangle_hits = 0, mismatches = 0;
+  for (uint32_t i = 0; i < hits.size(); i++) {
+    bool hit = hits[i].triangle != scene::CPU_INVALID_TRIANGLE;
+    triangle_hits += hit? 1 : 0;
+    if (hit != (aabb_t[i] >= 0.f) || (hit && std::abs(hits[i].t - aabb_t[i]) > 1e-3f * hits[i].t)) {
+      mismatches++;
+    }
+  }
+
+  std::cout << "    aabbs: " << aabb_bvh.get_nodes().size() << " nodes, " << rays.size()/(aabb_trace_time.min_ms * 1e3) << " Mrays/s, " << aabb_hits << " hits\n";
+  print_timings("  aabb build", aabb_build_time);
+  print_timings("  aabb trace", aabb_trace_time);
+  std::cout << "    triangles: " << triangle_bvh.get_nodes().size() << " nodes, " << rays.size()/(triangle_trace_time.min_ms * 1e3) << " Mrays/s, " << triangle_hits << " hits, "
+    << mismatches << " rays disagree with aabbs\n";
+  print_timings("  triangle build", triangle_build_time);
+  print_timings("  triangle trace", triangle_trace_time);
+}
+
+void bench_tree_compressor(uint32_t iterations) {
+  constexpr uint32_t WIDTH = 640;
+  constexpr uint32_t HEIGHT = 360;
+  const float plane_distances[] {0.02f, 0.05f, 0.1f};
+
+  std::cout << "Gbuffer tree compressor benchmark\n";
+
+  DepthAsParams params {glm::radians(60.f), float(WIDTH)/HEIGHT, 0.05f, 80.f};
+  DepthImage depth;
+  std::vector<glm::vec3> normals;
+  render_analytic_scene(WIDTH, HEIGHT, params, depth, normals);
+
+  for (float plane_distance : plane_distances) {
+    TreeCompressorThresholds thresholds {};
+    thresholds.max_plane_distance = plane_distance;
+
+    TreeCompressorResult result;
+    auto time = measure(iterations, [&](){
+      result = compress_gbuffer_tree(depth, normals, params, thresholds);
+    });
+
+    const auto &stats = result.stats;
+    std::cout << "  max plane distance " << plane_distance << " : " << stats.aabbs_count << " aabbs, "
+      << stats.pixels_count << " pixels, ratio " << float(stats.pixels_count)/std::max(stats.aabbs_count, 1u) << "\n";
+    for (uint32_t level = 0; level < stats.levels; level++) {
+      std::cout << "    level " << level << " : merged " << stats.merged_per_level[level] << ", aabbs " << stats.aabbs_per_level[level]
+        << ", dropped " << stats.dropped_per_level[level] << "\n";
+    }
+    std::cout << "    max plane distance " << stats.max_plane_distance << ", max reprojection error " << stats.max_reprojection_error << "\n";
+    print_timings("compress", time);
+    bench_tree_compressor_rays(result, params, WIDTH, HEIGHT, iterations);
+  }
+}
+
+struct GpuPrimitivesCase {
+  const char *name;
+  uint32_t count;
+  uint32_t key_bits;
+  uint32_t max_key; //keys are rng() % (max_key + 1), duplicates if it is small
+};
+
+static std::vector<uint32_t> counted_elems(const ReadBackData &data) {
+  auto ptr = (const uint32_t*)data.bytes.get();
+  uint32_t capacity = data.width * data.height * data.texel_size/sizeof(uint32_t) - 1;
+  return std::vector<uint32_t>(ptr + 1, ptr + 1 + std::min(ptr[0], capacity));
+}
+
+static std::vector<uint32_t> raw_elems(const ReadBackData &data, uint32_t count) {
+  auto ptr = (const uint32_t*)data.bytes.get();
+  return std::vector<uint32_t>(ptr, ptr + count);
+}
+
+void bench_gpu_primitives(rendergraph::RenderGraph &graph, ReadBackSystem &readback_sys, uint32_t iterations) {
+  //keys, flags and scan input fit into one gpu_transfer upload
+  constexpr uint32_t MAX_ELEMENTS = 1u << 16u;
+  enum Ranges {RANGE_SORT, RANGE_UNIQUE, RANGE_COMPACT, RANGE_SCAN, RANGES_COUNT};
+
+  const GpuPrimitivesCase cases[] {
+    {"random keys", MAX_ELEMENTS, 32, ~0u},
+    {"triangle ids with duplicates", 50000, 32, 4000},
+    {"16 bit keys", 33333, 16, 0xffff},
+    {"one block", 1000, 32, 100},
+    {"empty", 0, 32, ~0u}
+  };
+
+  std::cout << "GPU primitives benchmark\n";
+
+  constexpr VkBufferUsageFlags usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT|VK_BUFFER_USAGE_TRANSFER_SRC_BIT|VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+  GpuPrimitives primitives {graph, MAX_ELEMENTS};
+  auto keys = graph.create_buffer(VMA_MEMORY_USAGE_GPU_ONLY, GpuPrimitives::counted_array_size(MAX_ELEMENTS), usage);
+  auto unique_result = graph.create_buffer(VMA_MEMORY_USAGE_GPU_ONLY, GpuPrimitives::counted_array_size(MAX_ELEMENTS), usage);
+  auto compact_result = graph.create_buffer(VMA_MEMORY_USAGE_GPU_ONLY, GpuPrimitives::counted_array_size(MAX_ELEMENTS), usage);
+  auto flags = graph.create_buffer(VMA_MEMORY_USAGE_GPU_ONLY, sizeof(uint32_t) * MAX_ELEMENTS, usage);
+  auto scan = graph.create_buffer(VMA_MEMORY_USAGE_GPU_ONLY, sizeof(uint32_t) * MAX_ELEMENTS, usage);
+
+  FrameTimer timer;
+  timer.create(graph, RANGES_COUNT);
+
+  uint32_t case_index = 0;
+  for (const auto &test : cases) {
+    std::mt19937 rng {case_index++};
+    std::vector<uint32_t> src_keys(test.count);
+    std::vector<uint32_t> src_flags(test.count);
+    std::vector<uint32_t> src_scan(test.count);
+    for (uint32_t i = 0; i < test.count; i++) {
+      src_keys[i] = (test.max_key == ~0u)? uint32_t(rng()) : uint32_t(rng() % (test.max_key + 1));
+      src_flags[i] = rng() & 1;
+      src_scan[i] = rng() % 16;
+    }
+    std::vector<uint32_t> counted_keys {test.count};
+    counted_keys.insert(counted_keys.end(), src_keys.begin(), src_keys.end());
+
+    std::vector<float> min_ms(RANGES_COUNT, 1e30f);
+    auto collect_times = [&](){
+      for (uint32_t range = 0; range < RANGES_COUNT; range++) {
+        if (timer.get_ms(range) >= 0.f) {
+          min_ms[range] = std::min(min_ms[range], timer.get_ms(range));
+        }
+      }
+    };
+
+    ReadBackID sorted_id = INVALID_READBACK, unique_id = INVALID_READBACK, compact_id = INVALID_READBACK, scan_id = INVALID_READBACK;
+    for (uint32_t iteration = 0; iteration < iterations; iteration++) {
+      timer.begin_frame(graph);
+      gpu_transfer::write_buffer(keys, 0, sizeof(uint32_t) * counted_keys.size(), counted_keys.data());
+      if (test.count) {
+        gpu_transfer::write_buffer(flags, 0, sizeof(uint32_t) * test.count, src_flags.data());
+        gpu_transfer::write_buffer(scan, 0, sizeof(uint32_t) * test.count, src_scan.data());
+      }
+      gpu_transfer::process_requests(graph);
+
+      timer.begin(graph, RANGE_SORT);
+      primitives.radix_sort(graph, keys, test.key_bits);
+      timer.end(graph, RANGE_SORT);
+
+      timer.begin(graph, RANGE_UNIQUE);
+      primitives.unique(graph, keys, unique_result);
+      timer.end(graph, RANGE_UNIQUE);
+
+      //flags are aligned with the sorted keys
+      timer.begin(graph, RANGE_COMPACT);
+      primitives.compact(graph, keys, flags, compact_result);
+      timer.end(graph, RANGE_COMPACT);
+
+      timer.begin(graph, RANGE_SCAN);
+      primitives.exclusive_scan(graph, scan, scan, test.count);
+      timer.end(graph, RANGE_SCAN);
+
+      if (iteration == 0) {
+        sorted_id = readback_sys.read_buffer(graph, keys);
+        unique_id = readback_sys.read_buffer(graph, unique_result);
+        compact_id = readback_sys.read_buffer(graph, compact_result);
+        scan_id = readback_sys.read_buffer(graph, scan);
+      }
+
+      graph.submit();
+      readback_sys.after_submit(graph);
+      collect_times();
+    }
+
+    //resolves the timestamps and readbacks still in flight
+    for (uint32_t i = 0; i < graph.get_frames_count() || !readback_sys.is_data_available(scan_id); i++) {
+      timer.begin_frame(graph);
+      graph.submit();
+      readback_sys.after_submit(graph);
+      collect_times();
+    }
+
+    auto ref_sorted = radix_sort_cpu(src_keys, test.key_bits);
+    auto ref_unique = unique_cpu(ref_sorted);
+    auto ref_compact = compact_cpu(ref_sorted, src_flags);
+    auto ref_scan = exclusive_scan_cpu(src_scan);
+
+    bool sort_ok = counted_elems(readback_sys.get_data(sorted_id)) == ref_sorted;
+    bool unique_ok = counted_elems(readback_sys.get_data(unique_id)) == ref_unique;
+    bool compact_ok = counted_elems(readback_sys.get_data(compact_id)) == ref_compact;
+    bool scan_ok = raw_elems(readback_sys.get_data(scan_id), test.count) == ref_scan;
+
+    auto status = [](bool ok) { return ok? "ok" : "FAILED"; };
+    std::cout << "  " << test.name << ", " << test.count << " keys " << test.key_bits << " bits : sort " << status(sort_ok)
+      << ", unique " << status(unique_ok) << " (" << ref_unique.size() << "), compact " << status(compact_ok) << ", scan " << status(scan_ok) << "\n";
+    std::cout << "    min GPU ms: sort " << min_ms[RANGE_SORT] << ", unique " << min_ms[RANGE_UNIQUE]
+      << ", compact " << min_ms[RANGE_COMPACT] << ", scan " << min_ms[RANGE_SCAN] << "\n";
+  }
+
+  vkDeviceWaitIdle(gpu::app_device().api_device());
+}
+
+static uint32_t count_nodes(const std::vector<scene::BaseNode> &nodes) {
+  uint32_t count = 0;
+  for (const auto &node : nodes) {
+    count += 1 + count_nodes(node.children);
+  }
+  return count;
+}
+
+void bench_dynamic_tlas(rendergraph::RenderGraph &graph, gpu::TransferCmdPool &transfer_pool, const std::string &path, uint32_t frames) {
+  constexpr float CELL_SIZE = 40.f;
+  std::cout << "Dynamic TLAS benchmark " << path << "\n";
+
+  scene::SceneLoadOptions options {};
+  options.for_ray_tracing = true;
+  auto scene = scene::load_scene_cached(transfer_pool, path, options);
+  scene::SceneAccelerationStructure scene_as;
+  scene_as.build(transfer_pool, scene);
+
+  const auto source_nodes = scene.base_nodes;
+  const uint32_t copy_nodes = 1 + count_nodes(source_nodes);
+
+  FrameTimer timer;
+  timer.create(graph, 1);
+
+  for (uint32_t copies : {16u, 256u, 4096u}) {
+    //every copy is a root node over the scene, roots are animated
+    const uint32_t side = std::ceil(std::sqrt(float(copies)));
+    scene.base_nodes.clear();
+    for (uint32_t i = 0; i < copies; i++) {
+      scene::BaseNode root {};
+      root.transform = glm::translate(glm::mat4 {1.f}, glm::vec3 {CELL_SIZE * (i % side), 0.f, CELL_SIZE * (i / side)});
+      root.children = source_nodes;
+      scene.base_nodes.push_back(std::move(root));
+    }
+
+    for (bool rebuild_every_frame : {false, true}) {
+      SceneTLAS tlas {graph, scene, scene_as};
+
+      double update_ms = 0.0;
+      float min_gpu_ms = 1e30f;
+      float avg_gpu_ms = 0.f;
+      uint32_t gpu_samples = 0;
+      uint32_t rebuilds = 0;
+      uint32_t builds = 0;
+      uint32_t max_pending = 0;
+
+      auto collect_times = [&](){
+        if (timer.get_ms(0) >= 0.f) {
+          min_gpu_ms = std::min(min_gpu_ms, timer.get_ms(0));
+          avg_gpu_ms += timer.get_ms(0);
+          gpu_samples++;
+        }
+      };
+
+      for (uint32_t frame = 0; frame < frames; frame++) {
+        as_memory::begin_frame();
+        auto start = BenchClock::now();
+        for (uint32_t i = 0; i < copies; i++) {
+          float angle = 0.02f * frame + 0.1f * i;
+          auto transform = glm::translate(glm::mat4 {1.f}, glm::vec3 {CELL_SIZE * (i % side), 0.f, CELL_SIZE * (i / side)});
+          tlas.set_node_transform(i * copy_nodes, glm::rotate(transform, angle, glm::vec3 {0.f, 1.f, 0.f}));
+        }
+        if (rebuild_every_frame) {
+          tlas.force_rebuild();
+        }
+        tlas.update();
+        std::chrono::duration<double, std::milli> elapsed = BenchClock::now() - start;
+        update_ms += elapsed.count()/frames;
+
+        timer.begin_frame(graph);
+        gpu_transfer::process_requests(graph);
+        timer.begin(graph, 0);
+        tlas.build(graph);
+        timer.end(graph, 0);
+        graph.submit();
+        collect_times();
+
+        if (tlas.is_ready()) {
+          builds++;
+          rebuilds += tlas.get_stats().rebuilt? 1 : 0;
+        }
+        max_pending = std::max(max_pending, tlas.get_stats().pending_instances);
+      }
+
+      for (uint32_t i = 0; i < graph.get_frames_count(); i++) {
+        timer.begin_frame(graph);
+        graph.submit();
+        collect_times();
+      }
+      vkDeviceWaitIdle(gpu::app_device().api_device());
+
+      std::cout << "  " << copies << " animated nodes, " << tlas.get_instances().size() << " instances, "
+        << (rebuild_every_frame? "rebuild every frame" : "refit") << " : CPU update " << update_ms << " ms, GPU min "
+        << min_gpu_ms << " ms avg " << (gpu_samples? avg_gpu_ms/gpu_samples : 0.f) << " ms, " << rebuilds << "/" << builds << " rebuilds";
+      if (max_pending) {
+        std::cout << ", up to " << max_pending << " instances over the upload budget";
+      }
+      std::cout << "\n";
+    }
+  }
+
+  vkDeviceWaitIdle(gpu::app_device().api_device());
+}
+
+void bench_depth_as_build(rendergraph::RenderGraph &graph, gpu::TransferCmdPool &transfer_pool, uint32_t frames) {
+  constexpr uint32_t WIDTH = 960;
+  constexpr uint32_t HEIGHT = 540;
+  constexpr uint32_t TILE_SIZE = 64;
+  enum class Mode {Refit, Rebuild, CompactedRefit, CompactedRebuild};
+
+  std::cout << "DepthAs build benchmark " << WIDTH << "x" << HEIGHT << ", " << TILE_SIZE << " pixel tiles\n";
+
+  DepthAsParams params {glm::radians(60.f), float(WIDTH)/HEIGHT, 0.05f, 80.f};
+  DepthImage depth;
+  std::vector<glm::vec3> normals;
+  render_analytic_scene(WIDTH, HEIGHT, params, depth, normals);
+
+  DrawTAAParams draw_params {};
+  draw_params.camera = glm::mat4 {1.f};
+  draw_params.prev_camera = glm::mat4 {1.f};
+  draw_params.fovy_aspect_znear_zfar = glm::vec4 {params.fovy, params.aspect, params.znear, params.zfar};
+
+  auto depth_image = graph.create_image(VK_IMAGE_TYPE_2D, gpu::ImageInfo {VK_FORMAT_D32_SFLOAT, VK_IMAGE_ASPECT_DEPTH_BIT, WIDTH, HEIGHT},
+    VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_SAMPLED_BIT|VK_IMAGE_USAGE_TRANSFER_DST_BIT);
+  auto staging = gpu::create_buffer(VMA_MEMORY_USAGE_CPU_TO_GPU, sizeof(float) * WIDTH * HEIGHT, VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
+
+  FrameTimer timer;
+  timer.create(graph, 1);
+
+  //sky rows are skipped by the compacted build
+  for (float far_fraction : {0.f, 0.5f, 0.9f}) {
+    const uint32_t far_rows = uint32_t(far_fraction * HEIGHT);
+    auto texels = static_cast<float*>(staging->get_mapped_ptr());
+    for (uint32_t y = 0; y < HEIGHT; y++) {
+      for (uint32_t x = 0; x < WIDTH; x++) {
+        texels[y * WIDTH + x] = (y < far_rows)? 1.f : depth.texels[y * WIDTH + x];
+      }
+    }
+    staging->flush();
+
+    for (Mode mode : {Mode::Refit, Mode::Rebuild, Mode::CompactedRefit, Mode::CompactedRebuild}) {
+      const bool compact = (mode == Mode::CompactedRefit || mode == Mode::CompactedRebuild);
+      DepthAs depth_as;
+      depth_as.create(transfer_pool, WIDTH, HEIGHT, TILE_SIZE);
+      DepthAsBuilder builder;
+      builder.init(depth_as, compact);
+      builder.checkerboard_init(graph, depth_as, draw_params);
+
+      float min_gpu_ms = 1e30f;
+      float avg_gpu_ms = 0.f;
+      uint32_t gpu_samples = 0;
+      auto collect_times = [&](){
+        if (timer.get_ms(0) >= 0.f) {
+          min_gpu_ms = std::min(min_gpu_ms, timer.get_ms(0));
+          avg_gpu_ms += timer.get_ms(0);
+          gpu_samples++;
+        }
+      };
+
+      struct Empty {};
+      for (uint32_t frame = 0; frame < frames; frame++) {
+        as_memory::begin_frame();
+        timer.begin_frame(graph);
+
+        graph.add_task<Empty>("BenchDepthUpload",
+        [&](Empty &, rendergraph::RenderGraphBuilder &graph_builder){
+          graph_builder.transfer_write(depth_image, 0, 1, 0, 1);
+        },
+        [=](Empty &, rendergraph::RenderResources &resources, gpu::CmdContext &cmd){
+          VkBufferImageCopy region {0, 0, 0, {VK_IMAGE_ASPECT_DEPTH_BIT, 0, 0, 1}, {0, 0, 0}, {WIDTH, HEIGHT, 1}};
+          vkCmdCopyBufferToImage(cmd.get_command_buffer(), staging->api_buffer(), resources.get_image(depth_image)->api_image(),
+            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+        });
+
+        //the policy refits tiles while nothing moves
+        if (mode == Mode::Rebuild || mode == Mode::CompactedRebuild) {
+          builder.get_policy().force_rebuild();
+        }
+        timer.begin(graph, 0);
+        builder.run(graph, depth_as, depth_image, 0, draw_params);
+        timer.end(graph, 0);
+        graph.submit();
+        collect_times();
+      }
+
+      for (uint32_t i = 0; i < graph.get_frames_count(); i++) {
+        timer.begin_frame(graph);
+        graph.submit();
+        collect_times();
+      }
+      vkDeviceWaitIdle(gpu::app_device().api_device());
+
+      const char *mode_names[] {"per pixel refit", "per pixel rebuild", "compacted refit", "compacted rebuild"};
+      const char *mode_name = mode_names[uint32_t(mode)];
+      std::cout << "  far plane " << far_fraction * 100.f << "% of pixels, " << mode_name << " : GPU min " << min_gpu_ms << " ms avg "
+        << (gpu_samples? avg_gpu_ms/gpu_samples : 0.f) << " ms\n";
+    }
+  }
+
+  vkDeviceWaitIdle(gpu::app_device().api_device());
+}
@@ -0,0 +1,24 @@
+#ifndef BENCHMARKS_HPP_INCLUDED
+#define BENCHMARKS_HPP_INCLUDED
+
+#include "gpu/gpu.hpp"
+#include "scene/scene.hpp"
+#include "rendergraph/rendergraph.hpp"
+#include "image_readback.hpp"
+
+//offline measurements, started from main with --bench-* flags
+void bench_scene_loading(gpu::TransferCmdPool &transfer_pool, const std::string &path, uint32_t iterations = 3);
+//scene::CpuBVH build time and Mrays/s for coherent closest hit and incoherent any hit rays
+void bench_cpu_ray_tracing(gpu::TransferCmdPool &transfer_pool, const std::string &path, uint32_t iterations = 3);
+//CPU depth AS on an analytic scene, cost and reflection hit quality for several grid resolutions and AABB thicknesses. Does not need a GPU
+void bench_depth_as(uint32_t iterations = 3);
+//CPU GbufferCompressor tree on the same scene, AABB count per level and plane error for several merge thresholds. Does not need a GPU
+void bench_tree_compressor(uint32_t iterations = 3);
+//GpuPrimitives sort, unique, compaction and scan on random keys, checked against the CPU references. GPU times come from FrameTimer
+void bench_gpu_primitives(rendergraph::RenderGraph &graph, ReadBackSystem &readback_sys, uint32_t iterations = 8);
+//SceneTLAS over a grid of scene copies rotating every frame, CPU update and GPU refit/rebuild times against a rebuild every frame
+void bench_dynamic_tlas(rendergraph::RenderGraph &graph, gpu::TransferCmdPool &transfer_pool, const std::string &path, uint32_t frames = 120);
+//GPU DepthAsBuilder on the analytic depth with part of the rows moved to the far plane. Per pixel refit and rebuild against compacted rebuilds
+void bench_depth_as_build(rendergraph::RenderGraph &graph, gpu::TransferCmdPool &transfer_pool, uint32_t frames = 120);
+
+#endif
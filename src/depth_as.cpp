@@ -1,10 +1,11 @@
 #include "depth_as.hpp"
 #include "util_passes.hpp"
-#include <iostream>
-
-const uint32_t ALIGNMENT = 128; //vulkaninfo | grep minAccelerationStructureScratchOffsetAlignment
 
-constexpr VkBufferCreateFlags SCRATCH_USAGE_FLAGS = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT|VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+#include <algorithm>
+#include <cstddef>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
 
 void TLASHolder::close() {
   auto device = gpu::app_device().api_device();
@@ -13,12 +14,13 @@ void TLASHolder::close() {
   
   num_instances = 0;
   tlas = nullptr;
-  tlas_storage_buffer.release();
+  as_memory::free_storage(tlas_storage);
+  as_memory::release_scratch(ASCategory::TLAS, update_scratch_size);
+  update_scratch_size = 0;
   tlas_instance_buffer.release();
-  tlas_update_buffer.release();
 }
 
-void TLASHolder::create_instance_buffer(const std::vector<VkAccelerationStructureKHR> &elems) {
+void TLASHolder::create_instance_buffer(const std::vector<VkAccelerationStructureKHR> &elems, const std::vector<uint32_t> &custom_indices) {
   VkAccelerationStructureDeviceAddressInfoKHR address_info {
     .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_DEVICE_ADDRESS_INFO_KHR,
     .pNext = nullptr,
@@ -41,22 +43,22 @@ void TLASHolder::create_instance_buffer(const std::vector<VkAccelerationStructur
   };
 
   tlas_instance_buffer = gpu::create_buffer(VMA_MEMORY_USAGE_CPU_TO_GPU, sizeof(instance) * elems.size(),
-    VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT|VK_BUFFER_USAGE_TRANSFER_SRC_BIT|VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR);
+    VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT|VK_BUFFER_USAGE_TRANSFER_SRC_BIT|VK_BUFFER_USAGE_TRANSFER_DST_BIT|VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR);
 
   auto *ptr = static_cast<decltype(instance)*>(tlas_instance_buffer->get_mapped_ptr());
   
   for (uint32_t index = 0; index < elems.size(); index++) {
     address_info.accelerationStructure = elems[index];
     auto address = vkGetAccelerationStructureDeviceAddressKHR(gpu::app_device().api_device(), &address_info);
-    instance.instanceCustomIndex = index;
+    instance.instanceCustomIndex = custom_indices.size()? custom_indices[index] : index;
     instance.accelerationStructureReference = address;
     ptr[index] = instance;
   }
 }
 
-void TLASHolder::create(gpu::TransferCmdPool &cmd_pool, const std::vector<VkAccelerationStructureKHR> &elems) {
+void TLASHolder::create(gpu::TransferCmdPool &cmd_pool, const std::vector<VkAccelerationStructureKHR> &elems, const std::vector<uint32_t> &custom_indices) {
   num_instances = elems.size();
-  create_instance_buffer(elems);
+  create_instance_buffer(elems, custom_indices);
 
   VkAccelerationStructureGeometryInstancesDataKHR instances_data {
     .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_INSTANCES_DATA_KHR,
@@ -92,17 +94,16 @@ void TLASHolder::create(gpu::TransferCmdPool &cmd_pool, const std::vector<VkAcce
   vkGetAccelerationStructureBuildSizesKHR(gpu::app_device().api_device(), VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR, &data_info, &primitives, &out);
   std::cout << "TLAS = " << out.accelerationStructureSize << " BuildScrath " << out.buildScratchSize << " UpdateScratch " << out.updateScratchSize << "\n";
 
-  tlas_storage_buffer = gpu::create_buffer(VMA_MEMORY_USAGE_GPU_ONLY, out.accelerationStructureSize, VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR);
-  
-  if (out.updateScratchSize)
-    tlas_update_buffer = gpu::create_buffer(VMA_MEMORY_USAGE_GPU_ONLY, out.updateScratchSize, SCRATCH_USAGE_FLAGS, ALIGNMENT);
+  tlas_storage = as_memory::allocate_storage(ASCategory::TLAS, out.accelerationStructureSize);
+  update_scratch_size = out.updateScratchSize;
+  as_memory::reserve_scratch(ASCategory::TLAS, update_scratch_size);
 
   VkAccelerationStructureCreateInfoKHR create_info {
     .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR,
     .pNext = nullptr,
     .createFlags = 0,
-    .buffer = tlas_storage_buffer->api_buffer(),
-    .offset = 0,
+    .buffer = tlas_storage.api_buffer(),
+    .offset = tlas_storage.offset,
     .size = out.accelerationStructureSize,
     .type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR,
     .deviceAddress = 0
@@ -110,10 +111,8 @@ void TLASHolder::create(gpu::TransferCmdPool &cmd_pool, const std::vector<VkAcce
 
   VKCHECK(vkCreateAccelerationStructureKHR(gpu::app_device().api_device(), &create_info, nullptr, &tlas));
 
-  auto scratch_buffer = gpu::create_buffer(VMA_MEMORY_USAGE_GPU_ONLY, out.buildScratchSize, SCRATCH_USAGE_FLAGS, ALIGNMENT);
-
   data_info.dstAccelerationStructure = tlas;
-  data_info.scratchData.deviceAddress = scratch_buffer->device_address();
+  data_info.scratchData.deviceAddress = as_memory::allocate_init_scratch(out.buildScratchSize);
 
   VkAccelerationStructureBuildRangeInfoKHR range {
     .primitiveCount = primitives,
@@ -159,7 +158,7 @@ void TLASHolder::update(VkCommandBuffer cmd) {
     .geometryCount = 1,
     .pGeometries = &geometry,
     .ppGeometries = nullptr,
-    .scratchData {.deviceAddress = tlas_update_buffer->device_address()}
+    .scratchData {.deviceAddress = as_memory::allocate_scratch(cmd, update_scratch_size)}
   };
 
   VkAccelerationStructureBuildRangeInfoKHR range {
@@ -179,15 +178,20 @@ void DepthAs::close() {
 
   auto device = gpu::app_device().api_device();
   
-  if (blas)
+  for (auto blas : blases)
     vkDestroyAccelerationStructureKHR(device, blas, nullptr);
   
-  blas = nullptr;
-  storage_buffer.release();
-  update_buffer.release();
+  blases.clear();
+  as_memory::free_storage(storage);
+  as_memory::release_scratch(ASCategory::DepthAs, scratch_stride * get_tiles_count());
+  pixel_ids.release();
+  scratch_stride = 0;
+  width = height = 0;
+  tile_width = tile_height = 0;
+  tiles_x = tiles_y = 0;
 }
 
-static VkAccelerationStructureBuildSizesInfoKHR get_build_sizes(uint32_t width, uint32_t height) {
+static VkAccelerationStructureBuildSizesInfoKHR get_build_sizes(uint32_t primitives) {
   auto device = gpu::app_device().api_device();
   VkAccelerationStructureGeometryKHR geometry {};
   geometry.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR;
@@ -203,205 +207,247 @@ static VkAccelerationStructureBuildSizesInfoKHR get_build_sizes(uint32_t width,
   data_info.pGeometries = &geometry;
   //data_info.mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR;
 
-  uint32_t primitives = width * height;
-
   VkAccelerationStructureBuildSizesInfoKHR out {VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR};
   vkGetAccelerationStructureBuildSizesKHR(device, VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR, &data_info, &primitives, &out);
 
   return out;
 }
 
-static gpu::BufferPtr fill_data(uint32_t width, uint32_t height) {
-  auto storage_buffer = gpu::create_buffer(VMA_MEMORY_USAGE_CPU_TO_GPU, sizeof(VkAabbPositionsKHR) * width * height,
+//same tile by tile layout as depth_as_tiles.glsl, slots outside of the image are inactive
+static gpu::BufferPtr fill_data(uint32_t width, uint32_t height, uint32_t tile_width, uint32_t tile_height, uint32_t tiles_x, uint32_t tiles_count, std::vector<uint32_t> &out_pixel_ids) {
+  const uint32_t tile_primitives = tile_width * tile_height;
+  auto storage_buffer = gpu::create_buffer(VMA_MEMORY_USAGE_CPU_TO_GPU, sizeof(VkAabbPositionsKHR) * tile_primitives * tiles_count,
     VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT|VK_BUFFER_USAGE_TRANSFER_SRC_BIT|VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR);
 
   float delta_x = 2.f/width;
   float delta_y = 2.f/height;
 
   auto *ptr = static_cast<VkAabbPositionsKHR*>(storage_buffer->get_mapped_ptr());
-
-  for (uint32_t j = 0; j < height; j++) {
-    
-    float min_y = -1.f + j * delta_y; 
-    float max_y = min_y + delta_y;
-
-    for (uint32_t i = 0; i < width; i++) {
+  out_pixel_ids.assign(tile_primitives * tiles_count, 0u);
+
+  const float nan = std::numeric_limits<float>::quiet_NaN();
+  for (uint32_t tile = 0; tile < tiles_count; tile++) {
+    for (uint32_t local = 0; local < tile_primitives; local++) {
+      uint32_t i = (tile % tiles_x) * tile_width + local % tile_width;
+      uint32_t j = (tile / tiles_x) * tile_height + local / tile_width;
+      uint32_t slot = tile * tile_primitives + local;
+
+      if (i >= width || j >= height) {
+        ptr[slot] = VkAabbPositionsKHR {nan, nan, nan, nan, nan, nan};
+        continue;
+      }
+
+      float min_y = -1.f + j * delta_y; 
+      float max_y = min_y + delta_y;
       float min_x = -1.f + i * delta_x;
       float max_x = min_x + delta_x;
       VkAabbPositionsKHR bbox {min_x, min_y, 0.1f, max_x, max_y, 1.f};
-      ptr[j * width + i] = bbox;
+      ptr[slot] = bbox;
+      out_pixel_ids[slot] = j * width + i;
     }
+    //workaround for TLAS AABB
+    ptr[tile * tile_primitives].minZ -= 1000.f; //TOdo made normal TLAS update
+    ptr[tile * tile_primitives].maxZ += 1000.f;
   }
-  //workaround for TLAS AABB
-  ptr[0].minZ -= 1000.f; //TOdo made normal TLAS update
-  ptr[0].maxZ += 1000.f;
   return storage_buffer;
 }
 
-void DepthAs::create_internal(uint32_t byte_size) {
-  auto device = gpu::app_device().api_device();
-  storage_buffer = gpu::create_buffer(VMA_MEMORY_USAGE_GPU_ONLY, byte_size, VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT|VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR);
-
-  VkAccelerationStructureCreateInfoKHR create_info {
-    .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR,
-    .pNext = nullptr,
-    .createFlags = 0,
-    .buffer = storage_buffer->api_buffer(),
-    .offset = 0,
-    .size = byte_size,
-    .type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,
-    .deviceAddress = 0
-  };
-
-  vkCreateAccelerationStructureKHR(device, &create_info, nullptr, &blas);
-}
-
-void DepthAs::create(gpu::TransferCmdPool &cmd_pool, uint32_t width, uint32_t height) {
+void DepthAs::create(gpu::TransferCmdPool &cmd_pool, uint32_t image_width, uint32_t image_height, uint32_t tile_size) {
   close();
   
-  auto sizes = get_build_sizes(width, height);
+  if (tile_size % 8) {
+    throw std::runtime_error {"DepthAs tile size must be a multiple of 8"};
+  }
+
+  width = image_width;
+  height = image_height;
+  tile_width = tile_size? tile_size : width;
+  tile_height = tile_size? tile_size : height;
+  tiles_x = (width + tile_width - 1)/tile_width;
+  tiles_y = (height + tile_height - 1)/tile_height;
+
+  const uint32_t tiles_count = get_tiles_count();
+  const uint32_t tile_primitives = get_tile_primitives();
+  if (tiles_count > MAX_TILES) {
+    throw std::runtime_error {"DepthAs has too many tiles"};
+  }
+
+  auto sizes = get_build_sizes(tile_primitives);
   
-  std::cout << "DEPTHAS = " << sizes.accelerationStructureSize << " BuildScrath " << sizes.buildScratchSize << " UpdateScratch " << sizes.updateScratchSize << "\n";
+  std::cout << "DEPTHAS = " << sizes.accelerationStructureSize << " BuildScrath " << sizes.buildScratchSize << " UpdateScratch " << sizes.updateScratchSize
+    << " Tiles " << tiles_x << "x" << tiles_y << "\n";
   
-  create_internal(sizes.accelerationStructureSize);
+  //all tiles share one storage allocation, built tiles take their scratch from the frame arena
+  const uint64_t as_stride = (sizes.accelerationStructureSize + as_memory::STORAGE_ALIGNMENT - 1) & ~(as_memory::STORAGE_ALIGNMENT - 1);
+  const uint64_t scratch_alignment = as_memory::get_scratch_alignment();
+  scratch_stride = (std::max(sizes.buildScratchSize, sizes.updateScratchSize) + scratch_alignment - 1) / scratch_alignment * scratch_alignment;
 
-  auto src_buffer = fill_data(width, height);
-  if (sizes.updateScratchSize)
-    update_buffer = gpu::create_buffer(VMA_MEMORY_USAGE_GPU_ONLY, sizes.buildScratchSize, SCRATCH_USAGE_FLAGS, ALIGNMENT);
-  auto scratch_buffer = gpu::create_buffer(VMA_MEMORY_USAGE_GPU_ONLY, sizes.buildScratchSize, SCRATCH_USAGE_FLAGS, ALIGNMENT);
+  storage = as_memory::allocate_storage(ASCategory::DepthAs, as_stride * tiles_count);
+  as_memory::reserve_scratch(ASCategory::DepthAs, scratch_stride * tiles_count);
 
-  VkAccelerationStructureGeometryAabbsDataKHR aabbs {
-    .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_AABBS_DATA_KHR,
-    .pNext = nullptr,
-    .data = {.deviceAddress = src_buffer->device_address()},
-    .stride = sizeof(VkAabbPositionsKHR)
-  };
-
-  VkAccelerationStructureGeometryKHR geometry {
-    .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR,
-    .pNext = nullptr,
-    .geometryType = VK_GEOMETRY_TYPE_AABBS_KHR,
-    .geometry = {.aabbs = aabbs },
-    .flags = VK_GEOMETRY_OPAQUE_BIT_KHR
-  };
-
-  VkAccelerationStructureBuildGeometryInfoKHR mesh_info {
-    .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR,
-    .pNext = nullptr,
-    .type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,
-    .flags = VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR | VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR,
-    .mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR,
-    .srcAccelerationStructure = nullptr,
-    .dstAccelerationStructure = blas,
-    .geometryCount = 1,
-    .pGeometries = &geometry,
-    .ppGeometries = nullptr,
-    .scratchData {.deviceAddress = scratch_buffer->device_address()}
-  };
+  auto device = gpu::app_device().api_device();
+  blases.resize(tiles_count, nullptr);
+  for (uint32_t tile = 0; tile < tiles_count; tile++) {
+    VkAccelerationStructureCreateInfoKHR create_info {
+      .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR,
+      .pNext = nullptr,
+      .createFlags = 0,
+      .buffer = storage.api_buffer(),
+      .offset = storage.offset + tile * as_stride,
+      .size = sizes.accelerationStructureSize,
+      .type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,
+      .deviceAddress = 0
+    };
+
+    VKCHECK(vkCreateAccelerationStructureKHR(device, &create_info, nullptr, &blases[tile]));
+  }
 
-  VkAccelerationStructureBuildRangeInfoKHR range {
-    .primitiveCount = width * height,
-    .primitiveOffset = 0,
-    .firstVertex = 0,
-    .transformOffset = 0
-  };
+  std::vector<uint32_t> initial_ids;
+  auto src_buffer = fill_data(width, height, tile_width, tile_height, tiles_x, tiles_count, initial_ids);
 
-  auto range_ptr = &range;
+  pixel_ids = gpu::create_buffer(VMA_MEMORY_USAGE_GPU_ONLY, sizeof(uint32_t) * initial_ids.size(), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT|VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+  cmd_pool.upload_buffer(pixel_ids, 0, sizeof(uint32_t) * initial_ids.size(), initial_ids.data());
 
   VkCommandBufferBeginInfo begin_info {};
   begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
 
   auto cmd = cmd_pool.get_cmd_buffer();
   vkBeginCommandBuffer(cmd, &begin_info);
-  vkCmdBuildAccelerationStructuresKHR(cmd, 1, &mesh_info, &range_ptr);
+  build_tiles(cmd, src_buffer, nullptr, tile_primitives, true, true);
   vkEndCommandBuffer(cmd);
   cmd_pool.submit_and_wait();
 
-  tlas_holder.create(cmd_pool, {blas});
+  //instance custom index points to the first primitive slot of the tile
+  std::vector<uint32_t> first_slots;
+  for (uint32_t tile = 0; tile < tiles_count; tile++) {
+    first_slots.push_back(tile * tile_primitives);
+  }
+  tlas_holder.create(cmd_pool, blases, first_slots);
 }
 
-static void push_wr_barrier(VkCommandBuffer cmd) {
-  VkMemoryBarrier aa_memory_barrier {
-    .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
-    .pNext = nullptr, 
-    .srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT,
-    .dstAccessMask = VK_ACCESS_MEMORY_READ_BIT
-  };
-
-  vkCmdPipelineBarrier(cmd,
-    VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
-    VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 
-    0, 1, &aa_memory_barrier, 0, nullptr, 0, nullptr);
+//the instance buffer is shared by the frames in flight, so it is written on the timeline instead of the mapped pointer
+void TLASHolder::set_transform(VkCommandBuffer cmd, uint32_t instance, const VkTransformMatrixKHR &transform) {
+  gpu::push_rw_barrier(cmd);
+  vkCmdUpdateBuffer(cmd, tlas_instance_buffer->api_buffer(), instance * sizeof(VkAccelerationStructureInstanceKHR) + offsetof(VkAccelerationStructureInstanceKHR, transform),
+    sizeof(transform), &transform);
+  gpu::push_wr_barrier(cmd);
 }
 
-static void push_rw_barrier(VkCommandBuffer cmd) {
-  VkMemoryBarrier aa_memory_barrier {
-    .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
-    .pNext = nullptr, 
-    .srcAccessMask = VK_ACCESS_MEMORY_READ_BIT,
-    .dstAccessMask = VK_ACCESS_MEMORY_WRITE_BIT
-  };
+void DepthAs::build_tiles(VkCommandBuffer cmd, const gpu::BufferPtr &src, const std::vector<ASUpdateDecision> *tiles, uint32_t num_primitives, bool rebuild, bool init) {
+  const uint32_t tile_primitives = get_tile_primitives();
+  const uint32_t tiles_count = get_tiles_count();
+  
+  std::vector<VkAccelerationStructureGeometryKHR> geometries;
+  std::vector<VkAccelerationStructureBuildGeometryInfoKHR> infos;
+  std::vector<VkAccelerationStructureBuildRangeInfoKHR> ranges;
+  geometries.reserve(tiles_count);
+  infos.reserve(tiles_count);
+  ranges.reserve(tiles_count);
+
+  for (uint32_t tile = 0; tile < tiles_count; tile++) {
+    if (tiles && (*tiles)[tile] == ASUpdateDecision::Skip) {
+      continue;
+    }
+    const bool build = rebuild || (tiles && (*tiles)[tile] == ASUpdateDecision::Rebuild);
+
+    //every tile starts at its own slot so AABBs are addressed directly
+    VkAccelerationStructureGeometryAabbsDataKHR aabbs {
+      .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_AABBS_DATA_KHR,
+      .pNext = nullptr,
+      .data = {.deviceAddress = src->device_address() + sizeof(VkAabbPositionsKHR) * tile * tile_primitives},
+      .stride = sizeof(VkAabbPositionsKHR)
+    };
+
+    geometries.push_back(VkAccelerationStructureGeometryKHR {
+      .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR,
+      .pNext = nullptr,
+      .geometryType = VK_GEOMETRY_TYPE_AABBS_KHR,
+      .geometry = {.aabbs = aabbs },
+      .flags = VK_GEOMETRY_OPAQUE_BIT_KHR
+    });
+
+    infos.push_back(VkAccelerationStructureBuildGeometryInfoKHR {
+      .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR,
+      .pNext = nullptr,
+      .type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,
+      .flags = VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR | VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR,
+      .mode = build? VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR : VK_BUILD_ACCELERATION_STRUCTURE_MODE_UPDATE_KHR,
+      .srcAccelerationStructure = build? nullptr : blases[tile],
+      .dstAccelerationStructure = blases[tile],
+      .geometryCount = 1,
+      .pGeometries = nullptr,
+      .ppGeometries = nullptr,
+      .scratchData {.deviceAddress = 0}
+    });
+
+    ranges.push_back(VkAccelerationStructureBuildRangeInfoKHR {
+      .primitiveCount = std::min(num_primitives, tile_primitives),
+      .primitiveOffset = 0,
+      .firstVertex = 0,
+      .transformOffset = 0
+    });
+  }
 
-  vkCmdPipelineBarrier(cmd,
-    VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
-    VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 
-    0, 1, &aa_memory_barrier, 0, nullptr, 0, nullptr);
-}
+  if (infos.empty()) {
+    return;
+  }
 
-void DepthAs::update(VkCommandBuffer cmd, uint32_t num_primitives, const gpu::BufferPtr &src, bool rebuild) {
-  VkAccelerationStructureGeometryAabbsDataKHR aabbs {
-    .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_AABBS_DATA_KHR,
-    .pNext = nullptr,
-    .data = {.deviceAddress = src->device_address()},
-    .stride = sizeof(VkAabbPositionsKHR)
-  };
+  //only built tiles take scratch
+  const uint64_t scratch_size = scratch_stride * infos.size();
+  const VkDeviceAddress scratch = init? as_memory::allocate_init_scratch(scratch_size) : as_memory::allocate_scratch(cmd, scratch_size);
 
-  VkAccelerationStructureGeometryKHR geometry {
-    .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR,
-    .pNext = nullptr,
-    .geometryType = VK_GEOMETRY_TYPE_AABBS_KHR,
-    .geometry = {.aabbs = aabbs },
-    .flags = VK_GEOMETRY_OPAQUE_BIT_KHR
-  };
+  std::vector<const VkAccelerationStructureBuildRangeInfoKHR *> range_ptrs;
+  for (uint32_t i = 0; i < infos.size(); i++) {
+    infos[i].pGeometries = &geometries[i];
+    infos[i].scratchData.deviceAddress = scratch + i * scratch_stride;
+    range_ptrs.push_back(&ranges[i]);
+  }
 
-  VkAccelerationStructureBuildGeometryInfoKHR mesh_info {
-    .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR,
-    .pNext = nullptr,
-    .type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,
-    .flags = VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR | VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR,
-    .mode = rebuild? VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR : VK_BUILD_ACCELERATION_STRUCTURE_MODE_UPDATE_KHR,
-    .srcAccelerationStructure = blas,
-    .dstAccelerationStructure = blas,
-    .geometryCount = 1,
-    .pGeometries = &geometry,
-    .ppGeometries = nullptr,
-    .scratchData {.deviceAddress = update_buffer->device_address()}
-  };
+  vkCmdBuildAccelerationStructuresKHR(cmd, infos.size(), infos.data(), range_ptrs.data());
+}
 
-  VkAccelerationStructureBuildRangeInfoKHR range {
-    .primitiveCount = num_primitives,
-    .primitiveOffset = 0,
-    .firstVertex = 0,
-    .transformOffset = 0
-  };
+void DepthAs::update(VkCommandBuffer cmd, uint32_t num_primitives, const gpu::BufferPtr &src, bool rebuild) {
+  build_tiles(cmd, src, nullptr, num_primitives, rebuild);
+  
+  gpu::push_wr_barrier(cmd);
+  tlas_holder.update(cmd);
+}
 
-  auto range_ptr = &range;
+void DepthAs::update_tiles(VkCommandBuffer cmd, const gpu::BufferPtr &src, const std::vector<ASUpdateDecision> &tiles, bool rebuild) {
+  if (std::all_of(tiles.begin(), tiles.end(), [](ASUpdateDecision tile){ return tile == ASUpdateDecision::Skip; })) {
+    return;
+  }
 
-  vkCmdBuildAccelerationStructuresKHR(cmd, 1, &mesh_info, &range_ptr);
-  
-  push_wr_barrier(cmd);
+  build_tiles(cmd, src, &tiles, get_tile_primitives(), rebuild);
+
+  gpu::push_wr_barrier(cmd);
   tlas_holder.update(cmd);
 }
 
-void DepthAsBuilder::init(uint32_t width, uint32_t height) {
-  aabb_storage = gpu::create_buffer(VMA_MEMORY_USAGE_GPU_ONLY, sizeof(VkAabbPositionsKHR) * width * height,
+void DepthAsBuilder::init(const DepthAs &depth_as, bool compact_aabbs) {
+  aabb_storage = gpu::create_buffer(VMA_MEMORY_USAGE_GPU_ONLY, sizeof(VkAabbPositionsKHR) * depth_as.get_max_primitives(),
     VK_BUFFER_USAGE_STORAGE_BUFFER_BIT|VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT|VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR);
+  valid_counter = gpu::create_buffer(VMA_MEMORY_USAGE_GPU_ONLY, sizeof(uint32_t) * depth_as.get_tiles_count(), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT|VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+  //only read by compacted refits
+  const uint64_t slots_count = compact_aabbs? uint64_t(depth_as.get_width()) * depth_as.get_height() : 1u;
+  pixel_slots = gpu::create_buffer(VMA_MEMORY_USAGE_GPU_ONLY, sizeof(uint32_t) * slots_count, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
   
-  dst_width = width;
-  dst_height = height;
+  dst_width = depth_as.get_width();
+  dst_height = depth_as.get_height();
+  tile_width = depth_as.get_tile_width();
+  tile_height = depth_as.get_tile_height();
+  tiles_x = depth_as.get_tiles_x();
+  tiles_count = depth_as.get_tiles_count();
+  compact = compact_aabbs;
+
+  changed_tiles.assign(tiles_count, 0);
+  tile_age.assign(tiles_count, 0);
+  policy.init(tiles_count);
 
   pipeline = gpu::create_compute_pipeline("build_depth_as");
   init_pipeline = gpu::create_compute_pipeline("init_depth_as");
+  finalize_pipeline = gpu::create_compute_pipeline("finalize_depth_as");
+  changes_pipeline = gpu::create_compute_pipeline("depth_as_changes");
 }
 
 static VkExtent3D calculate_mip(VkExtent3D src, uint32_t mip) {
@@ -413,6 +459,89 @@ static VkExtent3D calculate_mip(VkExtent3D src, uint32_t mip) {
   return src;
 } 
 
+//uvec4 bitmasks of depth_as_tiles.glsl, built tiles and the rebuilt part of them
+struct DepthAsTileMask {
+  uint32_t bits[DepthAs::MAX_TILES/32];
+  uint32_t rebuild_bits[DepthAs::MAX_TILES/32];
+};
+
+static DepthAsTileMask make_tile_mask(const std::vector<ASUpdateDecision> &tiles, bool rebuild_all) {
+  DepthAsTileMask mask {};
+  for (uint32_t i = 0; i < tiles.size(); i++) {
+    if (tiles[i] != ASUpdateDecision::Skip) {
+      mask.bits[i/32] |= 1u << (i % 32);
+    }
+    if (tiles[i] == ASUpdateDecision::Rebuild || (rebuild_all && tiles[i] != ASUpdateDecision::Skip)) {
+      mask.rebuild_bits[i/32] |= 1u << (i % 32);
+    }
+  }
+  return mask;
+}
+
+void DepthAsBuilder::track_changes(rendergraph::RenderGraph &graph, ReadBackSystem &readback_sys, rendergraph::ImageResourceId depth, rendergraph::ImageResourceId prev_depth, uint32_t mip, const DrawTAAParams &params) {
+  if (!track_tiles) {
+    tile_changes = graph.create_buffer(VMA_MEMORY_USAGE_GPU_ONLY, sizeof(uint32_t) * tiles_count, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT|VK_BUFFER_USAGE_TRANSFER_SRC_BIT|VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+    track_tiles = true;
+  }
+
+  //results of older frames, every frame is read back so no change is lost
+  const float tile_pixels = tile_width * tile_height;
+  while (changes_readbacks.size() && readback_sys.is_data_available(changes_readbacks.front())) {
+    auto result = readback_sys.get_data(changes_readbacks.front());
+    changes_readbacks.pop_front();
+    auto ptr = (const uint32_t*)result.bytes.get();
+    for (uint32_t i = 0; i < tiles_count; i++) {
+      changed_tiles[i] |= ptr[i]? 1 : 0;
+      policy.add_disocclusion(i, ptr[i]/tile_pixels);
+    }
+  }
+
+  //screen space AABBs depend on the camera, readback latency is too high for that
+  if (params.camera != params.prev_camera) {
+    std::fill(changed_tiles.begin(), changed_tiles.end(), 1);
+  }
+
+  struct Input {
+    rendergraph::ImageViewId depth;
+    rendergraph::ImageViewId prev_depth;
+  };
+
+  struct PushConstants {
+    float znear;
+    float zfar;
+    float threshold;
+    uint32_t tile_width;
+    uint32_t tile_height;
+    uint32_t tiles_x;
+  };
+
+  PushConstants push_const {params.fovy_aspect_znear_zfar.z, params.fovy_aspect_znear_zfar.w, change_threshold, tile_width, tile_height, tiles_x};
+  auto sampler = gpu::create_sampler(gpu::DEFAULT_SAMPLER);
+
+  buffer_clear(graph, tile_changes, 0u);
+
+  graph.add_task<Input>("DepthAsTileChanges",
+  [&](Input &input, rendergraph::RenderGraphBuilder &builder){
+    input.depth = builder.sample_image(depth, VK_SHADER_STAGE_COMPUTE_BIT, VK_IMAGE_ASPECT_DEPTH_BIT, mip, 1, 0, 1);
+    input.prev_depth = builder.sample_image(prev_depth, VK_SHADER_STAGE_COMPUTE_BIT, VK_IMAGE_ASPECT_DEPTH_BIT, mip, 1, 0, 1);
+    builder.use_storage_buffer(tile_changes, VK_SHADER_STAGE_COMPUTE_BIT, false);
+  },
+  [=](Input &input, rendergraph::RenderResources &resources, gpu::CmdContext &cmd){
+    auto set = resources.allocate_set(changes_pipeline, 0);
+    gpu::write_set(set,
+      gpu::TextureBinding {0, resources.get_view(input.depth), sampler},
+      gpu::TextureBinding {1, resources.get_view(input.prev_depth), sampler},
+      gpu::SSBOBinding {2, resources.get_buffer(tile_changes)});
+
+    cmd.bind_pipeline(changes_pipeline);
+    cmd.bind_descriptors_compute(0, {set});
+    cmd.push_constants_compute(0, sizeof(push_const), &push_const);
+    cmd.dispatch((dst_width + 7)/8, (dst_height + 3)/4, 1);
+  });
+
+  changes_readbacks.push_back(readback_sys.read_buffer(graph, tile_changes));
+}
+
 void DepthAsBuilder::run(rendergraph::RenderGraph &graph, DepthAs &depth_as, rendergraph::ImageResourceId depth, uint32_t mip, const DrawTAAParams &params) {
   struct Input {
     rendergraph::ImageViewId depth;
@@ -423,9 +552,52 @@ void DepthAsBuilder::run(rendergraph::RenderGraph &graph, DepthAs &depth_as, ren
     float aspect;
     float min_z;
     float max_z;
+    uint32_t compact;
+    uint32_t tile_width;
+    uint32_t tile_height;
+    uint32_t tiles_x;
   };
 
-  PushConstants push_const {params.fovy_aspect_znear_zfar.x, params.fovy_aspect_znear_zfar.y, params.fovy_aspect_znear_zfar.z, params.fovy_aspect_znear_zfar.w};
+  struct FinalizeConstants {
+    uint32_t width;
+    uint32_t height;
+    uint32_t tile_width;
+    uint32_t tile_height;
+    uint32_t tiles_x;
+    uint32_t tiles_count;
+    uint32_t compact;
+  };
+
+  //without change tracking every tile is dirty
+  std::vector<ASUpdateDecision> dirty_tiles(tiles_count, ASUpdateDecision::Refit);
+  if (track_tiles && !rebuild) {
+    for (uint32_t i = 0; i < tiles_count; i++) {
+      bool dirty = changed_tiles[i] || tile_age[i] + 1 >= MAX_TILE_AGE;
+      dirty_tiles[i] = dirty? ASUpdateDecision::Refit : ASUpdateDecision::Skip;
+    }
+  }
+
+  if (rebuild) {
+    policy.force_rebuild();
+  }
+  policy.add_camera_motion(params.camera, params.prev_camera);
+  policy.decide(dirty_tiles);
+
+  built_tiles = 0;
+  for (uint32_t i = 0; i < tiles_count; i++) {
+    bool dirty = dirty_tiles[i] != ASUpdateDecision::Skip;
+    tile_age[i] = dirty? 0 : tile_age[i] + 1;
+    built_tiles += dirty? 1 : 0;
+  }
+  std::fill(changed_tiles.begin(), changed_tiles.end(), 0);
+
+  PushConstants push_const {params.fovy_aspect_znear_zfar.x, params.fovy_aspect_znear_zfar.y, params.fovy_aspect_znear_zfar.z, params.fovy_aspect_znear_zfar.w, compact? 1u : 0u,
+    tile_width, tile_height, tiles_x};
+  FinalizeConstants finalize_const {dst_width, dst_height, tile_width, tile_height, tiles_x, tiles_count, compact? 1u : 0u};
+  const bool full_rebuild = rebuild;
+  const DepthAsTileMask tile_mask = make_tile_mask(dirty_tiles, full_rebuild);
+  rebuild = false;
+
   auto sampler = gpu::create_sampler(gpu::DEFAULT_SAMPLER);
 
   graph.add_task<Input>("buildDepthBlas",
@@ -435,27 +607,49 @@ void DepthAsBuilder::run(rendergraph::RenderGraph &graph, DepthAs &depth_as, ren
   [=, &depth_as](Input &input, rendergraph::RenderResources &resources, gpu::CmdContext &cmd){
     auto api_cmd = cmd.get_command_buffer();
 
-    push_rw_barrier(api_cmd);
+    gpu::push_rw_barrier(api_cmd);
+    vkCmdFillBuffer(api_cmd, valid_counter->api_buffer(), 0, VK_WHOLE_SIZE, 0u);
+    gpu::push_wr_barrier(api_cmd);
+
+    auto blk = cmd.allocate_ubo<DepthAsTileMask>();
+    *blk.ptr = tile_mask;
 
     auto set = resources.allocate_set(pipeline.get_layout(0));
     gpu::write_set(set,
       gpu::TextureBinding {0, resources.get_view(input.depth), sampler},
-      gpu::SSBOBinding {1, aabb_storage});
+      gpu::SSBOBinding {1, aabb_storage},
+      gpu::SSBOBinding {2, depth_as.get_pixel_ids()},
+      gpu::SSBOBinding {3, valid_counter},
+      gpu::UBOBinding {4, cmd.get_ubo_pool(), blk},
+      gpu::SSBOBinding {5, pixel_slots});
     
     auto extent = resources.get_image(input.depth.get_id())->get_extent();
     extent = calculate_mip(extent, mip);
 
     cmd.bind_pipeline(pipeline);
-    cmd.bind_descriptors_compute(0, {set});
+    cmd.bind_descriptors_compute(0, {set}, {blk.offset});
     cmd.push_constants_compute(0, sizeof(push_const), &push_const);
     cmd.dispatch((extent.width + 7)/8, (extent.height + 3)/4, 1);
 
-
-    push_wr_barrier(api_cmd);  
+    gpu::push_wr_barrier(api_cmd);  
     
-    depth_as.update(api_cmd, extent.width * extent.height, aabb_storage, rebuild);
-    rebuild = false;
-    push_wr_barrier(api_cmd);
+    //the count stays on the GPU, tiles are built for all slots with the rest made inactive
+    auto finalize_set = resources.allocate_set(finalize_pipeline.get_layout(0));
+    gpu::write_set(finalize_set,
+      gpu::SSBOBinding {0, aabb_storage},
+      gpu::SSBOBinding {1, valid_counter},
+      gpu::UBOBinding {2, cmd.get_ubo_pool(), blk});
+
+    uint32_t max_primitives = depth_as.get_max_primitives();
+    cmd.bind_pipeline(finalize_pipeline);
+    cmd.bind_descriptors_compute(0, {finalize_set}, {blk.offset});
+    cmd.push_constants_compute(0, sizeof(finalize_const), &finalize_const);
+    cmd.dispatch((max_primitives + 63)/64, 1, 1);
+    gpu::push_wr_barrier(api_cmd);
+
+    //inactive primitives can't change between refits, compacted refits write to the slots of the last rebuild
+    depth_as.update_tiles(api_cmd, aabb_storage, dirty_tiles, full_rebuild);
+    gpu::push_wr_barrier(api_cmd);
   });
 }
 
@@ -471,14 +665,32 @@ void DepthAsBuilder::checkerboard_init(rendergraph::RenderGraph &graph, DepthAs
     float aspect;
     float znear;
     float zfar;
+    uint32_t tile_width;
+    uint32_t tile_height;
+    uint32_t tiles_x;
   } pc {
     dst_width,
     dst_height,
     params.fovy_aspect_znear_zfar.x,
     params.fovy_aspect_znear_zfar.y,
     params.fovy_aspect_znear_zfar.z,
-    params.fovy_aspect_znear_zfar.w
+    params.fovy_aspect_znear_zfar.w,
+    tile_width,
+    tile_height,
+    tiles_x
   };
+
+  struct FinalizeConstants {
+    uint32_t width;
+    uint32_t height;
+    uint32_t tile_width;
+    uint32_t tile_height;
+    uint32_t tiles_x;
+    uint32_t tiles_count;
+    uint32_t compact;
+  } finalize_const {dst_width, dst_height, tile_width, tile_height, tiles_x, tiles_count, 0u};
+
+  const DepthAsTileMask tile_mask = make_tile_mask(std::vector<ASUpdateDecision>(tiles_count, ASUpdateDecision::Rebuild), true);
   
   graph.add_task<Empty>("depthBlasInit",
   [&](Empty &input, rendergraph::RenderGraphBuilder &builder){
@@ -488,73 +700,65 @@ void DepthAsBuilder::checkerboard_init(rendergraph::RenderGraph &graph, DepthAs
   [=, &depth_as](Empty &input, rendergraph::RenderResources &resources, gpu::CmdContext &cmd){
     auto api_cmd = cmd.get_command_buffer();
 
-    push_rw_barrier(api_cmd);
+    gpu::push_rw_barrier(api_cmd);
 
     auto set = resources.allocate_set(init_pipeline.get_layout(0));
     gpu::write_set(set,
-      gpu::SSBOBinding {0, aabb_storage});
+      gpu::SSBOBinding {0, aabb_storage},
+      gpu::SSBOBinding {1, depth_as.get_pixel_ids()});
     
     cmd.bind_pipeline(init_pipeline);
     cmd.bind_descriptors_compute(0, {set});
     cmd.push_constants_compute(0, sizeof(pc), &pc);
     cmd.dispatch((pc.width + 7)/8, (pc.height + 3)/4, 1);
 
+    gpu::push_wr_barrier(api_cmd);  
 
-    push_wr_barrier(api_cmd);  
+    //slots outside of the image
+    auto blk = cmd.allocate_ubo<DepthAsTileMask>();
+    *blk.ptr = tile_mask;
+
+    auto finalize_set = resources.allocate_set(finalize_pipeline.get_layout(0));
+    gpu::write_set(finalize_set,
+      gpu::SSBOBinding {0, aabb_storage},
+      gpu::SSBOBinding {1, valid_counter},
+      gpu::UBOBinding {2, cmd.get_ubo_pool(), blk});
+
+    uint32_t max_primitives = depth_as.get_max_primitives();
+    cmd.bind_pipeline(finalize_pipeline);
+    cmd.bind_descriptors_compute(0, {finalize_set}, {blk.offset});
+    cmd.push_constants_compute(0, sizeof(finalize_const), &finalize_const);
+    cmd.dispatch((max_primitives + 63)/64, 1, 1);
+    gpu::push_wr_barrier(api_cmd);
     
-    depth_as.update(api_cmd, pc.width * pc.height, aabb_storage, rebuild);
-    rebuild = false;
-    push_wr_barrier(api_cmd);
+    depth_as.update(api_cmd, depth_as.get_tile_primitives(), aabb_storage, rebuild);
+    //per pixel slots, compacted refits need the slots of a compacted rebuild
+    rebuild = compact;
+    gpu::push_wr_barrier(api_cmd);
   });
 
 }
 
-UniqTriangleIDExtractor::UniqTriangleIDExtractor(rendergraph::RenderGraph &graph) {
-
-  const uint32_t CANDIDATES_COUNT = (1 << 17);
-  constexpr VkBufferUsageFlags hash_flags = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT|VK_BUFFER_USAGE_TRANSFER_SRC_BIT|VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+UniqTriangleIDExtractor::UniqTriangleIDExtractor(rendergraph::RenderGraph &graph)
+  : primitives {graph, MAX_CANDIDATES}
+{
+  constexpr VkBufferUsageFlags ids_flags = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT|VK_BUFFER_USAGE_TRANSFER_SRC_BIT|VK_BUFFER_USAGE_TRANSFER_DST_BIT;
 
-  reduce_buffer = graph.create_buffer(VMA_MEMORY_USAGE_GPU_ONLY, (1 + CANDIDATES_COUNT) * sizeof(uint32_t), hash_flags);
+  reduce_buffer = graph.create_buffer(VMA_MEMORY_USAGE_GPU_ONLY, GpuPrimitives::counted_array_size(MAX_IDS), ids_flags);
+  candidates = graph.create_buffer(VMA_MEMORY_USAGE_GPU_ONLY, GpuPrimitives::counted_array_size(MAX_CANDIDATES), ids_flags);
+  stats_buffer = graph.create_buffer(VMA_MEMORY_USAGE_GPU_ONLY, sizeof(TriangleIDStats), ids_flags);
   
   reduce_pipeline = gpu::create_compute_pipeline("image_id_reduce");
-  bucket_reduce_pipeline = gpu::create_compute_pipeline("buckets_reduce");
 
   auto desc = gpu::DEFAULT_SAMPLER;
   desc.minFilter = VK_FILTER_NEAREST;
   desc.magFilter = VK_FILTER_NEAREST;
   integer_sampler = gpu::create_sampler(desc);
-
-  fill_buffer_pipeline = gpu::create_compute_pipeline("fill_triangles");
-
-  num_buckets = 128;
-  const uint32_t IDS_IN_BUCKET = 1024;
-  triangles_per_bucket = graph.create_buffer(VMA_MEMORY_USAGE_GPU_ONLY, sizeof(uint32_t) * num_buckets, hash_flags);
-  buckets = graph.create_buffer(VMA_MEMORY_USAGE_GPU_ONLY, sizeof(uint32_t) * num_buckets * IDS_IN_BUCKET, hash_flags);
 }
 
 void UniqTriangleIDExtractor::run(rendergraph::RenderGraph &graph, rendergraph::ImageResourceId target, SceneRenderer &scene, const glm::mat4 &view_projection) {
-  buffer_clear(graph, triangles_per_bucket, 0);
-  buffer_clear(graph, buckets, 0);
-
-  struct Nil {};
-
-  graph.add_task<Nil>("ClearTriangles", 
-  [&](Nil &input, rendergraph::RenderGraphBuilder &builder){
-    builder.use_storage_buffer(reduce_buffer, VK_SHADER_STAGE_COMPUTE_BIT, false);
-  },
-  [=](Nil &input, rendergraph::RenderResources &res, gpu::CmdContext  &ctx) {
-    auto set = res.allocate_set(fill_buffer_pipeline, 0);
-    
-    gpu::write_set(set, 
-      gpu::SSBOBinding {0, res.get_buffer(reduce_buffer)});
-
-    const uint32_t COUNT = 80000;
-
-    ctx.bind_pipeline(fill_buffer_pipeline);
-    ctx.bind_descriptors_compute(0, {set}, {});
-    ctx.push_constants_compute(0, sizeof(COUNT), &COUNT);
-    ctx.dispatch((COUNT + 31)/32, 1, 1);
-  });
+  buffer_clear(graph, stats_buffer, 0);
+  buffer_clear(graph, candidates, 0, 0, sizeof(uint32_t));
 
   struct Data {
     rendergraph::ImageViewId id_image;
@@ -563,8 +767,8 @@ void UniqTriangleIDExtractor::run(rendergraph::RenderGraph &graph, rendergraph::
   graph.add_task<Data>("IdReduce", 
   [&](Data &input, rendergraph::RenderGraphBuilder &builder){
     input.id_image = builder.sample_image(target, VK_SHADER_STAGE_COMPUTE_BIT);
-    builder.use_storage_buffer(triangles_per_bucket, VK_SHADER_STAGE_COMPUTE_BIT, false);
-    builder.use_storage_buffer(buckets, VK_SHADER_STAGE_COMPUTE_BIT, false);
+    builder.use_storage_buffer(candidates, VK_SHADER_STAGE_COMPUTE_BIT, false);
+    builder.use_storage_buffer(stats_buffer, VK_SHADER_STAGE_COMPUTE_BIT, false);
   },
   [=](Data &input, rendergraph::RenderResources &res, gpu::CmdContext  &ctx) {
     auto desc = res.get_image(input.id_image)->get_extent();
@@ -573,53 +777,35 @@ void UniqTriangleIDExtractor::run(rendergraph::RenderGraph &graph, rendergraph::
 
     gpu::write_set(set, 
       gpu::TextureBinding {0, res.get_view(input.id_image), integer_sampler},
-      gpu::SSBOBinding {1, res.get_buffer(buckets)},
-      gpu::SSBOBinding {2, res.get_buffer(triangles_per_bucket)});
+      gpu::SSBOBinding {1, res.get_buffer(candidates)},
+      gpu::SSBOBinding {2, res.get_buffer(stats_buffer)});
 
+    const uint32_t max_candidates = MAX_CANDIDATES;
     ctx.bind_pipeline(reduce_pipeline);
     ctx.bind_descriptors_compute(0, {set}, {});
-    ctx.push_constants_compute(0, sizeof(num_buckets), &num_buckets);
+    ctx.push_constants_compute(0, sizeof(max_candidates), &max_candidates);
     ctx.dispatch((desc.width + 31)/32, (desc.height + 31)/32, 1);
   });
 
-  graph.add_task<Nil>("IdUnique", 
-  [&](Nil &input, rendergraph::RenderGraphBuilder &builder){
-    builder.use_storage_buffer(triangles_per_bucket, VK_SHADER_STAGE_COMPUTE_BIT, true);
-    builder.use_storage_buffer(buckets, VK_SHADER_STAGE_COMPUTE_BIT, true);
-    builder.use_storage_buffer(reduce_buffer, VK_SHADER_STAGE_COMPUTE_BIT, false);
-  },
-  [=](Nil &input, rendergraph::RenderResources &res, gpu::CmdContext  &ctx) {
-    auto set = res.allocate_set(bucket_reduce_pipeline, 0);
-
-    gpu::write_set(set, 
-      gpu::SSBOBinding {0, res.get_buffer(triangles_per_bucket)},
-      gpu::SSBOBinding {1, res.get_buffer(buckets)},
-      gpu::SSBOBinding {2, res.get_buffer(reduce_buffer)});
-
-    ctx.bind_pipeline(bucket_reduce_pipeline);
-    ctx.bind_descriptors_compute(0, {set}, {});
-    ctx.dispatch(num_buckets, 1, 1);
-  });
+  primitives.radix_sort(graph, candidates);
+  primitives.unique(graph, candidates, reduce_buffer);
 }
 
 void UniqTriangleIDExtractor::process_readback(rendergraph::RenderGraph &graph, ReadBackSystem &readback_sys) {
-  if (readback_id == INVALID_READBACK) {
-    if (readback_delay > 0) {
-      readback_delay--;
-      return;
+  if (readback_id != INVALID_READBACK && readback_sys.is_data_available(readback_id)) {
+    auto result = readback_sys.get_data(readback_id);
+    auto ptr = (const TriangleIDStats*)result.bytes.get();
+    if (ptr->dropped_ids && !stats.dropped_ids) {
+      std::cout << "TriangleID overflow, " << ptr->dropped_ids << " ids dropped\n";
     }
-    
-    readback_id = readback_sys.read_buffer(graph, reduce_buffer, 0, sizeof(uint32_t));
-    readback_delay = DELAY_FRAMES;
-    return;
+    stats = *ptr;
+    readback_id = INVALID_READBACK;
   }
 
-  if (!readback_sys.is_data_available(readback_id))
-    return;
-  auto result = readback_sys.get_data(readback_id);
-  auto ptr = (const uint32_t*)result.bytes.get();
-  std::cout << "TriangleID after reduce " << *ptr << "\n";
-  readback_id = INVALID_READBACK;
+  //one request in flight
+  if (readback_id == INVALID_READBACK) {
+    readback_id = readback_sys.read_buffer(graph, stats_buffer);
+  }
 }
 
 void TriangleAS::close() {
@@ -631,8 +817,9 @@ void TriangleAS::close() {
 
   max_triangles = 0;
   blas = nullptr;
-  blas_storage_buffer.release();
-  blas_update_buffer.release();
+  as_memory::free_storage(blas_storage);
+  as_memory::release_scratch(ASCategory::TriangleAS, scratch_size);
+  scratch_size = 0;
 }
 
 struct Triangle {
@@ -715,19 +902,17 @@ void TriangleAS::create(gpu::TransferCmdPool &ctx, uint32_t max_triangles_count)
   std::cout << "buildSize = " << out.buildScratchSize << " ";
   std::cout << "updateSize = " << out.updateScratchSize << "\n";
 
-  blas_storage_buffer = gpu::create_buffer(VMA_MEMORY_USAGE_GPU_ONLY, out.accelerationStructureSize, VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR);
-
-  if (out.updateScratchSize)
-    blas_update_buffer = gpu::create_buffer(VMA_MEMORY_USAGE_GPU_ONLY, out.buildScratchSize, VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, ALIGNMENT);
-
-  auto blas_build_buffer = gpu::create_buffer(VMA_MEMORY_USAGE_GPU_ONLY, out.buildScratchSize, VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, ALIGNMENT);
+  blas_storage = as_memory::allocate_storage(ASCategory::TriangleAS, out.accelerationStructureSize);
+  //update() rebuilds or refits, update_indirect() rebuilds
+  scratch_size = std::max(out.buildScratchSize, out.updateScratchSize);
+  as_memory::reserve_scratch(ASCategory::TriangleAS, scratch_size);
 
   VkAccelerationStructureCreateInfoKHR create_info {
     .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR,
     .pNext = nullptr,
     .createFlags = 0,
-    .buffer = blas_storage_buffer->api_buffer(),
-    .offset = 0,
+    .buffer = blas_storage.api_buffer(),
+    .offset = blas_storage.offset,
     .size = out.accelerationStructureSize,
     .type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,
     .deviceAddress = 0
@@ -736,7 +921,7 @@ void TriangleAS::create(gpu::TransferCmdPool &ctx, uint32_t max_triangles_count)
   VKCHECK(vkCreateAccelerationStructureKHR(gpu::app_device().api_device(), &create_info, nullptr, &blas));
 
   mesh_info.dstAccelerationStructure = blas;
-  mesh_info.scratchData.deviceAddress = blas_build_buffer->device_address();
+  mesh_info.scratchData.deviceAddress = as_memory::allocate_init_scratch(out.buildScratchSize);
 
   VkAccelerationStructureBuildRangeInfoKHR range {
     .primitiveCount = max_triangles,
@@ -759,7 +944,7 @@ void TriangleAS::create(gpu::TransferCmdPool &ctx, uint32_t max_triangles_count)
   tlas_holder.create(ctx, {blas});
 }
 
-void TriangleAS::update(VkCommandBuffer cmd, const gpu::BufferPtr &triangles_buffer, uint32_t triangles_count) {
+void TriangleAS::update(VkCommandBuffer cmd, const gpu::BufferPtr &triangles_buffer, uint32_t triangles_count, bool rebuild) {
   VkAccelerationStructureGeometryTrianglesDataKHR triangles_data {
     .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_TRIANGLES_DATA_KHR,
     .pNext = nullptr,
@@ -785,120 +970,448 @@ void TriangleAS::update(VkCommandBuffer cmd, const gpu::BufferPtr &triangles_buf
     .pNext = nullptr,
     .type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,
     .flags = VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR|VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_BUILD_BIT_KHR,
-    .mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR,
-    .srcAccelerationStructure = blas,
+    .mode = rebuild? VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR : VK_BUILD_ACCELERATION_STRUCTURE_MODE_UPDATE_KHR,
+    .srcAccelerationStructure = rebuild? nullptr : blas,
     .dstAccelerationStructure = blas,
     .geometryCount = 1,
     .pGeometries = &geometry,
     .ppGeometries = nullptr,
-    .scratchData {.deviceAddress = blas_update_buffer->device_address()}
+    .scratchData {.deviceAddress = as_memory::allocate_scratch(cmd, scratch_size)}
   };
 
-  //auto range_address = indirect_buffer->device_address();
-  //uint32_t stride = sizeof(VkAccelerationStructureBuildRangeInfoKHR);
-  //const uint32_t *primitive_ptr = &max_triangles;
-  //vkCmdBuildAccelerationStructuresIndirectKHR(cmd, 1, &mesh_info, &range_address, &stride, &primitive_ptr);
-  
   VkAccelerationStructureBuildRangeInfoKHR range {0, 0, 0, 0};
   range.primitiveCount = triangles_count;
   auto range_ptr = &range;
 
   vkCmdBuildAccelerationStructuresKHR(cmd, 1, &mesh_info, &range_ptr);
-  push_wr_barrier(cmd);
+  gpu::push_wr_barrier(cmd);
+
+  tlas_holder.update(cmd);
+}
+
+void TriangleAS::update_indirect(VkCommandBuffer cmd, const gpu::BufferPtr &triangles_buffer, const gpu::BufferPtr &range_buffer) {
+  VkAccelerationStructureGeometryTrianglesDataKHR triangles_data {
+    .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_TRIANGLES_DATA_KHR,
+    .pNext = nullptr,
+    .vertexFormat = VK_FORMAT_R32G32B32_SFLOAT,
+    .vertexData {.deviceAddress = triangles_buffer->device_address() },
+    .vertexStride = sizeof(glm::vec3),
+    .maxVertex = 3 * max_triangles - 1,
+    .indexType = VK_INDEX_TYPE_NONE_KHR,
+    .indexData {.hostAddress = nullptr},
+    .transformData {.hostAddress = nullptr} 
+  };
+
+  VkAccelerationStructureGeometryKHR geometry {
+    .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR,
+    .pNext = nullptr,
+    .geometryType = VK_GEOMETRY_TYPE_TRIANGLES_KHR,
+    .geometry = {.triangles = triangles_data },
+    .flags = VK_GEOMETRY_OPAQUE_BIT_KHR
+  };
+
+  VkAccelerationStructureBuildGeometryInfoKHR mesh_info {
+    .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR,
+    .pNext = nullptr,
+    .type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,
+    .flags = VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR|VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_BUILD_BIT_KHR,
+    .mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR,
+    .srcAccelerationStructure = nullptr,
+    .dstAccelerationStructure = blas,
+    .geometryCount = 1,
+    .pGeometries = &geometry,
+    .ppGeometries = nullptr,
+    .scratchData {.deviceAddress = as_memory::allocate_scratch(cmd, scratch_size)}
+  };
+
+  //the buffers are sized for max_triangles
+  VkDeviceAddress range_address = range_buffer->device_address();
+  uint32_t stride = sizeof(VkAccelerationStructureBuildRangeInfoKHR);
+  const uint32_t *max_primitives = &max_triangles;
+  vkCmdBuildAccelerationStructuresIndirectKHR(cmd, 1, &mesh_info, &range_address, &stride, &max_primitives);
+  gpu::push_wr_barrier(cmd);
 
   tlas_holder.update(cmd);
 }
 
-TriangleASBuilder::TriangleASBuilder(rendergraph::RenderGraph &graph, gpu::TransferCmdPool &ctx)
-  : id_extractor {graph}
+void DepthAs::append_instances(TLASBuilder &tlas_builder, uint8_t mask) const {
+  const glm::mat4 identity {1.f};
+  for (uint32_t tile = 0; tile < blases.size(); tile++) {
+    tlas_builder.add_instance(blases[tile], identity, tile * get_tile_primitives(), mask);
+  }
+}
+
+void TriangleAS::set_transform(VkCommandBuffer cmd, const glm::mat4 &transform) {
+  //row major 3x4
+  VkTransformMatrixKHR matrix {};
+  for (uint32_t row = 0; row < 3; row++) {
+    for (uint32_t col = 0; col < 4; col++) {
+      matrix.matrix[row][col] = transform[col][row];
+    }
+  }
+  tlas_holder.set_transform(cmd, 0, matrix);
+}
+
+TriangleASBuilder::TriangleASBuilder(rendergraph::RenderGraph &graph, gpu::TransferCmdPool &ctx, bool use_temporal_cache)
+  : id_extractor {graph}, temporal_cache {use_temporal_cache}
 {
-  auto max_triangles = 1u << 17u;
-  triangle_as.create(ctx, max_triangles);
+  triangle_as.create(ctx, MAX_TRIANGLES);
+  indirect_build = gpu::app_device().supports_indirect_as_build();
 
-  VkBufferUsageFlags indirect_flags = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT|VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT;
   VkBufferUsageFlags as_flags = VK_BUFFER_USAGE_TRANSFER_DST_BIT|VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR|VK_BUFFER_USAGE_STORAGE_BUFFER_BIT|VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
 
-  indirect_pipeline = gpu::create_compute_pipeline("unique_uints_init");
-  indirect_compute = graph.create_buffer(VMA_MEMORY_USAGE_GPU_ONLY, sizeof(VkDispatchIndirectCommand), indirect_flags);
-
   triangle_verts_pipeline = gpu::create_compute_pipeline("create_triangles");
-  triangle_verts = graph.create_buffer(VMA_MEMORY_USAGE_GPU_ONLY, sizeof(Triangle) * max_triangles, as_flags|VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT);
-  as_indirect_args = graph.create_buffer(VMA_MEMORY_USAGE_GPU_ONLY, sizeof(VkAccelerationStructureBuildRangeInfoKHR), indirect_flags);
+  triangle_verts_packed_pipeline = gpu::create_compute_pipeline("create_triangles_packed");
+  triangle_verts = graph.create_buffer(VMA_MEMORY_USAGE_GPU_ONLY, sizeof(Triangle) * MAX_TRIANGLES, as_flags);
+  as_indirect_args = graph.create_buffer(VMA_MEMORY_USAGE_GPU_ONLY, sizeof(VkAccelerationStructureBuildRangeInfoKHR),
+    VK_BUFFER_USAGE_STORAGE_BUFFER_BIT|VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT|VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT);
+
+  if (!temporal_cache) {
+    return;
+  }
+
+  cache_init_pipeline = gpu::create_compute_pipeline("triangle_cache_init");
+  cache_mark_pipeline = gpu::create_compute_pipeline("triangle_cache_mark");
+  cache_evict_pipeline = gpu::create_compute_pipeline("triangle_cache_evict");
+  cache_insert_pipeline = gpu::create_compute_pipeline("triangle_cache_insert");
+  cache_insert_packed_pipeline = gpu::create_compute_pipeline("triangle_cache_insert_packed");
+  cache_finalize_pipeline = gpu::create_compute_pipeline("triangle_cache_finalize");
+  cache_rehash_pipeline = gpu::create_compute_pipeline("triangle_cache_rehash");
+
+  constexpr VkBufferUsageFlags cache_flags = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT|VK_BUFFER_USAGE_TRANSFER_SRC_BIT|VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+  slot_ids = graph.create_buffer(VMA_MEMORY_USAGE_GPU_ONLY, sizeof(uint32_t) * MAX_TRIANGLES, cache_flags);
+  last_seen = graph.create_buffer(VMA_MEMORY_USAGE_GPU_ONLY, sizeof(uint32_t) * MAX_TRIANGLES, cache_flags);
+  hash_keys = graph.create_buffer(VMA_MEMORY_USAGE_GPU_ONLY, sizeof(uint32_t) * CACHE_HASH_SIZE, cache_flags);
+  hash_slots = graph.create_buffer(VMA_MEMORY_USAGE_GPU_ONLY, sizeof(uint32_t) * CACHE_HASH_SIZE, cache_flags);
+  free_slots = graph.create_buffer(VMA_MEMORY_USAGE_GPU_ONLY, sizeof(uint32_t) * (2 + MAX_TRIANGLES), cache_flags);
+  new_ids = graph.create_buffer(VMA_MEMORY_USAGE_GPU_ONLY, sizeof(uint32_t) * (1 + MAX_TRIANGLES), cache_flags);
+  cache_stats_buffer = graph.create_buffer(VMA_MEMORY_USAGE_GPU_ONLY, sizeof(TriangleCacheStats), cache_flags);
+
+  policy.init(1);
 }
 
 void TriangleASBuilder::run(rendergraph::RenderGraph &graph, SceneRenderer &scene, rendergraph::ImageResourceId triangle_id_image, const glm::mat4 &camera, const glm::mat4 &projection) {
-  buffer_clear(graph, triangle_verts, 0);
   id_extractor.run(graph, triangle_id_image, scene, projection * camera);
+  blas_transform = temporal_cache? camera : glm::mat4 {1.f};
+
+  if (temporal_cache) {
+    run_cache(graph, scene, camera);
+    return;
+  }
 
   auto reduce_buffer = id_extractor.get_result();
+  auto stats_buffer = id_extractor.get_stats_buffer();
+
+  auto verts_pipeline = (scene.get_target().vertex_layout == scene::VertexLayout::Packed)? &triangle_verts_packed_pipeline : &triangle_verts_pipeline;
+  auto verts_buffer = scene.get_target().vertex_buffer;
+  auto index_buffer = scene.get_target().index_buffer;
+  auto primitive_buffer = scene.get_target().primitive_buffer;
+  auto meshlet_buffer = scene.get_target().meshlet_buffer;
+  auto transform_buffer = scene.get_scene_transforms();
+  auto drawcalls_buffer = scene.get_drawcalls_buffer();
+
+  struct PushConstants {
+    glm::mat4 camera;
+    uint32_t max_triangles;
+  } push_const {camera, MAX_TRIANGLES};
 
   struct Nil {};
-  graph.add_task<Nil>("FillIndirect",
+  graph.add_task<Nil>("FillTriangles",
   [&](Nil &, rendergraph::RenderGraphBuilder &builder){
     builder.use_storage_buffer(reduce_buffer, VK_SHADER_STAGE_COMPUTE_BIT, true);
-    builder.use_storage_buffer(indirect_compute, VK_SHADER_STAGE_COMPUTE_BIT, false);
+    builder.use_storage_buffer(transform_buffer, VK_SHADER_STAGE_COMPUTE_BIT, true);
+    builder.use_storage_buffer(drawcalls_buffer, VK_SHADER_STAGE_COMPUTE_BIT, true);
+
+    builder.use_storage_buffer(triangle_verts, VK_SHADER_STAGE_COMPUTE_BIT, false);
+    builder.use_storage_buffer(as_indirect_args, VK_SHADER_STAGE_COMPUTE_BIT, false);
+    builder.use_storage_buffer(stats_buffer, VK_SHADER_STAGE_COMPUTE_BIT, false);
   },
   [=](Nil &, rendergraph::RenderResources &res, gpu::CmdContext &cmd){
-    auto set = res.allocate_set(indirect_pipeline, 0);
+    auto set = res.allocate_set(*verts_pipeline, 0);
     gpu::write_set(set,
-      gpu::SSBOBinding {0, res.get_buffer(indirect_compute)},
-      gpu::SSBOBinding {1, res.get_buffer(reduce_buffer)});
+      gpu::SSBOBinding {0, res.get_buffer(transform_buffer)},
+      gpu::SSBOBinding {1, verts_buffer},
+      gpu::SSBOBinding {2, index_buffer},
+      gpu::SSBOBinding {3, primitive_buffer},
+      gpu::SSBOBinding {4, res.get_buffer(reduce_buffer)},
+      gpu::SSBOBinding {5, res.get_buffer(as_indirect_args)},
+      gpu::SSBOBinding {6, res.get_buffer(triangle_verts)},
+      gpu::SSBOBinding {7, res.get_buffer(drawcalls_buffer)},
+      gpu::SSBOBinding {8, meshlet_buffer},
+      gpu::SSBOBinding {9, res.get_buffer(stats_buffer)}
+    );
 
-    cmd.bind_pipeline(indirect_pipeline);
+    //all slots, the ones after the visible triangles are padded
+    cmd.bind_pipeline(*verts_pipeline);
     cmd.bind_descriptors_compute(0, {set}, {});
-    cmd.dispatch(1, 1, 1);
+    cmd.push_constants_compute(0, sizeof(push_const), &push_const);
+    cmd.dispatch((MAX_TRIANGLES + 31)/32, 1, 1);
+  });
+
+  graph.add_task<Nil>("UpdateAccelerationStructure",
+  [&](Nil &, rendergraph::RenderGraphBuilder &builder){
+    builder.use_indirect_buffer(as_indirect_args);
+  },
+  [=](Nil &, rendergraph::RenderResources &res, gpu::CmdContext &cmd){
+    gpu::push_wr_barrier(cmd.get_command_buffer());
+    //the visible set changes every frame, refit is never valid
+    if (indirect_build) {
+      triangle_as.update_indirect(cmd.get_command_buffer(), res.get_buffer(triangle_verts), res.get_buffer(as_indirect_args));
+    } else {
+      triangle_as.update(cmd.get_command_buffer(), res.get_buffer(triangle_verts), MAX_TRIANGLES, true);
+    }
+    gpu::push_wr_barrier(cmd.get_command_buffer());
   });
+}
 
+void TriangleASBuilder::run_cache(rendergraph::RenderGraph &graph, SceneRenderer &scene, const glm::mat4 &camera) {
+  auto reduce_buffer = id_extractor.get_result();
+
+  auto insert_pipeline = (scene.get_target().vertex_layout == scene::VertexLayout::Packed)? &cache_insert_packed_pipeline : &cache_insert_pipeline;
   auto verts_buffer = scene.get_target().vertex_buffer;
   auto index_buffer = scene.get_target().index_buffer;
   auto primitive_buffer = scene.get_target().primitive_buffer;
+  auto meshlet_buffer = scene.get_target().meshlet_buffer;
   auto transform_buffer = scene.get_scene_transforms();
   auto drawcalls_buffer = scene.get_drawcalls_buffer();
 
-  graph.add_task<Nil>("FillTriangles",
-  [&](Nil &, rendergraph::RenderGraphBuilder &builder){
-    builder.use_indirect_buffer(indirect_compute);
+  const uint32_t frame = ++cache_frame;
+  const uint32_t hash_mask = CACHE_HASH_SIZE - 1;
+  const uint32_t capacity = MAX_TRIANGLES;
 
+  struct Nil {};
+
+  if (!cache_initialized) {
+    cache_initialized = true;
+    buffer_clear(graph, new_ids, 0);
+
+    graph.add_task<Nil>("TriangleCacheInit",
+    [&](Nil &, rendergraph::RenderGraphBuilder &builder){
+      builder.use_storage_buffer(slot_ids, VK_SHADER_STAGE_COMPUTE_BIT, false);
+      builder.use_storage_buffer(last_seen, VK_SHADER_STAGE_COMPUTE_BIT, false);
+      builder.use_storage_buffer(free_slots, VK_SHADER_STAGE_COMPUTE_BIT, false);
+      builder.use_storage_buffer(triangle_verts, VK_SHADER_STAGE_COMPUTE_BIT, false);
+    },
+    [=](Nil &, rendergraph::RenderResources &res, gpu::CmdContext &cmd){
+      auto set = res.allocate_set(cache_init_pipeline, 0);
+      gpu::write_set(set,
+        gpu::SSBOBinding {0, res.get_buffer(slot_ids)},
+        gpu::SSBOBinding {1, res.get_buffer(last_seen)},
+        gpu::SSBOBinding {2, res.get_buffer(free_slots)},
+        gpu::SSBOBinding {3, res.get_buffer(triangle_verts)});
+
+      cmd.bind_pipeline(cache_init_pipeline);
+      cmd.bind_descriptors_compute(0, {set}, {});
+      cmd.push_constants_compute(0, sizeof(capacity), &capacity);
+      cmd.dispatch((capacity + 31)/32, 1, 1);
+    });
+  }
+
+  //the first decide() after policy.init is a rebuild, so the table is also cleared on the first frame
+  std::vector<ASUpdateDecision> updates {ASUpdateDecision::Refit};
+  const bool rebuild = policy.decide(updates) > 0;
+
+  //a rebuild frame is also the time to drop the tombstones of the evicted ids
+  if (rebuild) {
+    buffer_clear(graph, hash_keys, ~0u);
+
+    graph.add_task<Nil>("TriangleCacheRehash",
+    [&](Nil &, rendergraph::RenderGraphBuilder &builder){
+      builder.use_storage_buffer(slot_ids, VK_SHADER_STAGE_COMPUTE_BIT, true);
+      builder.use_storage_buffer(hash_keys, VK_SHADER_STAGE_COMPUTE_BIT, false);
+      builder.use_storage_buffer(hash_slots, VK_SHADER_STAGE_COMPUTE_BIT, false);
+    },
+    [=](Nil &, rendergraph::RenderResources &res, gpu::CmdContext &cmd){
+      auto set = res.allocate_set(cache_rehash_pipeline, 0);
+      gpu::write_set(set,
+        gpu::SSBOBinding {0, res.get_buffer(slot_ids)},
+        gpu::SSBOBinding {1, res.get_buffer(hash_keys)},
+        gpu::SSBOBinding {2, res.get_buffer(hash_slots)});
+
+      struct {
+        uint32_t hash_mask;
+        uint32_t capacity;
+      } push_const {hash_mask, capacity};
+
+      cmd.bind_pipeline(cache_rehash_pipeline);
+      cmd.bind_descriptors_compute(0, {set}, {});
+      cmd.push_constants_compute(0, sizeof(push_const), &push_const);
+      cmd.dispatch((capacity + 31)/32, 1, 1);
+    });
+  }
+
+  buffer_clear(graph, cache_stats_buffer, 0);
+
+  graph.add_task<Nil>("TriangleCacheMark",
+  [&](Nil &, rendergraph::RenderGraphBuilder &builder){
     builder.use_storage_buffer(reduce_buffer, VK_SHADER_STAGE_COMPUTE_BIT, true);
+    builder.use_storage_buffer(hash_keys, VK_SHADER_STAGE_COMPUTE_BIT, true);
+    builder.use_storage_buffer(hash_slots, VK_SHADER_STAGE_COMPUTE_BIT, true);
+    builder.use_storage_buffer(last_seen, VK_SHADER_STAGE_COMPUTE_BIT, false);
+    builder.use_storage_buffer(new_ids, VK_SHADER_STAGE_COMPUTE_BIT, false);
+  },
+  [=](Nil &, rendergraph::RenderResources &res, gpu::CmdContext &cmd){
+    auto set = res.allocate_set(cache_mark_pipeline, 0);
+    gpu::write_set(set,
+      gpu::SSBOBinding {0, res.get_buffer(reduce_buffer)},
+      gpu::SSBOBinding {1, res.get_buffer(hash_keys)},
+      gpu::SSBOBinding {2, res.get_buffer(hash_slots)},
+      gpu::SSBOBinding {3, res.get_buffer(last_seen)},
+      gpu::SSBOBinding {4, res.get_buffer(new_ids)});
+
+    struct {
+      uint32_t frame;
+      uint32_t hash_mask;
+    } push_const {frame, hash_mask};
+
+    //UniqTriangleIDExtractor output is MAX_TRIANGLES ids at most
+    cmd.bind_pipeline(cache_mark_pipeline);
+    cmd.bind_descriptors_compute(0, {set}, {});
+    cmd.push_constants_compute(0, sizeof(push_const), &push_const);
+    cmd.dispatch((capacity + 31)/32, 1, 1);
+  });
+
+  graph.add_task<Nil>("TriangleCacheEvict",
+  [&](Nil &, rendergraph::RenderGraphBuilder &builder){
+    builder.use_storage_buffer(slot_ids, VK_SHADER_STAGE_COMPUTE_BIT, false);
+    builder.use_storage_buffer(last_seen, VK_SHADER_STAGE_COMPUTE_BIT, true);
+    builder.use_storage_buffer(hash_keys, VK_SHADER_STAGE_COMPUTE_BIT, false);
+    builder.use_storage_buffer(free_slots, VK_SHADER_STAGE_COMPUTE_BIT, false);
+    builder.use_storage_buffer(triangle_verts, VK_SHADER_STAGE_COMPUTE_BIT, false);
+    builder.use_storage_buffer(cache_stats_buffer, VK_SHADER_STAGE_COMPUTE_BIT, false);
+  },
+  [=](Nil &, rendergraph::RenderResources &res, gpu::CmdContext &cmd){
+    auto set = res.allocate_set(cache_evict_pipeline, 0);
+    gpu::write_set(set,
+      gpu::SSBOBinding {0, res.get_buffer(slot_ids)},
+      gpu::SSBOBinding {1, res.get_buffer(last_seen)},
+      gpu::SSBOBinding {2, res.get_buffer(hash_keys)},
+      gpu::SSBOBinding {3, res.get_buffer(free_slots)},
+      gpu::SSBOBinding {4, res.get_buffer(triangle_verts)},
+      gpu::SSBOBinding {5, res.get_buffer(cache_stats_buffer)});
+
+    struct {
+      uint32_t frame;
+      uint32_t max_age;
+      uint32_t hash_mask;
+      uint32_t capacity;
+    } push_const {frame, CACHE_MAX_AGE, hash_mask, capacity};
+
+    cmd.bind_pipeline(cache_evict_pipeline);
+    cmd.bind_descriptors_compute(0, {set}, {});
+    cmd.push_constants_compute(0, sizeof(push_const), &push_const);
+    cmd.dispatch((capacity + 31)/32, 1, 1);
+  });
+
+  graph.add_task<Nil>("TriangleCacheInsert",
+  [&](Nil &, rendergraph::RenderGraphBuilder &builder){
     builder.use_storage_buffer(transform_buffer, VK_SHADER_STAGE_COMPUTE_BIT, true);
     builder.use_storage_buffer(drawcalls_buffer, VK_SHADER_STAGE_COMPUTE_BIT, true);
+    builder.use_storage_buffer(new_ids, VK_SHADER_STAGE_COMPUTE_BIT, true);
 
+    builder.use_storage_buffer(hash_keys, VK_SHADER_STAGE_COMPUTE_BIT, false);
+    builder.use_storage_buffer(hash_slots, VK_SHADER_STAGE_COMPUTE_BIT, false);
+    builder.use_storage_buffer(slot_ids, VK_SHADER_STAGE_COMPUTE_BIT, false);
+    builder.use_storage_buffer(last_seen, VK_SHADER_STAGE_COMPUTE_BIT, false);
+    builder.use_storage_buffer(free_slots, VK_SHADER_STAGE_COMPUTE_BIT, false);
     builder.use_storage_buffer(triangle_verts, VK_SHADER_STAGE_COMPUTE_BIT, false);
-    builder.use_storage_buffer(as_indirect_args, VK_SHADER_STAGE_COMPUTE_BIT, false);
+    builder.use_storage_buffer(cache_stats_buffer, VK_SHADER_STAGE_COMPUTE_BIT, false);
   },
   [=](Nil &, rendergraph::RenderResources &res, gpu::CmdContext &cmd){
-    auto set = res.allocate_set(triangle_verts_pipeline, 0);
+    auto set = res.allocate_set(*insert_pipeline, 0);
     gpu::write_set(set,
       gpu::SSBOBinding {0, res.get_buffer(transform_buffer)},
       gpu::SSBOBinding {1, verts_buffer},
       gpu::SSBOBinding {2, index_buffer},
       gpu::SSBOBinding {3, primitive_buffer},
-      gpu::SSBOBinding {4, res.get_buffer(reduce_buffer)},
-      gpu::SSBOBinding {5, res.get_buffer(as_indirect_args)},
-      gpu::SSBOBinding {6, res.get_buffer(triangle_verts)},
-      gpu::SSBOBinding {7, res.get_buffer(drawcalls_buffer)}
+      gpu::SSBOBinding {4, res.get_buffer(new_ids)},
+      gpu::SSBOBinding {5, res.get_buffer(hash_keys)},
+      gpu::SSBOBinding {6, res.get_buffer(hash_slots)},
+      gpu::SSBOBinding {7, res.get_buffer(drawcalls_buffer)},
+      gpu::SSBOBinding {8, meshlet_buffer},
+      gpu::SSBOBinding {9, res.get_buffer(slot_ids)},
+      gpu::SSBOBinding {10, res.get_buffer(last_seen)},
+      gpu::SSBOBinding {11, res.get_buffer(free_slots)},
+      gpu::SSBOBinding {12, res.get_buffer(triangle_verts)},
+      gpu::SSBOBinding {13, res.get_buffer(cache_stats_buffer)}
     );
 
-    cmd.bind_pipeline(triangle_verts_pipeline);
+    struct {
+      uint32_t frame;
+      uint32_t hash_mask;
+      uint32_t capacity;
+    } push_const {frame, hash_mask, capacity};
+
+    cmd.bind_pipeline(*insert_pipeline);
+    cmd.bind_descriptors_compute(0, {set}, {});
+    cmd.push_constants_compute(0, sizeof(push_const), &push_const);
+    cmd.dispatch((capacity + 31)/32, 1, 1);
+  });
+
+  graph.add_task<Nil>("TriangleCacheFinalize",
+  [&](Nil &, rendergraph::RenderGraphBuilder &builder){
+    builder.use_storage_buffer(free_slots, VK_SHADER_STAGE_COMPUTE_BIT, false);
+    builder.use_storage_buffer(new_ids, VK_SHADER_STAGE_COMPUTE_BIT, false);
+    builder.use_storage_buffer(cache_stats_buffer, VK_SHADER_STAGE_COMPUTE_BIT, false);
+  },
+  [=](Nil &, rendergraph::RenderResources &res, gpu::CmdContext &cmd){
+    auto set = res.allocate_set(cache_finalize_pipeline, 0);
+    gpu::write_set(set,
+      gpu::SSBOBinding {0, res.get_buffer(free_slots)},
+      gpu::SSBOBinding {1, res.get_buffer(new_ids)},
+      gpu::SSBOBinding {2, res.get_buffer(cache_stats_buffer)});
+
+    cmd.bind_pipeline(cache_finalize_pipeline);
     cmd.bind_descriptors_compute(0, {set}, {});
-    cmd.push_constants_compute(0, sizeof(camera), &camera);
-    cmd.dispatch_indirect(res.get_buffer(indirect_compute)->api_buffer());
+    cmd.push_constants_compute(0, sizeof(capacity), &capacity);
+    cmd.dispatch(1, 1, 1);
   });
 
   graph.add_task<Nil>("UpdateAccelerationStructure",
   [&](Nil &, rendergraph::RenderGraphBuilder &builder){
-    builder.use_indirect_buffer(as_indirect_args);
+    builder.use_storage_buffer(triangle_verts, VK_SHADER_STAGE_COMPUTE_BIT, true);
   },
   [=](Nil &, rendergraph::RenderResources &res, gpu::CmdContext &cmd){
-    push_wr_barrier(cmd.get_command_buffer());
-    //triangle_as.update(cmd.get_command_buffer(), res.get_buffer(triangle_verts), res.get_buffer(as_indirect_args));
-    triangle_as.update(cmd.get_command_buffer(), res.get_buffer(triangle_verts), 80000);
-    push_wr_barrier(cmd.get_command_buffer());
+    gpu::push_wr_barrier(cmd.get_command_buffer());
+    //slots are world space and always active, the primitive set never changes so refit stays valid
+    triangle_as.set_transform(cmd.get_command_buffer(), camera);
+    triangle_as.update(cmd.get_command_buffer(), res.get_buffer(triangle_verts), MAX_TRIANGLES, rebuild);
+    gpu::push_wr_barrier(cmd.get_command_buffer());
   });
+}
 
+void TriangleASBuilder::append_instances(TLASBuilder &tlas_builder, uint8_t mask) const {
+  tlas_builder.add_instance(triangle_as.get_blas(), blas_transform, 0, mask);
 }
 
-GbufferCompressor::GbufferCompressor(rendergraph::RenderGraph &graph, gpu::TransferCmdPool &transfer_pool, uint32_t width, uint32_t height)
+void TriangleASBuilder::process_readback(rendergraph::RenderGraph &graph, ReadBackSystem &readback_sys) {
+  id_extractor.process_readback(graph, readback_sys);
+  if (!temporal_cache) {
+    return;
+  }
+
+  if (cache_readback != INVALID_READBACK && readback_sys.is_data_available(cache_readback)) {
+    auto result = readback_sys.get_data(cache_readback);
+    auto ptr = (const TriangleCacheStats*)result.bytes.get();
+    if (ptr->dropped_triangles && !cache_stats.dropped_triangles) {
+      std::cout << "TriangleCache overflow, " << ptr->dropped_triangles << " triangles dropped\n";
+    }
+    cache_stats = *ptr;
+    cache_readback = INVALID_READBACK;
+
+    //one frame is sampled, it stands for every frame since the request
+    float churn = float(cache_stats.inserted_triangles + cache_stats.evicted_triangles)/float(std::max(cache_stats.live_triangles, 1u));
+    policy.add_disocclusion(0, churn * float(cache_frame - cache_readback_frame));
+  }
+
+  if (cache_readback == INVALID_READBACK) {
+    cache_readback = readback_sys.read_buffer(graph, cache_stats_buffer);
+    cache_readback_frame = cache_frame;
+  }
+}
+
+GbufferCompressor::GbufferCompressor(rendergraph::RenderGraph &graph, gpu::TransferCmdPool &transfer_pool, uint32_t width, uint32_t height, Geometry geometry_type)
+  : geometry {geometry_type}
 {
   num_elems = width * height;
 
@@ -921,25 +1434,48 @@ GbufferCompressor::GbufferCompressor(rendergraph::RenderGraph &graph, gpu::Trans
 
   sampler = gpu::create_sampler(gpu::DEFAULT_SAMPLER);
 
-  depth_as.create(transfer_pool, width, height);
+  if (geometry == Geometry::Triangles) {
+    clear_triangles_pass = gpu::create_compute_pipeline("tree_clear_triangles");
+    plane_triangles = graph.create_buffer(VMA_MEMORY_USAGE_GPU_ONLY, 2 * sizeof(Triangle) * num_elems, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT|as_flags);
+    triangle_as.create(transfer_pool, 2 * num_elems);
+  } else {
+    depth_as.create(transfer_pool, width, height);
+  }
 }
 
 void GbufferCompressor::build_tree(rendergraph::RenderGraph &graph, rendergraph::ImageResourceId depth, uint32_t depth_mip, rendergraph::ImageResourceId normal, const DrawTAAParams &params)
 {
   struct Nil {};
-  graph.add_task<Nil>("ClearAABB", 
-  [&](Nil &, rendergraph::RenderGraphBuilder &builder){
-    builder.use_storage_buffer(aabbs, VK_SHADER_STAGE_COMPUTE_BIT, false);
-  },
-  [=](Nil &, rendergraph::RenderResources &res, gpu::CmdContext &cmd){
-    auto set = res.allocate_set(clear_pass, 0);
-    gpu::write_set(set, gpu::SSBOBinding {0, res.get_buffer(aabbs)});
-
-    cmd.bind_pipeline(clear_pass);
-    cmd.bind_descriptors_compute(0, {set});
-    cmd.push_constants_compute(0, sizeof(num_elems), &num_elems);
-    cmd.dispatch((num_elems + 31u)/32u, 1, 1);
-  });
+  if (geometry == Geometry::Triangles) {
+    graph.add_task<Nil>("ClearTriangles", 
+    [&](Nil &, rendergraph::RenderGraphBuilder &builder){
+      builder.use_storage_buffer(plane_triangles, VK_SHADER_STAGE_COMPUTE_BIT, false);
+    },
+    [=](Nil &, rendergraph::RenderResources &res, gpu::CmdContext &cmd){
+      auto set = res.allocate_set(clear_triangles_pass, 0);
+      gpu::write_set(set, gpu::SSBOBinding {0, res.get_buffer(plane_triangles)});
+      
+      uint32_t floats_count = 18 * num_elems;
+      cmd.bind_pipeline(clear_triangles_pass);
+      cmd.bind_descriptors_compute(0, {set});
+      cmd.push_constants_compute(0, sizeof(floats_count), &floats_count);
+      cmd.dispatch((floats_count + 31u)/32u, 1, 1);
+    });
+  } else {
+    graph.add_task<Nil>("ClearAABB", 
+    [&](Nil &, rendergraph::RenderGraphBuilder &builder){
+      builder.use_storage_buffer(aabbs, VK_SHADER_STAGE_COMPUTE_BIT, false);
+    },
+    [=](Nil &, rendergraph::RenderResources &res, gpu::CmdContext &cmd){
+      auto set = res.allocate_set(clear_pass, 0);
+      gpu::write_set(set, gpu::SSBOBinding {0, res.get_buffer(aabbs)});
+
+      cmd.bind_pipeline(clear_pass);
+      cmd.bind_descriptors_compute(0, {set});
+      cmd.push_constants_compute(0, sizeof(num_elems), &num_elems);
+      cmd.dispatch((num_elems + 31u)/32u, 1, 1);
+    });
+  }
 
   clear_color(graph, tree_levels, VkClearColorValue {.float32 {0.f, 0.f, -1.f, 0}});
   buffer_clear(graph, counter, 0u);
@@ -979,14 +1515,27 @@ void GbufferCompressor::build_tree(rendergraph::RenderGraph &graph, rendergraph:
     process_level(graph, params, i, (i == 0)? CHECK_GAPS : (i == last_src_mip)? DO_NOT_UPDATE : 0u);
   }
 
+  if (geometry == Geometry::Triangles) {
+    graph.add_task<Nil>("BuildTriangle_AS", 
+    [&](Nil &, rendergraph::RenderGraphBuilder &builder){
+      builder.use_storage_buffer(plane_triangles, VK_SHADER_STAGE_COMPUTE_BIT, true);
+    },
+    [=](Nil &, rendergraph::RenderResources &res, gpu::CmdContext &cmd){
+      gpu::push_rw_barrier(cmd.get_command_buffer());
+      triangle_as.update(cmd.get_command_buffer(), res.get_buffer(plane_triangles), 2 * num_elems);
+      gpu::push_wr_barrier(cmd.get_command_buffer());
+    });
+    return;
+  }
+
   graph.add_task<Nil>("BuildAABB_AS", 
   [&](Nil &, rendergraph::RenderGraphBuilder &builder){
     builder.use_storage_buffer(aabbs, VK_SHADER_STAGE_COMPUTE_BIT, true);
   },
   [=](Nil &, rendergraph::RenderResources &res, gpu::CmdContext &cmd){
-    push_rw_barrier(cmd.get_command_buffer());
+    gpu::push_rw_barrier(cmd.get_command_buffer());
     depth_as.update(cmd.get_command_buffer(), num_elems, res.get_buffer(aabbs));
-    push_wr_barrier(cmd.get_command_buffer());
+    gpu::push_wr_barrier(cmd.get_command_buffer());
   });
   
 }
@@ -1004,13 +1553,15 @@ void GbufferCompressor::process_level(rendergraph::RenderGraph &graph, const Dra
     float zfar;
     uint32_t flag;
     uint32_t src_level;
+    uint32_t emit_triangles;
   };
 
+  const bool triangles = geometry == Geometry::Triangles;
   PushConstants push_consts {params.fovy_aspect_znear_zfar.y,
                              params.fovy_aspect_znear_zfar.x,
                              params.fovy_aspect_znear_zfar.z,
                              params.fovy_aspect_znear_zfar.w,
-                             flag, src_level};
+                             flag, src_level, triangles? 1u : 0u};
 
   graph.add_task<Input>("ProcessLevel",
   [&](Input &input, rendergraph::RenderGraphBuilder &builder){
@@ -1020,15 +1571,20 @@ void GbufferCompressor::process_level(rendergraph::RenderGraph &graph, const Dra
     builder.use_storage_buffer(counter, VK_SHADER_STAGE_COMPUTE_BIT, false);
     builder.use_storage_buffer(aabbs, VK_SHADER_STAGE_COMPUTE_BIT, false);
     builder.use_storage_buffer(compressed_planes, VK_SHADER_STAGE_COMPUTE_BIT, false);
+    if (triangles) {
+      builder.use_storage_buffer(plane_triangles, VK_SHADER_STAGE_COMPUTE_BIT, false);
+    }
   },
   [=](Input &input, rendergraph::RenderResources &res, gpu::CmdContext &cmd){
     auto set = res.allocate_set(compress_mips, 0);
+    //aabbs are bound in place of unused triangles
     gpu::write_set(set, 
       gpu::StorageTextureBinding {0, res.get_view(input.src)},
       gpu::StorageTextureBinding {1, res.get_view(input.dst)},
       gpu::SSBOBinding {2, res.get_buffer(counter)},
       gpu::SSBOBinding {3, res.get_buffer(aabbs)},
-      gpu::SSBOBinding {4, res.get_buffer(compressed_planes)});
+      gpu::SSBOBinding {4, res.get_buffer(compressed_planes)},
+      gpu::SSBOBinding {5, res.get_buffer(triangles? plane_triangles : aabbs)});
     
     auto extent = res.get_image(input.src)->get_extent();
     for (uint32_t i = 0; i < src_level + 1; i++) {
@@ -7,51 +7,93 @@
 #include "scene_renderer.hpp"
 
 #include "image_readback.hpp"
+#include "as_update_policy.hpp"
+#include "gpu_primitives.hpp"
+#include "tlas_builder.hpp"
+#include "as_memory.hpp"
+
+#include <deque>
 
 struct TLASHolder {
   ~TLASHolder() { close(); } 
   void close();
 
-  void create(gpu::TransferCmdPool &cmd_pool, const std::vector<VkAccelerationStructureKHR> &elems);
+  //custom_indices[i] is instanceCustomIndex of elems[i], instance index if empty
+  void create(gpu::TransferCmdPool &cmd_pool, const std::vector<VkAccelerationStructureKHR> &elems, const std::vector<uint32_t> &custom_indices = {});
   void update(VkCommandBuffer cmd);
+  //instance transform, takes effect on the next update()
+  void set_transform(VkCommandBuffer cmd, uint32_t instance, const VkTransformMatrixKHR &transform);
 
   VkAccelerationStructureKHR get_tlas() const {
     return tlas;
   }
 
 private:
-  void create_instance_buffer(const std::vector<VkAccelerationStructureKHR> &elems);
+  void create_instance_buffer(const std::vector<VkAccelerationStructureKHR> &elems, const std::vector<uint32_t> &custom_indices);
 
   VkAccelerationStructureKHR tlas {nullptr};
-  gpu::BufferPtr tlas_storage_buffer;
-  gpu::BufferPtr tlas_update_buffer;
+  ASAllocation tlas_storage;
+  uint64_t update_scratch_size = 0; //reserved in as_memory
   gpu::BufferPtr tlas_instance_buffer;
 
   uint32_t num_instances = 0;
 };
 
 struct DepthAs {
+  static constexpr uint32_t MAX_TILES = 4096; //DEPTH_AS_MAX_TILES of depth_as_tiles.glsl
 
   ~DepthAs() { close(); }
 
   void close();
-  void create(gpu::TransferCmdPool &cmd_pool, uint32_t width, uint32_t height);
+  //tile_size = 0 builds one BLAS over the whole image. Otherwise every tile_size x tile_size tile gets its own BLAS and TLAS instance,
+  //tile_size must be a multiple of 8. AABBs are stored tile by tile, tile i owns primitive slots [i * get_tile_primitives(), (i + 1) * get_tile_primitives())
+  void create(gpu::TransferCmdPool &cmd_pool, uint32_t width, uint32_t height, uint32_t tile_size = 0);
+  //builds every tile with num_primitives AABBs
   void update(VkCommandBuffer cmd, uint32_t num_primitives, const gpu::BufferPtr &src, bool rebuild = false);
+  //refits or rebuilds tiles by tiles[i], rebuild = true rebuilds every tile that isn't skipped. The TLAS is refit if anything was built
+  void update_tiles(VkCommandBuffer cmd, const gpu::BufferPtr &src, const std::vector<ASUpdateDecision> &tiles, bool rebuild = false);
 
   VkAccelerationStructureKHR get_blas() const {
-    return blas;
+    return blases.size()? blases[0] : nullptr;
   }
 
   VkAccelerationStructureKHR get_tlas() const {
     return tlas_holder.get_tlas();
   }
 
+  //tile BLASes with the same custom indices as get_tlas(), screen space
+  void append_instances(TLASBuilder &tlas_builder, uint8_t mask = TLAS_MASK_DEPTH_AS) const;
+
+  //primitive slot -> y * width + x, consumers must map hits through it because DepthAsBuilder compacts AABBs.
+  //slot is instance custom index + primitive index
+  const gpu::BufferPtr &get_pixel_ids() const {
+    return pixel_ids;
+  }
+
+  uint32_t get_width() const { return width; }
+  uint32_t get_height() const { return height; }
+  uint32_t get_tile_width() const { return tile_width; }
+  uint32_t get_tile_height() const { return tile_height; }
+  uint32_t get_tiles_x() const { return tiles_x; }
+  uint32_t get_tiles_count() const { return tiles_x * tiles_y; }
+  uint32_t get_tile_primitives() const { return tile_width * tile_height; }
+  uint32_t get_max_primitives() const { return get_tiles_count() * get_tile_primitives(); }
+
 private:
-  void create_internal(uint32_t byte_size);
+  //init builds are submitted with submit_and_wait and use as_memory::allocate_init_scratch
+  void build_tiles(VkCommandBuffer cmd, const gpu::BufferPtr &src, const std::vector<ASUpdateDecision> *tiles, uint32_t num_primitives, bool rebuild, bool init = false);
 
-  VkAccelerationStructureKHR blas {nullptr};
-  gpu::BufferPtr storage_buffer;
-  gpu::BufferPtr update_buffer;
+  std::vector<VkAccelerationStructureKHR> blases;
+  ASAllocation storage; //all tiles
+  uint64_t scratch_stride = 0; //per built tile, tiles_count strides are reserved in as_memory
+  gpu::BufferPtr pixel_ids;
+
+  uint32_t width = 0;
+  uint32_t height = 0;
+  uint32_t tile_width = 0;
+  uint32_t tile_height = 0;
+  uint32_t tiles_x = 0;
+  uint32_t tiles_y = 0;
 
   TLASHolder tlas_holder;
 };
@@ -59,45 +101,87 @@ private:
 struct DepthAsBuilder {
   ~DepthAsBuilder() {}
 
-  void init(uint32_t width, uint32_t height);
+  //get_policy() decides which dirty tiles are refit or rebuilt. compact = false keeps one AABB per pixel.
+  //compact = true skips far plane pixels on rebuilds. Refits keep the slots of the last rebuild: pixels that turned to far plane become
+  //degenerate AABBs and pixels that left it are missing until the tile is rebuilt, the policy counts them as disocclusion
+  void init(const DepthAs &depth_as, bool compact = true);
+  //tiles compared against prev_depth, results come back through readback_sys a few frames later.
+  //Without this call every tile is built every frame
+  void track_changes(rendergraph::RenderGraph &graph, ReadBackSystem &readback_sys, rendergraph::ImageResourceId depth, rendergraph::ImageResourceId prev_depth, uint32_t mip, const DrawTAAParams &params);
   void run(rendergraph::RenderGraph &graph, DepthAs &depth_as, rendergraph::ImageResourceId depth, uint32_t mip, const DrawTAAParams &params);
   void checkerboard_init(rendergraph::RenderGraph &graph, DepthAs &depth_as, const DrawTAAParams &params);
 
+  uint32_t get_built_tiles() const { return built_tiles; }
+  bool is_compact() const { return compact; }
+  ASUpdatePolicy &get_policy() { return policy; }
+
+  float change_threshold = 0.01f; //relative view space distance
+  static constexpr uint32_t MAX_TILE_AGE = 60; //frames before a tile is rebuilt anyway, small changes accumulate
+
 private:
   uint32_t dst_width = 0;
   uint32_t dst_height = 0;
+  uint32_t tile_width = 0;
+  uint32_t tile_height = 0;
+  uint32_t tiles_x = 0;
+  uint32_t tiles_count = 0;
   
   gpu::ComputePipeline pipeline;
   gpu::ComputePipeline init_pipeline;
+  gpu::ComputePipeline finalize_pipeline;
+  gpu::ComputePipeline changes_pipeline;
   gpu::BufferPtr aabb_storage;
+  gpu::BufferPtr valid_counter;
+  gpu::BufferPtr pixel_slots; //y * width + x -> primitive slot given by the last compacted rebuild, ~0u for far plane pixels
+  bool compact = true;
   bool rebuild = true;
+
+  bool track_tiles = false;
+  rendergraph::BufferResourceId tile_changes;
+  std::deque<ReadBackID> changes_readbacks;
+  std::vector<uint8_t> changed_tiles;
+  std::vector<uint32_t> tile_age;
+  uint32_t built_tiles = 0;
+
+  ASUpdatePolicy policy;
 };
 
+struct TriangleIDStats {
+  uint32_t visible_triangles = 0; //unique ids, before the TriangleAS capacity clamp
+  uint32_t dropped_ids = 0;       //candidates over MAX_CANDIDATES and ids over the TriangleAS capacity
+};
+
+//ids unique inside of 32x32 pixel blocks are appended to a candidates list, GpuPrimitives sorts it and keeps the distinct ids.
+//The result is a counted array {count; ids[]}, count may be over the capacity and consumers clamp it.
+//CPU reference is unique_triangle_ids_cpu
 struct UniqTriangleIDExtractor {
+  static constexpr uint32_t MAX_CANDIDATES = 1u << 20u;
+  static constexpr uint32_t MAX_IDS = 1u << 17u;
+
   UniqTriangleIDExtractor(rendergraph::RenderGraph &graph);
 
   void run(rendergraph::RenderGraph &graph, rendergraph::ImageResourceId target, SceneRenderer &scene, const glm::mat4 &view_projection);
+  //statistics only, nothing on the GPU waits for it. Must be called after the stats buffer is written
   void process_readback(rendergraph::RenderGraph &graph, ReadBackSystem &readback_sys);
 
   rendergraph::BufferResourceId get_result() const { return reduce_buffer; }
+  //TriangleIDStats, cleared by run()
+  rendergraph::BufferResourceId get_stats_buffer() const { return stats_buffer; }
+  const TriangleIDStats &get_stats() const { return stats; }
 
 private:
-  uint32_t num_buckets = 128;
+  GpuPrimitives primitives;
 
   rendergraph::BufferResourceId reduce_buffer;
-  rendergraph::BufferResourceId triangles_per_bucket;
-  rendergraph::BufferResourceId buckets;
+  rendergraph::BufferResourceId candidates;
+  rendergraph::BufferResourceId stats_buffer;
 
   gpu::ComputePipeline reduce_pipeline;
-  gpu::ComputePipeline bucket_reduce_pipeline;
   
   VkSampler integer_sampler {nullptr};
 
-  gpu::ComputePipeline fill_buffer_pipeline;
-
   ReadBackID readback_id = INVALID_READBACK;
-  uint32_t readback_delay = 0;
-  static constexpr uint32_t DELAY_FRAMES = 300;
+  TriangleIDStats stats;
 };
 
 struct TriangleAS {
@@ -105,50 +189,115 @@ struct TriangleAS {
 
   void close();
   void create(gpu::TransferCmdPool &ctx, uint32_t max_triangles);
-  void update(VkCommandBuffer cmd, const gpu::BufferPtr &triangles_buffer, uint32_t triangles_count);
+  //refit is valid only if triangles_count and inactive triangles are the same as in the last rebuild
+  void update(VkCommandBuffer cmd, const gpu::BufferPtr &triangles_buffer, uint32_t triangles_count, bool rebuild = true);
+  //rebuild with the VkAccelerationStructureBuildRangeInfoKHR written by the GPU, needs gpu::Device::supports_indirect_as_build()
+  void update_indirect(VkCommandBuffer cmd, const gpu::BufferPtr &triangles_buffer, const gpu::BufferPtr &range_buffer);
+  //transform of the BLAS instance, call before update
+  void set_transform(VkCommandBuffer cmd, const glm::mat4 &transform);
 
   VkAccelerationStructureKHR get_tlas() const {
     return tlas_holder.get_tlas();
   }
 
+  VkAccelerationStructureKHR get_blas() const {
+    return blas;
+  }
+
 private:
   VkAccelerationStructureKHR blas {nullptr};
-  gpu::BufferPtr blas_storage_buffer;
-  gpu::BufferPtr blas_update_buffer;
+  ASAllocation blas_storage;
+  uint64_t scratch_size = 0; //reserved in as_memory
   uint32_t max_triangles = 0;
 
   TLASHolder tlas_holder;
 };
 
+struct TriangleCacheStats {
+  uint32_t live_triangles = 0;
+  uint32_t inserted_triangles = 0;
+  uint32_t evicted_triangles = 0;
+  uint32_t dropped_triangles = 0; //new triangles without a free slot
+};
+
 struct TriangleASBuilder {
-  TriangleASBuilder(rendergraph::RenderGraph &graph, gpu::TransferCmdPool &ctx);
+  //without temporal_cache the BLAS is rebuilt every frame from the visible triangles. The count never leaves the GPU:
+  //it is an indirect build if the device supports it, otherwise a MAX_TRIANGLES build with NaN padding.
+  //With temporal_cache visible triangles keep their slot in world space until they are unseen for CACHE_MAX_AGE frames,
+  //only new triangles are fetched and the BLAS is refit until the policy asks for a rebuild (churn is the disocclusion input)
+  TriangleASBuilder(rendergraph::RenderGraph &graph, gpu::TransferCmdPool &ctx, bool temporal_cache = true);
   void run(rendergraph::RenderGraph &graph, SceneRenderer &scene, rendergraph::ImageResourceId triangle_id_image, const glm::mat4 &camera, const glm::mat4 &projection);
+  //call after run
+  void process_readback(rendergraph::RenderGraph &graph, ReadBackSystem &readback_sys);
 
   VkAccelerationStructureKHR get_tlas() const { return triangle_as.get_tlas(); }
+  //the BLAS with the instance transform of the last run(), view space
+  void append_instances(TLASBuilder &tlas_builder, uint8_t mask = TLAS_MASK_TRIANGLE_AS) const;
+  //a few frames old
+  const TriangleIDStats &get_stats() const { return id_extractor.get_stats(); }
+  const TriangleCacheStats &get_cache_stats() const { return cache_stats; }
+  ASUpdatePolicy &get_policy() { return policy; }
 
   static constexpr uint32_t MAX_TRIANGLES = 1u << 17u;
+  static constexpr uint32_t CACHE_HASH_SIZE = 2u * MAX_TRIANGLES; //power of two
+  static constexpr uint32_t CACHE_MAX_AGE = 30;
 
 private:
+  void run_cache(rendergraph::RenderGraph &graph, SceneRenderer &scene, const glm::mat4 &camera);
+
   UniqTriangleIDExtractor id_extractor;
   TriangleAS triangle_as;
-  
-  gpu::ComputePipeline indirect_pipeline;
-  rendergraph::BufferResourceId indirect_compute; 
+  bool indirect_build = false;
+
+  bool temporal_cache = false;
+  bool cache_initialized = false;
+  glm::mat4 blas_transform {1.f}; //world space cache to view space
+  uint32_t cache_frame = 0;
+  ASUpdatePolicy policy;
+
+  gpu::ComputePipeline cache_init_pipeline;
+  gpu::ComputePipeline cache_mark_pipeline;
+  gpu::ComputePipeline cache_evict_pipeline;
+  gpu::ComputePipeline cache_insert_pipeline;
+  gpu::ComputePipeline cache_insert_packed_pipeline;
+  gpu::ComputePipeline cache_finalize_pipeline;
+  gpu::ComputePipeline cache_rehash_pipeline;
+
+  rendergraph::BufferResourceId slot_ids;
+  rendergraph::BufferResourceId last_seen;
+  rendergraph::BufferResourceId hash_keys;
+  rendergraph::BufferResourceId hash_slots;
+  rendergraph::BufferResourceId free_slots;
+  rendergraph::BufferResourceId new_ids;
+  rendergraph::BufferResourceId cache_stats_buffer;
+
+  ReadBackID cache_readback = INVALID_READBACK;
+  uint32_t cache_readback_frame = 0;
+  TriangleCacheStats cache_stats;
 
   gpu::ComputePipeline triangle_verts_pipeline;
+  gpu::ComputePipeline triangle_verts_packed_pipeline;
   rendergraph::BufferResourceId triangle_verts;
   rendergraph::BufferResourceId as_indirect_args;
 };
 
 struct GbufferCompressor {
-  GbufferCompressor(rendergraph::RenderGraph &graph, gpu::TransferCmdPool &transfer_pool, uint32_t width, uint32_t height);
+  enum class Geometry {
+    Aabbs,    //procedural AABB per plane, consumers intersect planes themselves
+    Triangles //2 triangles per plane, hardware intersection
+  };
+
+  GbufferCompressor(rendergraph::RenderGraph &graph, gpu::TransferCmdPool &transfer_pool, uint32_t width, uint32_t height, Geometry geometry = Geometry::Aabbs);
 
   void build_tree(rendergraph::RenderGraph &graph, rendergraph::ImageResourceId depth, uint32_t depth_mip, rendergraph::ImageResourceId normal, const DrawTAAParams &params);
   
-  VkAccelerationStructureKHR get_tlas() const { return depth_as.get_tlas(); } 
+  VkAccelerationStructureKHR get_tlas() const { return (geometry == Geometry::Triangles)? triangle_as.get_tlas() : depth_as.get_tlas(); } 
 
 private:
+  Geometry geometry;
+
   gpu::ComputePipeline clear_pass;
+  gpu::ComputePipeline clear_triangles_pass;
   gpu::ComputePipeline first_pass;
   gpu::ComputePipeline compress_mips;
 
@@ -159,10 +308,12 @@ private:
   rendergraph::BufferResourceId counter;
   rendergraph::BufferResourceId aabbs;
   rendergraph::BufferResourceId compressed_planes;
+  rendergraph::BufferResourceId plane_triangles;
 
   uint32_t num_elems = 0;
   
   DepthAs depth_as;
+  TriangleAS triangle_as;
 
   struct CompressedPlane {
     uint32_t packed_normal;
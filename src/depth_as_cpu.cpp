@@ -0,0 +1,174 @@
+#include "depth_as_cpu.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+float DepthImage::sample(const glm::vec2 &uv) const {
+  float fx = uv.x * width - 0.5f;
+  float fy = uv.y * height - 0.5f;
+  float x0 = std::floor(fx);
+  float y0 = std::floor(fy);
+  float wx = fx - x0;
+  float wy = fy - y0;
+
+  auto clamped = [&](float x, float y) {
+    uint32_t cx = uint32_t(std::clamp(x, 0.f, float(width - 1)));
+    uint32_t cy = uint32_t(std::clamp(y, 0.f, float(height - 1)));
+    return fetch(cx, cy);
+  };
+
+  float top = glm::mix(clamped(x0, y0), clamped(x0 + 1, y0), wx);
+  float bot = glm::mix(clamped(x0, y0 + 1), clamped(x0 + 1, y0 + 1), wx);
+  return glm::mix(top, bot, wy);
+}
+
+float linearize_depth2(float d, float n, float f) {
+  return n * f / (d * (f - n) - f);
+}
+
+float encode_depth(float z, float n, float f) {
+  return f/(f-n) + f*n/(z * (f - n));
+}
+
+glm::vec3 reconstruct_view_vec(const glm::vec2 &uv, float d, const DepthAsParams &params) {
+  float tg_alpha = std::tan(params.fovy/2);
+  float z = linearize_depth2(d, params.znear, params.zfar);
+
+  float xd = 2 * uv.x - 1;
+  float yd = 2 * uv.y - 1;
+
+  float x = -(xd) * (z * params.aspect * tg_alpha);
+  float y = -(yd) * (z * tg_alpha);
+  return glm::vec3(x, y, z);
+}
+
+glm::vec3 project_view_vec(const glm::vec3 &v, const DepthAsParams &params) {
+  float tg_alpha = std::tan(params.fovy/2);
+  float z = v.z;
+
+  float depth = encode_depth(z, params.znear, params.zfar);
+  float pu = v.x/(- v.z * tg_alpha * params.aspect);
+  float pv = v.y/(-z * tg_alpha);
+
+  return glm::vec3(0.5f * pu + 0.5f, 0.5f * pv + 0.5f, depth);
+}
+
+std::vector<VkAabbPositionsKHR> build_depth_as_aabbs(const DepthImage &depth, const DepthAsParams &params) {
+  std::vector<VkAabbPositionsKHR> aabbs;
+  aabbs.resize(depth.width * depth.height);
+  const glm::vec2 tex_size {depth.width, depth.height};
+
+  for (uint32_t y = 0; y < depth.height; y++) {
+    for (uint32_t x = 0; x < depth.width; x++) {
+      glm::vec2 pixel_pos {x, y};
+      glm::vec2 uv = (pixel_pos + glm::vec2{0.5f, 0.5f})/tex_size;
+      float pixel_depth = depth.fetch(x, y);
+
+      glm::vec2 uv_top = pixel_pos/tex_size;
+      glm::vec2 uv_bot = (pixel_pos + glm::vec2{1.f, 1.f})/tex_size;
+
+      glm::vec3 camera = reconstruct_view_vec(uv, pixel_depth, params);
+      float camera_len = glm::length(camera);
+      camera = (camera_len + params.thickness) * glm::normalize(camera);
+      float camera_depth = encode_depth(camera.z, params.znear, params.zfar);
+
+      aabbs[y * depth.width + x] = VkAabbPositionsKHR {uv_top.x, uv_top.y, pixel_depth, uv_bot.x, uv_bot.y, camera_depth};
+    }
+  }
+  return aabbs;
+}
+
+DepthAsRay make_depth_as_reflection_ray(const DepthImage &depth, const glm::vec2 &uv, const glm::vec3 &view_normal, const DepthAsParams &params) {
+  glm::vec3 view_vec = reconstruct_view_vec(uv, depth.sample(uv), params);
+  glm::vec3 R = glm::normalize(glm::reflect(view_vec, view_normal));
+  view_vec *= 0.98f;
+
+  DepthAsRay ray;
+  ray.start = project_view_vec(view_vec, params);
+  ray.dir = project_view_vec(view_vec + R, params) - ray.start;
+  ray.dir *= (1 - ray.start.z)/std::abs(ray.dir.z);
+  return ray;
+}
+
+static float ray_pixel_intersect(const glm::vec3 &ray_start, const glm::vec3 &ray_dir, const glm::vec2 &pixel_top_left, const glm::vec2 &pixel_bot_right, float pixel_depth) {
+  float x_coord = (ray_dir.x >= 0)? pixel_top_left.x : pixel_bot_right.x;
+  float y_coord = (ray_dir.y >= 0)? pixel_top_left.y : pixel_bot_right.y;
+
+  float t1 = (x_coord - ray_start.x)/ray_dir.x;
+  float y1 = ray_start.y + t1 * ray_dir.y;
+  if (y1 < pixel_top_left.y || y1 > pixel_bot_right.y || t1 < 0)
+    t1 = 1e20;
+
+  float t2 = (y_coord - ray_start.y)/ray_dir.y;
+  float x2 = ray_start.x + t2 * ray_dir.x;
+  if (x2 < pixel_top_left.x || x2 > pixel_bot_right.x  || t2 < 0)
+    t2 = 1e20;
+
+  float t = std::min(t1, t2);
+
+  if (t > 1000)
+    t = -1;
+  //check pixel corner
+
+  if (t > 0 && ray_start.z + t * ray_dir.z >= pixel_depth)
+    return t;
+
+  float t3 = (pixel_depth - ray_start.z)/ray_dir.z; //check depth intersection
+  glm::vec2 p = glm::vec2(ray_start) + t3 * glm::vec2(ray_dir);
+  if (t3 > 0 && glm::all(glm::greaterThanEqual(p, pixel_top_left)) && glm::all(glm::lessThan(p, pixel_bot_right)))
+    return t3;
+
+  return -1;
+}
+
+static float ray_pixel_intersect(const DepthImage &depth, const DepthAsRay &ray, const glm::ivec2 &pixel) {
+  const glm::vec2 tex_size {depth.width, depth.height};
+  glm::vec2 hit_top = glm::vec2(pixel)/tex_size;
+  glm::vec2 hit_bot = (glm::vec2(pixel) + glm::vec2(1, 1))/tex_size;
+  float hit_depth = depth.fetch(pixel.x, pixel.y);
+  return ray_pixel_intersect(ray.start, ray.dir, hit_top, hit_bot, hit_depth);
+}
+
+static bool find_correct_hit(const DepthImage &depth, const DepthAsRay &ray, const glm::ivec2 &first_hit, const DepthAsParams &params, glm::vec3 &out_hit_pos, float &out_t) {
+  float t = ray_pixel_intersect(depth, ray, first_hit);
+
+  if (t > 0) {
+    out_t = t;
+    out_hit_pos = ray.start + t * ray.dir;
+
+    float ray_depth = ray.start.z + t * ray.dir.z;
+
+    float ray_z = linearize_depth2(ray_depth, params.znear, params.zfar);
+    float scene_z = linearize_depth2(depth.fetch(first_hit.x, first_hit.y), params.znear, params.zfar);
+
+    if (ray_z + 0.1 < scene_z)
+      return false;
+
+    return true;
+  }
+  return false;
+}
+
+DepthAsHit trace_depth_as(const scene::CpuBVH &bvh, const DepthImage &depth, const DepthAsRay &ray, const DepthAsParams &params) {
+  DepthAsHit hit;
+  bool candidate_found = false;
+
+  //same candidate loop as trace_rays.comp, candidates come near first instead of in hardware order
+  scene::CpuRay query {ray.start, 0.005f, ray.dir, 1.f};
+  bvh.traverse(query, [&](uint32_t primitive_id, float) {
+    hit.pixel = glm::ivec2(primitive_id % depth.width, primitive_id/depth.width);
+    float t = ray_pixel_intersect(depth, ray, hit.pixel);
+
+    if (t > 0 || hit.steps > 2) {
+      candidate_found = true;
+      return false;
+    }
+    hit.steps++;
+    return true;
+  });
+
+  if (candidate_found) {
+    hit.valid = find_correct_hit(depth, ray, hit.pixel, params, hit.pos, hit.t);
+  }
+  return hit;
+}
@@ -0,0 +1,54 @@
+#ifndef DEPTH_AS_CPU_HPP_INCLUDED
+#define DEPTH_AS_CPU_HPP_INCLUDED
+
+#include "scene/cpu_bvh.hpp"
+
+#include <vector>
+
+//CPU reference of DepthAsBuilder (depth_as.comp) and the depth AS tracing of trace_rays.comp
+//everything is in the same screen space as on the GPU: x, y are uv and z is the encoded depth
+struct DepthAsParams {
+  float fovy;
+  float aspect;
+  float znear;
+  float zfar;
+  float thickness = 0.3f; //THIKNESS of depth_as.comp, in view space units along the view ray
+};
+
+struct DepthImage {
+  uint32_t width = 0;
+  uint32_t height = 0;
+  std::vector<float> texels;
+
+  float fetch(uint32_t x, uint32_t y) const { return texels[y * width + x]; }
+  //bilinear with clamp to edge, like gpu::DEFAULT_SAMPLER
+  float sample(const glm::vec2 &uv) const;
+};
+
+struct DepthAsRay {
+  glm::vec3 start;
+  glm::vec3 dir; //scaled to reach the far plane at t = 1
+};
+
+struct DepthAsHit {
+  bool valid = false;
+  glm::ivec2 pixel {0, 0};
+  glm::vec3 pos {0.f}; //screen space
+  float t = 0.f;
+  uint32_t steps = 0;  //candidates rejected before the accepted one
+};
+
+//gbuffer_encode.glsl helpers
+float linearize_depth2(float d, float n, float f);
+float encode_depth(float z, float n, float f);
+glm::vec3 reconstruct_view_vec(const glm::vec2 &uv, float d, const DepthAsParams &params);
+glm::vec3 project_view_vec(const glm::vec3 &v, const DepthAsParams &params);
+
+//one AABB per pixel, primitive index is y * width + x
+std::vector<VkAabbPositionsKHR> build_depth_as_aabbs(const DepthImage &depth, const DepthAsParams &params);
+//reflection ray of a pixel, view_normal is the gbuffer normal in view space
+DepthAsRay make_depth_as_reflection_ray(const DepthImage &depth, const glm::vec2 &uv, const glm::vec3 &view_normal, const DepthAsParams &params);
+//bvh must be built from build_depth_as_aabbs of the same depth image
+DepthAsHit trace_depth_as(const scene::CpuBVH &bvh, const DepthImage &depth, const DepthAsRay &ray, const DepthAsParams &params);
+
+#endif
@@ -0,0 +1,92 @@
+#include "frame_timer.hpp"
+
+#include <stdexcept>
+
+void FrameTimer::create(rendergraph::RenderGraph &graph, uint32_t ranges_count) {
+  close();
+
+  auto limits = gpu::app_device().get_properties().limits;
+  if (!limits.timestampComputeAndGraphics) {
+    throw std::runtime_error {"Timestamp queries are not supported"};
+  }
+
+  ranges = ranges_count;
+  frames = graph.get_frames_count();
+  ns_per_tick = limits.timestampPeriod;
+
+  VkQueryPoolCreateInfo info {
+    .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+    .pNext = nullptr,
+    .flags = 0,
+    .queryType = VK_QUERY_TYPE_TIMESTAMP,
+    .queryCount = 2 * ranges * frames,
+    .pipelineStatistics = 0
+  };
+
+  VKCHECK(vkCreateQueryPool(gpu::app_device().api_device(), &info, nullptr, &pool));
+  range_ms.assign(ranges, -1.f);
+  written.assign(ranges * frames, 0);
+}
+
+void FrameTimer::close() {
+  if (pool) {
+    vkDestroyQueryPool(gpu::app_device().api_device(), pool, nullptr);
+  }
+  pool = nullptr;
+  ranges = 0;
+  frames = 0;
+  range_ms.clear();
+  written.clear();
+}
+
+void FrameTimer::begin_frame(rendergraph::RenderGraph &graph) {
+  struct Nil {};
+  graph.add_task<Nil>("FrameTimerReset",
+  [&](Nil &, rendergraph::RenderGraphBuilder &){},
+  [=](Nil &, rendergraph::RenderResources &res, gpu::CmdContext &cmd){
+    const uint32_t frame = res.get_frame_index();
+    const uint32_t first_query = 2 * ranges * frame;
+
+    //the fence of this slot is already waited
+    std::vector<uint64_t> ticks(2 * ranges, 0);
+    bool has_results = false;
+    for (uint32_t i = 0; i < ranges; i++) {
+      has_results |= written[frame * ranges + i] != 0;
+    }
+
+    if (has_results) {
+      vkGetQueryPoolResults(gpu::app_device().api_device(), pool, first_query, 2 * ranges, sizeof(uint64_t) * ticks.size(), ticks.data(),
+        sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+    }
+
+    for (uint32_t i = 0; i < ranges; i++) {
+      if (written[frame * ranges + i]) {
+        range_ms[i] = float(ticks[2 * i + 1] - ticks[2 * i]) * ns_per_tick * 1e-6f;
+      }
+      written[frame * ranges + i] = 0;
+    }
+
+    vkCmdResetQueryPool(cmd.get_command_buffer(), pool, first_query, 2 * ranges);
+  });
+}
+
+void FrameTimer::begin(rendergraph::RenderGraph &graph, uint32_t range) {
+  struct Nil {};
+  graph.add_task<Nil>("FrameTimerBegin",
+  [&](Nil &, rendergraph::RenderGraphBuilder &){},
+  [=](Nil &, rendergraph::RenderResources &res, gpu::CmdContext &cmd){
+    const uint32_t query = 2 * (ranges * res.get_frame_index() + range);
+    vkCmdWriteTimestamp(cmd.get_command_buffer(), VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, pool, query);
+  });
+}
+
+void FrameTimer::end(rendergraph::RenderGraph &graph, uint32_t range) {
+  struct Nil {};
+  graph.add_task<Nil>("FrameTimerEnd",
+  [&](Nil &, rendergraph::RenderGraphBuilder &){},
+  [=](Nil &, rendergraph::RenderResources &res, gpu::CmdContext &cmd){
+    const uint32_t frame = res.get_frame_index();
+    vkCmdWriteTimestamp(cmd.get_command_buffer(), VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, pool, 2 * (ranges * frame + range) + 1);
+    written[frame * ranges + range] = 1;
+  });
+}
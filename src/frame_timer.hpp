@@ -0,0 +1,35 @@
+#ifndef FRAME_TIMER_HPP_INCLUDED
+#define FRAME_TIMER_HPP_INCLUDED
+
+#include "rendergraph/rendergraph.hpp"
+
+#include <vector>
+
+//GPU time of render graph task ranges, one timestamp pair per range and frame in flight.
+//Results are read when the frame slot is reused, so they are get_frames_count() frames old
+struct FrameTimer {
+  ~FrameTimer() { close(); }
+
+  void create(rendergraph::RenderGraph &graph, uint32_t ranges_count);
+  void close();
+
+  //must be the first task of the frame, resolves the previous use of the frame slot and resets its queries
+  void begin_frame(rendergraph::RenderGraph &graph);
+  //tasks added between begin and end are measured
+  void begin(rendergraph::RenderGraph &graph, uint32_t range);
+  void end(rendergraph::RenderGraph &graph, uint32_t range);
+
+  //negative if the range wasn't measured
+  float get_ms(uint32_t range) const { return range_ms[range]; }
+
+private:
+  VkQueryPool pool {nullptr};
+  uint32_t ranges = 0;
+  uint32_t frames = 0;
+  float ns_per_tick = 1.f;
+
+  std::vector<float> range_ms;
+  std::vector<uint8_t> written; //frames x ranges, end() was recorded
+};
+
+#endif
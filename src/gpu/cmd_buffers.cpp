@@ -2,9 +2,32 @@
 
 #include <stdexcept>
 #include <iostream>
+#include <cstring>
 
 namespace gpu {
 
+  static void push_memory_barrier(VkCommandBuffer cmd, VkAccessFlags src_access, VkAccessFlags dst_access) {
+    VkMemoryBarrier barrier {
+      .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+      .pNext = nullptr,
+      .srcAccessMask = src_access,
+      .dstAccessMask = dst_access
+    };
+
+    vkCmdPipelineBarrier(cmd,
+      VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+      VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+      0, 1, &barrier, 0, nullptr, 0, nullptr);
+  }
+
+  void push_wr_barrier(VkCommandBuffer cmd) {
+    push_memory_barrier(cmd, VK_ACCESS_MEMORY_WRITE_BIT, VK_ACCESS_MEMORY_READ_BIT);
+  }
+
+  void push_rw_barrier(VkCommandBuffer cmd) {
+    push_memory_barrier(cmd, VK_ACCESS_MEMORY_READ_BIT, VK_ACCESS_MEMORY_WRITE_BIT);
+  }
+
   struct FramebufferResource : CtxResource {
     FramebufferResource(VkFramebuffer framebuff) : CtxResource{},  fb {framebuff} {}
 
@@ -198,6 +221,14 @@ namespace gpu {
   void CmdContext::draw_indexed(uint32_t index_count, uint32_t instance_count, uint32_t first_index, uint32_t vertex_offset, uint32_t first_instance) {
     vkCmdDrawIndexed(cmd, index_count, instance_count, first_index, vertex_offset, first_instance);
   }
+
+  void CmdContext::draw_indexed_indirect(VkBuffer buffer, VkDeviceSize offset, uint32_t draw_count, uint32_t stride) {
+    vkCmdDrawIndexedIndirect(cmd, buffer, offset, draw_count, stride);
+  }
+
+  void CmdContext::draw_indexed_indirect_count(VkBuffer buffer, VkDeviceSize offset, VkBuffer count_buffer, VkDeviceSize count_offset, uint32_t max_draws, uint32_t stride) {
+    vkCmdDrawIndexedIndirectCount(cmd, buffer, offset, count_buffer, count_offset, max_draws, stride);
+  }
   
   void CmdContext::dispatch(uint32_t groups_x, uint32_t groups_y, uint32_t groups_z) {
     vkCmdDispatch(cmd, groups_x, groups_y, groups_z);
@@ -400,19 +431,43 @@ namespace gpu {
   }
 
   TransferCmdPool::TransferCmdPool(TransferCmdPool &&tpool)
-    : pool {tpool.pool}, cmd {tpool.cmd}, fence {tpool.fence},
-      buffer_acquired {tpool.buffer_acquired}
   {
+    *this = std::move(tpool);
   }
 
   TransferCmdPool::~TransferCmdPool() {
+    destroy();
+  }
+
+  void TransferCmdPool::destroy() {
     auto api_device = internal::app_vk_device();
+    
+    for (auto &chunk : chunks) {
+      if (chunk.submitted) {
+        VKCHECK(vkWaitForFences(api_device, 1, &chunk.fence, VK_TRUE, UINT64_MAX));
+      }
+      vkDestroyFence(api_device, chunk.fence, nullptr);
+    }
+    chunks.clear();
+
+    if (release_semaphore) {
+      vkDestroySemaphore(api_device, release_semaphore, nullptr);
+      release_semaphore = nullptr;
+    }
+
+    if (upload_pool) {
+      vkDestroyCommandPool(api_device, upload_pool, nullptr);
+      upload_pool = nullptr;
+    }
+
     if (fence) {
       vkDestroyFence(api_device, fence, nullptr);
+      fence = nullptr;
     }
 
     if (pool) {
       vkDestroyCommandPool(api_device, pool, nullptr);
+      pool = nullptr;
     }
   }
 
@@ -428,6 +483,8 @@ namespace gpu {
     auto api_device = internal::app_vk_device();
     auto api_queue = app_main_queue().queue;
 
+    flush();
+
     if (!buffer_acquired) {
       return;
     }
@@ -452,11 +509,454 @@ namespace gpu {
     buffer_acquired = false;
   }
 
+  void TransferCmdPool::init_upload_ring() {
+    auto api_device = internal::app_vk_device();
+    auto qinfo = app_transfer_queue();
+
+    VkCommandPoolCreateInfo pool_info {
+      .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+      .pNext = nullptr,
+      .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT|VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+      .queueFamilyIndex = qinfo.family
+    };
+
+    VKCHECK(vkCreateCommandPool(api_device, &pool_info, nullptr, &upload_pool));
+
+    VkCommandBufferAllocateInfo alloc_info {
+      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+      .pNext = nullptr,
+      .commandPool = upload_pool,
+      .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+      .commandBufferCount = UPLOAD_CHUNKS_COUNT + 1
+    };
+
+    std::vector<VkCommandBuffer> upload_cmds;
+    upload_cmds.resize(UPLOAD_CHUNKS_COUNT + 1);
+    VKCHECK(vkAllocateCommandBuffers(api_device, &alloc_info, upload_cmds.data()));
+    release_cmd = upload_cmds.back();
+
+    alloc_info.commandPool = pool;
+    alloc_info.commandBufferCount = 1;
+    VKCHECK(vkAllocateCommandBuffers(api_device, &alloc_info, &acquire_cmd));
+
+    VkSemaphoreCreateInfo semaphore_info {VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO};
+    VKCHECK(vkCreateSemaphore(api_device, &semaphore_info, nullptr, &release_semaphore));
+
+    uint32_t families_count = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(app_device().api_physical_device(), &families_count, nullptr);
+    std::vector<VkQueueFamilyProperties> families(families_count);
+    vkGetPhysicalDeviceQueueFamilyProperties(app_device().api_physical_device(), &families_count, families.data());
+
+    //copies start at x = 0 and cover the whole width, only the row offsets have to be aligned.
+    //Granularity is in texel blocks for compressed formats, so it counts upload rows either way
+    const auto &granularity = families.at(qinfo.family).minImageTransferGranularity;
+    granularity_rows = (granularity.width && granularity.height && granularity.depth)? granularity.height : 0;
+
+    chunks.resize(UPLOAD_CHUNKS_COUNT);
+    for (uint32_t i = 0; i < UPLOAD_CHUNKS_COUNT; i++) {
+      auto &chunk = chunks[i];
+      chunk.staging = create_buffer(VMA_MEMORY_USAGE_CPU_ONLY, UPLOAD_CHUNK_SIZE, VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
+      chunk.cmd = upload_cmds[i];
+
+      VkFenceCreateInfo fence_info {VK_STRUCTURE_TYPE_FENCE_CREATE_INFO};
+      VKCHECK(vkCreateFence(api_device, &fence_info, nullptr, &chunk.fence));
+    }
+  }
+
+  TransferCmdPool::UploadChunk &TransferCmdPool::begin_chunk() {
+    if (chunks.empty()) {
+      init_upload_ring();
+    }
+
+    auto &chunk = chunks[chunk_index];
+    if (chunk.recording) {
+      return chunk;
+    }
+
+    if (chunk.submitted) {
+      auto api_device = internal::app_vk_device();
+      VKCHECK(vkWaitForFences(api_device, 1, &chunk.fence, VK_TRUE, UINT64_MAX));
+      VKCHECK(vkResetFences(api_device, 1, &chunk.fence));
+      chunk.submitted = false;
+    }
+
+    VkCommandBufferBeginInfo begin_info {
+      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+      .pNext = nullptr,
+      .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+      .pInheritanceInfo = nullptr
+    };
+
+    VKCHECK(vkBeginCommandBuffer(chunk.cmd, &begin_info));
+    chunk.used = 0;
+    chunk.recording = true;
+    return chunk;
+  }
+
+  void TransferCmdPool::submit_chunk() {
+    if (chunks.empty()) {
+      return;
+    }
+
+    auto &chunk = chunks[chunk_index];
+    if (!chunk.recording) {
+      return;
+    }
+
+    chunk.staging->flush(0, chunk.used);
+    VKCHECK(vkEndCommandBuffer(chunk.cmd));
+
+    VkSubmitInfo submit_info {
+      .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+      .pNext = nullptr,
+      .waitSemaphoreCount = 0,
+      .pWaitSemaphores = nullptr,
+      .pWaitDstStageMask = nullptr,
+      .commandBufferCount = 1,
+      .pCommandBuffers = &chunk.cmd,
+      .signalSemaphoreCount = 0,
+      .pSignalSemaphores = nullptr
+    };
+
+    VKCHECK(vkQueueSubmit(app_transfer_queue().queue, 1, &submit_info, chunk.fence));
+    chunk.recording = false;
+    chunk.submitted = true;
+    chunk_index = (chunk_index + 1) % chunks.size();
+  }
+
+  static uint64_t align_upload_offset(uint64_t offset) {
+    //satisfies bufferOffset requirements of every texel block size we upload
+    return (offset + 15) & ~uint64_t(15);
+  }
+
+  void TransferCmdPool::upload_buffer(const BufferPtr &dst, uint64_t dst_offset, uint64_t size, const void *data) {
+    auto src = static_cast<const uint8_t*>(data);
+    
+    while (size) {
+      auto &chunk = begin_chunk();
+      if (chunk.used >= UPLOAD_CHUNK_SIZE) {
+        submit_chunk();
+        continue;
+      }
+
+      const uint64_t bytes = std::min(size, UPLOAD_CHUNK_SIZE - chunk.used);
+      std::memcpy(static_cast<uint8_t*>(chunk.staging->get_mapped_ptr()) + chunk.used, src, bytes);
+
+      VkBufferCopy region {
+        .srcOffset = chunk.used,
+        .dstOffset = dst_offset,
+        .size = bytes
+      };
+      vkCmdCopyBuffer(chunk.cmd, chunk.staging->api_buffer(), dst->api_buffer(), 1, &region);
+
+      chunk.used = align_upload_offset(chunk.used + bytes);
+      dst_offset += bytes;
+      src += bytes;
+      size -= bytes;
+    }
+
+    pending_buffers.insert(dst->api_buffer());
+  }
+
+  void TransferCmdPool::upload_image(const ImagePtr &dst, uint32_t mip, const void *data, uint64_t row_size, uint32_t rows_count, uint32_t row_height) {
+    if (chunks.empty()) {
+      init_upload_ring();
+    }
+
+    //copies are split at multiples of step_rows, the last one may end at the mip edge
+    const uint32_t step_rows = granularity_rows? granularity_rows : rows_count;
+    auto pending = pending_images.find(dst->api_image());
+    if (step_rows * row_size > UPLOAD_CHUNK_SIZE || (pending != pending_images.end() && pending->second.main_queue)) {
+      upload_image_main_queue(dst, mip, data, row_size, rows_count, row_height);
+      return;
+    }
+
+    auto src = static_cast<const uint8_t*>(data);
+    const auto extent = dst->get_extent();
+    const uint32_t mip_width = std::max(extent.width >> mip, 1u);
+    const uint32_t mip_height = std::max(extent.height >> mip, 1u);
+    const auto aspect = dst->get_default_aspect();
+
+    bool first_use = pending == pending_images.end();
+    uint32_t row = 0;
+    
+    while (row < rows_count) {
+      auto &chunk = begin_chunk();
+
+      if (first_use) {
+        VkImageMemoryBarrier barrier {
+          .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+          .pNext = nullptr,
+          .srcAccessMask = 0,
+          .dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+          .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+          .newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+          .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+          .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+          .image = dst->api_image(),
+          .subresourceRange = {dst->get_full_aspect(), 0, dst->get_mip_levels(), 0, dst->get_array_layers()}
+        };
+
+        vkCmdPipelineBarrier(chunk.cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+        pending_images[dst->api_image()] = PendingImage {dst->get_mip_levels(), dst->get_full_aspect(), false};
+        first_use = false;
+      }
+
+      const uint64_t fit_rows = (UPLOAD_CHUNK_SIZE - std::min(chunk.used, UPLOAD_CHUNK_SIZE))/row_size;
+      uint32_t rows = std::min<uint64_t>(fit_rows, rows_count - row);
+      if (row + rows < rows_count) {
+        rows -= rows % step_rows;
+      }
+      if (!rows) {
+        submit_chunk();
+        continue;
+      }
+
+      std::memcpy(static_cast<uint8_t*>(chunk.staging->get_mapped_ptr()) + chunk.used, src + row * row_size, rows * row_size);
+
+      const uint32_t y = row * row_height;
+      VkBufferImageCopy region {
+        .bufferOffset = chunk.used,
+        .bufferRowLength = 0,
+        .bufferImageHeight = 0,
+        .imageSubresource = {VkImageAspectFlags(aspect), mip, 0, 1},
+        .imageOffset = {0, int32_t(y), 0},
+        .imageExtent = {mip_width, std::min(rows * row_height, mip_height - y), 1}
+      };
+      vkCmdCopyBufferToImage(chunk.cmd, chunk.staging->api_buffer(), dst->api_image(), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+
+      chunk.used = align_upload_offset(chunk.used + rows * row_size);
+      row += rows;
+    }
+  }
+
+  //synchronous copy for mips the transfer queue can't split into chunks, later mips of the image follow it
+  void TransferCmdPool::upload_image_main_queue(const ImagePtr &dst, uint32_t mip, const void *data, uint64_t row_size, uint32_t rows_count, uint32_t row_height) {
+    auto api_device = internal::app_vk_device();
+    auto pending = pending_images.find(dst->api_image());
+    const bool first_use = pending == pending_images.end();
+
+    //earlier mips are owned by the transfer queue until flush
+    if (!first_use && !pending->second.main_queue) {
+      flush();
+    }
+
+    const uint64_t size = row_size * rows_count;
+    auto staging = create_buffer(VMA_MEMORY_USAGE_CPU_TO_GPU, size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
+    std::memcpy(staging->get_mapped_ptr(), data, size);
+    staging->flush();
+
+    VkCommandBufferAllocateInfo alloc_info {
+      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+      .pNext = nullptr,
+      .commandPool = pool,
+      .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+      .commandBufferCount = 1
+    };
+
+    VkCommandBuffer copy_cmd = nullptr;
+    VKCHECK(vkAllocateCommandBuffers(api_device, &alloc_info, &copy_cmd));
+
+    VkCommandBufferBeginInfo begin_info {
+      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+      .pNext = nullptr,
+      .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+      .pInheritanceInfo = nullptr
+    };
+    VKCHECK(vkBeginCommandBuffer(copy_cmd, &begin_info));
+
+    if (first_use) {
+      VkImageMemoryBarrier barrier {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+        .pNext = nullptr,
+        .srcAccessMask = 0,
+        .dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+        .newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .image = dst->api_image(),
+        .subresourceRange = {dst->get_full_aspect(), 0, dst->get_mip_levels(), 0, dst->get_array_layers()}
+      };
+      vkCmdPipelineBarrier(copy_cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+    }
+
+    const auto extent = dst->get_extent();
+    VkBufferImageCopy region {
+      .bufferOffset = 0,
+      .bufferRowLength = 0,
+      .bufferImageHeight = 0,
+      .imageSubresource = {VkImageAspectFlags(dst->get_default_aspect()), mip, 0, 1},
+      .imageOffset = {0, 0, 0},
+      .imageExtent = {std::max(extent.width >> mip, 1u), std::min(rows_count * row_height, std::max(extent.height >> mip, 1u)), 1}
+    };
+    vkCmdCopyBufferToImage(copy_cmd, staging->api_buffer(), dst->api_image(), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+    VKCHECK(vkEndCommandBuffer(copy_cmd));
+
+    VkSubmitInfo submit_info {
+      .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+      .pNext = nullptr,
+      .waitSemaphoreCount = 0,
+      .pWaitSemaphores = nullptr,
+      .pWaitDstStageMask = nullptr,
+      .commandBufferCount = 1,
+      .pCommandBuffers = &copy_cmd,
+      .signalSemaphoreCount = 0,
+      .pSignalSemaphores = nullptr
+    };
+
+    VKCHECK(vkQueueSubmit(app_main_queue().queue, 1, &submit_info, fence));
+    VKCHECK(vkWaitForFences(api_device, 1, &fence, VK_TRUE, UINT64_MAX));
+    VKCHECK(vkResetFences(api_device, 1, &fence));
+    vkFreeCommandBuffers(api_device, pool, 1, &copy_cmd);
+
+    pending_images[dst->api_image()] = PendingImage {dst->get_mip_levels(), dst->get_full_aspect(), true};
+  }
+
+  void TransferCmdPool::flush() {
+    if (chunks.empty()) {
+      return;
+    }
+
+    submit_chunk();
+    
+    auto api_device = internal::app_vk_device();
+    for (auto &chunk : chunks) {
+      if (chunk.submitted) {
+        VKCHECK(vkWaitForFences(api_device, 1, &chunk.fence, VK_TRUE, UINT64_MAX));
+        VKCHECK(vkResetFences(api_device, 1, &chunk.fence));
+        chunk.submitted = false;
+      }
+    }
+
+    const bool transfer_queue_images = std::any_of(pending_images.begin(), pending_images.end(), [](const auto &image){ return !image.second.main_queue; });
+    if (app_device().has_dedicated_transfer_queue() && (pending_buffers.size() || transfer_queue_images)) {
+      transfer_ownership();
+    }
+
+    pending_buffers.clear();
+    pending_images.clear();
+  }
+
+  //release on the transfer queue, acquire on the main queue
+  void TransferCmdPool::transfer_ownership() {
+    const uint32_t src_family = app_transfer_queue().family;
+    const uint32_t dst_family = app_main_queue().family;
+    
+    std::vector<VkBufferMemoryBarrier> buffer_barriers;
+    std::vector<VkImageMemoryBarrier> image_barriers;
+    buffer_barriers.reserve(pending_buffers.size());
+    image_barriers.reserve(pending_images.size());
+
+    for (auto buffer : pending_buffers) {
+      buffer_barriers.push_back(VkBufferMemoryBarrier {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+        .pNext = nullptr,
+        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .dstAccessMask = 0,
+        .srcQueueFamilyIndex = src_family,
+        .dstQueueFamilyIndex = dst_family,
+        .buffer = buffer,
+        .offset = 0,
+        .size = VK_WHOLE_SIZE
+      });
+    }
+
+    for (const auto &[image, pending] : pending_images) {
+      if (pending.main_queue) {
+        continue;
+      }
+      image_barriers.push_back(VkImageMemoryBarrier {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+        .pNext = nullptr,
+        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .dstAccessMask = 0,
+        .oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        .newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        .srcQueueFamilyIndex = src_family,
+        .dstQueueFamilyIndex = dst_family,
+        .image = image,
+        .subresourceRange = {pending.aspect, 0, pending.mips, 0, VK_REMAINING_ARRAY_LAYERS}
+      });
+    }
+
+    VkCommandBufferBeginInfo begin_info {
+      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+      .pNext = nullptr,
+      .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+      .pInheritanceInfo = nullptr
+    };
+
+    VKCHECK(vkBeginCommandBuffer(release_cmd, &begin_info));
+    vkCmdPipelineBarrier(release_cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0,
+      0, nullptr,
+      buffer_barriers.size(), buffer_barriers.data(),
+      image_barriers.size(), image_barriers.data());
+    VKCHECK(vkEndCommandBuffer(release_cmd));
+
+    for (auto &barrier : buffer_barriers) {
+      barrier.srcAccessMask = 0;
+      barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT|VK_ACCESS_MEMORY_WRITE_BIT;
+    }
+
+    for (auto &barrier : image_barriers) {
+      barrier.srcAccessMask = 0;
+      barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT|VK_ACCESS_MEMORY_WRITE_BIT;
+    }
+
+    VKCHECK(vkBeginCommandBuffer(acquire_cmd, &begin_info));
+    vkCmdPipelineBarrier(acquire_cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0,
+      0, nullptr,
+      buffer_barriers.size(), buffer_barriers.data(),
+      image_barriers.size(), image_barriers.data());
+    VKCHECK(vkEndCommandBuffer(acquire_cmd));
+
+    VkSubmitInfo release_submit {
+      .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+      .pNext = nullptr,
+      .waitSemaphoreCount = 0,
+      .pWaitSemaphores = nullptr,
+      .pWaitDstStageMask = nullptr,
+      .commandBufferCount = 1,
+      .pCommandBuffers = &release_cmd,
+      .signalSemaphoreCount = 1,
+      .pSignalSemaphores = &release_semaphore
+    };
+
+    const VkPipelineStageFlags wait_stage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+    VkSubmitInfo acquire_submit {
+      .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+      .pNext = nullptr,
+      .waitSemaphoreCount = 1,
+      .pWaitSemaphores = &release_semaphore,
+      .pWaitDstStageMask = &wait_stage,
+      .commandBufferCount = 1,
+      .pCommandBuffers = &acquire_cmd,
+      .signalSemaphoreCount = 0,
+      .pSignalSemaphores = nullptr
+    };
+
+    auto api_device = internal::app_vk_device();
+    VKCHECK(vkQueueSubmit(app_transfer_queue().queue, 1, &release_submit, nullptr));
+    VKCHECK(vkQueueSubmit(app_main_queue().queue, 1, &acquire_submit, fence));
+    VKCHECK(vkWaitForFences(api_device, 1, &fence, VK_TRUE, UINT64_MAX));
+    VKCHECK(vkResetFences(api_device, 1, &fence));
+  }
+
   const TransferCmdPool &TransferCmdPool::operator=(TransferCmdPool &&tpool) {
     std::swap(pool, tpool.pool);
     std::swap(cmd, tpool.cmd);
     std::swap(fence, tpool.fence);
     std::swap(buffer_acquired, tpool.buffer_acquired);
+    std::swap(upload_pool, tpool.upload_pool);
+    std::swap(chunks, tpool.chunks);
+    std::swap(chunk_index, tpool.chunk_index);
+    std::swap(release_cmd, tpool.release_cmd);
+    std::swap(acquire_cmd, tpool.acquire_cmd);
+    std::swap(release_semaphore, tpool.release_semaphore);
+    std::swap(pending_buffers, tpool.pending_buffers);
+    std::swap(pending_images, tpool.pending_images);
+    std::swap(granularity_rows, tpool.granularity_rows);
     return *this;
   }
 
@@ -8,6 +8,8 @@
 #include <vector>
 #include <algorithm>
 #include <memory>
+#include <unordered_map>
+#include <unordered_set>
 
 #include "gpu/pipelines.hpp"
 #include "gpu/dynbuffer.hpp"
@@ -18,6 +20,11 @@ namespace gpu {
 
   struct CmdContext;
 
+  //full memory barriers between all commands, writes before reads and reads before writes.
+  //Used around acceleration structure builds and their inputs
+  void push_wr_barrier(VkCommandBuffer cmd);
+  void push_rw_barrier(VkCommandBuffer cmd);
+
   struct CmdBufferPool {
     CmdBufferPool()
     {
@@ -192,6 +199,10 @@ namespace gpu {
 
     void draw(uint32_t vertex_count, uint32_t instance_count, uint32_t first_vertex, uint32_t first_instance);
     void draw_indexed(uint32_t index_count, uint32_t instance_count, uint32_t first_index, uint32_t vertex_offset, uint32_t first_instance);
+    //VkDrawIndexedIndirectCommand array
+    void draw_indexed_indirect(VkBuffer buffer, VkDeviceSize offset, uint32_t draw_count, uint32_t stride = sizeof(VkDrawIndexedIndirectCommand));
+    //VkDrawIndexedIndirectCommand array, draw count is read from count_buffer. Needs gpu::Device::supports_draw_indirect_count()
+    void draw_indexed_indirect_count(VkBuffer buffer, VkDeviceSize offset, VkBuffer count_buffer, VkDeviceSize count_offset, uint32_t max_draws, uint32_t stride = sizeof(VkDrawIndexedIndirectCommand));
     void dispatch(uint32_t groups_x, uint32_t groups_y, uint32_t groups_z);
     void dispatch_indirect(VkBuffer buffer, VkDeviceSize offset = 0);
 
@@ -247,22 +258,73 @@ namespace gpu {
     void flush_framebuffer_state(VkRenderPass renderpass);
   };
 
+  //One-shot command buffer for setup work and an upload queue.
+  //upload_buffer/upload_image stream data through a ring of staging chunks, every chunk has its own command buffer and fence,
+  //so memcpy into the next chunk overlaps copies from the previous ones. Copies run on the transfer queue if the device has a dedicated one.
   struct TransferCmdPool {
     TransferCmdPool();
     TransferCmdPool(TransferCmdPool &&pool);
     ~TransferCmdPool();
 
     VkCommandBuffer get_cmd_buffer();
+    //pending uploads are flushed before the submit
     void submit_and_wait();
 
+    //destination resources must be alive until flush()
+    void upload_buffer(const BufferPtr &dst, uint64_t dst_offset, uint64_t size, const void *data);
+    //row is a line of texels or texel blocks (row_height = 4 for block compressed formats), images are left in TRANSFER_DST_OPTIMAL.
+    //Copies the transfer queue can't split with its minImageTransferGranularity go through the main queue
+    void upload_image(const ImagePtr &dst, uint32_t mip, const void *data, uint64_t row_size, uint32_t rows_count, uint32_t row_height = 1);
+    //waits for all uploads and hands resources over to the main queue family
+    void flush();
+
     const TransferCmdPool &operator=(TransferCmdPool &&pool);
 
+    static constexpr uint64_t UPLOAD_CHUNK_SIZE = 8 << 20;
+    static constexpr uint32_t UPLOAD_CHUNKS_COUNT = 4;
+
   private:
     VkCommandPool pool {nullptr};
     VkCommandBuffer cmd {nullptr};
     VkFence fence {nullptr};
     bool buffer_acquired = false;
-    
+
+    struct UploadChunk {
+      BufferPtr staging;
+      VkCommandBuffer cmd {nullptr};
+      VkFence fence {nullptr};
+      uint64_t used = 0;
+      bool recording = false;
+      bool submitted = false;
+    };
+
+    VkCommandPool upload_pool {nullptr};
+    std::vector<UploadChunk> chunks;
+    uint32_t chunk_index = 0;
+
+    //queue family ownership transfer
+    VkCommandBuffer release_cmd {nullptr};
+    VkCommandBuffer acquire_cmd {nullptr};
+    VkSemaphore release_semaphore {nullptr};
+
+    struct PendingImage {
+      uint32_t mips;
+      VkImageAspectFlags aspect;
+      bool main_queue; //uploaded by upload_image_main_queue, owned by the main queue family
+    };
+
+    std::unordered_set<VkBuffer> pending_buffers;
+    std::unordered_map<VkImage, PendingImage> pending_images;
+    //rows of minImageTransferGranularity of the transfer queue, 0 if copies must cover whole mips
+    uint32_t granularity_rows = 1;
+
+    void init_upload_ring();
+    void upload_image_main_queue(const ImagePtr &dst, uint32_t mip, const void *data, uint64_t row_size, uint32_t rows_count, uint32_t row_height);
+    UploadChunk &begin_chunk();
+    void submit_chunk();
+    void transfer_ownership();
+    void destroy();
+
     TransferCmdPool(TransferCmdPool &) = delete;
     const TransferCmdPool &operator=(const TransferCmdPool &pool);
   };
@@ -91,6 +91,7 @@ namespace gpu {
     bool complete = false;
     uint32_t queue_family_index = 0;
     VkPhysicalDeviceProperties properties;
+    uint32_t transfer_family_index = 0;
   };
 
   static DeviceQueryInfo pick_physical_device(VkPhysicalDevice device, const DeviceConfig &cfg) {
@@ -110,12 +111,18 @@ namespace gpu {
 
     bool queue_found = false;
     uint32_t queue_family = 0;
+    std::optional<uint32_t> transfer_family;
 
     for (uint32_t i = 0; i < queues.size(); i++) {
       auto flags = queues[i].queueFlags;
       uint32_t required = VK_QUEUE_COMPUTE_BIT|VK_QUEUE_GRAPHICS_BIT|VK_QUEUE_TRANSFER_BIT;
       auto msk = flags & required;
-        
+      
+      //copy engine family
+      if (msk == VK_QUEUE_TRANSFER_BIT && !transfer_family.has_value()) {
+        transfer_family = i;
+      }
+
       if (msk != required) {
         continue;
       }
@@ -133,7 +140,7 @@ namespace gpu {
       queue_family = i;
     }
 
-    return {queue_found, queue_family, pproperties};
+    return {queue_found, queue_family, pproperties, transfer_family.value_or(queue_family)};
   }
 
   Device::Device(VkInstance instance, const DeviceConfig &cfg) {
@@ -155,6 +162,7 @@ namespace gpu {
     }
 
     queue_family_index = query.queue_family_index;    
+    transfer_queue_family_index = query.transfer_family_index;
 
     float priority = 1.f;
     
@@ -166,8 +174,17 @@ namespace gpu {
         .queueFamilyIndex = queue_family_index,
         .queueCount = 1,
         .pQueuePriorities = &priority 
+      },
+      {
+        .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+        .pNext = nullptr,
+        .flags = 0,
+        .queueFamilyIndex = transfer_queue_family_index,
+        .queueCount = 1,
+        .pQueuePriorities = &priority 
       }
     };
+    const uint32_t queues_count = has_dedicated_transfer_queue()? 2 : 1;
 
     auto ext_set = cfg.extensions;
     
@@ -190,19 +207,28 @@ namespace gpu {
     features.shaderSampledImageArrayDynamicIndexing = VK_TRUE;
     features.tessellationShader = VK_TRUE;
     features.geometryShader = VK_TRUE;
+    features.drawIndirectFirstInstance = VK_TRUE;
+    features.multiDrawIndirect = VK_TRUE;
+    features.textureCompressionBC = VK_TRUE;
     
-    VkPhysicalDeviceDescriptorIndexingFeatures bindless_features {
-      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES,
+    //descriptor indexing and buffer device address come from the same struct, it can't be chained with their own structs
+    VkPhysicalDeviceVulkan12Features features12 {
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES,
       .pNext = nullptr
     };
 
-    VkPhysicalDeviceBufferDeviceAddressFeatures device_adders {
-      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_BUFFER_DEVICE_ADDRESS_FEATURES,
-      nullptr,
-      VK_TRUE,
-      VK_FALSE,
-      VK_FALSE
+    //optional, meshlet draws fall back to vkCmdDrawIndexedIndirect
+    VkPhysicalDeviceVulkan12Features supported12 {
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES,
+      .pNext = nullptr
+    };
+    VkPhysicalDeviceFeatures2 supported_features {
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+      .pNext = &supported12
     };
+    vkGetPhysicalDeviceFeatures2(physical_device, &supported_features);
+    draw_indirect_count = supported12.drawIndirectCount;
+    features12.drawIndirectCount = supported12.drawIndirectCount;
 
     VkPhysicalDeviceAccelerationStructureFeaturesKHR acceleration_structure {
       .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_FEATURES_KHR
@@ -210,23 +236,37 @@ namespace gpu {
     acceleration_structure.accelerationStructure = VK_TRUE;
     acceleration_structure.accelerationStructureCaptureReplay = VK_TRUE;
 
+    //optional, a lot of drivers don't have it
+    if (cfg.use_ray_query) {
+      VkPhysicalDeviceAccelerationStructureFeaturesKHR supported_as {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_FEATURES_KHR
+      };
+      VkPhysicalDeviceFeatures2 supported {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+        .pNext = &supported_as
+      };
+      vkGetPhysicalDeviceFeatures2(physical_device, &supported);
+      indirect_as_build = supported_as.accelerationStructureIndirectBuild;
+      acceleration_structure.accelerationStructureIndirectBuild = supported_as.accelerationStructureIndirectBuild;
+    }
+
     VkPhysicalDeviceRayQueryFeaturesKHR ray_query_featrues {};
     ray_query_featrues.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_QUERY_FEATURES_KHR;
     ray_query_featrues.rayQuery = VK_TRUE;
     ray_query_featrues.pNext = nullptr;
     acceleration_structure.pNext = &ray_query_featrues;
-    device_adders.pNext = &acceleration_structure;
 
-    bindless_features.runtimeDescriptorArray = VK_TRUE;
-    bindless_features.descriptorBindingPartiallyBound = VK_TRUE;
-    bindless_features.descriptorBindingVariableDescriptorCount = VK_TRUE;
-    bindless_features.pNext = cfg.use_ray_query? &device_adders : nullptr;
+    features12.runtimeDescriptorArray = VK_TRUE;
+    features12.descriptorBindingPartiallyBound = VK_TRUE;
+    features12.descriptorBindingVariableDescriptorCount = VK_TRUE;
+    features12.bufferDeviceAddress = cfg.use_ray_query? VK_TRUE : VK_FALSE;
+    features12.pNext = cfg.use_ray_query? &acceleration_structure : nullptr;
     
     VkDeviceCreateInfo info {
       .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
-      .pNext = &bindless_features,
+      .pNext = &features12,
       .flags = 0,
-      .queueCreateInfoCount = 1,
+      .queueCreateInfoCount = queues_count,
       .pQueueCreateInfos = queues,
       .enabledLayerCount = 0,
       .ppEnabledLayerNames = nullptr,
@@ -237,6 +277,7 @@ namespace gpu {
 
     VKCHECK(vkCreateDevice(physical_device, &info, nullptr, &logical_device));
     vkGetDeviceQueue(logical_device, queue_family_index, 0, &queue);
+    vkGetDeviceQueue(logical_device, transfer_queue_family_index, 0, &transfer_queue);
   
     VmaVulkanFunctions vk_func {
       vkGetInstanceProcAddr,
@@ -276,7 +317,8 @@ namespace gpu {
   Device::Device(Device &&dev)
     : physical_device {dev.physical_device}, properties {dev.properties}, logical_device {dev.logical_device},
       allocator{dev.allocator}, queue_family_index {dev.queue_family_index},
-      queue {dev.queue}
+      queue {dev.queue}, transfer_queue_family_index {dev.transfer_queue_family_index},
+      transfer_queue {dev.transfer_queue}, indirect_as_build {dev.indirect_as_build}, draw_indirect_count {dev.draw_indirect_count}
   {
     dev.logical_device = nullptr;
     dev.allocator = nullptr;
@@ -298,6 +340,10 @@ namespace gpu {
     std::swap(allocator, dev.allocator);
     std::swap(queue_family_index, dev.queue_family_index);
     std::swap(queue, dev.queue);
+    std::swap(transfer_queue_family_index, dev.transfer_queue_family_index);
+    std::swap(transfer_queue, dev.transfer_queue);
+    std::swap(indirect_as_build, dev.indirect_as_build);
+    std::swap(draw_indirect_count, dev.draw_indirect_count);
     return *this;
   }
 
@@ -349,5 +395,10 @@ namespace gpu {
     auto &dev = app_device();
     return QueueInfo {dev.api_queue(), dev.get_queue_family()};
   }
+
+  QueueInfo app_transfer_queue() {
+    auto &dev = app_device();
+    return QueueInfo {dev.api_transfer_queue(), dev.get_transfer_queue_family()};
+  }
   
 }
\ No newline at end of file
@@ -85,8 +85,15 @@ namespace gpu {
     VkQueue api_queue() const { return queue; }
     VkPhysicalDevice api_physical_device() const { return physical_device; }
     uint32_t get_queue_family() const { return queue_family_index; }
+    VkQueue api_transfer_queue() const { return transfer_queue; }
+    uint32_t get_transfer_queue_family() const { return transfer_queue_family_index; }
+    bool has_dedicated_transfer_queue() const { return transfer_queue_family_index != queue_family_index; }
     VmaAllocator get_allocator() const { return allocator; }
     const VkPhysicalDeviceProperties get_properties() const { return properties; }
+    //vkCmdBuildAccelerationStructuresIndirectKHR is allowed
+    bool supports_indirect_as_build() const { return indirect_as_build; }
+    //Vulkan 1.2 drawIndirectCount feature
+    bool supports_draw_indirect_count() const { return draw_indirect_count; }
 
   private:
     VkPhysicalDevice physical_device {nullptr};
@@ -96,6 +103,13 @@ namespace gpu {
 
     uint32_t queue_family_index;
     VkQueue queue {nullptr};
+    
+    //same as the main queue if the device has no transfer-only family
+    uint32_t transfer_queue_family_index;
+    VkQueue transfer_queue {nullptr};
+
+    bool indirect_as_build = false;
+    bool draw_indirect_count = false;
   };
 
   struct Surface {
@@ -139,6 +153,7 @@ namespace gpu {
   };
 
   QueueInfo app_main_queue();
+  QueueInfo app_transfer_queue();
 
   namespace internal {
     VkDevice app_vk_device();
@@ -232,11 +232,16 @@ namespace gpu {
     return gpu::get_default_aspect(desc.format);
   }
   
-  VkImageAspectFlags DriverImage::get_full_aspect() const { //todo fix
-    VkImageAspectFlags aspect = get_default_aspect();
-    if (aspect != VK_IMAGE_ASPECT_COLOR_BIT)
-      aspect |= VK_IMAGE_ASPECT_STENCIL_BIT;
-    return aspect;
+  VkImageAspectFlags DriverImage::get_full_aspect() const {
+    switch (desc.format) {
+      case VK_FORMAT_D16_UNORM_S8_UINT:
+      case VK_FORMAT_D24_UNORM_S8_UINT:
+      case VK_FORMAT_D32_SFLOAT_S8_UINT:
+        return VK_IMAGE_ASPECT_DEPTH_BIT|VK_IMAGE_ASPECT_STENCIL_BIT;
+      default:
+        break;
+    }
+    return get_default_aspect();
   }
 
   VkImageView DriverImage::get_view(ImageViewRange range) {
@@ -260,7 +265,7 @@ namespace gpu {
       .image = handle,
       .viewType = range.type,
       .format = desc.format,
-      .components = {},
+      .components = components,
       .subresourceRange = {range.aspect, range.base_mip, range.mips_count, range.base_layer, range.layers_count}
     };
 
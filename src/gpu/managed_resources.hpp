@@ -143,6 +143,8 @@ namespace gpu {
 
     VkImageView get_view(ImageViewRange range);
     void destroy_views();
+    //applied to views created after the call
+    void set_swizzle(const VkComponentMapping &mapping) { components = mapping; }
 
     DriverImage(const DriverImage &) = delete;
     DriverImage &operator=(const DriverImage &) = delete;
@@ -151,6 +153,7 @@ namespace gpu {
     VkImage handle {nullptr};
     VmaAllocation allocation {nullptr};
     VkImageCreateInfo desc;
+    VkComponentMapping components {};
 
     std::mutex views_lock;
     std::unordered_map<ImageViewRange, VkImageView> views;
@@ -0,0 +1,218 @@
+#include "gpu_primitives.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+static uint32_t div_up(uint32_t a, uint32_t b) {
+  return (a + b - 1)/b;
+}
+
+GpuPrimitives::GpuPrimitives(rendergraph::RenderGraph &graph, uint32_t max_elements_count)
+  : max_elements {max_elements_count}
+{
+  if (!max_elements) {
+    throw std::runtime_error {"GpuPrimitives with zero capacity"};
+  }
+
+  tiles = div_up(max_elements, BLOCK_SIZE);
+  scan_capacity = std::max(max_elements, RADIX_SIZE * tiles);
+
+  scan_blocks_pipeline = gpu::create_compute_pipeline("primitives_scan_blocks");
+  scan_add_pipeline = gpu::create_compute_pipeline("primitives_scan_add");
+  radix_histogram_pipeline = gpu::create_compute_pipeline("primitives_radix_histogram");
+  radix_scatter_pipeline = gpu::create_compute_pipeline("primitives_radix_scatter");
+  compact_pipeline = gpu::create_compute_pipeline("primitives_compact_scatter");
+  unique_flags_pipeline = gpu::create_compute_pipeline("primitives_unique_flags");
+
+  constexpr VkBufferUsageFlags flags_usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT|VK_BUFFER_USAGE_TRANSFER_SRC_BIT|VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+  sort_temp = graph.create_buffer(VMA_MEMORY_USAGE_GPU_ONLY, counted_array_size(max_elements), flags_usage);
+  histogram = graph.create_buffer(VMA_MEMORY_USAGE_GPU_ONLY, sizeof(uint32_t) * RADIX_SIZE * tiles, flags_usage);
+  flags = graph.create_buffer(VMA_MEMORY_USAGE_GPU_ONLY, sizeof(uint32_t) * max_elements, flags_usage);
+  offsets = graph.create_buffer(VMA_MEMORY_USAGE_GPU_ONLY, sizeof(uint32_t) * max_elements, flags_usage);
+
+  //block sums of every level are scanned by the next one
+  uint32_t level_count = scan_capacity;
+  do {
+    level_count = div_up(level_count, BLOCK_SIZE);
+    block_sums.push_back(graph.create_buffer(VMA_MEMORY_USAGE_GPU_ONLY, sizeof(uint32_t) * level_count, flags_usage));
+  } while (level_count > 1);
+}
+
+void GpuPrimitives::exclusive_scan(rendergraph::RenderGraph &graph, rendergraph::BufferResourceId src, rendergraph::BufferResourceId dst, uint32_t count) {
+  if (count > scan_capacity) {
+    throw std::runtime_error {"GpuPrimitives scan over capacity"};
+  }
+  if (!count) {
+    return;
+  }
+  scan_level(graph, src, dst, count, 0);
+}
+
+void GpuPrimitives::scan_level(rendergraph::RenderGraph &graph, rendergraph::BufferResourceId src, rendergraph::BufferResourceId dst, uint32_t count, uint32_t level) {
+  const uint32_t blocks = div_up(count, BLOCK_SIZE);
+  auto sums = block_sums.at(level);
+
+  struct Nil {};
+  graph.add_task<Nil>("ScanBlocks",
+  [&](Nil &, rendergraph::RenderGraphBuilder &builder){
+    if (!(src == dst)) {
+      builder.use_storage_buffer(src, VK_SHADER_STAGE_COMPUTE_BIT, true);
+    }
+    builder.use_storage_buffer(dst, VK_SHADER_STAGE_COMPUTE_BIT, false);
+    builder.use_storage_buffer(sums, VK_SHADER_STAGE_COMPUTE_BIT, false);
+  },
+  [=](Nil &, rendergraph::RenderResources &res, gpu::CmdContext &cmd){
+    auto set = res.allocate_set(scan_blocks_pipeline, 0);
+    gpu::write_set(set,
+      gpu::SSBOBinding {0, res.get_buffer(src)},
+      gpu::SSBOBinding {1, res.get_buffer(dst)},
+      gpu::SSBOBinding {2, res.get_buffer(sums)});
+
+    cmd.bind_pipeline(scan_blocks_pipeline);
+    cmd.bind_descriptors_compute(0, {set}, {});
+    cmd.push_constants_compute(0, sizeof(count), &count);
+    cmd.dispatch(blocks, 1, 1);
+  });
+
+  if (blocks <= 1) {
+    return;
+  }
+
+  scan_level(graph, sums, sums, blocks, level + 1);
+
+  graph.add_task<Nil>("ScanAdd",
+  [&](Nil &, rendergraph::RenderGraphBuilder &builder){
+    builder.use_storage_buffer(sums, VK_SHADER_STAGE_COMPUTE_BIT, true);
+    builder.use_storage_buffer(dst, VK_SHADER_STAGE_COMPUTE_BIT, false);
+  },
+  [=](Nil &, rendergraph::RenderResources &res, gpu::CmdContext &cmd){
+    auto set = res.allocate_set(scan_add_pipeline, 0);
+    gpu::write_set(set,
+      gpu::SSBOBinding {0, res.get_buffer(dst)},
+      gpu::SSBOBinding {1, res.get_buffer(sums)});
+
+    cmd.bind_pipeline(scan_add_pipeline);
+    cmd.bind_descriptors_compute(0, {set}, {});
+    cmd.push_constants_compute(0, sizeof(count), &count);
+    cmd.dispatch(blocks, 1, 1);
+  });
+}
+
+void GpuPrimitives::radix_sort(rendergraph::RenderGraph &graph, rendergraph::BufferResourceId keys, uint32_t key_bits) {
+  if (!key_bits || key_bits > 32) {
+    throw std::runtime_error {"GpuPrimitives radix sort supports 1-32 bit keys"};
+  }
+
+  //even number of passes, the result ends in keys
+  const uint32_t passes = div_up(key_bits, 2 * RADIX_BITS) * 2;
+
+  struct PushConstants {
+    uint32_t shift;
+    uint32_t tiles;
+    uint32_t capacity;
+  };
+
+  struct Nil {};
+  for (uint32_t pass = 0; pass < passes; pass++) {
+    auto src = (pass & 1)? sort_temp : keys;
+    auto dst = (pass & 1)? keys : sort_temp;
+    const PushConstants push_const {pass * RADIX_BITS, tiles, max_elements};
+
+    graph.add_task<Nil>("RadixHistogram",
+    [&](Nil &, rendergraph::RenderGraphBuilder &builder){
+      builder.use_storage_buffer(src, VK_SHADER_STAGE_COMPUTE_BIT, true);
+      builder.use_storage_buffer(histogram, VK_SHADER_STAGE_COMPUTE_BIT, false);
+    },
+    [=](Nil &, rendergraph::RenderResources &res, gpu::CmdContext &cmd){
+      auto set = res.allocate_set(radix_histogram_pipeline, 0);
+      gpu::write_set(set,
+        gpu::SSBOBinding {0, res.get_buffer(src)},
+        gpu::SSBOBinding {1, res.get_buffer(histogram)});
+
+      cmd.bind_pipeline(radix_histogram_pipeline);
+      cmd.bind_descriptors_compute(0, {set}, {});
+      cmd.push_constants_compute(0, sizeof(push_const), &push_const);
+      cmd.dispatch(tiles, 1, 1);
+    });
+
+    exclusive_scan(graph, histogram, histogram, RADIX_SIZE * tiles);
+
+    graph.add_task<Nil>("RadixScatter",
+    [&](Nil &, rendergraph::RenderGraphBuilder &builder){
+      builder.use_storage_buffer(src, VK_SHADER_STAGE_COMPUTE_BIT, true);
+      builder.use_storage_buffer(histogram, VK_SHADER_STAGE_COMPUTE_BIT, true);
+      builder.use_storage_buffer(dst, VK_SHADER_STAGE_COMPUTE_BIT, false);
+    },
+    [=](Nil &, rendergraph::RenderResources &res, gpu::CmdContext &cmd){
+      auto set = res.allocate_set(radix_scatter_pipeline, 0);
+      gpu::write_set(set,
+        gpu::SSBOBinding {0, res.get_buffer(src)},
+        gpu::SSBOBinding {1, res.get_buffer(dst)},
+        gpu::SSBOBinding {2, res.get_buffer(histogram)});
+
+      cmd.bind_pipeline(radix_scatter_pipeline);
+      cmd.bind_descriptors_compute(0, {set}, {});
+      cmd.push_constants_compute(0, sizeof(push_const), &push_const);
+      cmd.dispatch(tiles, 1, 1);
+    });
+  }
+}
+
+void GpuPrimitives::compact(rendergraph::RenderGraph &graph, rendergraph::BufferResourceId src, rendergraph::BufferResourceId src_flags, rendergraph::BufferResourceId dst) {
+  //offsets past the src count are garbage, compact_scatter doesn't read them
+  exclusive_scan(graph, src_flags, offsets, max_elements);
+
+  struct PushConstants {
+    uint32_t capacity;
+    uint32_t dst_capacity;
+  } push_const {max_elements, uint32_t(graph.get_buffer(dst)->get_size()/sizeof(uint32_t) - 1)};
+
+  struct Nil {};
+  graph.add_task<Nil>("CompactScatter",
+  [&](Nil &, rendergraph::RenderGraphBuilder &builder){
+    builder.use_storage_buffer(src, VK_SHADER_STAGE_COMPUTE_BIT, true);
+    builder.use_storage_buffer(src_flags, VK_SHADER_STAGE_COMPUTE_BIT, true);
+    builder.use_storage_buffer(offsets, VK_SHADER_STAGE_COMPUTE_BIT, true);
+    builder.use_storage_buffer(dst, VK_SHADER_STAGE_COMPUTE_BIT, false);
+  },
+  [=](Nil &, rendergraph::RenderResources &res, gpu::CmdContext &cmd){
+    auto set = res.allocate_set(compact_pipeline, 0);
+    gpu::write_set(set,
+      gpu::SSBOBinding {0, res.get_buffer(src)},
+      gpu::SSBOBinding {1, res.get_buffer(src_flags)},
+      gpu::SSBOBinding {2, res.get_buffer(offsets)},
+      gpu::SSBOBinding {3, res.get_buffer(dst)});
+
+    cmd.bind_pipeline(compact_pipeline);
+    cmd.bind_descriptors_compute(0, {set}, {});
+    cmd.push_constants_compute(0, sizeof(push_const), &push_const);
+    cmd.dispatch(div_up(max_elements, GROUP_SIZE), 1, 1);
+  });
+}
+
+void GpuPrimitives::unique(rendergraph::RenderGraph &graph, rendergraph::BufferResourceId sorted_src, rendergraph::BufferResourceId dst, bool skip_invalid) {
+  struct PushConstants {
+    uint32_t capacity;
+    uint32_t skip_invalid;
+  } push_const {max_elements, skip_invalid? 1u : 0u};
+
+  struct Nil {};
+  graph.add_task<Nil>("UniqueFlags",
+  [&](Nil &, rendergraph::RenderGraphBuilder &builder){
+    builder.use_storage_buffer(sorted_src, VK_SHADER_STAGE_COMPUTE_BIT, true);
+    builder.use_storage_buffer(flags, VK_SHADER_STAGE_COMPUTE_BIT, false);
+  },
+  [=](Nil &, rendergraph::RenderResources &res, gpu::CmdContext &cmd){
+    auto set = res.allocate_set(unique_flags_pipeline, 0);
+    gpu::write_set(set,
+      gpu::SSBOBinding {0, res.get_buffer(sorted_src)},
+      gpu::SSBOBinding {1, res.get_buffer(flags)});
+
+    cmd.bind_pipeline(unique_flags_pipeline);
+    cmd.bind_descriptors_compute(0, {set}, {});
+    cmd.push_constants_compute(0, sizeof(push_const), &push_const);
+    cmd.dispatch(div_up(max_elements, GROUP_SIZE), 1, 1);
+  });
+
+  compact(graph, sorted_src, flags, dst);
+}
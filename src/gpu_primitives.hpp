@@ -0,0 +1,55 @@
+#ifndef GPU_PRIMITIVES_HPP_INCLUDED
+#define GPU_PRIMITIVES_HPP_INCLUDED
+
+#include "rendergraph/rendergraph.hpp"
+#include "gpu/gpu.hpp"
+
+#include <vector>
+
+//Prefix scan, radix sort and stream compaction as render graph tasks (shaders/primitives).
+//Sort, compaction and unique take counted arrays {uint count; uint elems[]}: the count stays on the GPU and is clamped to max_elements,
+//dispatches cover max_elements and groups past the count exit early. CPU references are in gpu_primitives_cpu.hpp
+struct GpuPrimitives {
+  static constexpr uint32_t BLOCK_SIZE = 1024; //PRIMITIVES_BLOCK_SIZE of primitives.glsl
+  static constexpr uint32_t GROUP_SIZE = 256;
+  static constexpr uint32_t RADIX_BITS = 8;
+  static constexpr uint32_t RADIX_SIZE = 1u << RADIX_BITS;
+
+  GpuPrimitives(rendergraph::RenderGraph &graph, uint32_t max_elements);
+
+  //raw uint arrays, count is known on the CPU. dst can be src
+  void exclusive_scan(rendergraph::RenderGraph &graph, rendergraph::BufferResourceId src, rendergraph::BufferResourceId dst, uint32_t count);
+  //stable ascending sort by the lowest key_bits bits, in place
+  void radix_sort(rendergraph::RenderGraph &graph, rendergraph::BufferResourceId keys, uint32_t key_bits = 32);
+  //dst gets the elements of src with nonzero flags in order, flags is a raw array aligned with the elements of src.
+  //dst count is the full result, elements over the dst capacity are not written
+  void compact(rendergraph::RenderGraph &graph, rendergraph::BufferResourceId src, rendergraph::BufferResourceId flags, rendergraph::BufferResourceId dst);
+  //distinct elements of a sorted src, ~0u is dropped if skip_invalid
+  void unique(rendergraph::RenderGraph &graph, rendergraph::BufferResourceId sorted_src, rendergraph::BufferResourceId dst, bool skip_invalid = false);
+
+  uint32_t get_max_elements() const { return max_elements; }
+
+  static uint64_t counted_array_size(uint32_t capacity) { return sizeof(uint32_t) * (1ull + capacity); }
+
+private:
+  void scan_level(rendergraph::RenderGraph &graph, rendergraph::BufferResourceId src, rendergraph::BufferResourceId dst, uint32_t count, uint32_t level);
+
+  uint32_t max_elements = 0;
+  uint32_t tiles = 0;         //radix sort groups
+  uint32_t scan_capacity = 0;
+
+  gpu::ComputePipeline scan_blocks_pipeline;
+  gpu::ComputePipeline scan_add_pipeline;
+  gpu::ComputePipeline radix_histogram_pipeline;
+  gpu::ComputePipeline radix_scatter_pipeline;
+  gpu::ComputePipeline compact_pipeline;
+  gpu::ComputePipeline unique_flags_pipeline;
+
+  rendergraph::BufferResourceId sort_temp;  //counted, radix sort ping-pong
+  rendergraph::BufferResourceId histogram;  //RADIX_SIZE x tiles
+  rendergraph::BufferResourceId flags;
+  rendergraph::BufferResourceId offsets;
+  std::vector<rendergraph::BufferResourceId> block_sums; //one per scan level
+};
+
+#endif
@@ -0,0 +1,68 @@
+#include "gpu_primitives_cpu.hpp"
+
+#include <algorithm>
+
+std::vector<uint32_t> exclusive_scan_cpu(const std::vector<uint32_t> &src) {
+  std::vector<uint32_t> result(src.size());
+  uint32_t sum = 0;
+  for (size_t i = 0; i < src.size(); i++) {
+    result[i] = sum;
+    sum += src[i];
+  }
+  return result;
+}
+
+std::vector<uint32_t> radix_sort_cpu(const std::vector<uint32_t> &keys, uint32_t key_bits) {
+  constexpr uint32_t RADIX_BITS = 8;
+  constexpr uint32_t RADIX_SIZE = 1u << RADIX_BITS;
+
+  std::vector<uint32_t> src = keys;
+  std::vector<uint32_t> dst(keys.size());
+
+  //GpuPrimitives::radix_sort rounds up to an even number of passes
+  const uint32_t passes = (key_bits + 2 * RADIX_BITS - 1)/(2 * RADIX_BITS) * 2;
+  for (uint32_t pass = 0; pass < passes; pass++) {
+    const uint32_t shift = pass * RADIX_BITS;
+    std::vector<uint32_t> histogram(RADIX_SIZE, 0);
+    for (auto key : src) {
+      histogram[(key >> shift) & (RADIX_SIZE - 1)]++;
+    }
+
+    auto offsets = exclusive_scan_cpu(histogram);
+    for (auto key : src) {
+      dst[offsets[(key >> shift) & (RADIX_SIZE - 1)]++] = key;
+    }
+    std::swap(src, dst);
+  }
+  return src;
+}
+
+std::vector<uint32_t> compact_cpu(const std::vector<uint32_t> &src, const std::vector<uint32_t> &flags) {
+  std::vector<uint32_t> result;
+  for (size_t i = 0; i < src.size(); i++) {
+    if (flags[i]) {
+      result.push_back(src[i]);
+    }
+  }
+  return result;
+}
+
+std::vector<uint32_t> unique_cpu(const std::vector<uint32_t> &sorted_src, bool skip_invalid) {
+  std::vector<uint32_t> result;
+  for (size_t i = 0; i < sorted_src.size(); i++) {
+    if (i > 0 && sorted_src[i - 1] == sorted_src[i]) {
+      continue;
+    }
+    if (skip_invalid && sorted_src[i] == ~0u) {
+      continue;
+    }
+    result.push_back(sorted_src[i]);
+  }
+  return result;
+}
+
+std::vector<uint32_t> unique_triangle_ids_cpu(const std::vector<uint32_t> &id_image) {
+  auto sorted = id_image;
+  std::sort(sorted.begin(), sorted.end());
+  return unique_cpu(sorted, true);
+}
@@ -0,0 +1,17 @@
+#ifndef GPU_PRIMITIVES_CPU_HPP_INCLUDED
+#define GPU_PRIMITIVES_CPU_HPP_INCLUDED
+
+#include <cstdint>
+#include <vector>
+
+//CPU references of GpuPrimitives and UniqTriangleIDExtractor, results must match the GPU ones exactly
+std::vector<uint32_t> exclusive_scan_cpu(const std::vector<uint32_t> &src);
+//LSD radix sort with the digit order of radix_scatter.comp
+std::vector<uint32_t> radix_sort_cpu(const std::vector<uint32_t> &keys, uint32_t key_bits = 32);
+std::vector<uint32_t> compact_cpu(const std::vector<uint32_t> &src, const std::vector<uint32_t> &flags);
+std::vector<uint32_t> unique_cpu(const std::vector<uint32_t> &sorted_src, bool skip_invalid = false);
+
+//sorted unique ids of a triangle id image, INVALID_TRIANGLE_ID is skipped
+std::vector<uint32_t> unique_triangle_ids_cpu(const std::vector<uint32_t> &id_image);
+
+#endif
@@ -4,10 +4,12 @@
 #include <iostream>
 #include <vector>
 #include <memory>
+#include <optional>
 #include <fstream>
 #include <filesystem>
 #include <lib/json.hpp>
 #include <ctime>
+#include <algorithm>
 
 using json = nlohmann::json; 
 namespace fs = std::filesystem;
@@ -22,6 +24,7 @@ namespace fs = std::filesystem;
 #include "scene_renderer.hpp"
 #include "defered_shading.hpp"
 #include "gpu_transfer.hpp"
+#include "as_memory.hpp"
 #include "downsample_pass.hpp"
 #include "ssr.hpp"
 #include "gtao.hpp"
@@ -30,9 +33,14 @@ namespace fs = std::filesystem;
 #include "advanced_ssr.hpp"
 #include "taa.hpp"
 #include "depth_as.hpp"
+#include "tlas_builder.hpp"
+#include "scene_tlas.hpp"
 #include "rtfx.hpp"
 #include "contact_shadows.hpp"
 #include "indirect_light.hpp"
+#include "benchmarks.hpp"
+#include "texture_streaming.hpp"
+#include "frame_timer.hpp"
 
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include <lib/stb_image_write.h>
@@ -241,7 +249,21 @@ int main(int argc, char **argv) {
     params.push_back(argv[i]);
   }
 
-  if (params.size() > 0 && params[0] == "--disable-validation") {
+  auto has_param = [&](const char *name) {
+    return std::find(params.begin(), params.end(), name) != params.end();
+  };
+
+  if (has_param("--bench-depth-as")) {
+    bench_depth_as();
+    return 0;
+  }
+
+  if (has_param("--bench-tree-compressor")) {
+    bench_tree_compressor();
+    return 0;
+  }
+
+  if (has_param("--disable-validation")) {
     std::cout << "validation disabled\n";
     enable_validation = false;
   }
@@ -254,13 +276,59 @@ int main(int argc, char **argv) {
   
   rendergraph::RenderGraph render_graph {gpu::app_device(), gpu::app_swapchain()};
   gpu_transfer::init(render_graph);
+  as_memory::init(render_graph);
   ReadBackSystem readback_system;
 
   gpu::TransferCmdPool transfer_pool {};
-  auto scene = scene::load_tinygltf_scene(transfer_pool,  "assets/gltf/Sponza/glTF/Sponza.gltf", USE_RAY_QUERY);
-  //auto scene = scene::load_tinygltf_scene(transfer_pool,  "/home/void/workspace/tools/glTF-Sample-Models/room/room_gltf/roomgltf.gltf", USE_RAY_QUERY);
-  //auto scene = scene::load_tinygltf_scene(transfer_pool,  "assets/gltf/st_dragon/stanford-dragon.gltf", USE_RAY_QUERY);
-  //auto scene = scene::load_tinygltf_scene(transfer_pool,  "assets/gltf/sibernik_gltf/untitled.gltf", USE_RAY_QUERY);
+  
+  if (has_param("--bench-scene-load")) {
+    bench_scene_loading(transfer_pool, "assets/gltf/Sponza/glTF/Sponza.gltf");
+    as_memory::close();
+    gpu_transfer::close();
+    return 0;
+  }
+
+  if (has_param("--bench-cpu-rt")) {
+    bench_cpu_ray_tracing(transfer_pool, "assets/gltf/Sponza/glTF/Sponza.gltf");
+    as_memory::close();
+    gpu_transfer::close();
+    return 0;
+  }
+
+  if (has_param("--bench-gpu-primitives")) {
+    bench_gpu_primitives(render_graph, readback_system);
+    as_memory::close();
+    gpu_transfer::close();
+    return 0;
+  }
+
+  if (has_param("--bench-dynamic-tlas")) {
+    bench_dynamic_tlas(render_graph, transfer_pool, "assets/gltf/Sponza/glTF/Sponza.gltf");
+    as_memory::close();
+    gpu_transfer::close();
+    return 0;
+  }
+
+  if (has_param("--bench-depth-as-build")) {
+    bench_depth_as_build(render_graph, transfer_pool);
+    as_memory::close();
+    gpu_transfer::close();
+    return 0;
+  }
+
+  scene::SceneLoadOptions scene_options {};
+  scene_options.for_ray_tracing = USE_RAY_QUERY;
+  //16 byte vertices, halves vertex fetch bandwidth of the gbuffer passes
+  scene_options.vertex_layout = has_param("--packed-vertices")? scene::VertexLayout::Packed : scene::VertexLayout::Full;
+  scene_options.optimize_meshes = has_param("--optimize-meshes");
+  scene_options.compress_textures = !has_param("--uncompressed-textures");
+  //start with mip tails only and stream the rest in under a memory budget
+  scene_options.stream_textures = has_param("--stream-textures");
+
+  auto scene = scene::load_scene_cached(transfer_pool,  "assets/gltf/Sponza/glTF/Sponza.gltf", scene_options);
+  //auto scene = scene::load_tinygltf_scene(transfer_pool,  "/home/void/workspace/tools/glTF-Sample-Models/room/room_gltf/roomgltf.gltf", scene_options);
+  //auto scene = scene::load_tinygltf_scene(transfer_pool,  "assets/gltf/st_dragon/stanford-dragon.gltf", scene_options);
+  //auto scene = scene::load_tinygltf_scene(transfer_pool,  "assets/gltf/sibernik_gltf/untitled.gltf", scene_options);
 
   bool use_rt_contact_shadows = false;
   bool use_rt_reflections = false;
@@ -269,7 +337,12 @@ int main(int argc, char **argv) {
 #if USE_RAY_QUERY
   bool use_rt_ao = false;
   scene::SceneAccelerationStructure acceleration_struct;
-  acceleration_struct.build(transfer_pool, scene);
+  acceleration_struct.build(transfer_pool, scene, has_param("--compact-blas"));
+  //follows node transforms edited at runtime
+  std::optional<SceneTLAS> scene_tlas;
+  if (has_param("--dynamic-scene-tlas")) {
+    scene_tlas.emplace(render_graph, scene, acceleration_struct);
+  }
 #endif
 
   SamplesMarker::init(render_graph, WIDTH, HEIGHT);
@@ -285,18 +358,45 @@ int main(int argc, char **argv) {
 
   SceneRenderer scene_renderer {scene};
   scene_renderer.init_pipeline(render_graph, gbuffer);
+  std::optional<TextureStreamer> texture_streamer;
+  if (scene_options.stream_textures) {
+    texture_streamer.emplace(render_graph, scene);
+  }
   DeferedShadingPass shading_pass {render_graph, app_init.window};
   DiffuseSpecularPass diffuse_specular_pass {render_graph, WIDTH, HEIGHT};
   IndirectLight indirect_light {render_graph, WIDTH, HEIGHT};
   LightResolvePass light_resolve_pass {render_graph};
 
-  TriangleASBuilder triangle_as_builder {render_graph, transfer_pool};
+  //AS over the visible triangles with the temporal cache, joins the unified TLAS
+  std::optional<TriangleASBuilder> triangle_as_builder;
+  if (has_param("--triangle-as")) {
+    triangle_as_builder.emplace(render_graph, transfer_pool);
+  }
   
   DepthAs depth_as;
   DepthAsBuilder depth_as_builder;
 
-  depth_as.create(transfer_pool, WIDTH/2, HEIGHT/2);
-  depth_as_builder.init(WIDTH/2, HEIGHT/2);
+  const bool depth_as_tiles = has_param("--depth-as-tiles");
+  depth_as.create(transfer_pool, WIDTH/2, HEIGHT/2, depth_as_tiles? 64u : 0u);
+  //far plane pixels are skipped by rebuilds, refits keep the slots of the last rebuild
+  depth_as_builder.init(depth_as, !has_param("--no-depth-as-compaction"));
+
+#if USE_RAY_QUERY
+  //scene instances in view space and DepthAs tiles in one TLAS, rays select the structure with the cull mask
+  const bool use_unified_tlas = has_param("--unified-tlas");
+  TLASBuilder unified_tlas;
+  if (use_unified_tlas) {
+    unified_tlas.create(render_graph, acceleration_struct.instances.size() + depth_as.get_tiles_count() + (triangle_as_builder? 1 : 0));
+  }
+#endif
+
+  enum {
+    TIMER_DEPTH_AS_BUILD,
+    TIMER_REFLECTIONS,
+    TIMER_RANGES
+  };
+  FrameTimer frame_timer;
+  frame_timer.create(render_graph, TIMER_RANGES);
 
   LightsManager light_manager {render_graph};
   set_lights(light_manager);
@@ -319,6 +419,8 @@ int main(int argc, char **argv) {
   draw_params.camera = camera.get_view_mat();
   draw_params.fovy_aspect_znear_zfar = glm::vec4{glm::radians(60.f), float(WIDTH)/HEIGHT, 0.05f, 80.f};
   
+  as_memory::print_report();
+
   bool quit = false;
   auto ticks = SDL_GetTicks();
   
@@ -361,22 +463,64 @@ int main(int argc, char **argv) {
     
     draw_params.jitter = use_jitter? next_taa_offset(gbuffer.w, gbuffer.h) : glm::vec4{0.f, 0.f, 0.f, 0.f};
 
+    as_memory::begin_frame();
     scene_renderer.update_scene();
     light_manager.update();
     //shading_pass.update_params(camera.get_view_mat(), shadow_mvp, glm::radians(60.f), float(WIDTH)/HEIGHT, 0.05f, 80.f);
     
+#if USE_RAY_QUERY
+    if (scene_tlas) {
+      scene_tlas->update();
+    }
+#endif
+    frame_timer.begin_frame(render_graph);
     gpu_transfer::process_requests(render_graph);
+#if USE_RAY_QUERY
+    if (scene_tlas) {
+      scene_tlas->build(render_graph);
+    }
+#endif
+    if (texture_streamer) {
+      texture_streamer->update(render_graph, readback_system);
+    }
 
     SamplesMarker::clear(render_graph);
 
     scene_renderer.rasterize_triange_id(render_graph, gbuffer, draw_params);
     scene_renderer.reconstruct_gbuffer(render_graph, gbuffer, draw_params);
+    if (texture_streamer) {
+      texture_streamer->read_feedback(render_graph, readback_system, scene_renderer.get_texture_feedback());
+    }
 
-    //triangle_as_builder.run(render_graph, scene_renderer, gbuffer.triangle_id, draw_params.camera, projection);
+    if (triangle_as_builder) {
+      triangle_as_builder->run(render_graph, scene_renderer, gbuffer.triangle_id, draw_params.camera, projection);
+      triangle_as_builder->process_readback(render_graph, readback_system);
+    }
 
     downsample_pass.run(render_graph, gbuffer.normal, gbuffer.velocity_vectors, gbuffer.depth, gbuffer.downsampled_normals, gbuffer.downsampled_velocity_vectors);
 
+    if (depth_as_tiles) {
+      depth_as_builder.track_changes(render_graph, readback_system, gbuffer.depth, gbuffer.prev_depth, 1, draw_params);
+    }
+    depth_as_builder.get_policy().report_build_ms(frame_timer.get_ms(TIMER_DEPTH_AS_BUILD));
+    depth_as_builder.get_policy().report_trace_ms(use_rt_reflections? frame_timer.get_ms(TIMER_REFLECTIONS) : -1.f);
+    frame_timer.begin(render_graph, TIMER_DEPTH_AS_BUILD);
     depth_as_builder.run(render_graph, depth_as, gbuffer.depth, 1, draw_params);
+    VkAccelerationStructureKHR depth_tlas = depth_as.get_tlas();
+#if USE_RAY_QUERY
+    if (use_unified_tlas) {
+      unified_tlas.clear();
+      depth_as.append_instances(unified_tlas);
+      if (triangle_as_builder) {
+        triangle_as_builder->append_instances(unified_tlas);
+      }
+      const bool dynamic_scene = scene_tlas && scene_tlas->is_ready();
+      unified_tlas.add_instances(dynamic_scene? scene_tlas->get_instances() : acceleration_struct.instances, draw_params.camera, TLAS_MASK_SCENE);
+      unified_tlas.build(render_graph);
+      depth_tlas = unified_tlas.get_tlas();
+    }
+#endif
+    frame_timer.end(render_graph, TIMER_DEPTH_AS_BUILD);
     
     //render_graph.submit();
 
@@ -397,12 +541,26 @@ int main(int argc, char **argv) {
     ImGui::Checkbox("Enable RT Reflection", &use_rt_reflections);
 #endif
     ImGui::Checkbox("Enable screen space effects", &enable_screen_space_effects);
+    ImGui::Text("DepthAs tiles built %u/%u", depth_as_builder.get_built_tiles(), depth_as.get_tiles_count());
+    if (triangle_as_builder) {
+      const auto &cache_stats = triangle_as_builder->get_cache_stats();
+      ImGui::Text("TriangleAS %u visible, cache %u live %u inserted %u evicted", triangle_as_builder->get_stats().visible_triangles,
+        cache_stats.live_triangles, cache_stats.inserted_triangles, cache_stats.evicted_triangles);
+    }
     ImGui::End();
 
     light_manager.update_imgui();
     ssr.render_ui();
+    depth_as_builder.get_policy().draw_ui("DepthAs update policy");
+    if (triangle_as_builder) {
+      triangle_as_builder->get_policy().draw_ui("TriangleAS update policy");
+    }
+    as_memory::draw_ui();
     gtao.draw_ui();
     light_resolve_pass.ui();
+    if (texture_streamer) {
+      texture_streamer->draw_ui();
+    }
     //shading_pass.draw_ui();
 
     auto normal_mat = glm::transpose(glm::inverse(camera.get_view_mat()));
@@ -414,7 +572,7 @@ int main(int argc, char **argv) {
 
 #if USE_RAY_QUERY
     if (use_rt_ao) {
-      gtao.add_depth_rt_pass(render_graph, draw_params, gbuffer.downsampled_normals, gbuffer.depth, depth_as.get_tlas());
+      gtao.add_depth_rt_pass(render_graph, draw_params, gbuffer.downsampled_normals, gbuffer.depth, depth_tlas);
       //gtao.add_main_rt_pass(render_graph, gtao_rt_params, acceleration_struct.tlas, gbuffer.depth, gbuffer.normal);
     } else 
 #endif
@@ -425,14 +583,17 @@ int main(int argc, char **argv) {
     gtao.add_filter_pass(render_graph, gtao_params, gbuffer.depth);
     gtao.add_accumulate_pass(render_graph, draw_params, gbuffer);
 
-    //contact_shadows.run(render_graph, draw_params, light_manager, gbuffer.depth, use_rt_contact_shadows? triangle_as_builder.get_tlas() : nullptr);
-    contact_shadows.run(render_graph, draw_params, light_manager, gbuffer.depth, use_rt_contact_shadows? depth_as.get_tlas() : nullptr, true);
+    //contact_shadows.run(render_graph, draw_params, light_manager, gbuffer.depth, use_rt_contact_shadows? triangle_as_builder->get_tlas() : nullptr);
+    contact_shadows.run(render_graph, draw_params, light_manager, gbuffer.depth, use_rt_contact_shadows? depth_tlas : nullptr, true);
 
     diffuse_specular_pass.run(render_graph, gbuffer, contact_shadows.get_output(), gtao.accumulated_ao, draw_params, light_manager, enable_screen_space_effects);
 
-    //ssr.run(render_graph, assr_params, draw_params, gbuffer, gtao.raw, use_rt_reflections? triangle_as_builder.get_tlas() : nullptr, false);
-    //ssr.run(render_graph, assr_params, draw_params, gbuffer, diffuse_specular_pass.get_diffuse(), gtao.raw, use_rt_reflections? triangle_as_builder.get_tlas() : nullptr, false);
-    ssr.run(render_graph, assr_params, draw_params, gbuffer, diffuse_specular_pass.get_diffuse(), gtao.raw, use_rt_reflections? depth_as.get_tlas() : nullptr, true);
+    //ssr.run(render_graph, assr_params, draw_params, gbuffer, gtao.raw, use_rt_reflections? triangle_as_builder->get_tlas() : nullptr, false);
+    //ssr.run(render_graph, assr_params, draw_params, gbuffer, diffuse_specular_pass.get_diffuse(), gtao.raw, use_rt_reflections? triangle_as_builder->get_tlas() : nullptr, false);
+    //trace, filter and blur, only the trace depends on the AS
+    frame_timer.begin(render_graph, TIMER_REFLECTIONS);
+    ssr.run(render_graph, assr_params, draw_params, gbuffer, diffuse_specular_pass.get_diffuse(), gtao.raw, use_rt_reflections? depth_tlas : nullptr, true, depth_as.get_pixel_ids());
+    frame_timer.end(render_graph, TIMER_REFLECTIONS);
     //indirect_light.run(render_graph, gbuffer, diffuse_specular_pass.get_diffuse(), draw_params);
 
     //shading_pass.draw(render_graph, gbuffer, contact_shadows.get_output(), gtao.accumulated_ao, ssr.get_preintegrated_brdf(), ssr.get_blurred(), light_manager, color_out_tex);
@@ -481,6 +642,7 @@ int main(int argc, char **argv) {
   }
   
   vkDeviceWaitIdle(gpu::app_device().api_device());
+  as_memory::close();
   gpu_transfer::close();
   imgui_close();
   return 0;
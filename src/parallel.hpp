@@ -0,0 +1,71 @@
+#ifndef PARALLEL_HPP_INCLUDED
+#define PARALLEL_HPP_INCLUDED
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+inline uint32_t get_worker_count(uint32_t jobs_count, uint32_t max_threads = 0) {
+  uint32_t threads = std::max(std::thread::hardware_concurrency(), 1u);
+  if (max_threads) {
+    threads = std::min(threads, max_threads);
+  }
+  return std::max(std::min(threads, jobs_count), 1u);
+}
+
+//calls cb(index) for every index in [0, count) from a pool of worker threads, the first exception is rethrown in the caller
+inline void parallel_for(uint32_t count, const std::function<void(uint32_t)> &cb, uint32_t max_threads = 0) {
+  const uint32_t workers_count = get_worker_count(count, max_threads);
+  
+  if (workers_count <= 1) {
+    for (uint32_t i = 0; i < count; i++) {
+      cb(i);
+    }
+    return;
+  }
+
+  std::atomic<uint32_t> next_index {0};
+  std::exception_ptr error;
+  std::mutex error_lock;
+
+  auto worker = [&]() {
+    while (true) {
+      uint32_t index = next_index.fetch_add(1u);
+      if (index >= count) {
+        break;
+      }
+
+      try {
+        cb(index);
+      } catch (...) {
+        std::lock_guard lock {error_lock};
+        if (!error) {
+          error = std::current_exception();
+        }
+        next_index.store(count);
+      }
+    }
+  };
+
+  std::vector<std::thread> workers;
+  workers.reserve(workers_count - 1);
+  for (uint32_t i = 0; i + 1 < workers_count; i++) {
+    workers.emplace_back(worker);
+  }
+  
+  worker();
+
+  for (auto &t : workers) {
+    t.join();
+  }
+
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+
+#endif
@@ -1,13 +1,15 @@
 #include "rtfx.hpp"
 
-RTReflections::RTReflections(rendergraph::RenderGraph &graph, uint32_t width, uint32_t height, bool triangles) {
+RTReflections::RTReflections(rendergraph::RenderGraph &graph, uint32_t width, uint32_t height, bool triangles)
+  : use_triangles {triangles}
+{
   gpu::ImageInfo rays_info {VK_FORMAT_R16G16B16A16_SFLOAT, VK_IMAGE_ASPECT_COLOR_BIT, width, height};
   result = graph.create_image(VK_IMAGE_TYPE_2D, rays_info, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_SAMPLED_BIT|VK_IMAGE_USAGE_STORAGE_BIT);
   pipeline = gpu::create_compute_pipeline(triangles? "trace_triangle_as" : "trace_depth_as");
   sampler = gpu::create_sampler(gpu::DEFAULT_SAMPLER);
 }
   
-void RTReflections::run(rendergraph::RenderGraph &graph, const Gbuffer &gbuff, VkAccelerationStructureKHR depth_as, const AdvancedSSRParams &params) {
+void RTReflections::run(rendergraph::RenderGraph &graph, const Gbuffer &gbuff, VkAccelerationStructureKHR depth_as, const gpu::BufferPtr &pixel_ids, const AdvancedSSRParams &params) {
 
   struct ShaderParams {
     glm::mat4 normal_mat;
@@ -56,6 +58,9 @@ void RTReflections::run(rendergraph::RenderGraph &graph, const Gbuffer &gbuff, V
         gpu::UBOBinding {3, cmd.get_ubo_pool(), blk},
         gpu::AccelerationStructBinding {4, input.acstruct},
         gpu::StorageTextureBinding {5, resources.get_view(input.out)});
+      if (!use_triangles) {
+        gpu::write_set(set, gpu::SSBOBinding {6, pixel_ids});
+      }
       
       auto ext = resources.get_image(input.out)->get_extent();
       cmd.bind_pipeline(pipeline);
@@ -7,7 +7,8 @@
 struct RTReflections {
   RTReflections(rendergraph::RenderGraph &graph, uint32_t width, uint32_t height, bool triangles);
   
-  void run(rendergraph::RenderGraph &graph, const Gbuffer &gbuffer, VkAccelerationStructureKHR depth_as, const AdvancedSSRParams &params);
+  //pixel_ids is DepthAs::get_pixel_ids(), unused for triangles
+  void run(rendergraph::RenderGraph &graph, const Gbuffer &gbuffer, VkAccelerationStructureKHR depth_as, const gpu::BufferPtr &pixel_ids, const AdvancedSSRParams &params);
 
   rendergraph::ImageResourceId get_target() const {
     return result;
@@ -17,6 +18,7 @@ private:
   gpu::ComputePipeline pipeline;
   rendergraph::ImageResourceId result;
   VkSampler sampler {nullptr}; 
+  bool use_triangles = false;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,444 @@
+#include "cpu_bvh.hpp"
+#include "parallel.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+namespace scene {
+
+  struct FlatInstance {
+    glm::mat4 transform;
+    uint32_t mesh;
+  };
+
+  static glm::vec3 get_position(const CompiledScene &scene, const Primitive &prim, const uint8_t *vertices, uint32_t index) {
+    const uint32_t vertex = prim.vertex_offset + index;
+    if (scene.vertex_layout == VertexLayout::Full) {
+      Vertex v;
+      std::memcpy(&v, vertices + sizeof(Vertex) * vertex, sizeof(Vertex));
+      return v.pos;
+    }
+
+    PackedVertex v;
+    std::memcpy(&v, vertices + sizeof(PackedVertex) * vertex, sizeof(PackedVertex));
+    glm::vec3 pos {v.pos[0], v.pos[1], v.pos[2]};
+    return prim.bounds_center + prim.bounds_extent * glm::max(pos/32767.f, glm::vec3{-1.f});
+  }
+
+  static uint32_t get_index(const Primitive &prim, const uint8_t *indexes, uint32_t i) {
+    const uint8_t *ptr = indexes + uint64_t(prim.index_offset + i) * prim.index_size;
+    if (prim.index_size == sizeof(uint16_t)) {
+      uint16_t index;
+      std::memcpy(&index, ptr, sizeof(index));
+      return index;
+    }
+    uint32_t index;
+    std::memcpy(&index, ptr, sizeof(index));
+    return index;
+  }
+
+  CpuTriangleSoup read_scene_triangles(gpu::TransferCmdPool &transfer_pool, const CompiledScene &scene) {
+    const uint64_t verts_size = scene.vertex_buffer->get_size();
+    const uint64_t index_size = scene.index_buffer->get_size();
+    auto verts_staging = gpu::create_buffer(VMA_MEMORY_USAGE_GPU_TO_CPU, verts_size, VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+    auto index_staging = gpu::create_buffer(VMA_MEMORY_USAGE_GPU_TO_CPU, index_size, VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+
+    VkBufferCopy verts_region {0, 0, verts_size};
+    VkBufferCopy index_region {0, 0, index_size};
+
+    auto cmd = transfer_pool.get_cmd_buffer();
+    VkCommandBufferBeginInfo begin_info {VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO};
+    vkBeginCommandBuffer(cmd, &begin_info);
+    vkCmdCopyBuffer(cmd, scene.vertex_buffer->api_buffer(), verts_staging->api_buffer(), 1, &verts_region);
+    vkCmdCopyBuffer(cmd, scene.index_buffer->api_buffer(), index_staging->api_buffer(), 1, &index_region);
+    vkEndCommandBuffer(cmd);
+    transfer_pool.submit_and_wait();
+
+    verts_staging->invalidate_mapped_memory();
+    index_staging->invalidate_mapped_memory();
+    auto vertices = static_cast<const uint8_t*>(verts_staging->get_mapped_ptr());
+    auto indexes = static_cast<const uint8_t*>(index_staging->get_mapped_ptr());
+
+    std::vector<FlatInstance> instances;
+    for (const auto &flat : flattern_nodes(scene.base_nodes)) {
+      if (flat.node->mesh_index >= 0) {
+        instances.push_back(FlatInstance {flat.world_transform, uint32_t(flat.node->mesh_index)});
+      }
+    }
+
+    CpuTriangleSoup soup;
+    for (uint32_t instance_index = 0; instance_index < instances.size(); instance_index++) {
+      const auto &instance = instances[instance_index];
+      for (auto prim_index : scene.root_meshes.at(instance.mesh).primitive_indexes) {
+        const auto &prim = scene.primitives.at(prim_index);
+        for (uint32_t tri = 0; tri < prim.index_count/3; tri++) {
+          for (uint32_t i = 0; i < 3; i++) {
+            auto pos = get_position(scene, prim, vertices, get_index(prim, indexes, 3 * tri + i));
+            soup.positions.push_back(glm::vec3{instance.transform * glm::vec4{pos, 1.f}});
+          }
+          soup.sources.push_back(CpuTriangleSoup::Source {prim_index, tri, instance_index});
+        }
+      }
+    }
+    return soup;
+  }
+
+  struct BuildBounds {
+    glm::vec3 bmin {std::numeric_limits<float>::max()};
+    glm::vec3 bmax {-std::numeric_limits<float>::max()};
+
+    void add(const glm::vec3 &p) { bmin = glm::min(bmin, p); bmax = glm::max(bmax, p); }
+    void add(const BuildBounds &b) { bmin = glm::min(bmin, b.bmin); bmax = glm::max(bmax, b.bmax); }
+
+    //half of the surface area
+    float area() const {
+      glm::vec3 d = glm::max(bmax - bmin, glm::vec3{0.f});
+      return d.x * d.y + d.y * d.z + d.z * d.x;
+    }
+  };
+
+  struct BuildTask {
+    uint32_t node;
+    uint32_t begin;
+    uint32_t end;
+    uint32_t level;
+  };
+
+  struct BuildSplit {
+    BuildBounds bounds;
+    uint32_t mid; //equal to begin for leaves
+  };
+
+  //computes node bounds and partitions ids of the task by the best binned SAH split
+  static BuildSplit split_task(const BuildTask &task, const std::vector<BuildBounds> &tri_bounds, const std::vector<glm::vec3> &centroids, uint32_t *ids) {
+    constexpr uint32_t BINS = CpuBVH::SAH_BINS;
+
+    BuildSplit split {};
+    BuildBounds centroid_bounds;
+    for (uint32_t i = task.begin; i < task.end; i++) {
+      split.bounds.add(tri_bounds[ids[i]]);
+      centroid_bounds.add(centroids[ids[i]]);
+    }
+
+    split.mid = task.begin;
+    const uint32_t count = task.end - task.begin;
+    if (count <= CpuBVH::MAX_LEAF_SIZE || task.level >= CpuBVH::MAX_DEPTH) {
+      return split;
+    }
+
+    float best_cost = std::numeric_limits<float>::max();
+    uint32_t best_axis = 0;
+    uint32_t best_bin = 0;
+
+    const glm::vec3 extent = centroid_bounds.bmax - centroid_bounds.bmin;
+    for (uint32_t axis = 0; axis < 3; axis++) {
+      if (extent[axis] <= 0.f) {
+        continue;
+      }
+
+      const float scale = BINS/extent[axis];
+      BuildBounds bins[BINS];
+      uint32_t counts[BINS] {};
+
+      for (uint32_t i = task.begin; i < task.end; i++) {
+        uint32_t bin = std::min(uint32_t((centroids[ids[i]][axis] - centroid_bounds.bmin[axis]) * scale), BINS - 1);
+        bins[bin].add(tri_bounds[ids[i]]);
+        counts[bin]++;
+      }
+
+      //sweep from the right, then evaluate splits from the left
+      float right_areas[BINS];
+      uint32_t right_counts[BINS];
+      BuildBounds right;
+      uint32_t right_count = 0;
+      for (uint32_t bin = BINS - 1; bin > 0; bin--) {
+        right.add(bins[bin]);
+        right_count += counts[bin];
+        right_areas[bin] = right.area();
+        right_counts[bin] = right_count;
+      }
+
+      BuildBounds left;
+      uint32_t left_count = 0;
+      for (uint32_t bin = 0; bin + 1 < BINS; bin++) {
+        left.add(bins[bin]);
+        left_count += counts[bin];
+        if (!left_count || !right_counts[bin + 1]) {
+          continue;
+        }
+
+        float cost = left.area() * left_count + right_areas[bin + 1] * right_counts[bin + 1];
+        if (cost < best_cost) {
+          best_cost = cost;
+          best_axis = axis;
+          best_bin = bin;
+        }
+      }
+    }
+
+    uint32_t *mid = ids + task.begin + count/2;
+    if (best_cost < std::numeric_limits<float>::max()) {
+      const float scale = BINS/extent[best_axis];
+      mid = std::partition(ids + task.begin, ids + task.end, [&](uint32_t id) {
+        uint32_t bin = std::min(uint32_t((centroids[id][best_axis] - centroid_bounds.bmin[best_axis]) * scale), BINS - 1);
+        return bin <= best_bin;
+      });
+    }
+
+    split.mid = mid - ids;
+    //all centroids in one point, split in the middle
+    if (split.mid == task.begin || split.mid == task.end) {
+      split.mid = task.begin + count/2;
+    }
+    return split;
+  }
+
+  static void build_nodes(const std::vector<BuildBounds> &prim_bounds, const std::vector<glm::vec3> &centroids, std::vector<CpuBVH::Node> &nodes, std::vector<uint32_t> &ids, uint32_t &depth) {
+    const uint32_t count = prim_bounds.size();
+    ids.resize(count);
+    for (uint32_t i = 0; i < count; i++) {
+      ids[i] = i;
+    }
+
+    nodes.clear();
+    nodes.reserve(2 * std::max(count, 1u));
+    nodes.push_back(CpuBVH::Node {});
+    depth = 0;
+
+    //nodes of one level are split in parallel, their primitive ranges do not overlap
+    std::vector<BuildTask> tasks {BuildTask {0, 0, count, 1}};
+    std::vector<BuildTask> next_tasks;
+    std::vector<BuildSplit> splits;
+
+    while (!tasks.empty()) {
+      splits.resize(tasks.size());
+      parallel_for(tasks.size(), [&](uint32_t i) {
+        splits[i] = split_task(tasks[i], prim_bounds, centroids, ids.data());
+      });
+
+      next_tasks.clear();
+      for (uint32_t i = 0; i < tasks.size(); i++) {
+        const auto &task = tasks[i];
+        const auto &split = splits[i];
+        auto &node = nodes[task.node];
+        node.bmin = split.bounds.bmin;
+        node.bmax = split.bounds.bmax;
+        depth = std::max(depth, task.level);
+
+        if (split.mid == task.begin) {
+          node.offset = task.begin;
+          node.count = task.end - task.begin;
+          continue;
+        }
+
+        node.offset = nodes.size();
+        node.count = 0;
+        next_tasks.push_back(BuildTask {(uint32_t)nodes.size(), task.begin, split.mid, task.level + 1});
+        next_tasks.push_back(BuildTask {(uint32_t)nodes.size() + 1, split.mid, task.end, task.level + 1});
+        nodes.push_back(CpuBVH::Node {});
+        nodes.push_back(CpuBVH::Node {});
+      }
+      std::swap(tasks, next_tasks);
+    }
+  }
+
+  constexpr uint32_t BOUNDS_PER_JOB = 4096;
+
+  void CpuBVH::build(const CpuTriangleSoup &soup) {
+    const uint32_t count = soup.sources.size();
+
+    std::vector<BuildBounds> tri_bounds(count);
+    std::vector<glm::vec3> centroids(count);
+
+    parallel_for((count + BOUNDS_PER_JOB - 1)/BOUNDS_PER_JOB, [&](uint32_t job) {
+      for (uint32_t i = job * BOUNDS_PER_JOB; i < std::min(count, (job + 1) * BOUNDS_PER_JOB); i++) {
+        BuildBounds b;
+        for (uint32_t v = 0; v < 3; v++) {
+          b.add(soup.positions[3 * i + v]);
+        }
+        tri_bounds[i] = b;
+        centroids[i] = 0.5f * (b.bmin + b.bmax);
+      }
+    });
+
+    build_nodes(tri_bounds, centroids, nodes, primitive_ids, depth);
+
+    boxes.clear();
+    triangles.resize(count);
+    for (uint32_t i = 0; i < count; i++) {
+      const glm::vec3 *v = soup.positions.data() + 3 * primitive_ids[i];
+      triangles[i] = Triangle {v[0], v[1] - v[0], v[2] - v[0]};
+    }
+  }
+
+  void CpuBVH::build(const std::vector<VkAabbPositionsKHR> &aabbs) {
+    const uint32_t count = aabbs.size();
+
+    std::vector<BuildBounds> box_bounds(count);
+    std::vector<glm::vec3> centroids(count);
+
+    parallel_for((count + BOUNDS_PER_JOB - 1)/BOUNDS_PER_JOB, [&](uint32_t job) {
+      for (uint32_t i = job * BOUNDS_PER_JOB; i < std::min(count, (job + 1) * BOUNDS_PER_JOB); i++) {
+        const auto &src = aabbs[i];
+        BuildBounds b;
+        b.add(glm::vec3{src.minX, src.minY, src.minZ});
+        b.add(glm::vec3{src.maxX, src.maxY, src.maxZ});
+        box_bounds[i] = b;
+        centroids[i] = 0.5f * (b.bmin + b.bmax);
+      }
+    });
+
+    build_nodes(box_bounds, centroids, nodes, primitive_ids, depth);
+
+    triangles.clear();
+    boxes.resize(count);
+    for (uint32_t i = 0; i < count; i++) {
+      boxes[i] = Box {box_bounds[primitive_ids[i]].bmin, box_bounds[primitive_ids[i]].bmax};
+    }
+  }
+
+  //lanes are processed with plain loops over CPU_RAY_PACKET_SIZE so the compiler can vectorize them
+  template <bool any_hit>
+  void CpuBVH::trace_packet(const CpuRay *rays, uint32_t count, CpuHit *hits) const {
+    constexpr uint32_t P = CPU_RAY_PACKET_SIZE;
+    constexpr uint32_t MAX_STACK = MAX_DEPTH;
+
+    alignas(32) float ox[P], oy[P], oz[P];
+    alignas(32) float dx[P], dy[P], dz[P];
+    alignas(32) float ix[P], iy[P], iz[P];
+    alignas(32) float tmin[P], tmax[P];
+    alignas(32) float hit_u[P], hit_v[P];
+    uint32_t hit_tri[P];
+
+    for (uint32_t l = 0; l < P; l++) {
+      const CpuRay &ray = rays[std::min(l, count - 1)];
+      ox[l] = ray.origin.x; oy[l] = ray.origin.y; oz[l] = ray.origin.z;
+      dx[l] = ray.dir.x; dy[l] = ray.dir.y; dz[l] = ray.dir.z;
+      ix[l] = 1.f/(std::abs(dx[l]) > 1e-20f? dx[l] : std::copysign(1e-20f, dx[l]));
+      iy[l] = 1.f/(std::abs(dy[l]) > 1e-20f? dy[l] : std::copysign(1e-20f, dy[l]));
+      iz[l] = 1.f/(std::abs(dz[l]) > 1e-20f? dz[l] : std::copysign(1e-20f, dz[l]));
+      tmin[l] = ray.tmin;
+      tmax[l] = (l < count)? ray.tmax : -1.f; //padding lanes never hit
+      hit_u[l] = hit_v[l] = 0.f;
+      hit_tri[l] = CPU_INVALID_TRIANGLE;
+    }
+
+    uint32_t stack[MAX_STACK];
+    uint32_t stack_size = 0;
+    if (!nodes.empty() && !triangles.empty()) {
+      stack[stack_size++] = 0;
+    }
+
+    while (stack_size) {
+      const Node &node = nodes[stack[--stack_size]];
+
+      uint32_t active = 0;
+      for (uint32_t l = 0; l < P; l++) {
+        float t0x = (node.bmin.x - ox[l]) * ix[l], t1x = (node.bmax.x - ox[l]) * ix[l];
+        float t0y = (node.bmin.y - oy[l]) * iy[l], t1y = (node.bmax.y - oy[l]) * iy[l];
+        float t0z = (node.bmin.z - oz[l]) * iz[l], t1z = (node.bmax.z - oz[l]) * iz[l];
+        float tn = std::max(std::max(std::min(t0x, t1x), std::min(t0y, t1y)), std::max(std::min(t0z, t1z), tmin[l]));
+        float tf = std::min(std::min(std::max(t0x, t1x), std::max(t0y, t1y)), std::min(std::max(t0z, t1z), tmax[l]));
+        active |= (tn <= tf)? 1u : 0u;
+      }
+
+      if (!active) {
+        continue;
+      }
+
+      if (node.count) {
+        for (uint32_t i = node.offset; i < node.offset + node.count; i++) {
+          const Triangle &tri = triangles[i];
+          for (uint32_t l = 0; l < P; l++) {
+            //Moller-Trumbore, both faces
+            float px = dy[l] * tri.e2.z - dz[l] * tri.e2.y;
+            float py = dz[l] * tri.e2.x - dx[l] * tri.e2.z;
+            float pz = dx[l] * tri.e2.y - dy[l] * tri.e2.x;
+            float det = tri.e1.x * px + tri.e1.y * py + tri.e1.z * pz;
+            float inv_det = 1.f/det;
+
+            float sx = ox[l] - tri.v0.x, sy = oy[l] - tri.v0.y, sz = oz[l] - tri.v0.z;
+            float u = (sx * px + sy * py + sz * pz) * inv_det;
+
+            float qx = sy * tri.e1.z - sz * tri.e1.y;
+            float qy = sz * tri.e1.x - sx * tri.e1.z;
+            float qz = sx * tri.e1.y - sy * tri.e1.x;
+            float v = (dx[l] * qx + dy[l] * qy + dz[l] * qz) * inv_det;
+            float t = (tri.e2.x * qx + tri.e2.y * qy + tri.e2.z * qz) * inv_det;
+
+            bool hit = det != 0.f && u >= 0.f && v >= 0.f && u + v <= 1.f && t >= tmin[l] && t <= tmax[l];
+            hit_tri[l] = hit? i : hit_tri[l];
+            hit_u[l] = hit? u : hit_u[l];
+            hit_v[l] = hit? v : hit_v[l];
+            //any hit rays stop at the first hit
+            tmax[l] = hit? (any_hit? -1.f : t) : tmax[l];
+          }
+        }
+
+        if (any_hit) {
+          bool done = true;
+          for (uint32_t l = 0; l < P; l++) {
+            done &= tmax[l] < tmin[l];
+          }
+          if (done) {
+            break;
+          }
+        }
+        continue;
+      }
+
+      //near child is visited first, ordered by the direction of the first ray
+      const Node &left = nodes[node.offset];
+      const Node &right = nodes[node.offset + 1];
+      glm::vec3 delta = (left.bmin + left.bmax) - (right.bmin + right.bmax);
+      bool left_first = delta.x * dx[0] + delta.y * dy[0] + delta.z * dz[0] < 0.f;
+      stack[stack_size++] = left_first? node.offset + 1 : node.offset;
+      stack[stack_size++] = left_first? node.offset : node.offset + 1;
+    }
+
+    for (uint32_t l = 0; l < count; l++) {
+      hits[l].triangle = (hit_tri[l] != CPU_INVALID_TRIANGLE)? primitive_ids[hit_tri[l]] : CPU_INVALID_TRIANGLE;
+      hits[l].t = any_hit? 0.f : tmax[l];
+      hits[l].bary = glm::vec2{hit_u[l], hit_v[l]};
+    }
+  }
+
+  void CpuBVH::closest_hit(const CpuRay *rays, CpuHit *hits, uint32_t count) const {
+    for (uint32_t i = 0; i < count; i += CPU_RAY_PACKET_SIZE) {
+      trace_packet<false>(rays + i, std::min(count - i, CPU_RAY_PACKET_SIZE), hits + i);
+    }
+  }
+
+  void CpuBVH::any_hit(const CpuRay *rays, uint8_t *occluded, uint32_t count) const {
+    CpuHit hits[CPU_RAY_PACKET_SIZE];
+    for (uint32_t i = 0; i < count; i += CPU_RAY_PACKET_SIZE) {
+      const uint32_t packet_size = std::min(count - i, CPU_RAY_PACKET_SIZE);
+      trace_packet<true>(rays + i, packet_size, hits);
+      for (uint32_t l = 0; l < packet_size; l++) {
+        occluded[i + l] = (hits[l].triangle != CPU_INVALID_TRIANGLE)? 1 : 0;
+      }
+    }
+  }
+
+  constexpr uint32_t RAYS_PER_JOB = 64 * CPU_RAY_PACKET_SIZE;
+
+  void CpuBVH::closest_hit_parallel(const std::vector<CpuRay> &rays, std::vector<CpuHit> &hits) const {
+    const uint32_t count = rays.size();
+    hits.resize(count);
+    parallel_for((count + RAYS_PER_JOB - 1)/RAYS_PER_JOB, [&](uint32_t job) {
+      const uint32_t start = job * RAYS_PER_JOB;
+      closest_hit(rays.data() + start, hits.data() + start, std::min(count - start, RAYS_PER_JOB));
+    });
+  }
+
+  void CpuBVH::any_hit_parallel(const std::vector<CpuRay> &rays, std::vector<uint8_t> &occluded) const {
+    const uint32_t count = rays.size();
+    occluded.resize(count);
+    parallel_for((count + RAYS_PER_JOB - 1)/RAYS_PER_JOB, [&](uint32_t job) {
+      const uint32_t start = job * RAYS_PER_JOB;
+      any_hit(rays.data() + start, occluded.data() + start, std::min(count - start, RAYS_PER_JOB));
+    });
+  }
+}
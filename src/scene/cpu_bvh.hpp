@@ -0,0 +1,150 @@
+#ifndef CPU_BVH_HPP_INCLUDED
+#define CPU_BVH_HPP_INCLUDED
+
+#include "scene.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+namespace scene {
+  constexpr uint32_t CPU_RAY_PACKET_SIZE = 8;
+  constexpr uint32_t CPU_INVALID_TRIANGLE = UINT32_MAX;
+
+  struct CpuRay {
+    glm::vec3 origin;
+    float tmin;
+    glm::vec3 dir;
+    float tmax;
+  };
+
+  struct CpuHit {
+    float t;
+    uint32_t triangle; //CPU_INVALID_TRIANGLE on miss, index into CpuTriangleSoup
+    glm::vec2 bary;    //weights of v1 and v2
+  };
+
+  //world space triangles, every triangle remembers where it came from
+  struct CpuTriangleSoup {
+    struct Source {
+      uint32_t primitive;
+      uint32_t triangle;  //relative to the primitive
+      uint32_t instance;  //index of the mesh node in flattened base_nodes
+    };
+    std::vector<glm::vec3> positions; //3 per triangle
+    std::vector<Source> sources;
+  };
+
+  //reads geometry back from the GPU, node transforms are flattened the same way as in SceneAccelerationStructure::build_tlas
+  CpuTriangleSoup read_scene_triangles(gpu::TransferCmdPool &transfer_pool, const CompiledScene &scene);
+
+  //binned SAH BVH, software fallback for ray queries and a reference for the hardware paths
+  struct CpuBVH {
+    static constexpr uint32_t SAH_BINS = 16;
+    static constexpr uint32_t MAX_LEAF_SIZE = 4;
+    //deeper nodes become leaves over MAX_LEAF_SIZE, traversal stacks never need more than MAX_DEPTH entries
+    static constexpr uint32_t MAX_DEPTH = 64;
+
+    struct Node {
+      glm::vec3 bmin;
+      uint32_t offset; //first primitive for leaves, left child for inner nodes. right child is offset + 1
+      glm::vec3 bmax;
+      uint32_t count;  //0 for inner nodes
+    };
+
+    void build(const CpuTriangleSoup &soup);
+    //procedural geometry, only traverse() can be used
+    void build(const std::vector<VkAabbPositionsKHR> &aabbs);
+
+    //rays are traced in packets of CPU_RAY_PACKET_SIZE, coherent streams are faster
+    void closest_hit(const CpuRay *rays, CpuHit *hits, uint32_t count) const;
+    //occluded[i] is 1 if anything is hit in [tmin, tmax]
+    void any_hit(const CpuRay *rays, uint8_t *occluded, uint32_t count) const;
+
+    //same as above, packets are distributed between worker threads
+    void closest_hit_parallel(const std::vector<CpuRay> &rays, std::vector<CpuHit> &hits) const;
+    void any_hit_parallel(const std::vector<CpuRay> &rays, std::vector<uint8_t> &occluded) const;
+
+    //like a ray query over AABBs, cb(aabb_index, t_enter) is called for every box hit by the ray in near first order. cb returns false to terminate
+    template <typename Callback>
+    void traverse(const CpuRay &ray, Callback &&cb) const;
+
+    const std::vector<Node> &get_nodes() const { return nodes; }
+    uint32_t get_primitives_count() const { return primitive_ids.size(); }
+    uint32_t get_depth() const { return depth; }
+
+  private:
+    //v0 and edges for the ray-triangle test, ordered like leaves
+    struct Triangle {
+      glm::vec3 v0;
+      glm::vec3 e1;
+      glm::vec3 e2;
+    };
+
+    struct Box {
+      glm::vec3 bmin;
+      glm::vec3 bmax;
+    };
+
+    std::vector<Node> nodes;
+    std::vector<Triangle> triangles;
+    std::vector<Box> boxes;
+    std::vector<uint32_t> primitive_ids; //index in the source soup or aabb array
+    uint32_t depth = 0;
+
+    static bool intersect_box(const glm::vec3 &bmin, const glm::vec3 &bmax, const glm::vec3 &origin, const glm::vec3 &inv_dir, float tmin, float tmax, float &t_enter) {
+      glm::vec3 t0 = (bmin - origin) * inv_dir;
+      glm::vec3 t1 = (bmax - origin) * inv_dir;
+      glm::vec3 tn = glm::min(t0, t1);
+      glm::vec3 tf = glm::max(t0, t1);
+      t_enter = std::max(std::max(tn.x, tn.y), std::max(tn.z, tmin));
+      return t_enter <= std::min(std::min(tf.x, tf.y), std::min(tf.z, tmax));
+    }
+
+    template <bool any_hit>
+    void trace_packet(const CpuRay *rays, uint32_t count, CpuHit *hits) const;
+  };
+
+  template <typename Callback>
+  void CpuBVH::traverse(const CpuRay &ray, Callback &&cb) const {
+    constexpr uint32_t MAX_STACK = MAX_DEPTH;
+    if (nodes.empty() || boxes.empty()) {
+      return;
+    }
+
+    glm::vec3 inv_dir;
+    for (uint32_t axis = 0; axis < 3; axis++) {
+      inv_dir[axis] = 1.f/(std::abs(ray.dir[axis]) > 1e-20f? ray.dir[axis] : std::copysign(1e-20f, ray.dir[axis]));
+    }
+
+    uint32_t stack[MAX_STACK];
+    uint32_t stack_size = 0;
+    stack[stack_size++] = 0;
+
+    while (stack_size) {
+      const Node &node = nodes[stack[--stack_size]];
+      float t_enter;
+      if (!intersect_box(node.bmin, node.bmax, ray.origin, inv_dir, ray.tmin, ray.tmax, t_enter)) {
+        continue;
+      }
+
+      if (node.count) {
+        for (uint32_t i = node.offset; i < node.offset + node.count; i++) {
+          if (intersect_box(boxes[i].bmin, boxes[i].bmax, ray.origin, inv_dir, ray.tmin, ray.tmax, t_enter) && !cb(primitive_ids[i], t_enter)) {
+            return;
+          }
+        }
+        continue;
+      }
+
+      const Node &left = nodes[node.offset];
+      const Node &right = nodes[node.offset + 1];
+      bool left_first = glm::dot((left.bmin + left.bmax) - (right.bmin + right.bmax), ray.dir) < 0.f;
+      stack[stack_size++] = left_first? node.offset + 1 : node.offset;
+      stack[stack_size++] = left_first? node.offset : node.offset + 1;
+    }
+  }
+}
+
+#endif
@@ -0,0 +1,63 @@
+#ifndef SCENE_GLB_HPP_INCLUDED
+#define SCENE_GLB_HPP_INCLUDED
+
+#include <cstdint>
+#include <cstring>
+
+namespace scene {
+
+  //chunks of a binary gltf container, pointers refer to the source memory
+  struct GlbChunks {
+    const uint8_t *json = nullptr;
+    uint64_t json_size = 0;
+    const uint8_t *bin = nullptr;
+    uint64_t bin_size = 0;
+  };
+
+  inline bool is_glb(const uint8_t *data, uint64_t size) {
+    return size >= 12 && std::memcmp(data, "glTF", 4) == 0;
+  }
+
+  inline bool parse_glb(const uint8_t *data, uint64_t size, GlbChunks &out) {
+    constexpr uint32_t CHUNK_JSON = 0x4E4F534A;
+    constexpr uint32_t CHUNK_BIN = 0x004E4942;
+
+    if (!is_glb(data, size)) {
+      return false;
+    }
+
+    uint32_t length = 0;
+    std::memcpy(&length, data + 8, 4);
+    if (length > size) {
+      return false;
+    }
+
+    out = {};
+    uint64_t offset = 12;
+    while (offset + 8 <= length) {
+      uint32_t chunk_size = 0, chunk_type = 0;
+      std::memcpy(&chunk_size, data + offset, 4);
+      std::memcpy(&chunk_type, data + offset + 4, 4);
+      offset += 8;
+
+      if (offset + chunk_size > length) {
+        return false;
+      }
+
+      if (chunk_type == CHUNK_JSON && !out.json) {
+        out.json = data + offset;
+        out.json_size = chunk_size;
+      } else if (chunk_type == CHUNK_BIN && !out.bin) {
+        out.bin = data + offset;
+        out.bin_size = chunk_size;
+      }
+
+      offset += (chunk_size + 3) & ~3u;
+    }
+
+    return out.json != nullptr;
+  }
+
+}
+
+#endif
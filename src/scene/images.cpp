@@ -1,9 +1,12 @@
 #include "scene.hpp"
+#include "parallel.hpp"
 
 #include <string>
 #include <memory>
 #include <cmath>
 #include <cstring>
+#include <algorithm>
+#include <vector>
 
 #define STB_IMAGE_IMPLEMENTATION
 #include <lib/stb_image.h>
@@ -16,8 +19,28 @@ namespace scene {
     }
   };
 
-  static void copy_pixels(VkCommandBuffer cmd, gpu::ImagePtr &dst, gpu::BufferPtr &transfer);
+  static stbi_uc *load_rgba8(const EncodedImage &src, int &x, int &y) {
+    int comps;
+    if (src.data) {
+      return stbi_load_from_memory(src.data, int(src.size), &x, &y, &comps, 4);
+    }
+    return stbi_load(src.path.c_str(), &x, &y, &comps, 4);
+  }
+
+  static bool get_image_info(const EncodedImage &src, int &x, int &y) {
+    int comps;
+    if (src.data) {
+      return stbi_info_from_memory(src.data, int(src.size), &x, &y, &comps);
+    }
+    return stbi_info(src.path.c_str(), &x, &y, &comps);
+  }
+
   static void gen_image_mips(VkCommandBuffer cmd, gpu::ImagePtr &dst);
+  static void finish_image_uploads(gpu::TransferCmdPool &transfer_pool, const std::vector<gpu::ImagePtr> &images);
+  static void finish_rgba8_uploads(gpu::TransferCmdPool &transfer_pool, std::vector<gpu::ImagePtr> &images);
+
+  //decoded pixels kept in memory at once by load_images_rgba8
+  constexpr uint64_t DECODE_BATCH_SIZE = 256 << 20;
 
   gpu::ImagePtr load_image_rgba8(gpu::TransferCmdPool &transfer_pool, const char *path) {
     int x, y, comps;
@@ -36,58 +59,321 @@ namespace scene {
     //output_image.create(VK_IMAGE_TYPE_2D, image_info, VK_IMAGE_TILING_OPTIMAL, flags);
 
     auto output_image = gpu::create_tex2d(VK_FORMAT_R8G8B8A8_SRGB, uint32_t(x), uint32_t(y), mips, flags); 
-    uint64_t buff_size = x * y * 4;
-    auto transfer_buffer = gpu::create_buffer(VMA_MEMORY_USAGE_CPU_TO_GPU, buff_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
-    std::memcpy(transfer_buffer->get_mapped_ptr(), pixels.get(), buff_size);
-    pixels.release();
+    transfer_pool.upload_image(output_image, 0, pixels.get(), 4ull * x, uint32_t(y));
 
-    auto cmd = transfer_pool.get_cmd_buffer();
-    VkCommandBufferBeginInfo begin_info {VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO};
-    vkBeginCommandBuffer(cmd, &begin_info);
+    std::vector<gpu::ImagePtr> images {output_image};
+    finish_rgba8_uploads(transfer_pool, images);
+    return output_image;
+  }
 
-    copy_pixels(cmd, output_image, transfer_buffer);
-    gen_image_mips(cmd, output_image);
+  static float srgb_to_linear(float c) {
+    return (c <= 0.04045f)? c/12.92f : std::pow((c + 0.055f)/1.055f, 2.4f);
+  }
 
-    vkEndCommandBuffer(cmd);
-    transfer_pool.submit_and_wait();
+  static uint8_t linear_to_srgb(float c) {
+    c = std::clamp(c, 0.f, 1.f);
+    float s = (c <= 0.0031308f)? 12.92f * c : 1.055f * std::pow(c, 1.f/2.4f) - 0.055f;
+    return uint8_t(s * 255.f + 0.5f);
+  }
 
-    return output_image;
+  //box filter in linear space, matches the linear blit gen_image_mips does on srgb images. Alpha is always linear
+  static void downsample_rgba8(const uint8_t *src, uint32_t src_w, uint32_t src_h, uint8_t *dst, const float *to_linear, bool srgb) {
+    const uint32_t dst_w = std::max(src_w/2, 1u);
+    const uint32_t dst_h = std::max(src_h/2, 1u);
+
+    for (uint32_t y = 0; y < dst_h; y++) {
+      const uint32_t y0 = std::min(2 * y, src_h - 1);
+      const uint32_t y1 = std::min(2 * y + 1, src_h - 1);
+
+      for (uint32_t x = 0; x < dst_w; x++) {
+        const uint32_t x0 = std::min(2 * x, src_w - 1);
+        const uint32_t x1 = std::min(2 * x + 1, src_w - 1);
+        
+        const uint8_t *texels[] {
+          src + 4 * (y0 * src_w + x0),
+          src + 4 * (y0 * src_w + x1),
+          src + 4 * (y1 * src_w + x0),
+          src + 4 * (y1 * src_w + x1)
+        };
+
+        uint8_t *out = dst + 4 * (y * dst_w + x);
+        for (uint32_t c = 0; c < 3; c++) {
+          float sum = 0.f;
+          for (auto t : texels) {
+            sum += to_linear[t[c]];
+          }
+          out[c] = srgb? linear_to_srgb(0.25f * sum) : uint8_t(std::clamp(0.25f * sum, 0.f, 1.f) * 255.f + 0.5f);
+        }
+
+        uint32_t alpha = 0;
+        for (auto t : texels) {
+          alpha += t[3];
+        }
+        out[3] = uint8_t((alpha + 2)/4);
+      }
+    }
+  }
+
+  HostImage decode_image_rgba8(const EncodedImage &source, bool srgb) {
+    int x, y;
+
+    std::unique_ptr<stbi_uc, PixelsDeleter> pixels;
+    pixels.reset(load_rgba8(source, x, y));
+    
+    if (!pixels) {
+      throw std::runtime_error {source.path + ": " + stbi_failure_reason()};
+    }
+
+    HostImage image {};
+    image.format = srgb? VK_FORMAT_R8G8B8A8_SRGB : VK_FORMAT_R8G8B8A8_UNORM;
+    image.width = x;
+    image.height = y;
+    image.mip_levels = std::floor(std::log2(std::max(x, y))) + 1;
+    image.data.resize(get_image_byte_size(image.format, image.width, image.height, image.mip_levels));
+    std::memcpy(image.data.data(), pixels.get(), get_mip_byte_size(image.format, image.width, image.height, 0));
+
+    float to_linear[256];
+    for (uint32_t i = 0; i < 256; i++) {
+      to_linear[i] = srgb? srgb_to_linear(i/255.f) : i/255.f;
+    }
+
+    uint64_t offset = 0;
+    for (uint32_t mip = 1; mip < image.mip_levels; mip++) {
+      const uint64_t src_size = get_mip_byte_size(image.format, image.width, image.height, mip - 1);
+      downsample_rgba8(image.data.data() + offset,
+        std::max(image.width >> (mip - 1), 1u),
+        std::max(image.height >> (mip - 1), 1u),
+        image.data.data() + offset + src_size,
+        to_linear,
+        srgb);
+      offset += src_size;
+    }
+
+    return image;
+  }
+
+  uint64_t get_mip_byte_size(VkFormat fmt, uint32_t width, uint32_t height, uint32_t mip) {
+    const uint64_t w = std::max(width >> mip, 1u);
+    const uint64_t h = std::max(height >> mip, 1u);
+
+    switch (fmt) {
+    case VK_FORMAT_R8G8B8A8_SRGB:
+    case VK_FORMAT_R8G8B8A8_UNORM:
+      return 4 * w * h;
+    case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+    case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+      return 8 * ((w + 3)/4) * ((h + 3)/4);
+    case VK_FORMAT_BC3_SRGB_BLOCK:
+    case VK_FORMAT_BC3_UNORM_BLOCK:
+    case VK_FORMAT_BC5_UNORM_BLOCK:
+      return 16 * ((w + 3)/4) * ((h + 3)/4);
+    default:
+      break;
+    }
+    throw std::runtime_error {"Unsupported image format"};
+  }
+
+  uint64_t get_image_byte_size(VkFormat fmt, uint32_t width, uint32_t height, uint32_t mip_levels) {
+    uint64_t size = 0;
+    for (uint32_t mip = 0; mip < mip_levels; mip++) {
+      size += get_mip_byte_size(fmt, width, height, mip);
+    }
+    return size;
   }
 
-  static void copy_pixels(VkCommandBuffer cmd, gpu::ImagePtr &dst, gpu::BufferPtr &transfer) {
-    VkImageMemoryBarrier image_barrier {
+  static bool is_block_compressed(VkFormat fmt) {
+    return fmt >= VK_FORMAT_BC1_RGB_UNORM_BLOCK && fmt <= VK_FORMAT_BC7_SRGB_BLOCK;
+  }
+
+  void upload_image_mips(gpu::TransferCmdPool &transfer_pool, const gpu::ImagePtr &dst, const uint8_t *data) {
+    const auto &desc = dst->get_info();
+    const uint32_t row_height = is_block_compressed(desc.format)? 4 : 1;
+
+    for (uint32_t mip = 0; mip < desc.mipLevels; mip++) {
+      const uint32_t h = std::max(desc.extent.height >> mip, 1u);
+      const uint32_t rows = (h + row_height - 1)/row_height;
+      const uint64_t mip_size = get_mip_byte_size(desc.format, desc.extent.width, desc.extent.height, mip);
+      transfer_pool.upload_image(dst, mip, data, mip_size/rows, rows, row_height);
+      data += mip_size;
+    }
+  }
+
+  VkComponentMapping get_image_swizzle(VkFormat fmt) {
+    if (fmt == VK_FORMAT_BC5_UNORM_BLOCK) {
+      return {VK_COMPONENT_SWIZZLE_ZERO, VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_G, VK_COMPONENT_SWIZZLE_ONE};
+    }
+    return {};
+  }
+
+  gpu::ImagePtr create_scene_image(VkFormat fmt, uint32_t width, uint32_t height, uint32_t mip_levels) {
+    auto image = gpu::create_tex2d(fmt, width, height, mip_levels, VK_IMAGE_USAGE_TRANSFER_DST_BIT|VK_IMAGE_USAGE_SAMPLED_BIT);
+    image->set_swizzle(get_image_swizzle(fmt));
+    return image;
+  }
+
+  std::vector<gpu::ImagePtr> upload_host_images(gpu::TransferCmdPool &transfer_pool, const std::vector<HostImage> &images) {
+    std::vector<gpu::ImagePtr> out_images;
+    out_images.reserve(images.size());
+
+    for (const auto &src : images) {
+      auto image = create_scene_image(src.format, src.width, src.height, src.mip_levels);
+      upload_image_mips(transfer_pool, image, src.data.data());
+      out_images.push_back(std::move(image));
+    }
+
+    finish_image_uploads(transfer_pool, out_images);
+    return out_images;
+  }
+
+  uint32_t get_streaming_tail_mip(uint32_t width, uint32_t height, uint32_t mip_levels) {
+    uint32_t mip = 0;
+    while (mip + 1 < mip_levels && std::max(width >> mip, height >> mip) > STREAMING_TAIL_SIZE) {
+      mip++;
+    }
+    return mip;
+  }
+
+  const uint8_t *get_streamed_mip_data(const StreamedImage &src, uint32_t mip) {
+    return src.data + get_image_byte_size(src.format, src.width, src.height, mip);
+  }
+
+  gpu::ImagePtr create_streamed_image(const StreamedImage &src, uint32_t first_mip) {
+    return create_scene_image(src.format,
+      std::max(src.width >> first_mip, 1u),
+      std::max(src.height >> first_mip, 1u),
+      src.mip_levels - first_mip);
+  }
+
+  std::vector<gpu::ImagePtr> upload_streamed_images(gpu::TransferCmdPool &transfer_pool, std::vector<StreamedImage> &images) {
+    std::vector<gpu::ImagePtr> out_images;
+    out_images.reserve(images.size());
+
+    for (auto &src : images) {
+      src.resident_mip = get_streaming_tail_mip(src.width, src.height, src.mip_levels);
+      auto image = create_streamed_image(src, src.resident_mip);
+      upload_image_mips(transfer_pool, image, get_streamed_mip_data(src, src.resident_mip));
+      out_images.push_back(std::move(image));
+    }
+
+    finish_image_uploads(transfer_pool, out_images);
+    return out_images;
+  }
+
+  void set_image_sampled(VkCommandBuffer cmd, const gpu::ImagePtr &dst) {
+    VkImageMemoryBarrier sampled_barrier {
       .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
       .pNext = nullptr,
-      .srcAccessMask = 0,
-      .dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
-      .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-      .newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+      .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+      .dstAccessMask = VK_ACCESS_MEMORY_READ_BIT,
+      .oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+      .newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
       .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
       .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
       .image = dst->api_image(),
-      .subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1}
-    };
-    
-    const auto &desc = dst->get_info();
-
-    VkBufferImageCopy copy_region {
-      .bufferOffset = 0,
-      .bufferRowLength = desc.extent.width,
-      .bufferImageHeight = desc.extent.height,
-      .imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1},
-      .imageOffset = {0, 0, 0},
-      .imageExtent = {desc.extent.width, desc.extent.height, 1}
+      .subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, dst->get_mip_levels(), 0, 1}
     };
 
     vkCmdPipelineBarrier(cmd,
-      VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
       VK_PIPELINE_STAGE_TRANSFER_BIT,
-      0, 
+      VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+      0,
       0, nullptr,
       0, nullptr,
-      1, &image_barrier);
+      1, &sampled_barrier);
+  }
+
+  //waits for upload_image_mips and moves images to SHADER_READ_ONLY_OPTIMAL
+  static void finish_image_uploads(gpu::TransferCmdPool &transfer_pool, const std::vector<gpu::ImagePtr> &images) {
+    transfer_pool.flush();
+
+    auto cmd = transfer_pool.get_cmd_buffer();
+    VkCommandBufferBeginInfo begin_info {VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO};
+    vkBeginCommandBuffer(cmd, &begin_info);
+    for (const auto &image : images) {
+      set_image_sampled(cmd, image);
+    }
+    vkEndCommandBuffer(cmd);
+    transfer_pool.submit_and_wait();
+  }
+
+  //waits for mip 0 uploads and generates the other mips on the main queue, blits need a graphics queue
+  static void finish_rgba8_uploads(gpu::TransferCmdPool &transfer_pool, std::vector<gpu::ImagePtr> &images) {
+    transfer_pool.flush();
+
+    auto cmd = transfer_pool.get_cmd_buffer();
+    VkCommandBufferBeginInfo begin_info {VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO};
+    vkBeginCommandBuffer(cmd, &begin_info);
+    for (auto &image : images) {
+      gen_image_mips(cmd, image);
+    }
+    vkEndCommandBuffer(cmd);
+    transfer_pool.submit_and_wait();
+  }
+
+  std::vector<gpu::ImagePtr> load_images_rgba8(gpu::TransferCmdPool &transfer_pool, const std::vector<EncodedImage> &sources) {
+    struct ImageSize {
+      uint32_t width;
+      uint32_t height;
+    };
+
+    std::vector<ImageSize> sizes;
+    sizes.resize(sources.size());
+    
+    //headers are enough to split decoding into batches
+    parallel_for(sources.size(), [&](uint32_t i) {
+      int x, y;
+      if (!get_image_info(sources[i], x, y)) {
+        throw std::runtime_error {sources[i].path + ": " + stbi_failure_reason()};
+      }
+      sizes[i].width = x;
+      sizes[i].height = y;
+    });
+
+    auto flags = VK_IMAGE_USAGE_TRANSFER_SRC_BIT|VK_IMAGE_USAGE_TRANSFER_DST_BIT|VK_IMAGE_USAGE_SAMPLED_BIT;
+    std::vector<gpu::ImagePtr> images;
+    images.reserve(sources.size());
+
+    std::vector<std::unique_ptr<stbi_uc, PixelsDeleter>> pixels;
+    pixels.resize(sources.size());
+
+    //a batch is decoded in parallel, then streamed through the upload ring while the next one is not decoded yet
+    uint32_t first = 0;
+    while (first < sources.size()) {
+      uint32_t last = first;
+      uint64_t batch_size = 0;
+      while (last < sources.size() && (last == first || batch_size + 4ull * sizes[last].width * sizes[last].height <= DECODE_BATCH_SIZE)) {
+        batch_size += 4ull * sizes[last].width * sizes[last].height;
+        last++;
+      }
+
+      parallel_for(last - first, [&](uint32_t index) {
+        const uint32_t i = first + index;
+        int x, y;
+        pixels[i].reset(load_rgba8(sources[i], x, y));
+
+        if (!pixels[i]) {
+          throw std::runtime_error {sources[i].path + ": " + stbi_failure_reason()};
+        }
+
+        if (uint32_t(x) != sizes[i].width || uint32_t(y) != sizes[i].height) {
+          throw std::runtime_error {sources[i].path + ": size changed while loading"};
+        }
+      });
+
+      for (uint32_t i = first; i < last; i++) {
+        const auto &size = sizes[i];
+        uint32_t mips = std::floor(std::log2(std::max(size.width, size.height))) + 1;
+        auto image = gpu::create_tex2d(VK_FORMAT_R8G8B8A8_SRGB, size.width, size.height, mips, flags);
+        transfer_pool.upload_image(image, 0, pixels[i].get(), 4ull * size.width, size.height);
+        pixels[i].reset();
+        images.push_back(std::move(image));
+      }
+
+      first = last;
+    }
 
-    vkCmdCopyBufferToImage(cmd, transfer->api_buffer(), dst->api_image(), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copy_region);
+    finish_rgba8_uploads(transfer_pool, images);
+    return images;
   }
 
   static void gen_image_mips(VkCommandBuffer cmd, gpu::ImagePtr &dst) {
@@ -0,0 +1,84 @@
+#ifndef SCENE_MAPPED_FILE_HPP_INCLUDED
+#define SCENE_MAPPED_FILE_HPP_INCLUDED
+
+#include <cstdint>
+#include <string>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace scene {
+
+  //read-only view of a whole file
+  struct MappedFile {
+    MappedFile() {}
+    MappedFile(const std::string &path) { open(path); }
+    ~MappedFile() { close(); }
+
+    MappedFile(MappedFile &&o) : ptr {o.ptr}, size {o.size} { o.ptr = nullptr; o.size = 0; }
+    MappedFile &operator=(MappedFile &&o) {
+      std::swap(ptr, o.ptr);
+      std::swap(size, o.size);
+      return *this;
+    }
+
+    bool open(const std::string &path) {
+      close();
+
+      int fd = ::open(path.c_str(), O_RDONLY);
+      if (fd < 0) {
+        return false;
+      }
+
+      struct stat st {};
+      if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        ::close(fd);
+        return false;
+      }
+
+      void *mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      ::close(fd);
+
+      if (mapping == MAP_FAILED) {
+        return false;
+      }
+
+      ptr = static_cast<const uint8_t*>(mapping);
+      size = st.st_size;
+      return true;
+    }
+
+    void close() {
+      if (ptr) {
+        munmap(const_cast<uint8_t*>(ptr), size);
+      }
+      ptr = nullptr;
+      size = 0;
+    }
+
+    //hint that the whole mapping will be read front to back
+    void prefetch() const {
+      if (ptr) {
+        madvise(const_cast<uint8_t*>(ptr), size, MADV_WILLNEED);
+      }
+    }
+
+    operator bool() const { return ptr != nullptr; }
+
+    const uint8_t *data() const { return ptr; }
+    uint64_t get_size() const { return size; }
+
+  private:
+    const uint8_t *ptr = nullptr;
+    uint64_t size = 0;
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+  };
+
+}
+
+#endif
@@ -0,0 +1,533 @@
+#include "mesh_optimizer.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <numeric>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace scene {
+
+  constexpr uint32_t INVALID_INDEX = ~0u;
+
+  //FIFO cache simulation, a vertex is in the cache if it was inserted less than cache_size misses ago
+  struct FifoCache {
+    FifoCache(uint32_t vertex_count, uint32_t size) : timestamps(vertex_count, 0), cache_size {size}, time {size + 1} {}
+
+    uint32_t add_triangle(const uint32_t *tri) {
+      uint32_t misses = 0;
+      for (uint32_t i = 0; i < 3; i++) {
+        if (time - timestamps[tri[i]] > cache_size) {
+          timestamps[tri[i]] = time++;
+          misses++;
+        }
+      }
+      return misses;
+    }
+
+    void reset() { time += cache_size + 1; }
+
+  private:
+    std::vector<uint32_t> timestamps;
+    uint32_t cache_size;
+    uint32_t time;
+  };
+
+  static uint64_t count_cache_misses(const uint32_t *indexes, uint32_t index_count, uint32_t vertex_count) {
+    FifoCache cache {vertex_count, MeshStats::STATS_CACHE_SIZE};
+    uint64_t misses = 0;
+    for (uint32_t i = 0; i + 2 < index_count; i += 3) {
+      misses += cache.add_triangle(indexes + i);
+    }
+    return misses;
+  }
+
+  constexpr uint32_t OVERDRAW_GRID = 256;
+
+  //orthographic views along +-X, +-Y, +-Z with depth test and backface culling, like a z-prepass-less raster
+  static void count_overdraw(const Vertex *vertices, uint32_t vertex_count, const uint32_t *indexes, uint32_t index_count, MeshStats &stats) {
+    if (!vertex_count) {
+      return;
+    }
+
+    glm::vec3 bmin {std::numeric_limits<float>::max()};
+    glm::vec3 bmax {-std::numeric_limits<float>::max()};
+    for (uint32_t i = 0; i < vertex_count; i++) {
+      bmin = glm::min(bmin, vertices[i].pos);
+      bmax = glm::max(bmax, vertices[i].pos);
+    }
+
+    const glm::vec3 extent = bmax - bmin;
+    const float max_extent = std::max(std::max(extent.x, extent.y), extent.z);
+    if (max_extent <= 0.f) {
+      return;
+    }
+    const float scale = float(OVERDRAW_GRID - 1)/max_extent;
+
+    std::vector<float> depth(OVERDRAW_GRID * OVERDRAW_GRID);
+
+    for (uint32_t axis = 0; axis < 3; axis++) {
+      //(u, v, axis) form a right-handed basis
+      const uint32_t u_axis = (axis + 1) % 3;
+      const uint32_t v_axis = (axis + 2) % 3;
+
+      for (float dir : {1.f, -1.f}) {
+        std::fill(depth.begin(), depth.end(), std::numeric_limits<float>::max());
+
+        for (uint32_t i = 0; i + 2 < index_count; i += 3) {
+          glm::vec3 p[3];
+          for (uint32_t k = 0; k < 3; k++) {
+            auto pos = (vertices[indexes[i + k]].pos - bmin) * scale;
+            p[k] = glm::vec3 {pos[u_axis], pos[v_axis], -dir * pos[axis]};
+          }
+
+          float area = (p[1].x - p[0].x) * (p[2].y - p[0].y) - (p[1].y - p[0].y) * (p[2].x - p[0].x);
+          if (area * dir <= 0.f) {
+            continue; //back facing or degenerate for this view
+          }
+
+          int32_t x0 = std::max(int32_t(std::ceil(std::min({p[0].x, p[1].x, p[2].x}) - 0.5f)), 0);
+          int32_t y0 = std::max(int32_t(std::ceil(std::min({p[0].y, p[1].y, p[2].y}) - 0.5f)), 0);
+          int32_t x1 = std::min(int32_t(std::max({p[0].x, p[1].x, p[2].x}) - 0.5f), int32_t(OVERDRAW_GRID - 1));
+          int32_t y1 = std::min(int32_t(std::max({p[0].y, p[1].y, p[2].y}) - 0.5f), int32_t(OVERDRAW_GRID - 1));
+
+          const float inv_area = 1.f/area;
+
+          for (int32_t y = y0; y <= y1; y++) {
+            for (int32_t x = x0; x <= x1; x++) {
+              const float px = x + 0.5f, py = y + 0.5f;
+              float w0 = ((p[2].x - p[1].x) * (py - p[1].y) - (p[2].y - p[1].y) * (px - p[1].x)) * inv_area;
+              float w1 = ((p[0].x - p[2].x) * (py - p[2].y) - (p[0].y - p[2].y) * (px - p[2].x)) * inv_area;
+              float w2 = 1.f - w0 - w1;
+              if (w0 < 0.f || w1 < 0.f || w2 < 0.f) {
+                continue;
+              }
+
+              float z = w0 * p[0].z + w1 * p[1].z + w2 * p[2].z;
+              float &dst = depth[y * OVERDRAW_GRID + x];
+              if (z < dst) {
+                dst = z;
+                stats.pixels_shaded++;
+              }
+            }
+          }
+        }
+
+        for (float d : depth) {
+          stats.pixels_covered += (d != std::numeric_limits<float>::max())? 1 : 0;
+        }
+      }
+    }
+  }
+
+  MeshStats analyze_mesh(const Vertex *vertices, uint32_t vertex_count, const uint32_t *indexes, uint32_t index_count) {
+    MeshStats stats {};
+    stats.triangles = index_count/3;
+    stats.cache_misses = count_cache_misses(indexes, index_count, vertex_count);
+    count_overdraw(vertices, vertex_count, indexes, index_count, stats);
+    return stats;
+  }
+
+  constexpr uint32_t FORSYTH_CACHE_SIZE = 32;
+
+  static float forsyth_vertex_score(int32_t cache_pos, uint32_t live_triangles) {
+    if (!live_triangles) {
+      return -1.f;
+    }
+
+    float score = 0.f;
+    if (cache_pos >= 3) {
+      score = std::pow(1.f - float(cache_pos - 3)/float(FORSYTH_CACHE_SIZE - 3), 1.5f);
+    } else if (cache_pos >= 0) {
+      score = 0.75f; //last triangle vertices, it should not matter which one of them is used
+    }
+    return score + 2.f/std::sqrt(float(live_triangles));
+  }
+
+  void optimize_vertex_cache(uint32_t *indexes, uint32_t index_count, uint32_t vertex_count) {
+    const uint32_t triangle_count = index_count/3;
+    if (triangle_count < 2) {
+      return;
+    }
+
+    //triangles of every vertex, first live_triangles[v] entries are not emitted yet
+    std::vector<uint32_t> live_triangles(vertex_count, 0);
+    for (uint32_t i = 0; i < triangle_count * 3; i++) {
+      live_triangles[indexes[i]]++;
+    }
+
+    std::vector<uint32_t> adjacency_offsets(vertex_count + 1, 0);
+    std::partial_sum(live_triangles.begin(), live_triangles.end(), adjacency_offsets.begin() + 1);
+
+    std::vector<uint32_t> adjacency(triangle_count * 3);
+    {
+      std::vector<uint32_t> cursor {adjacency_offsets.begin(), adjacency_offsets.end() - 1};
+      for (uint32_t i = 0; i < triangle_count * 3; i++) {
+        adjacency[cursor[indexes[i]]++] = i/3;
+      }
+    }
+
+    std::vector<int32_t> cache_pos(vertex_count, -1);
+    std::vector<float> vertex_score(vertex_count);
+    for (uint32_t v = 0; v < vertex_count; v++) {
+      vertex_score[v] = forsyth_vertex_score(-1, live_triangles[v]);
+    }
+
+    std::vector<float> triangle_score(triangle_count);
+    std::vector<bool> emitted(triangle_count, false);
+    for (uint32_t t = 0; t < triangle_count; t++) {
+      const uint32_t *tri = indexes + 3 * t;
+      triangle_score[t] = vertex_score[tri[0]] + vertex_score[tri[1]] + vertex_score[tri[2]];
+    }
+
+    std::vector<uint32_t> result(triangle_count * 3);
+    std::vector<uint32_t> cache, next_cache;
+    cache.reserve(FORSYTH_CACHE_SIZE + 3);
+    next_cache.reserve(FORSYTH_CACHE_SIZE + 3);
+
+    uint32_t best = std::max_element(triangle_score.begin(), triangle_score.end()) - triangle_score.begin();
+    uint32_t scan_cursor = 0;
+
+    for (uint32_t out_tri = 0; out_tri < triangle_count; out_tri++) {
+      if (best == INVALID_INDEX) {
+        //nothing in the cache has live triangles, continue from the first one left
+        while (emitted[scan_cursor]) {
+          scan_cursor++;
+        }
+        best = scan_cursor;
+      }
+
+      const uint32_t *tri = indexes + 3 * best;
+      emitted[best] = true;
+      std::copy(tri, tri + 3, result.begin() + 3 * out_tri);
+
+      for (uint32_t k = 0; k < 3; k++) {
+        const uint32_t v = tri[k];
+        auto begin = adjacency.begin() + adjacency_offsets[v];
+        auto end = begin + live_triangles[v];
+        auto it = std::find(begin, end, best);
+        if (it != end) {
+          std::iter_swap(it, end - 1);
+          live_triangles[v]--;
+        }
+      }
+
+      next_cache.assign(tri, tri + 3);
+      for (uint32_t v : cache) {
+        if (v != tri[0] && v != tri[1] && v != tri[2]) {
+          next_cache.push_back(v);
+        }
+      }
+      std::swap(cache, next_cache);
+
+      //evicted vertices still get their scores updated
+      for (uint32_t i = 0; i < cache.size(); i++) {
+        const uint32_t v = cache[i];
+        cache_pos[v] = (i < FORSYTH_CACHE_SIZE)? int32_t(i) : -1;
+        vertex_score[v] = forsyth_vertex_score(cache_pos[v], live_triangles[v]);
+      }
+
+      best = INVALID_INDEX;
+      float best_score = -1.f;
+      for (uint32_t v : cache) {
+        for (uint32_t j = 0; j < live_triangles[v]; j++) {
+          const uint32_t t = adjacency[adjacency_offsets[v] + j];
+          const uint32_t *adj = indexes + 3 * t;
+          triangle_score[t] = vertex_score[adj[0]] + vertex_score[adj[1]] + vertex_score[adj[2]];
+          if (triangle_score[t] > best_score) {
+            best_score = triangle_score[t];
+            best = t;
+          }
+        }
+      }
+
+      if (cache.size() > FORSYTH_CACHE_SIZE) {
+        cache.resize(FORSYTH_CACHE_SIZE);
+      }
+    }
+
+    std::copy(result.begin(), result.end(), indexes);
+  }
+
+  void optimize_overdraw(uint32_t *indexes, uint32_t index_count, const Vertex *vertices, uint32_t vertex_count, float threshold) {
+    const uint32_t triangle_count = index_count/3;
+    if (triangle_count < 2) {
+      return;
+    }
+
+    //hard boundaries are triangles that miss on all 3 vertices, the cache is effectively flushed there
+    std::vector<uint32_t> hard_clusters;
+    {
+      FifoCache cache {vertex_count, MeshStats::STATS_CACHE_SIZE};
+      for (uint32_t t = 0; t < triangle_count; t++) {
+        if (cache.add_triangle(indexes + 3 * t) == 3 || t == 0) {
+          hard_clusters.push_back(t);
+        }
+      }
+    }
+    hard_clusters.push_back(triangle_count);
+
+    //soft boundaries, cache is restarted at each one so splitting there costs at most the threshold
+    std::vector<uint32_t> clusters;
+    FifoCache cache {vertex_count, MeshStats::STATS_CACHE_SIZE};
+    for (uint32_t c = 0; c + 1 < hard_clusters.size(); c++) {
+      const uint32_t start = hard_clusters[c], end = hard_clusters[c + 1];
+
+      cache.reset();
+      uint32_t cluster_misses = 0;
+      for (uint32_t t = start; t < end; t++) {
+        cluster_misses += cache.add_triangle(indexes + 3 * t);
+      }
+      const float cluster_threshold = threshold * float(cluster_misses)/float(end - start);
+
+      cache.reset();
+      clusters.push_back(start);
+      uint32_t running_misses = 0, running_triangles = 0;
+      for (uint32_t t = start; t < end; t++) {
+        running_misses += cache.add_triangle(indexes + 3 * t);
+        running_triangles++;
+
+        if (t + 1 < end && float(running_misses)/float(running_triangles) <= cluster_threshold) {
+          clusters.push_back(t + 1);
+          cache.reset();
+          running_misses = 0;
+          running_triangles = 0;
+        }
+      }
+    }
+    clusters.push_back(triangle_count);
+
+    glm::vec3 mesh_center {0.f};
+    for (uint32_t v = 0; v < vertex_count; v++) {
+      mesh_center += vertices[v].pos;
+    }
+    mesh_center /= float(std::max(vertex_count, 1u));
+
+    //clusters facing away from the center are drawn first, they are likely to occlude the rest
+    const uint32_t cluster_count = clusters.size() - 1;
+    std::vector<float> sort_keys(cluster_count);
+    for (uint32_t c = 0; c < cluster_count; c++) {
+      glm::vec3 centroid {0.f}, normal {0.f};
+      float area_sum = 0.f;
+
+      for (uint32_t t = clusters[c]; t < clusters[c + 1]; t++) {
+        const auto &p0 = vertices[indexes[3 * t]].pos;
+        const auto &p1 = vertices[indexes[3 * t + 1]].pos;
+        const auto &p2 = vertices[indexes[3 * t + 2]].pos;
+
+        auto n = glm::cross(p1 - p0, p2 - p0);
+        float area = glm::length(n);
+        centroid += area * (p0 + p1 + p2)/3.f;
+        normal += n;
+        area_sum += area;
+      }
+
+      centroid = (area_sum > 0.f)? centroid/area_sum : vertices[indexes[3 * clusters[c]]].pos;
+      float normal_len = glm::length(normal);
+      sort_keys[c] = (normal_len > 0.f)? glm::dot(centroid - mesh_center, normal/normal_len) : 0.f;
+    }
+
+    std::vector<uint32_t> order(cluster_count);
+    std::iota(order.begin(), order.end(), 0u);
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+      return sort_keys[a] > sort_keys[b];
+    });
+
+    std::vector<uint32_t> result;
+    result.reserve(triangle_count * 3);
+    for (uint32_t c : order) {
+      result.insert(result.end(), indexes + 3 * clusters[c], indexes + 3 * clusters[c + 1]);
+    }
+    std::copy(result.begin(), result.end(), indexes);
+  }
+
+  void optimize_vertex_fetch(Vertex *vertices, uint32_t vertex_count, uint32_t *indexes, uint32_t index_count) {
+    std::vector<uint32_t> remap(vertex_count, INVALID_INDEX);
+    uint32_t next_vertex = 0;
+
+    for (uint32_t i = 0; i < index_count; i++) {
+      uint32_t &dst = remap[indexes[i]];
+      if (dst == INVALID_INDEX) {
+        dst = next_vertex++;
+      }
+      indexes[i] = dst;
+    }
+
+    for (auto &dst : remap) {
+      if (dst == INVALID_INDEX) {
+        dst = next_vertex++;
+      }
+    }
+
+    std::vector<Vertex> src {vertices, vertices + vertex_count};
+    for (uint32_t v = 0; v < vertex_count; v++) {
+      vertices[remap[v]] = src[v];
+    }
+  }
+
+  void optimize_mesh(Vertex *vertices, uint32_t vertex_count, uint32_t *indexes, uint32_t index_count, MeshStats *before, MeshStats *after) {
+    for (uint32_t i = 0; i < index_count; i++) {
+      if (indexes[i] >= vertex_count) {
+        throw std::runtime_error {"Index out of range"};
+      }
+    }
+
+    if (before) {
+      *before = analyze_mesh(vertices, vertex_count, indexes, index_count);
+    }
+
+    optimize_vertex_cache(indexes, index_count, vertex_count);
+    optimize_overdraw(indexes, index_count, vertices, vertex_count);
+    optimize_vertex_fetch(vertices, vertex_count, indexes, index_count);
+
+    if (after) {
+      *after = analyze_mesh(vertices, vertex_count, indexes, index_count);
+    }
+  }
+
+  struct VertexBitsHash {
+    size_t operator()(const Vertex &v) const {
+      uint32_t words[sizeof(Vertex)/sizeof(uint32_t)];
+      std::memcpy(words, &v, sizeof(Vertex));
+      uint64_t hash = 14695981039346656037ull;
+      for (auto w : words) {
+        hash = (hash ^ w) * 1099511628211ull;
+      }
+      return size_t(hash);
+    }
+  };
+
+  struct VertexBitsEqual {
+    bool operator()(const Vertex &a, const Vertex &b) const {
+      return std::memcmp(&a, &b, sizeof(Vertex)) == 0;
+    }
+  };
+
+  uint32_t weld_vertices(Vertex *vertices, uint32_t vertex_count, uint32_t *indexes, uint32_t index_count) {
+    static_assert(sizeof(Vertex) == 8 * sizeof(float), "Vertex must not have padding");
+
+    std::unordered_map<Vertex, uint32_t, VertexBitsHash, VertexBitsEqual> unique;
+    unique.reserve(vertex_count);
+
+    std::vector<uint32_t> remap(vertex_count);
+    uint32_t welded_count = 0;
+    for (uint32_t i = 0; i < vertex_count; i++) {
+      auto res = unique.emplace(vertices[i], welded_count);
+      if (res.second) {
+        vertices[welded_count] = vertices[i];
+        welded_count++;
+      }
+      remap[i] = res.first->second;
+    }
+
+    for (uint32_t i = 0; i < index_count; i++) {
+      if (indexes[i] >= vertex_count) {
+        throw std::runtime_error {"Index out of range"};
+      }
+      indexes[i] = remap[indexes[i]];
+    }
+    return welded_count;
+  }
+
+  static void compute_meshlet_bounds(const Vertex *vertices, const uint32_t *indexes, bool cone_culling, Meshlet &meshlet) {
+    const uint32_t *tris = indexes + 3 * meshlet.first_triangle;
+    const uint32_t count = 3 * meshlet.triangle_count;
+
+    glm::vec3 bmin {std::numeric_limits<float>::max()};
+    glm::vec3 bmax {-std::numeric_limits<float>::max()};
+    for (uint32_t i = 0; i < count; i++) {
+      bmin = glm::min(bmin, vertices[tris[i]].pos);
+      bmax = glm::max(bmax, vertices[tris[i]].pos);
+    }
+
+    const glm::vec3 center = 0.5f * (bmin + bmax);
+    float radius = 0.f;
+    for (uint32_t i = 0; i < count; i++) {
+      radius = std::max(radius, glm::length(vertices[tris[i]].pos - center));
+    }
+    meshlet.sphere = glm::vec4 {center, radius};
+    meshlet.cone = glm::vec4 {0.f, 0.f, 0.f, 1.f};
+
+    if (!cone_culling) {
+      return;
+    }
+
+    glm::vec3 normals[MESHLET_MAX_TRIANGLES];
+    uint32_t normals_count = 0;
+    glm::vec3 axis {0.f};
+
+    for (uint32_t i = 0; i < count; i += 3) {
+      const auto &p0 = vertices[tris[i]].pos;
+      auto n = glm::cross(vertices[tris[i + 1]].pos - p0, vertices[tris[i + 2]].pos - p0);
+      float len = glm::length(n);
+      if (len > 0.f) {
+        normals[normals_count++] = n/len;
+        axis += n/len;
+      }
+    }
+
+    float axis_len = glm::length(axis);
+    if (!normals_count || axis_len <= 0.f) {
+      return;
+    }
+    axis /= axis_len;
+
+    float min_dp = 1.f;
+    for (uint32_t i = 0; i < normals_count; i++) {
+      min_dp = std::min(min_dp, glm::dot(normals[i], axis));
+    }
+
+    //wide cones are almost never culled, skip the test for them
+    if (min_dp <= 0.1f) {
+      return;
+    }
+
+    //all triangles are back facing if the view direction is within 90 - acos(min_dp) of the axis
+    meshlet.cone = glm::vec4 {axis, std::sqrt(1.f - min_dp * min_dp)};
+  }
+
+  void build_meshlets(const Vertex *vertices, uint32_t vertex_count, const uint32_t *indexes, uint32_t index_count, bool cone_culling, std::vector<Meshlet> &out) {
+    const uint32_t triangle_count = index_count/3;
+    out.clear();
+
+    //vertex_stamp[v] == out.size() if v is already used by the current meshlet
+    std::vector<uint32_t> vertex_stamp(vertex_count, INVALID_INDEX);
+    Meshlet meshlet {};
+    uint32_t meshlet_vertices = 0;
+
+    for (uint32_t t = 0; t < triangle_count; t++) {
+      const uint32_t *tri = indexes + 3 * t;
+      const uint32_t stamp = out.size();
+
+      uint32_t new_vertices = 0;
+      new_vertices += (vertex_stamp[tri[0]] != stamp)? 1 : 0;
+      new_vertices += (vertex_stamp[tri[1]] != stamp && tri[1] != tri[0])? 1 : 0;
+      new_vertices += (vertex_stamp[tri[2]] != stamp && tri[2] != tri[0] && tri[2] != tri[1])? 1 : 0;
+
+      if (meshlet.triangle_count == MESHLET_MAX_TRIANGLES || meshlet_vertices + new_vertices > MESHLET_MAX_VERTICES) {
+        compute_meshlet_bounds(vertices, indexes, cone_culling, meshlet);
+        out.push_back(meshlet);
+        
+        meshlet = Meshlet {};
+        meshlet.first_triangle = t;
+        meshlet_vertices = 0;
+        t--;
+        continue;
+      }
+
+      for (uint32_t k = 0; k < 3; k++) {
+        vertex_stamp[tri[k]] = stamp;
+      }
+      meshlet_vertices += new_vertices;
+      meshlet.triangle_count++;
+    }
+
+    if (meshlet.triangle_count) {
+      compute_meshlet_bounds(vertices, indexes, cone_culling, meshlet);
+      out.push_back(meshlet);
+    }
+  }
+
+}
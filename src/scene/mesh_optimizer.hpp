@@ -0,0 +1,52 @@
+#ifndef SCENE_MESH_OPTIMIZER_HPP_INCLUDED
+#define SCENE_MESH_OPTIMIZER_HPP_INCLUDED
+
+#include "scene.hpp"
+
+namespace scene {
+
+  //indexes are local to the mesh, every 3 indexes form a triangle
+  struct MeshStats {
+    uint64_t triangles = 0;
+    uint64_t cache_misses = 0;   //FIFO cache with STATS_CACHE_SIZE entries
+    uint64_t pixels_covered = 0; //summed over 6 axis aligned views
+    uint64_t pixels_shaded = 0;
+
+    static constexpr uint32_t STATS_CACHE_SIZE = 16;
+
+    //average cache miss ratio, transformed vertices per triangle
+    float get_acmr() const { return triangles? float(cache_misses)/float(triangles) : 0.f; }
+    //shaded fragments per covered pixel
+    float get_overdraw() const { return pixels_covered? float(pixels_shaded)/float(pixels_covered) : 0.f; }
+
+    MeshStats &operator+=(const MeshStats &o) {
+      triangles += o.triangles;
+      cache_misses += o.cache_misses;
+      pixels_covered += o.pixels_covered;
+      pixels_shaded += o.pixels_shaded;
+      return *this;
+    }
+  };
+
+  MeshStats analyze_mesh(const Vertex *vertices, uint32_t vertex_count, const uint32_t *indexes, uint32_t index_count);
+
+  //Forsyth's linear speed triangle reordering for the post transform cache
+  void optimize_vertex_cache(uint32_t *indexes, uint32_t index_count, uint32_t vertex_count);
+  //splits cache optimized triangles into clusters and sorts them front to back from the mesh center,
+  //clusters are only split while their ACMR stays below threshold * ACMR of the whole cluster
+  void optimize_overdraw(uint32_t *indexes, uint32_t index_count, const Vertex *vertices, uint32_t vertex_count, float threshold = 1.05f);
+  //renumbers vertices in order of the first use, unused vertices are moved to the end
+  void optimize_vertex_fetch(Vertex *vertices, uint32_t vertex_count, uint32_t *indexes, uint32_t index_count);
+
+  //merges bit identical vertices, returns the new vertex count. Welded vertices are moved to the front in order of the first occurrence
+  uint32_t weld_vertices(Vertex *vertices, uint32_t vertex_count, uint32_t *indexes, uint32_t index_count);
+
+  //all passes above, stats are gathered only if before/after are not null
+  void optimize_mesh(Vertex *vertices, uint32_t vertex_count, uint32_t *indexes, uint32_t index_count, MeshStats *before = nullptr, MeshStats *after = nullptr);
+
+  //splits triangles in index order into meshlets of at most MESHLET_MAX_VERTICES/MESHLET_MAX_TRIANGLES,
+  //cone_culling should be false for double sided geometry. primitive_index of the result is not set
+  void build_meshlets(const Vertex *vertices, uint32_t vertex_count, const uint32_t *indexes, uint32_t index_count, bool cone_culling, std::vector<Meshlet> &out);
+}
+
+#endif
@@ -1,9 +1,20 @@
 #include "scene.hpp"
+#include "scene_cache.hpp"
+#include "parallel.hpp"
+#include "mapped_file.hpp"
+#include "glb.hpp"
+#include "mesh_optimizer.hpp"
+#include "texture_compression.hpp"
 
 
 #include <iostream>
 #include <unordered_map>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <limits>
 #include <glm/gtc/type_ptr.hpp>
+#include <glm/gtc/packing.hpp>
 #define TINYGLTF_IMPLEMENTATION
 #define TINYGLTF_NO_STB_IMAGE_WRITE
 #define TINYGLTF_NO_STB_IMAGE
@@ -15,107 +26,113 @@ namespace fs = std::filesystem;
 
 namespace scene {
 
-  gpu::VertexInput get_vertex_input() {
+  uint32_t get_vertex_stride(VertexLayout layout) {
+    return (layout == VertexLayout::Packed)? sizeof(PackedVertex) : sizeof(Vertex);
+  }
+
+  VkIndexType get_index_type(const Primitive &prim) {
+    return (prim.index_size == sizeof(uint16_t))? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+  }
+
+  static VkVertexInputAttributeDescription get_pos_attribute(VertexLayout layout, uint32_t location) {
+    if (layout == VertexLayout::Packed) {
+      return {location, 0, VK_FORMAT_R16G16B16A16_SNORM, offsetof(scene::PackedVertex, pos)};
+    }
+    return {location, 0, VK_FORMAT_R32G32B32_SFLOAT, offsetof(scene::Vertex, pos)};
+  }
+
+  static VkVertexInputAttributeDescription get_norm_attribute(VertexLayout layout, uint32_t location) {
+    if (layout == VertexLayout::Packed) {
+      return {location, 0, VK_FORMAT_R16G16_UNORM, offsetof(scene::PackedVertex, norm)};
+    }
+    return {location, 0, VK_FORMAT_R32G32B32_SFLOAT, offsetof(scene::Vertex, norm)};
+  }
+
+  static VkVertexInputAttributeDescription get_uv_attribute(VertexLayout layout, uint32_t location) {
+    if (layout == VertexLayout::Packed) {
+      return {location, 0, VK_FORMAT_R16G16_SFLOAT, offsetof(scene::PackedVertex, uv)};
+    }
+    return {location, 0, VK_FORMAT_R32G32_SFLOAT, offsetof(scene::Vertex, uv)};
+  }
+
+  gpu::VertexInput get_vertex_input(VertexLayout layout) {
     gpu::VertexInput vinput;
 
-    vinput.bindings = {{0, sizeof(scene::Vertex), VK_VERTEX_INPUT_RATE_VERTEX}};
+    vinput.bindings = {{0, get_vertex_stride(layout), VK_VERTEX_INPUT_RATE_VERTEX}};
     vinput.attributes = {
-      {
-        .location = 0,
-        .binding = 0,
-        .format = VK_FORMAT_R32G32B32_SFLOAT,
-        .offset = offsetof(scene::Vertex, pos)
-      },
-      {
-        .location = 1,
-        .binding = 0,
-        .format = VK_FORMAT_R32G32B32_SFLOAT,
-        .offset = offsetof(scene::Vertex, norm)
-      },
-      {
-        .location = 2,
-        .binding = 0,
-        .format = VK_FORMAT_R32G32_SFLOAT,
-        .offset = offsetof(scene::Vertex, uv)
-      }
+      get_pos_attribute(layout, 0),
+      get_norm_attribute(layout, 1),
+      get_uv_attribute(layout, 2)
     };
     
     return vinput;
   }
 
-  gpu::VertexInput get_vertex_input_shadow() {
+  gpu::VertexInput get_vertex_input_shadow(VertexLayout layout) {
     gpu::VertexInput vinput;
 
-    vinput.bindings = {{0, sizeof(scene::Vertex), VK_VERTEX_INPUT_RATE_VERTEX}};
+    vinput.bindings = {{0, get_vertex_stride(layout), VK_VERTEX_INPUT_RATE_VERTEX}};
     vinput.attributes = {
-      {
-        .location = 0,
-        .binding = 0,
-        .format = VK_FORMAT_R32G32B32_SFLOAT,
-        .offset = offsetof(scene::Vertex, pos)
-      }
+      get_pos_attribute(layout, 0)
     };
     
     return vinput;
   }
 
-  gpu::VertexInput get_vertex_input_pos_uv() {
+  gpu::VertexInput get_vertex_input_pos_uv(VertexLayout layout) {
     gpu::VertexInput vinput;
 
-    vinput.bindings = {{0, sizeof(scene::Vertex), VK_VERTEX_INPUT_RATE_VERTEX}};
+    vinput.bindings = {{0, get_vertex_stride(layout), VK_VERTEX_INPUT_RATE_VERTEX}};
     vinput.attributes = {
-      {
-        .location = 0,
-        .binding = 0,
-        .format = VK_FORMAT_R32G32B32_SFLOAT,
-        .offset = offsetof(scene::Vertex, pos)
-      },
-      {
-        .location = 1,
-        .binding = 0,
-        .format = VK_FORMAT_R32G32_SFLOAT,
-        .offset = offsetof(scene::Vertex, uv)
-      }
+      get_pos_attribute(layout, 0),
+      get_uv_attribute(layout, 1)
     };
 
     return vinput;
   }
 
-  static void copy_data(gpu::TransferCmdPool &transfer_pool, gpu::BufferPtr &dst, gpu::BufferPtr &transfer, uint32_t byte_count, uint8_t *data) {
-    
-    VkCommandBufferBeginInfo begin_info {
-      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
-      .pNext = nullptr,
-      .flags = 0,
-      .pInheritanceInfo = nullptr
-    };
-    
-    uint32_t offset = 0;
-    uint32_t remaining_size = byte_count;
-
-    while (remaining_size) {
-      auto chunk = std::min(remaining_size, (uint32_t)transfer->get_size());
-      std::memcpy(transfer->get_mapped_ptr(), data, chunk);
-      transfer->flush();
-      
-      VkBufferCopy region {
-        .srcOffset = 0,
-        .dstOffset = offset,
-        .size = chunk
-      };
+  static int16_t quantize_snorm16(float v) {
+    return int16_t(std::round(std::clamp(v, -1.f, 1.f) * 32767.f));
+  }
 
-      data += chunk;
-      remaining_size -= chunk;
-      offset += chunk;
+  static uint16_t quantize_unorm16(float v) {
+    return uint16_t(std::round(std::clamp(v, 0.f, 1.f) * 65535.f));
+  }
 
-      auto cmd = transfer_pool.get_cmd_buffer();
+  //matches oct_encode from octahedral.glsl
+  static glm::vec2 oct_encode(glm::vec3 v) {
+    float l1norm = std::abs(v.x) + std::abs(v.y) + std::abs(v.z);
+    if (l1norm <= 0.f) {
+      return glm::vec2 {0.5f, 0.5f};
+    }
 
-      vkBeginCommandBuffer(cmd, &begin_info);
-      vkCmdCopyBuffer(cmd, transfer->api_buffer(), dst->api_buffer(), 1, &region);
-      vkEndCommandBuffer(cmd);
-      transfer_pool.submit_and_wait();
+    glm::vec2 result = glm::vec2 {v.x, v.y} * (1.f/l1norm);
+    if (v.z < 0.f) {
+      result = glm::vec2 {
+        (1.f - std::abs(result.y)) * (result.x >= 0.f? 1.f : -1.f),
+        (1.f - std::abs(result.x)) * (result.y >= 0.f? 1.f : -1.f)};
     }
+    return 0.5f * result + glm::vec2 {0.5f, 0.5f};
+  }
 
+  void pack_vertices(const Vertex *src, const std::vector<Primitive> &primitives, PackedVertex *dst) {
+    for (const auto &prim : primitives) {
+      for (uint32_t i = prim.vertex_offset; i < prim.vertex_offset + prim.vertex_count; i++) {
+        const Vertex v = src[i];
+        PackedVertex out {};
+
+        for (uint32_t axis = 0; axis < 3; axis++) {
+          const float extent = prim.bounds_extent[axis];
+          out.pos[axis] = (extent > 0.f)? quantize_snorm16((v.pos[axis] - prim.bounds_center[axis])/extent) : 0;
+        }
+        
+        auto oct = oct_encode(v.norm);
+        out.norm[0] = quantize_unorm16(oct.x);
+        out.norm[1] = quantize_unorm16(oct.y);
+        out.uv = glm::packHalf2x16(v.uv);
+        dst[i] = out;
+      }
+    }
   }
 
   struct MaterialDesc {
@@ -163,160 +180,480 @@ namespace scene {
     return VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
   }
 
-  static void tinygltf_load_materials(gpu::TransferCmdPool &transfer_pool, const fs::path folder, tinygltf::Model &model, CompiledScene &out_scene) {
-    out_scene.images.reserve(model.images.size());
-    for (uint32_t i = 0; i < model.images.size(); i++) {
-      const auto &src = model.images[i];
-      const std::string path = (folder / src.uri).native();
-      out_scene.images.emplace_back(load_image_rgba8(transfer_pool, path.c_str()));
+  static CookedSampler tinygltf_get_sampler(const tinygltf::Sampler &smp) {
+    CookedSampler desc {};
+    desc.mag_filter = gltf_remap_filter(smp.magFilter);
+    desc.min_filter = gltf_remap_filter(smp.minFilter);
+    desc.mipmap_mode = gltf_remap_mipmap_mode(smp.minFilter);
+    desc.address_u = gltf_remap_address_mode(smp.wrapS);
+    desc.address_v = gltf_remap_address_mode(smp.wrapT);
+    return desc;
+  }
+
+  VkSamplerCreateInfo get_sampler_info(const CookedSampler &desc) {
+    auto cfg = gpu::DEFAULT_SAMPLER;
+    cfg.magFilter = VkFilter(desc.mag_filter);
+    cfg.minFilter = VkFilter(desc.min_filter);
+    cfg.mipmapMode = VkSamplerMipmapMode(desc.mipmap_mode);
+    cfg.addressModeU = VkSamplerAddressMode(desc.address_u);
+    cfg.addressModeV = VkSamplerAddressMode(desc.address_v);
+    return cfg;
+  }
+
+  static Texture tinygltf_get_texture(const tinygltf::Texture &src) {
+    Texture tex;
+    tex.image_index = src.source;
+    tex.sampler_index = src.sampler;
+    return tex;
+  }
+
+  static Material tinygltf_get_material(const tinygltf::Material &src) {
+    Material mat {};
+    mat.albedo_tex_index = src.pbrMetallicRoughness.baseColorTexture.index;
+    mat.metalic_roughness_index = src.pbrMetallicRoughness.metallicRoughnessTexture.index;
+    mat.alpha_cutoff = src.alphaCutoff;
+    mat.clip_alpha = (src.alphaMode == "MASK")? 1u : 0u;
+    std::cout << "Material " << mat.albedo_tex_index << " " << mat.metalic_roughness_index << "\n";
+    return mat;
+  }
+
+  //buffer bytes as seen by accessors
+  struct GltfBufferSpan {
+    const uint8_t *ptr = nullptr;
+    uint64_t size = 0;
+  };
+
+  //.glb files are mapped, their BIN chunk is read in place
+  struct GltfSource {
+    tinygltf::Model model;
+    MappedFile file;
+    std::vector<GltfBufferSpan> buffers;
+    fs::path folder;
+  };
+
+  static void tinygltf_open(const std::string &path, GltfSource &out) {
+    tinygltf::TinyGLTF loader {};
+    std::string err, warn;
+    GlbChunks glb {};
+
+    out.folder = fs::path{path}.parent_path();
+
+    if (fs::path{path}.extension() == ".glb") {
+      if (!out.file.open(path) || !parse_glb(out.file.data(), out.file.get_size(), glb)) {
+        throw std::runtime_error {"Failed to open glb " + path};
+      }
+      out.file.prefetch();
+
+      if (!loader.LoadBinaryFromMemory(&out.model, &err, &warn, out.file.data(), uint32_t(out.file.get_size()), out.folder.native())) {
+        throw std::runtime_error {err};
+      }
+    } else if (!loader.LoadASCIIFromFile(&out.model, &err, &warn, path)) {
+      throw std::runtime_error {err};
+    }
+
+    if (!warn.empty()) {
+      std::cout << "[W] " << warn.c_str() << "\n";
+    }
+
+    out.buffers.resize(out.model.buffers.size());
+    for (uint32_t i = 0; i < out.model.buffers.size(); i++) {
+      auto &buffer = out.model.buffers[i];
+      if (i == 0 && buffer.uri.empty() && glb.bin) {
+        //tinygltf keeps its own copy of the BIN chunk, drop it and use the mapping
+        out.buffers[i] = GltfBufferSpan {glb.bin, glb.bin_size};
+        buffer.data.clear();
+        buffer.data.shrink_to_fit();
+      } else {
+        out.buffers[i] = GltfBufferSpan {buffer.data.data(), buffer.data.size()};
+      }
+    }
+  }
+
+  static std::vector<EncodedImage> tinygltf_get_images(const GltfSource &source) {
+    std::vector<EncodedImage> images;
+    images.reserve(source.model.images.size());
+    
+    for (const auto &src : source.model.images) {
+      EncodedImage image {};
+      if (!src.uri.empty()) {
+        image.path = (source.folder / src.uri).native();
+      } else if (src.bufferView >= 0) {
+        const auto &view = source.model.bufferViews[src.bufferView];
+        const auto &buffer = source.buffers[view.buffer];
+        if (view.byteOffset + view.byteLength > buffer.size) {
+          throw std::runtime_error {"Image buffer view is out of range"};
+        }
+        image.path = src.name.empty()? "<embedded image>" : src.name;
+        image.data = buffer.ptr + view.byteOffset;
+        image.size = view.byteLength;
+      } else {
+        throw std::runtime_error {"Image without source"};
+      }
+      images.push_back(std::move(image));
+    }
+    return images;
+  }
+
+  //an image is compressed as metallic-roughness only if no material samples it as color
+  static std::vector<TextureUsage> tinygltf_get_image_usage(const tinygltf::Model &model) {
+    std::vector<bool> as_color(model.images.size(), false);
+    std::vector<bool> as_metallic_roughness(model.images.size(), false);
+
+    auto mark = [&](int texture, std::vector<bool> &flags) {
+      if (texture < 0 || texture >= int(model.textures.size())) {
+        return;
+      }
+      const int image = model.textures[texture].source;
+      if (image >= 0 && image < int(model.images.size())) {
+        flags[image] = true;
+      }
+    };
+
+    for (const auto &mat : model.materials) {
+      mark(mat.pbrMetallicRoughness.baseColorTexture.index, as_color);
+      mark(mat.pbrMetallicRoughness.metallicRoughnessTexture.index, as_metallic_roughness);
+    }
+
+    std::vector<TextureUsage> usage(model.images.size(), TextureUsage::Color);
+    for (uint32_t i = 0; i < usage.size(); i++) {
+      if (as_metallic_roughness[i] && !as_color[i]) {
+        usage[i] = TextureUsage::MetallicRoughness;
+      }
+    }
+    return usage;
+  }
+
+  //images are decoded, mipmapped and compressed on all cores
+  static std::vector<HostImage> tinygltf_cook_images(const GltfSource &source, bool compress) {
+    auto image_sources = tinygltf_get_images(source);
+    auto usage = tinygltf_get_image_usage(source.model);
+
+    std::vector<HostImage> images(image_sources.size());
+    parallel_for(image_sources.size(), [&](uint32_t i) {
+      if (!compress) {
+        images[i] = decode_image_rgba8(image_sources[i]);
+        return;
+      }
+      //BC5 is linear only, metallic-roughness mips are filtered without srgb conversion
+      auto decoded = decode_image_rgba8(image_sources[i], usage[i] == TextureUsage::Color);
+      images[i] = compress_image(decoded, usage[i]);
+    });
+
+    if (compress) {
+      uint64_t total_size = 0;
+      for (const auto &image : images) {
+        total_size += image.data.size();
+      }
+      std::cout << "Compressed " << images.size() << " images, " << (total_size >> 20u) << " MB\n";
+    }
+    return images;
+  }
+
+  static void tinygltf_load_materials(gpu::TransferCmdPool &transfer_pool, const GltfSource &source, CompiledScene &out_scene, const SceneLoadOptions &options) {
+    const auto &model = source.model;
+    if (options.stream_textures) {
+      auto host_images = std::make_shared<std::vector<HostImage>>(tinygltf_cook_images(source, options.compress_textures));
+      for (const auto &image : *host_images) {
+        out_scene.streamed_images.push_back(StreamedImage {image.format, image.width, image.height, image.mip_levels, image.data.data(), 0});
+      }
+      out_scene.images = upload_streamed_images(transfer_pool, out_scene.streamed_images);
+      out_scene.streamed_data = std::move(host_images);
+    } else if (options.compress_textures) {
+      out_scene.images = upload_host_images(transfer_pool, tinygltf_cook_images(source, true));
+    } else {
+      out_scene.images = load_images_rgba8(transfer_pool, tinygltf_get_images(source));
     }
 
     out_scene.samplers.reserve(model.samplers.size());
     for (auto &smp : model.samplers) {
-      auto cfg = gpu::DEFAULT_SAMPLER;
-      cfg.magFilter = gltf_remap_filter(smp.magFilter);
-      cfg.minFilter = gltf_remap_filter(smp.minFilter);
-      cfg.mipmapMode = gltf_remap_mipmap_mode(smp.minFilter);
-      cfg.addressModeU = gltf_remap_address_mode(smp.wrapS);
-      cfg.addressModeV = gltf_remap_address_mode(smp.wrapT);
-      out_scene.samplers.push_back(gpu::create_sampler(cfg));
+      out_scene.samplers.push_back(gpu::create_sampler(get_sampler_info(tinygltf_get_sampler(smp))));
     }
 
     out_scene.textures.reserve(model.textures.size());
     for (auto &src : model.textures) {
-      Texture tex;
-      tex.image_index = src.source;
-      tex.sampler_index = src.sampler;
-      out_scene.textures.push_back(tex);
+      out_scene.textures.push_back(tinygltf_get_texture(src));
     }
 
     out_scene.materials.reserve(model.materials.size());
-    for (uint32_t i = 0; i < model.materials.size(); i++) {
-      const auto &src = model.materials[i];
-      Material mat {};
-      mat.albedo_tex_index = src.pbrMetallicRoughness.baseColorTexture.index;
-      mat.metalic_roughness_index = src.pbrMetallicRoughness.metallicRoughnessTexture.index;
-      mat.alpha_cutoff = src.alphaCutoff;
-      mat.clip_alpha = (src.alphaMode == "MASK")? 1u : 0u;
-      std::cout << "Material " << mat.albedo_tex_index << " " << mat.metalic_roughness_index << "\n";
-      out_scene.materials.push_back(mat);
+    for (const auto &src : model.materials) {
+      out_scene.materials.push_back(tinygltf_get_material(src));
     }
   }
 
-  static Primitive tinygltf_load_prim(const tinygltf::Model &model, const tinygltf::Primitive &src, std::vector<Vertex> &vertices, std::vector<uint32_t> &indexes) {
-		const float *pos_ptr = nullptr;
-		const float *norm_ptr = nullptr;
-		const float *uv_ptr = nullptr;
+  //strided view over accessor elements
+  struct AccessorView {
+    const uint8_t *ptr = nullptr;
+    uint64_t stride = 0;
+    uint32_t count = 0;
+    int component_type = 0;
 
-    uint32_t first_index = static_cast<uint32_t>(indexes.size());
-		uint32_t vertex_start = static_cast<uint32_t>(vertices.size());
-		uint32_t index_count = 0;
-    uint32_t vertex_count = 0;
+    template <typename T, uint32_t N>
+    void read(uint32_t index, T *out) const {
+      std::memcpy(out, ptr + index * stride, sizeof(T) * N);
+    }
+  };
 
-    auto pos_it = src.attributes.find("POSITION");
-    auto norm_it = src.attributes.find("NORMAL");
-    auto tex_it = src.attributes.find("TEXCOORD_0");
+  static AccessorView tinygltf_get_accessor(const GltfSource &source, int accessor_id) {
+    const auto &accessor = source.model.accessors[accessor_id];
+    if (accessor.sparse.isSparse || accessor.bufferView < 0) {
+      throw std::runtime_error {"Sparse accessors are not supported"};
+    }
+
+    const auto &view = source.model.bufferViews[accessor.bufferView];
+    const auto &buffer = source.buffers[view.buffer];
     
-    if (pos_it != src.attributes.end()) {
-      auto &accessor = model.accessors[pos_it->second];
-      auto &view = model.bufferViews[accessor.bufferView];
-      pos_ptr = reinterpret_cast<const float*>(&model.buffers[view.buffer].data[accessor.byteOffset + view.byteOffset]);
-      vertex_count = accessor.count;
-    } else {
-      throw std::runtime_error {"No position"};
+    const uint64_t elem_size = tinygltf::GetComponentSizeInBytes(accessor.componentType) * tinygltf::GetNumComponentsInType(accessor.type);
+    const int stride = accessor.ByteStride(view);
+    if (stride <= 0) {
+      throw std::runtime_error {"Invalid accessor stride"};
+    }
+
+    const uint64_t offset = view.byteOffset + accessor.byteOffset;
+    if (accessor.count && offset + uint64_t(stride) * (accessor.count - 1) + elem_size > buffer.size) {
+      throw std::runtime_error {"Accessor is out of buffer range"};
+    }
+
+    return AccessorView {buffer.ptr + offset, uint64_t(stride), uint32_t(accessor.count), accessor.componentType};
+  }
+
+  static const AccessorView *tinygltf_find_attribute(const GltfSource &source, const tinygltf::Primitive &src, const char *name, int type, AccessorView &out) {
+    auto it = src.attributes.find(name);
+    if (it == src.attributes.end()) {
+      return nullptr;
+    }
+
+    const auto &accessor = source.model.accessors[it->second];
+    if (accessor.componentType != TINYGLTF_COMPONENT_TYPE_FLOAT || accessor.type != type) {
+      throw std::runtime_error {std::string{"Unsupported format of "} + name};
+    }
+
+    out = tinygltf_get_accessor(source, it->second);
+    return &out;
+  }
+
+  template <typename T>
+  static void tinygltf_read_indexes(const AccessorView &view, uint32_t *out) {
+    for (uint32_t i = 0; i < view.count; i++) {
+      T index;
+      view.read<T, 1>(i, &index);
+      out[i] = index;
     }
+  }
 
-    if (norm_it != src.attributes.end()) {
-      auto &accessor = model.accessors[norm_it->second];
-      auto &view = model.bufferViews[accessor.bufferView];
-      norm_ptr = reinterpret_cast<const float*>(&model.buffers[view.buffer].data[accessor.byteOffset + view.byteOffset]);
+  static uint32_t tinygltf_get_index_count(const tinygltf::Model &model, const tinygltf::Primitive &src) {
+    if (src.indices < 0) {
+      return model.accessors[src.attributes.at("POSITION")].count;
     }
+    return model.accessors[src.indices].count;
+  }
+
+  //vertices and indexes must have space for accessor counts, offsets of the result are not set
+  static Primitive tinygltf_load_prim(const GltfSource &source, const tinygltf::Primitive &src, Vertex *vertices, uint32_t *indexes) {
+    AccessorView pos_view, norm_view, uv_view;
 
-    if (tex_it != src.attributes.end()) {
-      auto &accessor = model.accessors[tex_it->second];
-      auto &view = model.bufferViews[accessor.bufferView];
-      uv_ptr = reinterpret_cast<const float*>(&model.buffers[view.buffer].data[accessor.byteOffset + view.byteOffset]);
+    auto pos = tinygltf_find_attribute(source, src, "POSITION", TINYGLTF_TYPE_VEC3, pos_view);
+    auto norm = tinygltf_find_attribute(source, src, "NORMAL", TINYGLTF_TYPE_VEC3, norm_view);
+    auto uv = tinygltf_find_attribute(source, src, "TEXCOORD_0", TINYGLTF_TYPE_VEC2, uv_view);
+
+    if (!pos) {
+      throw std::runtime_error {"No position"};
     }
 
+    const uint32_t vertex_count = pos->count;
+    if ((norm && norm->count != vertex_count) || (uv && uv->count != vertex_count)) {
+      throw std::runtime_error {"Attribute count mismatch"};
+    }
+
+    glm::vec3 bmin {std::numeric_limits<float>::max()};
+    glm::vec3 bmax {-std::numeric_limits<float>::max()};
+
     for (uint32_t i = 0; i < vertex_count; i++) {
       Vertex v {};
+      pos->read<float, 3>(i, &v.pos.x);
+      bmin = glm::min(bmin, v.pos);
+      bmax = glm::max(bmax, v.pos);
 
-      if (pos_ptr) {
-        v.pos = glm::vec3{pos_ptr[3 * i + 0], pos_ptr[3 * i + 1], pos_ptr[3 * i + 2]};
-      }
-
-      if (norm_ptr) {
-        v.norm = glm::vec3{norm_ptr[3 * i + 0], norm_ptr[3 * i + 1], norm_ptr[3 * i + 2]};
+      if (norm) {
+        norm->read<float, 3>(i, &v.norm.x);
       }
 
-      if (uv_ptr) {
-        v.uv = glm::vec2{uv_ptr[2 * i + 0], uv_ptr[2 * i + 1]};
+      if (uv) {
+        uv->read<float, 2>(i, &v.uv.x);
       }
-      vertices.push_back(v);
+      vertices[i] = v;
     }
 
-    auto &accessor = model.accessors[src.indices];
-    auto &view = model.bufferViews[accessor.bufferView];
-    auto &buffer = model.buffers[view.buffer];
-
-    index_count = accessor.count;
-    if (accessor.componentType == TINYGLTF_PARAMETER_TYPE_UNSIGNED_INT) {
-      const uint32_t *buf = reinterpret_cast<const uint32_t*>(&buffer.data[accessor.byteOffset + view.byteOffset]);  
-      for (uint32_t i = 0; i < index_count; i++) {
-        indexes.push_back(buf[i]);
+    uint32_t index_count = vertex_count;
+    if (src.indices >= 0) {
+      auto view = tinygltf_get_accessor(source, src.indices);
+      index_count = view.count;
+
+      if (view.component_type == TINYGLTF_PARAMETER_TYPE_UNSIGNED_INT) {
+        tinygltf_read_indexes<uint32_t>(view, indexes);
+      } else if (view.component_type == TINYGLTF_PARAMETER_TYPE_UNSIGNED_SHORT) {
+        tinygltf_read_indexes<uint16_t>(view, indexes);
+      } else if (view.component_type == TINYGLTF_PARAMETER_TYPE_UNSIGNED_BYTE) {
+        tinygltf_read_indexes<uint8_t>(view, indexes);
+      } else {
+        throw std::runtime_error {"Unsupported index type"};
       }
-    } else if (accessor.componentType == TINYGLTF_PARAMETER_TYPE_UNSIGNED_SHORT) {
-      const uint16_t *buf = reinterpret_cast<const uint16_t*>(&buffer.data[accessor.byteOffset + view.byteOffset]);  
-      for (uint32_t i = 0; i < index_count; i++) {
-        indexes.push_back(buf[i]);
-      }
-    } else if (accessor.componentType == TINYGLTF_PARAMETER_TYPE_UNSIGNED_BYTE) {
-      const uint8_t *buf = reinterpret_cast<const uint8_t*>(&buffer.data[accessor.byteOffset + view.byteOffset]);  
+    } else {
       for (uint32_t i = 0; i < index_count; i++) {
-        indexes.push_back(buf[i]);
+        indexes[i] = i;
       }
-    } else {
-      throw std::runtime_error {"Unsupported index type"};
     }
 
     Primitive prim {};
     prim.material_index = src.material;
     prim.index_count = index_count;
-    prim.vertex_offset = vertex_start;
-    prim.index_offset = first_index;
-
-    std::cout << "Proccessed prim " << prim.vertex_offset << " " << prim.index_offset << " " << prim.index_count << "\n";
+    prim.vertex_count = vertex_count;
+    prim.bounds_center = vertex_count? 0.5f * (bmin + bmax) : glm::vec3 {0.f};
+    prim.bounds_extent = vertex_count? 0.5f * (bmax - bmin) : glm::vec3 {0.f};
     return prim;
   } 
 
-  static void tinygltf_load_meshes(gpu::TransferCmdPool &transfer_pool, const fs::path folder, const tinygltf::Model &model, CompiledScene &out_scene, bool for_ray_tracing) {
-    std::vector<Vertex> vertices;
-    std::vector<uint32_t> indexes;
+  static uint32_t tinygltf_get_vertex_count(const tinygltf::Model &model, const tinygltf::Primitive &src) {
+    auto pos_it = src.attributes.find("POSITION");
+    if (pos_it == src.attributes.end()) {
+      throw std::runtime_error {"No position"};
+    }
+    return model.accessors[pos_it->second].count;
+  }
+
+  static uint32_t get_index_size(uint32_t vertex_count) {
+    return (vertex_count <= (1u << 16u))? sizeof(uint16_t) : sizeof(uint32_t);
+  }
 
-    out_scene.primitives.clear();
+  //geometry before welding, tinygltf_load_geometry needs this much space
+  static void tinygltf_get_geometry_bounds(const tinygltf::Model &model, uint64_t &max_vertex_count, uint64_t &max_index_count) {
+    max_vertex_count = 0;
+    max_index_count = 0;
+    for (const auto &mesh : model.meshes) {
+      for (const auto &prim : mesh.primitives) {
+        max_vertex_count += tinygltf_get_vertex_count(model, prim);
+        max_index_count += tinygltf_get_index_count(model, prim);
+      }
+    }
+  }
 
-    out_scene.root_meshes.reserve(model.meshes.size());
+  //primitives are converted on all cores in place, at their unwelded offsets, then compacted to the start of vertices and indexes.
+  //vertices and indexes may point to mapped staging memory with space for tinygltf_get_geometry_bounds,
+  //vertex_count and index_size receive the sizes of the compacted geometry, indexes are narrowed to prim.index_size
+  static void tinygltf_load_geometry(const GltfSource &source, bool optimize_meshes, Vertex *vertices, uint8_t *indexes, std::vector<Primitive> &primitives, std::vector<Meshlet> &meshlets, std::vector<BaseMesh> &root_meshes, uint64_t &vertex_count, uint64_t &index_size) {
+    const auto &model = source.model;
+    
+    std::vector<const tinygltf::Primitive*> src_prims;
+    root_meshes.clear();
+    root_meshes.reserve(model.meshes.size());
     for (const auto &src : model.meshes) {
       BaseMesh base_mesh;
       base_mesh.primitive_indexes.reserve(src.primitives.size());
-      uint32_t primitive_index = out_scene.primitives.size();
-
       for (const auto &prim : src.primitives) {
-        auto res = tinygltf_load_prim(model, prim, vertices, indexes); 
-        out_scene.primitives.push_back(std::move(res));
-        base_mesh.primitive_indexes.push_back(primitive_index);
-        primitive_index++;
+        base_mesh.primitive_indexes.push_back(src_prims.size());
+        src_prims.push_back(&prim);
       }
+      root_meshes.push_back(std::move(base_mesh));
+    }
 
-      out_scene.root_meshes.push_back(std::move(base_mesh));
+    primitives.clear();
+    primitives.resize(src_prims.size());
+    std::vector<uint64_t> src_vertex_offsets(src_prims.size());
+    std::vector<uint64_t> src_index_offsets(src_prims.size());
+    for (uint32_t i = 1; i < src_prims.size(); i++) {
+      src_vertex_offsets[i] = src_vertex_offsets[i - 1] + tinygltf_get_vertex_count(model, *src_prims[i - 1]);
+      src_index_offsets[i] = src_index_offsets[i - 1] + tinygltf_get_index_count(model, *src_prims[i - 1]);
     }
-    //upload vertices
-    const uint64_t verts_size = sizeof(Vertex) * vertices.size();
-    const uint64_t index_size = sizeof(uint32_t) * indexes.size();
+
+    std::vector<MeshStats> stats_before(optimize_meshes? src_prims.size() : 0);
+    std::vector<MeshStats> stats_after(optimize_meshes? src_prims.size() : 0);
+    std::vector<std::vector<Meshlet>> prim_meshlets(src_prims.size());
+
+    parallel_for(src_prims.size(), [&](uint32_t i) {
+      auto local_vertices = vertices + src_vertex_offsets[i];
+      auto local_indexes = reinterpret_cast<uint32_t*>(indexes) + src_index_offsets[i];
+
+      auto &prim = primitives[i];
+      prim = tinygltf_load_prim(source, *src_prims[i], local_vertices, local_indexes);
+      prim.vertex_count = weld_vertices(local_vertices, prim.vertex_count, local_indexes, prim.index_count);
+      prim.index_size = get_index_size(prim.vertex_count);
+
+      if (optimize_meshes) {
+        optimize_mesh(local_vertices, prim.vertex_count, local_indexes, prim.index_count, &stats_before[i], &stats_after[i]);
+      }
+
+      const int material = src_prims[i]->material;
+      const bool double_sided = material >= 0 && model.materials[material].doubleSided;
+      build_meshlets(local_vertices, prim.vertex_count, local_indexes, prim.index_count, !double_sided, prim_meshlets[i]);
+    });
+
+    meshlets.clear();
+    vertex_count = 0;
+    index_size = 0;
+    MeshStats total_before {}, total_after {};
+    uint64_t source_vertices = 0;
+
+    for (uint32_t i = 0; i < primitives.size(); i++) {
+      auto &prim = primitives[i];
+      if (prim_meshlets[i].size() > MAX_PRIMITIVE_MESHLETS) {
+        throw std::runtime_error {"Too many meshlets in primitive"};
+      }
+
+      prim.vertex_offset = vertex_count;
+      prim.index_offset = index_size/prim.index_size;
+      vertex_count += prim.vertex_count;
+      index_size += (uint64_t(prim.index_size) * prim.index_count + 3) & ~3ull;
+      source_vertices += tinygltf_get_vertex_count(model, *src_prims[i]);
+
+      //compacted offsets never pass the source ones, earlier primitives are already moved out of the way
+      std::memmove(vertices + prim.vertex_offset, vertices + src_vertex_offsets[i], sizeof(Vertex) * prim.vertex_count);
+
+      const uint8_t *src_indexes = indexes + sizeof(uint32_t) * src_index_offsets[i];
+      uint8_t *dst_indexes = indexes + uint64_t(prim.index_size) * prim.index_offset;
+      if (prim.index_size == sizeof(uint16_t)) {
+        //front to back, every write lands below the indexes still to be read
+        for (uint32_t j = 0; j < prim.index_count; j++) {
+          uint32_t index;
+          std::memcpy(&index, src_indexes + sizeof(uint32_t) * j, sizeof(uint32_t));
+          const uint16_t narrow_index = index;
+          std::memcpy(dst_indexes + sizeof(uint16_t) * j, &narrow_index, sizeof(uint16_t));
+        }
+      } else {
+        std::memmove(dst_indexes, src_indexes, sizeof(uint32_t) * prim.index_count);
+      }
+
+      prim.first_meshlet = meshlets.size();
+      prim.meshlet_count = prim_meshlets[i].size();
+      for (auto &meshlet : prim_meshlets[i]) {
+        meshlet.primitive_index = i;
+        meshlets.push_back(meshlet);
+      }
+
+      if (optimize_meshes) {
+        total_before += stats_before[i];
+        total_after += stats_after[i];
+      }
+    }
+
+    if (vertex_count > UINT32_MAX || index_size/sizeof(uint16_t) > UINT32_MAX) {
+      throw std::runtime_error {"Scene geometry is too big"};
+    }
+
+    std::cout << "Welded " << source_vertices << " -> " << vertex_count << " vertices, " << index_size << " bytes of indexes\n";
+
+    if (optimize_meshes) {
+      std::cout << "Mesh optimizer: " << total_after.triangles << " triangles, ";
+      std::cout << "ACMR " << total_before.get_acmr() << " -> " << total_after.get_acmr() << ", ";
+      std::cout << "overdraw " << total_before.get_overdraw() << " -> " << total_after.get_overdraw() << "\n";
+    }
+  }
+
+  static void create_scene_geometry_buffers(CompiledScene &out_scene, uint64_t verts_size, uint64_t index_size, bool for_ray_tracing) {
     const uint64_t prim_size = sizeof(Primitive) * out_scene.primitives.size();
     const uint64_t mat_size = sizeof(Material) * out_scene.materials.size();
+    const uint64_t meshlet_size = sizeof(Meshlet) * out_scene.meshlets.size();
 
-    VkBufferUsageFlags buffer_flags = VK_BUFFER_USAGE_TRANSFER_DST_BIT|VK_BUFFER_USAGE_STORAGE_BUFFER_BIT; 
+    //transfer src for read_scene_triangles
+    VkBufferUsageFlags buffer_flags = VK_BUFFER_USAGE_TRANSFER_DST_BIT|VK_BUFFER_USAGE_TRANSFER_SRC_BIT|VK_BUFFER_USAGE_STORAGE_BUFFER_BIT; 
     if (for_ray_tracing) {
       buffer_flags |= VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT|VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR;
     }
@@ -326,17 +663,91 @@ namespace scene {
     
     out_scene.primitive_buffer = gpu::create_buffer(VMA_MEMORY_USAGE_GPU_ONLY, prim_size, VK_BUFFER_USAGE_TRANSFER_DST_BIT|VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
     out_scene.material_buffer = gpu::create_buffer(VMA_MEMORY_USAGE_GPU_ONLY, mat_size, VK_BUFFER_USAGE_TRANSFER_DST_BIT|VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
-  
-    const uint32_t TRANSFER_SIZE = 1024 * 1024;
-    auto transfer_buffer = gpu::create_buffer(VMA_MEMORY_USAGE_CPU_TO_GPU, TRANSFER_SIZE, VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
+    out_scene.meshlet_buffer = gpu::create_buffer(VMA_MEMORY_USAGE_GPU_ONLY, meshlet_size, VK_BUFFER_USAGE_TRANSFER_DST_BIT|VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+  }
+
+  //geometry is converted and welded straight in one staging buffer and copied with a single submission.
+  //The staging buffer is sized for the unwelded geometry, only the welded part is copied
+  static void tinygltf_load_meshes(gpu::TransferCmdPool &transfer_pool, const GltfSource &source, CompiledScene &out_scene, const SceneLoadOptions &options) {
+    const auto layout = options.vertex_layout;
+    uint64_t max_vertex_count = 0, max_index_count = 0;
+    tinygltf_get_geometry_bounds(source.model, max_vertex_count, max_index_count);
+
+    const uint64_t max_verts_size = sizeof(Vertex) * max_vertex_count;
+    auto staging = gpu::create_buffer(VMA_MEMORY_USAGE_CPU_ONLY, max_verts_size + sizeof(uint32_t) * max_index_count, VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
+    auto staging_ptr = static_cast<uint8_t*>(staging->get_mapped_ptr());
+
+    uint64_t vertex_count = 0, index_size = 0;
+    tinygltf_load_geometry(source, options.optimize_meshes, reinterpret_cast<Vertex*>(staging_ptr), staging_ptr + max_verts_size,
+      out_scene.primitives, out_scene.meshlets, out_scene.root_meshes, vertex_count, index_size);
+
+    const uint64_t verts_size = get_vertex_stride(layout) * vertex_count;
     
-    copy_data(transfer_pool, out_scene.vertex_buffer, transfer_buffer, verts_size, (uint8_t*)vertices.data());
-    copy_data(transfer_pool, out_scene.index_buffer, transfer_buffer, index_size, (uint8_t*)indexes.data());
-    copy_data(transfer_pool, out_scene.primitive_buffer, transfer_buffer, prim_size, (uint8_t*)out_scene.primitives.data());
-    copy_data(transfer_pool, out_scene.material_buffer, transfer_buffer, mat_size, (uint8_t*)out_scene.materials.data());
+    if (layout == VertexLayout::Packed) {
+      pack_vertices(reinterpret_cast<const Vertex*>(staging_ptr), out_scene.primitives, reinterpret_cast<PackedVertex*>(staging_ptr));
+    }
+    staging->flush();
+    
+    out_scene.vertex_layout = layout;
+    create_scene_geometry_buffers(out_scene, verts_size, index_size, options.for_ray_tracing);
+    transfer_pool.upload_buffer(out_scene.primitive_buffer, 0, sizeof(Primitive) * out_scene.primitives.size(), out_scene.primitives.data());
+    transfer_pool.upload_buffer(out_scene.material_buffer, 0, sizeof(Material) * out_scene.materials.size(), out_scene.materials.data());
+    transfer_pool.upload_buffer(out_scene.meshlet_buffer, 0, sizeof(Meshlet) * out_scene.meshlets.size(), out_scene.meshlets.data());
+
+    VkBufferCopy verts_region {0, 0, verts_size};
+    VkBufferCopy index_region {max_verts_size, 0, index_size};
+
+    auto cmd = transfer_pool.get_cmd_buffer();
+    VkCommandBufferBeginInfo begin_info {VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO};
+    vkBeginCommandBuffer(cmd, &begin_info);
+    vkCmdCopyBuffer(cmd, staging->api_buffer(), out_scene.vertex_buffer->api_buffer(), 1, &verts_region);
+    vkCmdCopyBuffer(cmd, staging->api_buffer(), out_scene.index_buffer->api_buffer(), 1, &index_region);
+    vkEndCommandBuffer(cmd);
+    transfer_pool.submit_and_wait();
   }
 
-  static void tinygltf_load_nodes(CompiledScene &out_scene, const tinygltf::Model &model, const tinygltf::Node &src_node, BaseNode &out_node) {
+  //primitives, meshlets and materials are taken from out_scene
+  void upload_scene_geometry(gpu::TransferCmdPool &transfer_pool, CompiledScene &out_scene, const Vertex *vertices, uint64_t vertex_count, const void *indexes, uint64_t index_size, const SceneLoadOptions &options) {
+    const auto layout = options.vertex_layout;
+    const uint64_t prim_size = sizeof(Primitive) * out_scene.primitives.size();
+    const uint64_t mat_size = sizeof(Material) * out_scene.materials.size();
+    const uint64_t meshlet_size = sizeof(Meshlet) * out_scene.meshlets.size();
+    const uint64_t verts_size = get_vertex_stride(layout) * vertex_count;
+
+    std::vector<PackedVertex> packed;
+    if (layout == VertexLayout::Packed) {
+      packed.resize(vertex_count);
+      pack_vertices(vertices, out_scene.primitives, packed.data());
+    }
+
+    out_scene.vertex_layout = layout;
+    create_scene_geometry_buffers(out_scene, verts_size, index_size, options.for_ray_tracing);
+    transfer_pool.upload_buffer(out_scene.vertex_buffer, 0, verts_size, packed.size()? (const void*)packed.data() : (const void*)vertices);
+    transfer_pool.upload_buffer(out_scene.index_buffer, 0, index_size, indexes);
+    transfer_pool.upload_buffer(out_scene.primitive_buffer, 0, prim_size, out_scene.primitives.data());
+    transfer_pool.upload_buffer(out_scene.material_buffer, 0, mat_size, out_scene.materials.data());
+    transfer_pool.upload_buffer(out_scene.meshlet_buffer, 0, meshlet_size, out_scene.meshlets.data());
+    transfer_pool.flush();
+  }
+
+  static void flattern_nodes(const BaseNode &node, const glm::mat4 &parent_transform, std::vector<FlatNode> &out) {
+    out.push_back(FlatNode {&node, parent_transform * node.transform});
+    const glm::mat4 transform = out.back().world_transform;
+
+    for (const auto &child : node.children) {
+      flattern_nodes(child, transform, out);
+    }
+  }
+
+  std::vector<FlatNode> flattern_nodes(const std::vector<BaseNode> &roots) {
+    std::vector<FlatNode> out;
+    for (const auto &node : roots) {
+      flattern_nodes(node, glm::identity<glm::mat4>(), out);
+    }
+    return out;
+  }
+
+  static void tinygltf_load_nodes(uint32_t &transforms_count, const tinygltf::Model &model, const tinygltf::Node &src_node, BaseNode &out_node) {
     out_node.transform = glm::identity<glm::mat4>();
     out_node.mesh_index = src_node.mesh;
 
@@ -357,47 +768,40 @@ namespace scene {
     out_node.children.resize(src_node.children.size());
 
     if (out_node.mesh_index >= 0) {
-      out_node.transform_index = out_scene.transforms_count;
-      out_scene.transforms_count++;
+      out_node.transform_index = transforms_count;
+      transforms_count++;
     }
     else {
       out_node.transform_index = -1;
     }
 
     for (uint32_t i = 0; i < src_node.children.size(); i++) {
-      tinygltf_load_nodes(out_scene, model, model.nodes[src_node.children[i]], out_node.children[i]);
+      tinygltf_load_nodes(transforms_count, model, model.nodes[src_node.children[i]], out_node.children[i]);
     }
   }
 
-  CompiledScene load_tinygltf_scene(gpu::TransferCmdPool &transfer_pool, const std::string &path, bool for_ray_traing) {
-    CompiledScene result_scene {};
-    tinygltf::Model model;
-    tinygltf::TinyGLTF loader {};
-    std::string err, warn;
-    
-    if (!loader.LoadASCIIFromFile(&model, &err, &warn, path)) {
-      throw std::runtime_error {err};
-    }
-    auto folder = fs::path{path}.parent_path();
-    tinygltf_load_materials(transfer_pool, folder, model, result_scene);
-    tinygltf_load_meshes(transfer_pool, folder, model, result_scene, for_ray_traing); //call only after load_materials
-    
+  static void tinygltf_load_scene_nodes(const tinygltf::Model &model, uint32_t &transforms_count, std::vector<BaseNode> &base_nodes) {
     int default_scene = std::max(0, model.defaultScene);
     const auto &scene = model.scenes[default_scene];
 
-    result_scene.base_nodes.resize(scene.nodes.size());
+    base_nodes.resize(scene.nodes.size());
     std::cout << "Loading scene " << default_scene << " with "<< scene.nodes.size() << " root nodes\n";  
-    
 
     for (uint32_t i = 0; i < scene.nodes.size(); i++) {
       auto node_id = scene.nodes[i];
       std::cout << "Loading node " << node_id << "\n";
-      tinygltf_load_nodes(result_scene, model, model.nodes[node_id], result_scene.base_nodes[i]);
-    }
-    
-    if (!warn.empty()) {
-      std::cout << "[W] " << warn.c_str() << "\n";
+      tinygltf_load_nodes(transforms_count, model, model.nodes[node_id], base_nodes[i]);
     }
+  }
+
+  CompiledScene load_tinygltf_scene(gpu::TransferCmdPool &transfer_pool, const std::string &path, const SceneLoadOptions &options) {
+    CompiledScene result_scene {};
+    GltfSource source;
+    tinygltf_open(path, source);
+
+    tinygltf_load_materials(transfer_pool, source, result_scene, options);
+    tinygltf_load_meshes(transfer_pool, source, result_scene, options); //call only after load_materials
+    tinygltf_load_scene_nodes(source.model, result_scene.transforms_count, result_scene.base_nodes);
 
     std::cout << "Loaded scene ";
     std::cout << result_scene.primitives.size() << " primitives ";
@@ -413,4 +817,38 @@ namespace scene {
     return result_scene;
   }
 
-}
\ No newline at end of file
+  CookedScene cook_tinygltf_scene(const std::string &path, const SceneLoadOptions &options) {
+    CookedScene result {};
+    GltfSource source;
+    tinygltf_open(path, source);
+    const auto &model = source.model;
+    
+    result.images = tinygltf_cook_images(source, options.compress_textures);
+
+    for (const auto &smp : model.samplers) {
+      result.samplers.push_back(tinygltf_get_sampler(smp));
+    }
+
+    for (const auto &src : model.textures) {
+      result.textures.push_back(tinygltf_get_texture(src));
+    }
+
+    for (const auto &src : model.materials) {
+      result.materials.push_back(tinygltf_get_material(src));
+    }
+
+    uint64_t max_vertex_count = 0, max_index_count = 0;
+    tinygltf_get_geometry_bounds(model, max_vertex_count, max_index_count);
+    result.vertices.resize(max_vertex_count);
+    result.indexes.resize(sizeof(uint32_t) * max_index_count);
+
+    uint64_t vertex_count = 0, index_size = 0;
+    tinygltf_load_geometry(source, options.optimize_meshes, result.vertices.data(), result.indexes.data(),
+      result.primitives, result.meshlets, result.root_meshes, vertex_count, index_size);
+    result.vertices.resize(vertex_count);
+    result.indexes.resize(index_size);
+    tinygltf_load_scene_nodes(model, result.transforms_count, result.base_nodes);
+    return result;
+  }
+
+}
@@ -9,6 +9,8 @@
 #include <lib/volk.h>
 #include "gpu/gpu.hpp"
 
+#include <memory>
+
 namespace scene {
   constexpr uint32_t INVALID_TEXTURE = UINT32_MAX;
 
@@ -18,11 +20,58 @@ namespace scene {
     glm::vec2 uv;
   };
 
+  //16 byte vertex, position is quantized relative to the primitive bounds
+  struct PackedVertex {
+    int16_t pos[4];   //R16G16B16A16_SNORM, w is unused
+    uint16_t norm[2]; //R16G16_UNORM octahedral normal
+    uint32_t uv;      //R16G16_SFLOAT
+  };
+
+  static_assert(sizeof(PackedVertex) == 16, "PackedVertex must be 16 bytes");
+
+  enum class VertexLayout : uint32_t {
+    Full,  //Vertex
+    Packed //PackedVertex
+  };
+
+  struct SceneLoadOptions {
+    bool for_ray_tracing = true;
+    VertexLayout vertex_layout = VertexLayout::Full;
+    //reorder triangles and vertices of every primitive for vertex cache, overdraw and vertex fetch, applied at cook time
+    bool optimize_meshes = false;
+    //cook albedo to BC1/BC3 and metallic-roughness to BC5 with mips built on the CPU
+    bool compress_textures = false;
+    //keep host copies of image mips and create images with only their mip tail, TextureStreamer uploads the rest on demand
+    bool stream_textures = false;
+  };
+
   struct Primitive {
     uint32_t vertex_offset;
-    uint32_t index_offset;
+    uint32_t index_offset; //in indexes of index_size, ranges of all primitives start at 4 byte boundary
     uint32_t index_count;
     uint32_t material_index;
+    //pos = bounds_center + bounds_extent * packed_pos
+    glm::vec3 bounds_center;
+    uint32_t vertex_count;
+    glm::vec3 bounds_extent;
+    uint32_t first_meshlet;
+    uint32_t meshlet_count;
+    uint32_t index_size; //2 if the primitive has no more than 65536 vertices, 4 otherwise
+    uint32_t pad[2];
+  };
+
+  constexpr uint32_t MESHLET_MAX_VERTICES = 64;
+  constexpr uint32_t MESHLET_MAX_TRIANGLES = 128; //triangle_id.glsl TRIANGLE_BITS
+  constexpr uint32_t MAX_PRIMITIVE_MESHLETS = 1u << 13u; //triangle_id.glsl MESHLET_BITS
+
+  //contiguous range of primitive triangles, bounds are in primitive space
+  struct Meshlet {
+    uint32_t primitive_index;
+    uint32_t first_triangle; //relative to the primitive
+    uint32_t triangle_count;
+    uint32_t pad;
+    glm::vec4 sphere; //center, radius
+    glm::vec4 cone;   //axis, cutoff. cutoff >= 1 disables cone culling
   };
 
   struct BaseMesh {
@@ -48,6 +97,19 @@ namespace scene {
     uint32_t sampler_index;
   };
 
+  //mips not larger than this are resident from load time when textures are streamed
+  constexpr uint32_t STREAMING_TAIL_SIZE = 64;
+
+  //host copy of a streamed image, mips are packed one after another starting from mip 0
+  struct StreamedImage {
+    VkFormat format;
+    uint32_t width;
+    uint32_t height;
+    uint32_t mip_levels;
+    const uint8_t *data;
+    uint32_t resident_mip; //mip of data stored in mip 0 of CompiledScene::images
+  };
+
   struct CompiledScene {
     CompiledScene() {}
 
@@ -58,28 +120,97 @@ namespace scene {
     CompiledScene &operator=(CompiledScene &) = delete;
 
     uint32_t transforms_count = 0;
+    VertexLayout vertex_layout = VertexLayout::Full;
     
     std::vector<Material> materials;
     gpu::BufferPtr vertex_buffer;
     gpu::BufferPtr index_buffer;
     gpu::BufferPtr primitive_buffer;
     gpu::BufferPtr material_buffer;
+    gpu::BufferPtr meshlet_buffer;
 
     std::vector<gpu::ImagePtr> images;    
     std::vector<VkSampler> samplers;
     std::vector<Texture> textures;
+    
+    //empty unless SceneLoadOptions::stream_textures is set, indexed like images
+    std::vector<StreamedImage> streamed_images;
+    std::shared_ptr<const void> streamed_data; //owns StreamedImage::data
+    uint32_t images_version = 0; //incremented every time images are replaced
 
     std::vector<Primitive> primitives;
+    std::vector<Meshlet> meshlets;
     std::vector<BaseMesh> root_meshes;
     std::vector<BaseNode> base_nodes;
   };
 
-  gpu::VertexInput get_vertex_input();
-  gpu::VertexInput get_vertex_input_shadow();
-  gpu::VertexInput get_vertex_input_pos_uv();
+  enum class TextureUsage {
+    Color,
+    MetallicRoughness
+  };
+
+  //host side image, mips are packed one after another starting from mip 0
+  struct HostImage {
+    VkFormat format = VK_FORMAT_UNDEFINED;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t mip_levels = 0;
+    std::vector<uint8_t> data;
+  };
+
+  //encoded image file, either on disk or embedded into a glb buffer
+  struct EncodedImage {
+    std::string path;
+    const uint8_t *data = nullptr;
+    uint64_t size = 0;
+  };
+
+  gpu::VertexInput get_vertex_input(VertexLayout layout = VertexLayout::Full);
+  gpu::VertexInput get_vertex_input_shadow(VertexLayout layout = VertexLayout::Full);
+  gpu::VertexInput get_vertex_input_pos_uv(VertexLayout layout = VertexLayout::Full);
+  uint32_t get_vertex_stride(VertexLayout layout);
+  VkIndexType get_index_type(const Primitive &prim);
+
+  //uses primitive bounds, dst may point to src if primitives are sorted by vertex_offset
+  void pack_vertices(const Vertex *src, const std::vector<Primitive> &primitives, PackedVertex *dst);
+
+  struct FlatNode {
+    const BaseNode *node;
+    glm::mat4 world_transform;
+  };
+
+  //all nodes in preorder, children follow their parent. TLAS instances and CpuTriangleSoup instances are the mesh nodes in this order
+  std::vector<FlatNode> flattern_nodes(const std::vector<BaseNode> &roots);
+
+  CompiledScene load_tinygltf_scene(gpu::TransferCmdPool &transfer_pool, const std::string &path, const SceneLoadOptions &options = {});
+  //same as load_tinygltf_scene, but goes through a cooked <path>.scache file which is rebuilt when the sources or cook options change
+  CompiledScene load_scene_cached(gpu::TransferCmdPool &transfer_pool, const std::string &path, const SceneLoadOptions &options = {});
 
-  CompiledScene load_tinygltf_scene(gpu::TransferCmdPool &transfer_pool, const std::string &path, bool for_ray_traing = true);
   gpu::ImagePtr load_image_rgba8(gpu::TransferCmdPool &transfer_pool, const char *path);
+  //decodes images on all cores and uploads them with one submission
+  std::vector<gpu::ImagePtr> load_images_rgba8(gpu::TransferCmdPool &transfer_pool, const std::vector<EncodedImage> &sources);
+  //mips are box filtered in linear space, srgb = false gives an R8G8B8A8_UNORM image
+  HostImage decode_image_rgba8(const EncodedImage &source, bool srgb = true);
+  std::vector<gpu::ImagePtr> upload_host_images(gpu::TransferCmdPool &transfer_pool, const std::vector<HostImage> &images);
+  
+  //sampled image with swizzle from get_image_swizzle, left in TRANSFER_DST_OPTIMAL for upload_image_mips
+  gpu::ImagePtr create_scene_image(VkFormat fmt, uint32_t width, uint32_t height, uint32_t mip_levels);
+  //BC5 metallic-roughness images keep roughness and metallic in R and G, views move them back to G and B
+  VkComponentMapping get_image_swizzle(VkFormat fmt);
+
+  uint64_t get_mip_byte_size(VkFormat fmt, uint32_t width, uint32_t height, uint32_t mip);
+  uint64_t get_image_byte_size(VkFormat fmt, uint32_t width, uint32_t height, uint32_t mip_levels);
+  //queues all mips packed one after another, image stays in TRANSFER_DST_OPTIMAL until set_image_sampled
+  void upload_image_mips(gpu::TransferCmdPool &transfer_pool, const gpu::ImagePtr &dst, const uint8_t *data);
+  void set_image_sampled(VkCommandBuffer cmd, const gpu::ImagePtr &dst);
+
+  //first mip not larger than STREAMING_TAIL_SIZE
+  uint32_t get_streaming_tail_mip(uint32_t width, uint32_t height, uint32_t mip_levels);
+  const uint8_t *get_streamed_mip_data(const StreamedImage &src, uint32_t mip);
+  //image with mips [first_mip, mip_levels) of src, layout is undefined
+  gpu::ImagePtr create_streamed_image(const StreamedImage &src, uint32_t first_mip);
+  //uploads mip tails of all images and sets resident_mip
+  std::vector<gpu::ImagePtr> upload_streamed_images(gpu::TransferCmdPool &transfer_pool, std::vector<StreamedImage> &images);
 }
 
 #endif
\ No newline at end of file
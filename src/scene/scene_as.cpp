@@ -1,5 +1,6 @@
 #include "scene_as.hpp"
 #include <iostream>
+#include <algorithm>
 
 namespace scene {
 
@@ -14,40 +15,95 @@ namespace scene {
         vkDestroyAccelerationStructureKHR(vk_device, blas, nullptr);
       }
     }
+    as_memory::free_storage(blas_heap);
+    as_memory::free_storage(tlas_memory);
   }
 
-  void SceneAccelerationStructure::build(gpu::TransferCmdPool &transfer_pool, const CompiledScene &source) {
-    for (const auto &mesh : source.root_meshes) { 
-      build_blas(transfer_pool, mesh, source);
+  //packed positions are dequantized by a per geometry transform
+  static gpu::BufferPtr create_dequant_transforms(gpu::TransferCmdPool &transfer_pool, const CompiledScene &source) {
+    auto format = VK_FORMAT_R16G16B16A16_SNORM;
+    VkFormatProperties props {};
+    vkGetPhysicalDeviceFormatProperties(gpu::app_device().api_physical_device(), format, &props);
+    if (!(props.bufferFeatures & VK_FORMAT_FEATURE_ACCELERATION_STRUCTURE_VERTEX_BUFFER_BIT_KHR)) {
+      throw std::runtime_error {"Packed vertex format is not supported for acceleration structures"};
     }
+
+    std::vector<VkTransformMatrixKHR> transforms;
+    transforms.reserve(source.primitives.size());
+    for (const auto &prim : source.primitives) {
+      const auto &c = prim.bounds_center;
+      const auto &e = prim.bounds_extent;
+      transforms.push_back(VkTransformMatrixKHR {
+        e.x, 0.f, 0.f, c.x,
+        0.f, e.y, 0.f, c.y,
+        0.f, 0.f, e.z, c.z
+      });
+    }
+
+    const uint64_t size = sizeof(VkTransformMatrixKHR) * std::max<uint64_t>(transforms.size(), 1);
+    auto buffer = gpu::create_buffer(VMA_MEMORY_USAGE_GPU_ONLY, size,
+      VK_BUFFER_USAGE_TRANSFER_DST_BIT|VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT|VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR);
+    
+    transfer_pool.upload_buffer(buffer, 0, sizeof(VkTransformMatrixKHR) * transforms.size(), transforms.data());
+    transfer_pool.flush();
+    return buffer;
+  }
+
+  void SceneAccelerationStructure::build(gpu::TransferCmdPool &transfer_pool, const CompiledScene &source, bool compact) {
+    if (source.vertex_layout == VertexLayout::Packed) {
+      dequant_transforms = create_dequant_transforms(transfer_pool, source);
+    }
+
+    build_blases(transfer_pool, source, compact);
     build_tlas(transfer_pool, source);
+    dequant_transforms.release();
+  }
+
+  //acceleration structures must start at 256 byte offsets of their buffer
+  constexpr uint64_t AS_STORAGE_ALIGNMENT = as_memory::STORAGE_ALIGNMENT;
+
+  static uint64_t align_up(uint64_t value, uint64_t alignment) {
+    return (value + alignment - 1)/alignment * alignment;
   }
 
-  void SceneAccelerationStructure::build_blas(gpu::TransferCmdPool &transfer_pool, const BaseMesh &mesh, const CompiledScene &source) {
-    uint32_t verts_count = source.vertex_buffer->get_size()/sizeof(Vertex);
+  //geometry of one root mesh, build info points into the vectors and is refreshed before recording
+  struct BlasInput {
+    std::vector<VkAccelerationStructureGeometryKHR> geometry;
+    std::vector<VkAccelerationStructureBuildRangeInfoKHR> ranges;
+    std::vector<uint32_t> max_primitives;
+    VkAccelerationStructureBuildGeometryInfoKHR info;
+    VkAccelerationStructureBuildSizesInfoKHR sizes;
+    uint64_t storage_offset;
+  };
+
+  static void get_blas_input(const BaseMesh &mesh, const CompiledScene &source, const gpu::BufferPtr &dequant_transforms, bool compact, BlasInput &out) {
+    const bool packed = source.vertex_layout == VertexLayout::Packed;
+    const uint32_t vertex_stride = get_vertex_stride(source.vertex_layout);
+    
+    uint32_t verts_count = source.vertex_buffer->get_size()/vertex_stride;
     if (!verts_count) {
       verts_count = 1;
     }
-  
-    std::vector<VkAccelerationStructureGeometryKHR> geometry_data;
-    std::vector<VkAccelerationStructureBuildRangeInfoKHR> prim_data;
-    std::vector<uint32_t> geometry_prims;
 
-    geometry_data.reserve(mesh.primitive_indexes.size());
-    prim_data.reserve(mesh.primitive_indexes.size());
-    geometry_prims.reserve(mesh.primitive_indexes.size());
+    out.geometry.reserve(mesh.primitive_indexes.size());
+    out.ranges.reserve(mesh.primitive_indexes.size());
+    out.max_primitives.reserve(mesh.primitive_indexes.size());
 
     VkAccelerationStructureGeometryTrianglesDataKHR triangles {
       .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_TRIANGLES_DATA_KHR,
       .pNext = nullptr,
-      .vertexFormat = VK_FORMAT_R32G32B32_SFLOAT,
+      .vertexFormat = packed? VK_FORMAT_R16G16B16A16_SNORM : VK_FORMAT_R32G32B32_SFLOAT,
       .vertexData = VkDeviceOrHostAddressConstKHR {.deviceAddress = source.vertex_buffer->device_address()},
-      .vertexStride = sizeof(Vertex),
+      .vertexStride = vertex_stride,
       .maxVertex = verts_count - 1,
       .indexType = VK_INDEX_TYPE_UINT32,
       .indexData = VkDeviceOrHostAddressConstKHR {.deviceAddress = source.index_buffer->device_address()},
       .transformData = VkDeviceOrHostAddressConstKHR {.hostAddress = nullptr}
     };
+
+    if (packed) {
+      triangles.transformData.deviceAddress = dequant_transforms->device_address();
+    }
     
     VkAccelerationStructureGeometryKHR geometry {
       .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR,
@@ -59,121 +115,276 @@ namespace scene {
 
     for (auto prim_index : mesh.primitive_indexes) {
       const auto &prim = source.primitives.at(prim_index);
+      geometry.geometry.triangles.indexType = get_index_type(prim);
+
       VkAccelerationStructureBuildRangeInfoKHR build_range {
         .primitiveCount = prim.index_count/3,
-        .primitiveOffset = uint32_t(prim.index_offset * sizeof(uint32_t)),
+        .primitiveOffset = prim.index_offset * prim.index_size,
         .firstVertex = prim.vertex_offset,
-        .transformOffset = 0
+        .transformOffset = packed? uint32_t(prim_index * sizeof(VkTransformMatrixKHR)) : 0u
       };
 
-      geometry_data.push_back(geometry);
-      geometry_prims.push_back(prim.index_count/3);
-      prim_data.push_back(build_range);
+      out.geometry.push_back(geometry);
+      out.max_primitives.push_back(prim.index_count/3);
+      out.ranges.push_back(build_range);
     }
 
-    
-    VkAccelerationStructureBuildGeometryInfoKHR mesh_info {
+    out.info = VkAccelerationStructureBuildGeometryInfoKHR {
       .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR,
       .pNext = nullptr,
       .type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,
-      .flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR,
+      .flags = VkBuildAccelerationStructureFlagsKHR(VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR|(compact? VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR : 0)),
       .mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR,
       .srcAccelerationStructure = nullptr,
       .dstAccelerationStructure = nullptr,
-      .geometryCount = (uint32_t)geometry_data.size(),
-      .pGeometries = geometry_data.data(),
+      .geometryCount = (uint32_t)out.geometry.size(),
+      .pGeometries = out.geometry.data(),
       .ppGeometries = nullptr,
       .scratchData = VkDeviceOrHostAddressKHR {.hostAddress = nullptr}
     };
 
-    auto vk_device = gpu::app_device().api_device(); 
-
-    VkAccelerationStructureBuildSizesInfoKHR build_info {};
-    build_info.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR;
+    out.sizes = VkAccelerationStructureBuildSizesInfoKHR {};
+    out.sizes.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR;
 
-
-    vkGetAccelerationStructureBuildSizesKHR(vk_device, 
+    vkGetAccelerationStructureBuildSizesKHR(gpu::app_device().api_device(), 
       VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR, 
-      &mesh_info,
-      geometry_prims.data(),
-      &build_info);
-    
-    std::cout << build_info.accelerationStructureSize/1024 << "\n";
-  
-    auto storage_buffer = gpu::create_buffer(VMA_MEMORY_USAGE_GPU_ONLY, build_info.accelerationStructureSize,
-      VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR|VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT);
+      &out.info,
+      out.max_primitives.data(),
+      &out.sizes);
+  }
 
-    VkAccelerationStructureCreateInfoKHR create_info {
-      .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR,
-      .pNext = nullptr,
-      .createFlags = 0,
-      .buffer = storage_buffer->api_buffer(),
-      .offset = 0,
-      .size = build_info.accelerationStructureSize,
-      .type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,
-      .deviceAddress = 0
-    };
+  void SceneAccelerationStructure::build_blases(gpu::TransferCmdPool &transfer_pool, const CompiledScene &source, bool compact) {
+    if (source.root_meshes.empty()) {
+      return;
+    }
+
+    auto vk_device = gpu::app_device().api_device(); 
+    const uint64_t scratch_alignment = as_memory::get_scratch_alignment();
+
+    std::vector<BlasInput> inputs(source.root_meshes.size());
+    uint64_t heap_size = 0;
+    uint64_t max_scratch = 0;
+    uint64_t total_scratch = 0;
+
+    for (uint32_t i = 0; i < inputs.size(); i++) {
+      auto &input = inputs[i];
+      get_blas_input(source.root_meshes[i], source, dequant_transforms, compact, input);
+      
+      input.storage_offset = heap_size;
+      heap_size = align_up(heap_size + input.sizes.accelerationStructureSize, AS_STORAGE_ALIGNMENT);
+      
+      const uint64_t scratch_size = align_up(input.sizes.buildScratchSize, scratch_alignment);
+      max_scratch = std::max(max_scratch, scratch_size);
+      total_scratch += scratch_size;
+    }
 
-    VkAccelerationStructureKHR acceleration_struct = nullptr;
-    VKCHECK(vkCreateAccelerationStructureKHR(vk_device, &create_info, nullptr, &acceleration_struct));
+    blas_heap = as_memory::allocate_storage(ASCategory::SceneBLAS, heap_size);
 
-    blas_array.push_back(acceleration_struct);
-    blas_buffers.push_back(std::move(storage_buffer));
+    for (auto &input : inputs) {
+      VkAccelerationStructureCreateInfoKHR create_info {
+        .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR,
+        .pNext = nullptr,
+        .createFlags = 0,
+        .buffer = blas_heap.api_buffer(),
+        .offset = blas_heap.offset + input.storage_offset,
+        .size = input.sizes.accelerationStructureSize,
+        .type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,
+        .deviceAddress = 0
+      };
 
-    auto scratch_buffer = gpu::create_buffer(VMA_MEMORY_USAGE_GPU_ONLY, build_info.buildScratchSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT|VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT);
+      VkAccelerationStructureKHR acceleration_struct = nullptr;
+      VKCHECK(vkCreateAccelerationStructureKHR(vk_device, &create_info, nullptr, &acceleration_struct));
+      blas_array.push_back(acceleration_struct);
+    }
 
-    auto range_ptr = prim_data.data();
-    
-    mesh_info.dstAccelerationStructure = acceleration_struct;
-    mesh_info.scratchData.deviceAddress = scratch_buffer->device_address();
+    //a single build may still need more than the budget
+    const uint64_t arena_size = std::max(max_scratch, std::min(total_scratch, BLAS_SCRATCH_BUDGET));
+    auto scratch_arena = gpu::create_buffer(VMA_MEMORY_USAGE_GPU_ONLY, arena_size,
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT|VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, scratch_alignment);
+    const VkDeviceAddress scratch_address = scratch_arena->device_address();
 
     VkCommandBufferBeginInfo begin_info {};
     begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
 
     auto cmd = transfer_pool.get_cmd_buffer();
     vkBeginCommandBuffer(cmd, &begin_info);
-    vkCmdBuildAccelerationStructuresKHR(cmd, 1, &mesh_info, &range_ptr);
+
+    std::vector<VkAccelerationStructureBuildGeometryInfoKHR> batch_infos;
+    std::vector<const VkAccelerationStructureBuildRangeInfoKHR *> batch_ranges;
+    uint64_t scratch_offset = 0;
+    uint32_t batches_count = 0;
+
+    //builds of the next batch reuse the arena, they wait for the previous ones
+    auto record_batch = [&]() {
+      if (batch_infos.empty()) {
+        return;
+      }
+
+      if (batches_count) {
+        VkMemoryBarrier barrier {
+          .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+          .pNext = nullptr,
+          .srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR,
+          .dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR|VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR
+        };
+
+        vkCmdPipelineBarrier(cmd,
+          VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+          VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+          0,
+          1, &barrier,
+          0, nullptr,
+          0, nullptr);
+      }
+
+      vkCmdBuildAccelerationStructuresKHR(cmd, batch_infos.size(), batch_infos.data(), batch_ranges.data());
+      batch_infos.clear();
+      batch_ranges.clear();
+      scratch_offset = 0;
+      batches_count++;
+    };
+
+    for (uint32_t i = 0; i < inputs.size(); i++) {
+      auto &input = inputs[i];
+      const uint64_t scratch_size = align_up(input.sizes.buildScratchSize, scratch_alignment);
+      if (scratch_offset + scratch_size > arena_size) {
+        record_batch();
+      }
+
+      input.info.pGeometries = input.geometry.data();
+      input.info.dstAccelerationStructure = blas_array[i];
+      input.info.scratchData.deviceAddress = scratch_address + scratch_offset;
+      scratch_offset += scratch_size;
+
+      batch_infos.push_back(input.info);
+      batch_ranges.push_back(input.ranges.data());
+    }
+    record_batch();
+
+    VkQueryPool size_queries = nullptr;
+    if (compact) {
+      VkQueryPoolCreateInfo query_info {
+        .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+        .pNext = nullptr,
+        .flags = 0,
+        .queryType = VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR,
+        .queryCount = (uint32_t)blas_array.size(),
+        .pipelineStatistics = 0
+      };
+      VKCHECK(vkCreateQueryPool(vk_device, &query_info, nullptr, &size_queries));
+
+      VkMemoryBarrier barrier {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .pNext = nullptr,
+        .srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR,
+        .dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR
+      };
+
+      vkCmdPipelineBarrier(cmd,
+        VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+        VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+        0,
+        1, &barrier,
+        0, nullptr,
+        0, nullptr);
+
+      vkCmdResetQueryPool(cmd, size_queries, 0, blas_array.size());
+      vkCmdWriteAccelerationStructuresPropertiesKHR(cmd, blas_array.size(), blas_array.data(), VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR, size_queries, 0);
+    }
+
     vkEndCommandBuffer(cmd);
     transfer_pool.submit_and_wait();
+
+    std::cout << "Built " << blas_array.size() << " BLAS in " << batches_count << " batches, "
+      << (heap_size >> 10) << " KB storage, " << (arena_size >> 10) << " KB scratch\n";
+
+    if (compact) {
+      std::vector<uint64_t> sizes;
+      sizes.reserve(inputs.size());
+      for (const auto &input : inputs) {
+        sizes.push_back(input.sizes.accelerationStructureSize);
+      }
+
+      compact_blases(transfer_pool, size_queries, sizes);
+      vkDestroyQueryPool(vk_device, size_queries, nullptr);
+    }
   }
-  
-  struct TLASNode {
-    glm::mat4 transform;
-    uint32_t acceleration_struct;
-  };
 
-  static void flattern_nodes(std::vector<TLASNode> &out, const BaseNode &node, const glm::mat4 &pre_transform) {
-    TLASNode out_node;
-    out_node.transform = pre_transform * node.transform;
-    auto mesh_id = node.mesh_index;
+  void SceneAccelerationStructure::compact_blases(gpu::TransferCmdPool &transfer_pool, VkQueryPool size_queries, const std::vector<uint64_t> &sizes) {
+    auto vk_device = gpu::app_device().api_device();
 
-    if (mesh_id >= 0) {
-      out_node.acceleration_struct = mesh_id;
-      out.push_back(out_node);
+    std::vector<uint64_t> compacted_sizes(blas_array.size());
+    VKCHECK(vkGetQueryPoolResults(vk_device, size_queries, 0, blas_array.size(),
+      sizeof(uint64_t) * compacted_sizes.size(), compacted_sizes.data(), sizeof(uint64_t),
+      VK_QUERY_RESULT_64_BIT|VK_QUERY_RESULT_WAIT_BIT));
+
+    std::vector<uint64_t> offsets;
+    offsets.reserve(blas_array.size());
+    uint64_t heap_size = 0;
+    for (auto size : compacted_sizes) {
+      offsets.push_back(heap_size);
+      heap_size = align_up(heap_size + size, AS_STORAGE_ALIGNMENT);
     }
 
-    for (const auto &child : node.children) {
-      flattern_nodes(out, child, out_node.transform);
+    auto compacted_heap = as_memory::allocate_storage(ASCategory::SceneBLAS, heap_size);
+
+    std::vector<VkAccelerationStructureKHR> compacted_array;
+    compacted_array.reserve(blas_array.size());
+
+    for (uint32_t i = 0; i < blas_array.size(); i++) {
+      VkAccelerationStructureCreateInfoKHR create_info {
+        .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR,
+        .pNext = nullptr,
+        .createFlags = 0,
+        .buffer = compacted_heap.api_buffer(),
+        .offset = compacted_heap.offset + offsets[i],
+        .size = compacted_sizes[i],
+        .type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,
+        .deviceAddress = 0
+      };
+
+      VkAccelerationStructureKHR acceleration_struct = nullptr;
+      VKCHECK(vkCreateAccelerationStructureKHR(vk_device, &create_info, nullptr, &acceleration_struct));
+      compacted_array.push_back(acceleration_struct);
     }
-  }
 
-  static void copy_buf(gpu::TransferCmdPool &transfer_pool, gpu::BufferPtr &src, gpu::BufferPtr &dst) {
     VkCommandBufferBeginInfo begin_info {};
     begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-    
-    VkBufferCopy region {
-      .srcOffset = 0,
-      .dstOffset = 0,
-      .size = src->get_size()
-    };
 
     auto cmd = transfer_pool.get_cmd_buffer();
     vkBeginCommandBuffer(cmd, &begin_info);
-    
-    vkCmdCopyBuffer(cmd, src->api_buffer(), dst->api_buffer(), 1, &region);
+    for (uint32_t i = 0; i < blas_array.size(); i++) {
+      VkCopyAccelerationStructureInfoKHR copy_info {
+        .sType = VK_STRUCTURE_TYPE_COPY_ACCELERATION_STRUCTURE_INFO_KHR,
+        .pNext = nullptr,
+        .src = blas_array[i],
+        .dst = compacted_array[i],
+        .mode = VK_COPY_ACCELERATION_STRUCTURE_MODE_COMPACT_KHR
+      };
+      vkCmdCopyAccelerationStructureKHR(cmd, &copy_info);
+    }
     vkEndCommandBuffer(cmd);
     transfer_pool.submit_and_wait();
+
+    uint64_t total_size = 0;
+    uint64_t total_compacted = 0;
+    for (uint32_t i = 0; i < blas_array.size(); i++) {
+      std::cout << "BLAS " << i << " : " << (sizes[i] >> 10) << " KB -> " << (compacted_sizes[i] >> 10) << " KB\n";
+      total_size += sizes[i];
+      total_compacted += compacted_sizes[i];
+      vkDestroyAccelerationStructureKHR(vk_device, blas_array[i], nullptr);
+    }
+    std::cout << "BLAS compaction saved " << ((total_size - total_compacted) >> 10) << " KB of " << (total_size >> 10) << " KB\n";
+
+    blas_array = std::move(compacted_array);
+    as_memory::free_storage(blas_heap);
+    blas_heap = std::move(compacted_heap);
   }
+  
+  struct TLASNode {
+    glm::mat4 transform;
+    uint32_t acceleration_struct;
+  };
 
   void SceneAccelerationStructure::build_tlas(gpu::TransferCmdPool &transfer_pool, const CompiledScene &source) {
     //todo : normal alghorithm
@@ -192,17 +403,16 @@ namespace scene {
 		instance.accelerationStructureReference = 0;
 
     std::vector<TLASNode> nodes;
-    for (auto &node : source.base_nodes) {
-      glm::mat4 initial_transform = glm::identity<glm::mat4>();
-      flattern_nodes(nodes, node, initial_transform);
+    for (const auto &flat : flattern_nodes(source.base_nodes)) {
+      if (flat.node->mesh_index >= 0) {
+        nodes.push_back(TLASNode {flat.world_transform, uint32_t(flat.node->mesh_index)});
+      }
     }
     
 
   
-    auto instance_buffer_cpu = gpu::create_buffer(VMA_MEMORY_USAGE_CPU_TO_GPU, sizeof(instance) * nodes.size(),
-      VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
-
-    auto instance_data = (VkAccelerationStructureInstanceKHR*)instance_buffer_cpu->get_mapped_ptr();
+    std::vector<VkAccelerationStructureInstanceKHR> instance_data;
+    instance_data.resize(nodes.size());
 
     auto vk_device = gpu::app_device().api_device();
 
@@ -228,8 +438,9 @@ namespace scene {
     auto instance_buffer_gpu = gpu::create_buffer(VMA_MEMORY_USAGE_GPU_ONLY, sizeof(instance) * nodes.size(),
       VK_BUFFER_USAGE_TRANSFER_DST_BIT|VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT|VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR);
 
-    copy_buf(transfer_pool, instance_buffer_cpu, instance_buffer_gpu);
-    instance_buffer_cpu.release();
+    transfer_pool.upload_buffer(instance_buffer_gpu, 0, sizeof(instance) * nodes.size(), instance_data.data());
+    transfer_pool.flush();
+    instances = instance_data;
     
     VkAccelerationStructureGeometryKHR geometry {};
     geometry.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR;
@@ -246,7 +457,7 @@ namespace scene {
 		build_geometry.geometryCount = 1;
 		build_geometry.pGeometries = &geometry;
 
-    uint32_t primitive_count = source.root_meshes.size();
+    uint32_t primitive_count = nodes.size();
     VkAccelerationStructureBuildSizesInfoKHR build_sizes {};
     build_sizes.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR;
   
@@ -259,15 +470,14 @@ namespace scene {
     
     std::cout << "TLAS : " << build_sizes.accelerationStructureSize << "\n";
   
-    tlas_memory = gpu::create_buffer(VMA_MEMORY_USAGE_GPU_ONLY, build_sizes.accelerationStructureSize,
-      VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR|VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT);
+    tlas_memory = as_memory::allocate_storage(ASCategory::SceneTLAS, build_sizes.accelerationStructureSize);
 
     VkAccelerationStructureCreateInfoKHR create_info {
       .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR,
       .pNext = nullptr,
       .createFlags = 0,
-      .buffer = tlas_memory->api_buffer(),
-      .offset = 0,
+      .buffer = tlas_memory.api_buffer(),
+      .offset = tlas_memory.offset,
       .size = build_sizes.accelerationStructureSize,
       .type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR,
       .deviceAddress = 0
@@ -275,9 +485,6 @@ namespace scene {
 
     VKCHECK(vkCreateAccelerationStructureKHR(vk_device, &create_info, nullptr, &tlas));
 
-    auto scratch_buffer = gpu::create_buffer(VMA_MEMORY_USAGE_GPU_ONLY, build_sizes.buildScratchSize,
-      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT|VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT);
-
     VkAccelerationStructureBuildRangeInfoKHR build_range {
       .primitiveCount = primitive_count,
       .primitiveOffset = 0,
@@ -287,7 +494,7 @@ namespace scene {
 
     auto range_ptr = &build_range;
     build_geometry.dstAccelerationStructure = tlas;
-    build_geometry.scratchData.deviceAddress = scratch_buffer->device_address();
+    build_geometry.scratchData.deviceAddress = as_memory::allocate_init_scratch(build_sizes.buildScratchSize);
 
     VkCommandBufferBeginInfo begin_info {};
     begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
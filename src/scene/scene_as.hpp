@@ -2,21 +2,37 @@
 #define SCENE_AS_HPP_INCLUDED
 
 #include "scene.hpp"
+#include "as_memory.hpp"
 
 namespace scene {
 
   struct SceneAccelerationStructure {
+    //builds sharing the arena at once are recorded into one vkCmdBuildAccelerationStructuresKHR call.
+    //The arena is only alive during build_blases, the as_memory arena never shrinks
+    static constexpr uint64_t BLAS_SCRATCH_BUDGET = 64ull << 20;
+
     ~SceneAccelerationStructure();
 
-    void build(gpu::TransferCmdPool &transfer_pool, const CompiledScene &source);
-    void build_blas(gpu::TransferCmdPool &transfer_pool, const BaseMesh &mesh, const CompiledScene &source);
+    //compact = true copies BLASes into allocations of their compacted size after the build
+    void build(gpu::TransferCmdPool &transfer_pool, const CompiledScene &source, bool compact = false);
+    //one BLAS per root mesh, all builds go into one submission
+    void build_blases(gpu::TransferCmdPool &transfer_pool, const CompiledScene &source, bool compact = false);
     void build_tlas(gpu::TransferCmdPool &transfer_pool, const CompiledScene &source);
 
-    std::vector<gpu::BufferPtr> blas_buffers;
+    ASAllocation blas_heap; //every BLAS is suballocated from this range
     std::vector<VkAccelerationStructureKHR> blas_array;
 
-    gpu::BufferPtr tlas_memory;
+    ASAllocation tlas_memory;
     VkAccelerationStructureKHR tlas {nullptr};
+    //instances of tlas in world space, for TLASes combining the scene with other structures
+    std::vector<VkAccelerationStructureInstanceKHR> instances;
+
+  private:
+    //only alive during build() for VertexLayout::Packed scenes
+    gpu::BufferPtr dequant_transforms;
+
+    //blas_array must be built with ALLOW_COMPACTION, sizes are the uncompacted storage sizes
+    void compact_blases(gpu::TransferCmdPool &transfer_pool, VkQueryPool size_queries, const std::vector<uint64_t> &sizes);
   };
 
 
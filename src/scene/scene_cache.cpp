@@ -0,0 +1,586 @@
+#include "scene_cache.hpp"
+#include "mapped_file.hpp"
+#include "glb.hpp"
+
+#include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <cstring>
+#include <lib/json.hpp>
+
+namespace fs = std::filesystem;
+
+namespace scene {
+
+  constexpr char CACHE_MAGIC[8] {'S', 'C', 'E', 'N', 'E', 'B', 'I', 'N'};
+  constexpr uint32_t CACHE_VERSION = 4;
+  constexpr uint64_t SECTION_ALIGNMENT = 16;
+
+  enum CacheSection : uint32_t {
+    SECTION_VERTICES,
+    SECTION_INDEXES,
+    SECTION_PRIMITIVES,
+    SECTION_MATERIALS,
+    SECTION_MESHES,
+    SECTION_NODES,
+    SECTION_SAMPLERS,
+    SECTION_TEXTURES,
+    SECTION_IMAGES,
+    SECTION_IMAGE_DATA,
+    SECTION_MESHLETS,
+    SECTION_COUNT
+  };
+
+  struct CacheRange {
+    uint64_t offset;
+    uint64_t size;
+  };
+
+  struct CacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t transforms_count;
+    uint64_t content_hash;
+    CacheRange sections[SECTION_COUNT];
+  };
+
+  //nodes are stored in preorder, children follow their parent
+  struct CachedNode {
+    glm::mat4 transform;
+    int32_t mesh_index;
+    int32_t transform_index;
+    uint32_t children_count;
+    uint32_t pad;
+  };
+
+  struct CachedImage {
+    uint32_t format;
+    uint32_t width;
+    uint32_t height;
+    uint32_t mip_levels;
+    uint64_t offset; //from the start of SECTION_IMAGE_DATA
+    uint64_t size;
+  };
+
+  static uint64_t fnv1a(uint64_t hash, const void *data, uint64_t size) {
+    auto bytes = static_cast<const uint8_t*>(data);
+    for (uint64_t i = 0; i < size; i++) {
+      hash ^= bytes[i];
+      hash *= 0x100000001b3ull;
+    }
+    return hash;
+  }
+
+  template <typename T>
+  static uint64_t fnv1a(uint64_t hash, const T &val) {
+    return fnv1a(hash, &val, sizeof(val));
+  }
+
+  static bool stamp_file(uint64_t &hash, const fs::path &file_path) {
+    std::error_code ec;
+    uint64_t size = fs::file_size(file_path, ec);
+    if (ec) {
+      return false;
+    }
+    int64_t mtime = int64_t(fs::last_write_time(file_path, ec).time_since_epoch().count());
+    if (ec) {
+      return false;
+    }
+
+    hash = fnv1a(hash, size);
+    hash = fnv1a(hash, mtime);
+    return true;
+  }
+
+  static int from_hex(char c) {
+    if (c >= '0' && c <= '9') {
+      return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+      return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+      return c - 'A' + 10;
+    }
+    return 0;
+  }
+
+  //same decoding as tinygltf uses to open external files
+  static std::string decode_uri(const std::string &uri) {
+    std::string result;
+    for (size_t i = 0; i < uri.size(); i++) {
+      if (uri[i] == '+') {
+        result += ' ';
+      } else if (uri[i] == '%' && uri.size() > i + 2) {
+        result += char((from_hex(uri[i + 1]) << 4) | from_hex(uri[i + 2]));
+        i += 2;
+      } else {
+        result += uri[i];
+      }
+    }
+    return result;
+  }
+
+  //images, buffers and the BIN chunk of a glb are stamped by size and mtime, hashing hundreds of MB of textures would cost as much as cooking
+  bool hash_gltf_sources(const std::string &gltf_path, uint64_t &out_hash) {
+    MappedFile gltf {gltf_path};
+    if (!gltf) {
+      throw std::runtime_error {"Failed to open " + gltf_path};
+    }
+
+    uint64_t hash = 0xcbf29ce484222325ull;
+    hash = fnv1a(hash, CACHE_VERSION);
+
+    const uint8_t *json_begin = gltf.data();
+    const uint8_t *json_end = gltf.data() + gltf.get_size();
+    
+    GlbChunks glb;
+    if (is_glb(gltf.data(), gltf.get_size())) {
+      if (!parse_glb(gltf.data(), gltf.get_size(), glb)) {
+        throw std::runtime_error {"Invalid glb container " + gltf_path};
+      }
+      json_begin = glb.json;
+      json_end = glb.json + glb.json_size;
+
+      hash = fnv1a(hash, glb.bin_size);
+      if (!stamp_file(hash, gltf_path)) {
+        return false;
+      }
+    }
+
+    hash = fnv1a(hash, json_begin, json_end - json_begin);
+
+    auto json = nlohmann::json::parse(json_begin, json_end);
+    auto folder = fs::path{gltf_path}.parent_path();
+
+    auto stamp_uris = [&](const char *key) {
+      if (!json.contains(key)) {
+        return true;
+      }
+
+      for (const auto &elem : json[key]) {
+        if (!elem.contains("uri")) {
+          continue;
+        }
+
+        auto uri = elem["uri"].get<std::string>();
+        if (uri.rfind("data:", 0) == 0) {
+          continue; //embedded, already hashed with the gltf
+        }
+
+        hash = fnv1a(hash, uri.data(), uri.size());
+        if (!stamp_file(hash, folder / decode_uri(uri))) {
+          std::cout << "Scene cache: can't stamp " << uri << "\n";
+          return false;
+        }
+      }
+      return true;
+    };
+
+    if (!stamp_uris("buffers") || !stamp_uris("images")) {
+      return false;
+    }
+    out_hash = hash;
+    return true;
+  }
+
+  //returns nullptr if the hierarchy runs past the section end
+  static const CachedNode *unflattern_nodes(const CachedNode *src, const CachedNode *end, BaseNode &out) {
+    if (src >= end || src->children_count > uint64_t(end - src - 1)) {
+      return nullptr;
+    }
+
+    out.transform = src->transform;
+    out.mesh_index = src->mesh_index;
+    out.transform_index = src->transform_index;
+    out.children.resize(src->children_count);
+    src++;
+
+    for (auto &child : out.children) {
+      src = unflattern_nodes(src, end, child);
+      if (!src) {
+        return nullptr;
+      }
+    }
+    return src;
+  }
+
+  struct CacheWriter {
+    CacheWriter(const std::string &path) : file {path, std::ios::binary|std::ios::trunc} {
+      if (!file) {
+        throw std::runtime_error {"Failed to create " + path};
+      }
+      CacheHeader dummy {};
+      write_bytes(&dummy, sizeof(dummy));
+    }
+
+    void write_bytes(const void *data, uint64_t size) {
+      file.write(static_cast<const char*>(data), size);
+      offset += size;
+    }
+
+    void align() {
+      const char zeros[SECTION_ALIGNMENT] {};
+      uint64_t pad = (SECTION_ALIGNMENT - offset % SECTION_ALIGNMENT) % SECTION_ALIGNMENT;
+      write_bytes(zeros, pad);
+    }
+
+    template <typename T>
+    void write_section(CacheSection id, const std::vector<T> &elems) {
+      begin_section(id);
+      write_bytes(elems.data(), sizeof(T) * elems.size());
+      end_section(id);
+    }
+
+    void begin_section(CacheSection id) {
+      align();
+      header.sections[id].offset = offset;
+    }
+
+    void end_section(CacheSection id) {
+      header.sections[id].size = offset - header.sections[id].offset;
+    }
+
+    void finish() {
+      file.seekp(0);
+      file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+      file.close();
+      if (!file) {
+        throw std::runtime_error {"Scene cache: write failed"};
+      }
+    }
+
+    CacheHeader header {};
+  private:
+    std::ofstream file;
+    uint64_t offset = 0;
+  };
+
+  void write_scene_cache(const std::string &cache_path, uint64_t content_hash, const CookedScene &scene) {
+    const std::string tmp_path = cache_path + ".tmp";
+    {
+      CacheWriter writer {tmp_path};
+      std::memcpy(writer.header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+      writer.header.version = CACHE_VERSION;
+      writer.header.transforms_count = scene.transforms_count;
+      writer.header.content_hash = content_hash;
+
+      writer.write_section(SECTION_VERTICES, scene.vertices);
+      writer.write_section(SECTION_INDEXES, scene.indexes);
+      writer.write_section(SECTION_PRIMITIVES, scene.primitives);
+      writer.write_section(SECTION_MESHLETS, scene.meshlets);
+      writer.write_section(SECTION_MATERIALS, scene.materials);
+
+      //mesh count, then primitives count and indexes for every mesh
+      std::vector<uint32_t> meshes;
+      meshes.push_back(scene.root_meshes.size());
+      for (const auto &mesh : scene.root_meshes) {
+        meshes.push_back(mesh.primitive_indexes.size());
+        meshes.insert(meshes.end(), mesh.primitive_indexes.begin(), mesh.primitive_indexes.end());
+      }
+      writer.write_section(SECTION_MESHES, meshes);
+
+      //roots are read back until the section ends
+      std::vector<CachedNode> nodes;
+      for (const auto &flat : flattern_nodes(scene.base_nodes)) {
+        CachedNode dst {};
+        dst.transform = flat.node->transform;
+        dst.mesh_index = flat.node->mesh_index;
+        dst.transform_index = flat.node->transform_index;
+        dst.children_count = flat.node->children.size();
+        nodes.push_back(dst);
+      }
+      writer.write_section(SECTION_NODES, nodes);
+      writer.write_section(SECTION_SAMPLERS, scene.samplers);
+      writer.write_section(SECTION_TEXTURES, scene.textures);
+
+      std::vector<CachedImage> images;
+      uint64_t data_offset = 0;
+      for (const auto &image : scene.images) {
+        images.push_back(CachedImage {uint32_t(image.format), image.width, image.height, image.mip_levels, data_offset, image.data.size()});
+        data_offset += (image.data.size() + SECTION_ALIGNMENT - 1) & ~(SECTION_ALIGNMENT - 1);
+      }
+      writer.write_section(SECTION_IMAGES, images);
+
+      writer.begin_section(SECTION_IMAGE_DATA);
+      for (const auto &image : scene.images) {
+        writer.align();
+        writer.write_bytes(image.data.data(), image.data.size());
+      }
+      writer.end_section(SECTION_IMAGE_DATA);
+
+      writer.finish();
+    }
+    fs::rename(tmp_path, cache_path);
+  }
+
+  template <typename T>
+  struct SectionView {
+    const T *ptr = nullptr;
+    uint64_t count = 0;
+
+    const T *begin() const { return ptr; }
+    const T *end() const { return ptr + count; }
+  };
+
+  template <typename T>
+  static SectionView<T> get_section(const MappedFile &file, const CacheHeader &header, CacheSection id) {
+    const auto &range = header.sections[id];
+    return SectionView<T> {reinterpret_cast<const T*>(file.data() + range.offset), range.size/sizeof(T)};
+  }
+
+  //mesh count, then primitives count and indexes for every mesh
+  static bool read_cached_meshes(SectionView<uint32_t> meshes, uint64_t primitives_count, std::vector<BaseMesh> &out) {
+    if (!meshes.count) {
+      return true;
+    }
+
+    const uint32_t *ptr = meshes.begin();
+    const uint32_t *end = meshes.end();
+    uint32_t meshes_count = *ptr++;
+    if (meshes_count > uint64_t(end - ptr)) {
+      return false;
+    }
+
+    out.resize(meshes_count);
+    for (auto &mesh : out) {
+      if (ptr >= end) {
+        return false;
+      }
+      uint32_t count = *ptr++;
+      if (count > uint64_t(end - ptr)) {
+        return false;
+      }
+      mesh.primitive_indexes.assign(ptr, ptr + count);
+      ptr += count;
+
+      for (auto index : mesh.primitive_indexes) {
+        if (index >= primitives_count) {
+          return false;
+        }
+      }
+    }
+    return true;
+  }
+
+  static bool is_valid_node(const BaseNode &node, uint64_t meshes_count) {
+    if (node.mesh_index >= 0 && uint64_t(node.mesh_index) >= meshes_count) {
+      return false;
+    }
+    for (const auto &child : node.children) {
+      if (!is_valid_node(child, meshes_count)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  //ranges of primitives and meshlets stay inside the geometry sections, the vertex packing and shaders read them unchecked
+  static bool is_valid_geometry(const CompiledScene &scene, uint64_t vertex_count, uint64_t index_size) {
+    for (const auto &prim : scene.primitives) {
+      if (prim.index_size != sizeof(uint16_t) && prim.index_size != sizeof(uint32_t)) {
+        return false;
+      }
+      if (uint64_t(prim.vertex_offset) + prim.vertex_count > vertex_count) {
+        return false;
+      }
+      if ((uint64_t(prim.index_offset) + prim.index_count) * prim.index_size > index_size) {
+        return false;
+      }
+      if (uint64_t(prim.first_meshlet) + prim.meshlet_count > scene.meshlets.size()) {
+        return false;
+      }
+      if (prim.material_index != UINT32_MAX && prim.material_index >= scene.materials.size()) { //primitives without a material keep -1
+        return false;
+      }
+    }
+
+    for (const auto &meshlet : scene.meshlets) {
+      if (meshlet.primitive_index >= scene.primitives.size()) {
+        return false;
+      }
+      const auto &prim = scene.primitives[meshlet.primitive_index];
+      if (uint64_t(meshlet.first_triangle) + meshlet.triangle_count > prim.index_count/3) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  static bool is_valid_texture_index(uint32_t index, uint64_t textures_count) {
+    return index == INVALID_TEXTURE || index < textures_count;
+  }
+
+  static bool is_valid_cached_image(const CachedImage &image, uint64_t data_size) {
+    switch (VkFormat(image.format)) {
+    case VK_FORMAT_R8G8B8A8_SRGB:
+    case VK_FORMAT_R8G8B8A8_UNORM:
+    case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+    case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+    case VK_FORMAT_BC3_SRGB_BLOCK:
+    case VK_FORMAT_BC3_UNORM_BLOCK:
+    case VK_FORMAT_BC5_UNORM_BLOCK:
+      break;
+    default:
+      return false;
+    }
+
+    if (!image.width || !image.height || !image.mip_levels || image.mip_levels > 32) {
+      return false;
+    }
+
+    //upload_image_mips reads the whole mip chain from offset
+    const uint64_t size = get_image_byte_size(VkFormat(image.format), image.width, image.height, image.mip_levels);
+    return image.offset <= data_size && image.size <= data_size - image.offset && size <= image.size;
+  }
+
+  static void upload_cached_images(gpu::TransferCmdPool &transfer_pool, SectionView<CachedImage> images, const uint8_t *image_data, std::vector<gpu::ImagePtr> &out_images) {
+    out_images.reserve(images.count);
+    for (const auto &src : images) {
+      auto image = create_scene_image(VkFormat(src.format), src.width, src.height, src.mip_levels);
+      upload_image_mips(transfer_pool, image, image_data + src.offset);
+      out_images.push_back(std::move(image));
+    }
+
+    transfer_pool.flush();
+
+    auto cmd = transfer_pool.get_cmd_buffer();
+    VkCommandBufferBeginInfo begin_info {VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO};
+    vkBeginCommandBuffer(cmd, &begin_info);
+    for (const auto &image : out_images) {
+      set_image_sampled(cmd, image);
+    }
+    vkEndCommandBuffer(cmd);
+    transfer_pool.submit_and_wait();
+  }
+
+  bool load_scene_cache(gpu::TransferCmdPool &transfer_pool, const std::string &cache_path, uint64_t content_hash, const SceneLoadOptions &options, CompiledScene &out_scene) {
+    MappedFile file;
+    if (!file.open(cache_path) || file.get_size() < sizeof(CacheHeader)) {
+      return false;
+    }
+
+    CacheHeader header;
+    std::memcpy(&header, file.data(), sizeof(header));
+
+    if (std::memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 || header.version != CACHE_VERSION || header.content_hash != content_hash) {
+      return false;
+    }
+
+    for (const auto &range : header.sections) {
+      if (range.offset > file.get_size() || range.size > file.get_size() - range.offset) {
+        return false;
+      }
+    }
+
+    file.prefetch();
+
+    CompiledScene scene {};
+    scene.transforms_count = header.transforms_count;
+
+    auto primitives = get_section<Primitive>(file, header, SECTION_PRIMITIVES);
+    auto materials = get_section<Material>(file, header, SECTION_MATERIALS);
+    auto meshlets = get_section<Meshlet>(file, header, SECTION_MESHLETS);
+    scene.primitives.assign(primitives.begin(), primitives.end());
+    scene.meshlets.assign(meshlets.begin(), meshlets.end());
+    scene.materials.assign(materials.begin(), materials.end());
+
+    //a broken cache is treated as stale and cooked again
+    auto meshes = get_section<uint32_t>(file, header, SECTION_MESHES);
+    if (!read_cached_meshes(meshes, scene.primitives.size(), scene.root_meshes)) {
+      return false;
+    }
+
+    auto nodes = get_section<CachedNode>(file, header, SECTION_NODES);
+    for (auto node = nodes.begin(); node < nodes.end();) {
+      scene.base_nodes.emplace_back();
+      node = unflattern_nodes(node, nodes.end(), scene.base_nodes.back());
+      if (!node || !is_valid_node(scene.base_nodes.back(), scene.root_meshes.size())) {
+        return false;
+      }
+    }
+
+    auto images = get_section<CachedImage>(file, header, SECTION_IMAGES);
+    const uint64_t image_data_size = header.sections[SECTION_IMAGE_DATA].size;
+    for (const auto &src : images) {
+      if (!is_valid_cached_image(src, image_data_size)) {
+        return false;
+      }
+    }
+
+    auto vertices = header.sections[SECTION_VERTICES];
+    auto indexes = header.sections[SECTION_INDEXES];
+    if (!is_valid_geometry(scene, vertices.size/sizeof(Vertex), indexes.size)) {
+      return false;
+    }
+
+    auto samplers = get_section<CookedSampler>(file, header, SECTION_SAMPLERS);
+    auto textures = get_section<Texture>(file, header, SECTION_TEXTURES);
+    for (const auto &tex : textures) {
+      if (tex.image_index >= images.count || tex.sampler_index >= samplers.count) {
+        return false;
+      }
+    }
+    for (const auto &mat : scene.materials) {
+      if (!is_valid_texture_index(mat.albedo_tex_index, textures.count) || !is_valid_texture_index(mat.metalic_roughness_index, textures.count)) {
+        return false;
+      }
+    }
+
+    for (const auto &smp : samplers) {
+      scene.samplers.push_back(gpu::create_sampler(get_sampler_info(smp)));
+    }
+    scene.textures.assign(textures.begin(), textures.end());
+
+    upload_scene_geometry(transfer_pool, scene,
+      reinterpret_cast<const Vertex*>(file.data() + vertices.offset), vertices.size/sizeof(Vertex),
+      file.data() + indexes.offset, indexes.size,
+      options);
+
+    const uint8_t *image_data = file.data() + header.sections[SECTION_IMAGE_DATA].offset;
+    if (options.stream_textures) {
+      //mips are read straight from the mapping, it lives as long as the scene
+      for (const auto &src : images) {
+        scene.streamed_images.push_back(StreamedImage {VkFormat(src.format), src.width, src.height, src.mip_levels, image_data + src.offset, 0});
+      }
+      scene.images = upload_streamed_images(transfer_pool, scene.streamed_images);
+      scene.streamed_data = std::make_shared<MappedFile>(std::move(file));
+    } else {
+      upload_cached_images(transfer_pool, images, image_data, scene.images);
+    }
+
+    out_scene = std::move(scene);
+    return true;
+  }
+
+  CompiledScene load_scene_cached(gpu::TransferCmdPool &transfer_pool, const std::string &path, const SceneLoadOptions &options) {
+    const std::string cache_path = path + ".scache";
+    uint64_t content_hash = 0;
+    if (!hash_gltf_sources(path, content_hash)) {
+      //a cache of unstamped sources would never go stale
+      std::cout << "Scene cache is not used for " << path << ", loading directly\n";
+      return load_tinygltf_scene(transfer_pool, path, options);
+    }
+    //options that change cooked data, toggling them recooks the cache
+    content_hash = fnv1a(content_hash, options.optimize_meshes);
+    content_hash = fnv1a(content_hash, options.compress_textures);
+
+    CompiledScene result_scene {};
+    if (!load_scene_cache(transfer_pool, cache_path, content_hash, options, result_scene)) {
+      std::cout << "Scene cache " << cache_path << " is missing or stale, cooking\n";
+      write_scene_cache(cache_path, content_hash, cook_tinygltf_scene(path, options));
+
+      if (!load_scene_cache(transfer_pool, cache_path, content_hash, options, result_scene)) {
+        std::cout << "Failed to load cooked scene " << cache_path << ", loading " << path << " directly\n";
+        return load_tinygltf_scene(transfer_pool, path, options);
+      }
+    }
+
+    std::cout << "Loaded cached scene ";
+    std::cout << result_scene.primitives.size() << " primitives ";
+    std::cout << result_scene.transforms_count << " transforms ";
+    std::cout << result_scene.images.size() << " images\n";
+    return result_scene;
+  }
+
+}
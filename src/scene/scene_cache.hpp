@@ -0,0 +1,47 @@
+#ifndef SCENE_CACHE_HPP_INCLUDED
+#define SCENE_CACHE_HPP_INCLUDED
+
+#include "scene.hpp"
+
+namespace scene {
+
+  struct CookedSampler {
+    uint32_t mag_filter;
+    uint32_t min_filter;
+    uint32_t mipmap_mode;
+    uint32_t address_u;
+    uint32_t address_v;
+  };
+
+  //everything CompiledScene is created from, kept on the host side
+  struct CookedScene {
+    uint32_t transforms_count = 0;
+
+    std::vector<Vertex> vertices;
+    std::vector<uint8_t> indexes; //16 and 32 bit ranges, see Primitive::index_size
+    std::vector<Primitive> primitives;
+    std::vector<Meshlet> meshlets;
+    std::vector<Material> materials;
+    std::vector<BaseMesh> root_meshes;
+    std::vector<BaseNode> base_nodes;
+
+    std::vector<CookedSampler> samplers;
+    std::vector<Texture> textures;
+    std::vector<HostImage> images;
+  };
+
+  //hash of the gltf/glb file and size/mtime stamps of every file it references. Returns false if a referenced file can't be stamped
+  bool hash_gltf_sources(const std::string &gltf_path, uint64_t &out_hash);
+
+  void write_scene_cache(const std::string &cache_path, uint64_t content_hash, const CookedScene &scene);
+  //returns false if the cache is missing, broken or was cooked from other sources
+  bool load_scene_cache(gpu::TransferCmdPool &transfer_pool, const std::string &cache_path, uint64_t content_hash, const SceneLoadOptions &options, CompiledScene &out_scene);
+
+  //scene.cpp
+  CookedScene cook_tinygltf_scene(const std::string &path, const SceneLoadOptions &options);
+  VkSamplerCreateInfo get_sampler_info(const CookedSampler &desc);
+  //packs vertices if options.vertex_layout is VertexLayout::Packed
+  void upload_scene_geometry(gpu::TransferCmdPool &transfer_pool, CompiledScene &out_scene, const Vertex *vertices, uint64_t vertex_count, const void *indexes, uint64_t index_size, const SceneLoadOptions &options);
+}
+
+#endif
@@ -0,0 +1,324 @@
+#include "texture_compression.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+namespace scene {
+
+  constexpr uint32_t BLOCK_TEXELS = 16;
+
+  static uint16_t pack_565(const float *c) {
+    const uint32_t r = uint32_t(std::clamp(c[0], 0.f, 255.f) * 31.f/255.f + 0.5f);
+    const uint32_t g = uint32_t(std::clamp(c[1], 0.f, 255.f) * 63.f/255.f + 0.5f);
+    const uint32_t b = uint32_t(std::clamp(c[2], 0.f, 255.f) * 31.f/255.f + 0.5f);
+    return uint16_t((r << 11u) | (g << 5u) | b);
+  }
+
+  static void unpack_565(uint16_t c, int32_t *out) {
+    const int32_t r = (c >> 11u) & 31;
+    const int32_t g = (c >> 5u) & 63;
+    const int32_t b = c & 31;
+    out[0] = (r << 3) | (r >> 2);
+    out[1] = (g << 2) | (g >> 4);
+    out[2] = (b << 3) | (b >> 2);
+  }
+
+  //4 color mode palette, c0 > c1 is required by the decoder
+  static void get_bc1_palette(uint16_t c0, uint16_t c1, int32_t palette[4][3]) {
+    unpack_565(c0, palette[0]);
+    unpack_565(c1, palette[1]);
+    for (uint32_t i = 0; i < 3; i++) {
+      palette[2][i] = (2 * palette[0][i] + palette[1][i])/3;
+      palette[3][i] = (palette[0][i] + 2 * palette[1][i])/3;
+    }
+  }
+
+  static uint32_t get_bc1_indexes(const uint8_t *rgba, uint16_t c0, uint16_t c1, uint32_t &indexes) {
+    int32_t palette[4][3];
+    get_bc1_palette(c0, c1, palette);
+
+    uint32_t total_error = 0;
+    indexes = 0;
+    for (uint32_t t = 0; t < BLOCK_TEXELS; t++) {
+      const uint8_t *texel = rgba + 4 * t;
+      uint32_t best = 0;
+      uint32_t best_error = UINT32_MAX;
+      for (uint32_t p = 0; p < 4; p++) {
+        uint32_t error = 0;
+        for (uint32_t i = 0; i < 3; i++) {
+          const int32_t d = int32_t(texel[i]) - palette[p][i];
+          error += d * d;
+        }
+        if (error < best_error) {
+          best_error = error;
+          best = p;
+        }
+      }
+      indexes |= best << (2 * t);
+      total_error += best_error;
+    }
+    return total_error;
+  }
+
+  //endpoints are ordered so the block is decoded in 4 color mode, equal endpoints use index 0 only
+  static uint32_t make_bc1_block(const uint8_t *rgba, uint16_t c0, uint16_t c1, uint16_t &out_c0, uint16_t &out_c1, uint32_t &out_indexes) {
+    if (c0 < c1) {
+      std::swap(c0, c1);
+    }
+
+    out_c0 = c0;
+    out_c1 = c1;
+    if (c0 == c1) {
+      out_indexes = 0;
+      int32_t color[3];
+      unpack_565(c0, color);
+      uint32_t error = 0;
+      for (uint32_t t = 0; t < BLOCK_TEXELS; t++) {
+        for (uint32_t i = 0; i < 3; i++) {
+          const int32_t d = int32_t(rgba[4 * t + i]) - color[i];
+          error += d * d;
+        }
+      }
+      return error;
+    }
+    return get_bc1_indexes(rgba, c0, c1, out_indexes);
+  }
+
+  //endpoints on the principal axis of the block colors, then one least squares refit for the chosen indexes
+  void encode_bc1_block(const uint8_t *rgba, uint8_t *out) {
+    float mean[3] {0.f, 0.f, 0.f};
+    for (uint32_t t = 0; t < BLOCK_TEXELS; t++) {
+      for (uint32_t i = 0; i < 3; i++) {
+        mean[i] += rgba[4 * t + i];
+      }
+    }
+    for (auto &m : mean) {
+      m /= float(BLOCK_TEXELS);
+    }
+
+    float cov[6] {}; //xx xy xz yy yz zz
+    for (uint32_t t = 0; t < BLOCK_TEXELS; t++) {
+      const float d[3] {rgba[4 * t] - mean[0], rgba[4 * t + 1] - mean[1], rgba[4 * t + 2] - mean[2]};
+      cov[0] += d[0] * d[0];
+      cov[1] += d[0] * d[1];
+      cov[2] += d[0] * d[2];
+      cov[3] += d[1] * d[1];
+      cov[4] += d[1] * d[2];
+      cov[5] += d[2] * d[2];
+    }
+
+    float axis[3] {1.f, 1.f, 1.f};
+    for (uint32_t iter = 0; iter < 8; iter++) {
+      const float next[3] {
+        cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2],
+        cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2],
+        cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2]
+      };
+      const float len = std::max({std::abs(next[0]), std::abs(next[1]), std::abs(next[2])});
+      if (len < 1e-6f) {
+        break;
+      }
+      for (uint32_t i = 0; i < 3; i++) {
+        axis[i] = next[i]/len;
+      }
+    }
+
+    float tmin = std::numeric_limits<float>::max();
+    float tmax = -std::numeric_limits<float>::max();
+    const float axis_len2 = axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2];
+    for (uint32_t t = 0; t < BLOCK_TEXELS; t++) {
+      float proj = 0.f;
+      for (uint32_t i = 0; i < 3; i++) {
+        proj += (rgba[4 * t + i] - mean[i]) * axis[i];
+      }
+      proj /= axis_len2;
+      tmin = std::min(tmin, proj);
+      tmax = std::max(tmax, proj);
+    }
+
+    //inset by half of a palette step, extreme texels are rarely exactly on the line
+    const float inset = (tmax - tmin)/16.f;
+    tmin += inset;
+    tmax -= inset;
+
+    float e0[3], e1[3];
+    for (uint32_t i = 0; i < 3; i++) {
+      e0[i] = mean[i] + axis[i] * tmax;
+      e1[i] = mean[i] + axis[i] * tmin;
+    }
+
+    uint16_t c0, c1;
+    uint32_t indexes;
+    uint32_t error = make_bc1_block(rgba, pack_565(e0), pack_565(e1), c0, c1, indexes);
+
+    //solve for endpoints minimizing the error with fixed palette weights
+    if (c0 != c1 && error) {
+      static const float weights[4] {1.f, 0.f, 2.f/3.f, 1.f/3.f};
+      float aa = 0.f, bb = 0.f, ab = 0.f;
+      float ax[3] {}, bx[3] {};
+      for (uint32_t t = 0; t < BLOCK_TEXELS; t++) {
+        const float a = weights[(indexes >> (2 * t)) & 3];
+        const float b = 1.f - a;
+        aa += a * a;
+        bb += b * b;
+        ab += a * b;
+        for (uint32_t i = 0; i < 3; i++) {
+          ax[i] += a * rgba[4 * t + i];
+          bx[i] += b * rgba[4 * t + i];
+        }
+      }
+
+      const float det = aa * bb - ab * ab;
+      if (std::abs(det) > 1e-6f) {
+        for (uint32_t i = 0; i < 3; i++) {
+          e0[i] = (ax[i] * bb - bx[i] * ab)/det;
+          e1[i] = (bx[i] * aa - ax[i] * ab)/det;
+        }
+
+        uint16_t refit_c0, refit_c1;
+        uint32_t refit_indexes;
+        uint32_t refit_error = make_bc1_block(rgba, pack_565(e0), pack_565(e1), refit_c0, refit_c1, refit_indexes);
+        if (refit_error < error) {
+          c0 = refit_c0;
+          c1 = refit_c1;
+          indexes = refit_indexes;
+        }
+      }
+    }
+
+    std::memcpy(out, &c0, 2);
+    std::memcpy(out + 2, &c1, 2);
+    std::memcpy(out + 4, &indexes, 4);
+  }
+
+  //8 value mode with min/max endpoints
+  void encode_bc4_block(const uint8_t *values, uint8_t *out) {
+    uint8_t vmin = 255, vmax = 0;
+    for (uint32_t t = 0; t < BLOCK_TEXELS; t++) {
+      vmin = std::min(vmin, values[t]);
+      vmax = std::max(vmax, values[t]);
+    }
+
+    out[0] = vmax;
+    out[1] = vmin;
+    uint64_t bits = 0;
+
+    if (vmax != vmin) {
+      int32_t palette[8];
+      palette[0] = vmax;
+      palette[1] = vmin;
+      for (int32_t i = 1; i < 7; i++) {
+        palette[i + 1] = ((7 - i) * vmax + i * vmin)/7;
+      }
+
+      for (uint32_t t = 0; t < BLOCK_TEXELS; t++) {
+        uint32_t best = 0;
+        int32_t best_error = INT32_MAX;
+        for (uint32_t p = 0; p < 8; p++) {
+          const int32_t error = std::abs(int32_t(values[t]) - palette[p]);
+          if (error < best_error) {
+            best_error = error;
+            best = p;
+          }
+        }
+        bits |= uint64_t(best) << (3 * t);
+      }
+    }
+
+    for (uint32_t i = 0; i < 6; i++) {
+      out[2 + i] = uint8_t(bits >> (8 * i));
+    }
+  }
+
+  //texels outside of the mip are clamped to the edge
+  static void fetch_block(const uint8_t *src, uint32_t width, uint32_t height, uint32_t bx, uint32_t by, uint8_t *block) {
+    for (uint32_t y = 0; y < 4; y++) {
+      const uint32_t sy = std::min(4 * by + y, height - 1);
+      for (uint32_t x = 0; x < 4; x++) {
+        const uint32_t sx = std::min(4 * bx + x, width - 1);
+        std::memcpy(block + 4 * (4 * y + x), src + 4 * (sy * width + sx), 4);
+      }
+    }
+  }
+
+  static bool has_transparency(const HostImage &src) {
+    const uint64_t size = get_mip_byte_size(src.format, src.width, src.height, 0);
+    for (uint64_t i = 3; i < size; i += 4) {
+      if (src.data[i] != 255) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  HostImage compress_image(const HostImage &src, TextureUsage usage) {
+    if (src.format != VK_FORMAT_R8G8B8A8_SRGB && src.format != VK_FORMAT_R8G8B8A8_UNORM) {
+      throw std::runtime_error {"Only R8G8B8A8 images can be compressed"};
+    }
+
+    const bool srgb = src.format == VK_FORMAT_R8G8B8A8_SRGB;
+
+    HostImage dst {};
+    if (usage == TextureUsage::MetallicRoughness) {
+      dst.format = VK_FORMAT_BC5_UNORM_BLOCK;
+    } else if (has_transparency(src)) {
+      dst.format = srgb? VK_FORMAT_BC3_SRGB_BLOCK : VK_FORMAT_BC3_UNORM_BLOCK;
+    } else {
+      dst.format = srgb? VK_FORMAT_BC1_RGB_SRGB_BLOCK : VK_FORMAT_BC1_RGB_UNORM_BLOCK;
+    }
+
+    dst.width = src.width;
+    dst.height = src.height;
+    dst.mip_levels = src.mip_levels;
+    dst.data.resize(get_image_byte_size(dst.format, dst.width, dst.height, dst.mip_levels));
+
+    const uint8_t *src_mip = src.data.data();
+    uint8_t *dst_block = dst.data.data();
+
+    for (uint32_t mip = 0; mip < src.mip_levels; mip++) {
+      const uint32_t w = std::max(src.width >> mip, 1u);
+      const uint32_t h = std::max(src.height >> mip, 1u);
+
+      for (uint32_t by = 0; by < (h + 3)/4; by++) {
+        for (uint32_t bx = 0; bx < (w + 3)/4; bx++) {
+          uint8_t block[4 * BLOCK_TEXELS];
+          fetch_block(src_mip, w, h, bx, by, block);
+
+          uint8_t channel[BLOCK_TEXELS];
+          auto get_channel = [&](uint32_t c) {
+            for (uint32_t t = 0; t < BLOCK_TEXELS; t++) {
+              channel[t] = block[4 * t + c];
+            }
+            return channel;
+          };
+
+          switch (dst.format) {
+          case VK_FORMAT_BC5_UNORM_BLOCK:
+            encode_bc4_block(get_channel(1), dst_block);
+            encode_bc4_block(get_channel(2), dst_block + 8);
+            dst_block += 16;
+            break;
+          case VK_FORMAT_BC3_SRGB_BLOCK:
+          case VK_FORMAT_BC3_UNORM_BLOCK:
+            encode_bc4_block(get_channel(3), dst_block);
+            encode_bc1_block(block, dst_block + 8);
+            dst_block += 16;
+            break;
+          default:
+            encode_bc1_block(block, dst_block);
+            dst_block += 8;
+            break;
+          }
+        }
+      }
+
+      src_mip += get_mip_byte_size(src.format, src.width, src.height, mip);
+    }
+
+    return dst;
+  }
+
+}
@@ -0,0 +1,18 @@
+#ifndef SCENE_TEXTURE_COMPRESSION_HPP_INCLUDED
+#define SCENE_TEXTURE_COMPRESSION_HPP_INCLUDED
+
+#include "scene.hpp"
+
+namespace scene {
+
+  //4x4 blocks of R8G8B8A8 texels, row by row
+  void encode_bc1_block(const uint8_t *rgba, uint8_t *out);  //8 bytes, alpha is ignored
+  void encode_bc4_block(const uint8_t *values, uint8_t *out); //8 bytes, 16 single channel values
+
+  //all mips of an R8G8B8A8 image are encoded:
+  //  Color - BC1 if alpha is opaque, BC3 otherwise
+  //  MetallicRoughness - BC5 of G (roughness) and B (metallic) channels, see get_image_swizzle
+  HostImage compress_image(const HostImage &src, TextureUsage usage);
+}
+
+#endif
@@ -1,5 +1,6 @@
 #include "scene_renderer.hpp"
 #include "gpu_transfer.hpp"
+#include "util_passes.hpp"
 #include "gpu/imgui_context.hpp"
 
 #include <cstdlib>
@@ -169,15 +170,31 @@ void LightsManager::draw_lights(rendergraph::RenderGraph &graph, rendergraph::Im
 
 }
 
+//every meshlet of every drawcall may pass culling, [0] counts 32 bit index primitives, [1] 16 bit ones
+static void count_meshlet_draws(const scene::CompiledScene &target, const scene::BaseNode &node, uint32_t *out_counts) {
+  if (node.mesh_index >= 0) {
+    for (auto prim_id : target.root_meshes[node.mesh_index].primitive_indexes) {
+      const auto &prim = target.primitives[prim_id];
+      out_counts[(prim.index_size == sizeof(uint16_t))? 1 : 0] += prim.meshlet_count;
+    }
+  }
+
+  for (const auto &child : node.children) {
+    count_meshlet_draws(target, child, out_counts);
+  }
+}
+
 void SceneRenderer::init_pipeline(rendergraph::RenderGraph &graph, const Gbuffer &gbuffer) {
   gpu::Registers regs {};
   regs.depth_stencil.depthTestEnable = VK_TRUE;
   regs.depth_stencil.depthWriteEnable = VK_TRUE;
 
+  const bool packed = target.vertex_layout == scene::VertexLayout::Packed;
+
   opaque_taa_pipeline = gpu::create_graphics_pipeline();
-  opaque_taa_pipeline.set_program("gbuf_opaque_taa");
+  opaque_taa_pipeline.set_program(packed? "gbuf_opaque_taa_packed" : "gbuf_opaque_taa");
   opaque_taa_pipeline.set_registers(regs);
-  opaque_taa_pipeline.set_vertex_input(scene::get_vertex_input());    
+  opaque_taa_pipeline.set_vertex_input(scene::get_vertex_input(target.vertex_layout));    
   opaque_taa_pipeline.set_rendersubpass({true, {
     graph.get_descriptor(gbuffer.albedo).format, 
     VK_FORMAT_R16G16_UNORM,
@@ -187,15 +204,16 @@ void SceneRenderer::init_pipeline(rendergraph::RenderGraph &graph, const Gbuffer
   }});
 
   triangle_id_pipeline = gpu::create_graphics_pipeline();
-  triangle_id_pipeline.set_program("gbuf_triangle_id");
+  triangle_id_pipeline.set_program(packed? "gbuf_triangle_id_packed" : "gbuf_triangle_id");
   triangle_id_pipeline.set_registers(regs);
-  triangle_id_pipeline.set_vertex_input(scene::get_vertex_input_pos_uv());
+  triangle_id_pipeline.set_vertex_input(scene::get_vertex_input_pos_uv(target.vertex_layout));
   triangle_id_pipeline.set_rendersubpass({true, {
     VK_FORMAT_R32_UINT,
     VK_FORMAT_D24_UNORM_S8_UINT
   }});
 
-  reconstruct_pipeline = gpu::create_compute_pipeline("gbuf_reconstruct");
+  reconstruct_pipeline = gpu::create_compute_pipeline(packed? "gbuf_reconstruct_packed" : "gbuf_reconstruct");
+  meshlet_cull_pipeline = gpu::create_compute_pipeline("gbuf_meshlet_cull");
 
   auto sampler_info = gpu::DEFAULT_SAMPLER;
   sampler_info.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
@@ -210,6 +228,40 @@ void SceneRenderer::init_pipeline(rendergraph::RenderGraph &graph, const Gbuffer
   transform_buffer = graph.create_buffer(VMA_MEMORY_USAGE_CPU_TO_GPU, sizeof(glm::mat4) * 1000, VK_BUFFER_USAGE_TRANSFER_DST_BIT|VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
   drawcall_buffer = graph.create_buffer(VMA_MEMORY_USAGE_GPU_ONLY, sizeof(DrawCall) * MAX_DRAWCALLS, VK_BUFFER_USAGE_TRANSFER_DST_BIT|VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
 
+  max_meshlet_draws[0] = max_meshlet_draws[1] = 0;
+  for (const auto &node : target.base_nodes) {
+    count_meshlet_draws(target, node, max_meshlet_draws);
+  }
+  const uint64_t draws_count = uint64_t(max_meshlet_draws[0]) + max_meshlet_draws[1];
+  meshlet_draws = graph.create_buffer(VMA_MEMORY_USAGE_GPU_ONLY, 4 * sizeof(uint32_t) + sizeof(VkDrawIndexedIndirectCommand) * draws_count,
+    VK_BUFFER_USAGE_TRANSFER_DST_BIT|VK_BUFFER_USAGE_STORAGE_BUFFER_BIT|VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT);
+
+  for (const auto &prim : target.primitives) {
+    max_primitive_meshlets = std::max(max_primitive_meshlets, prim.meshlet_count);
+  }
+
+  //textures are sampled in reconstruct_gbuffer only
+  texture_feedback = graph.create_buffer(VMA_MEMORY_USAGE_GPU_ONLY, sizeof(uint32_t) * std::max<size_t>(target.textures.size(), 1),
+    VK_BUFFER_USAGE_TRANSFER_SRC_BIT|VK_BUFFER_USAGE_TRANSFER_DST_BIT|VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+  buffer_clear(graph, texture_feedback, ~0u);
+
+  update_scene_textures();
+
+  uint32_t count = (uint32_t)scene_textures.size();
+  if (count == 0) {
+    count = 1;
+  }
+
+  bindless_textures.clear();
+  bindless_versions.clear();
+  for (uint32_t i = 0; i < graph.get_frames_count(); i++) {
+    bindless_textures.emplace_back(gpu::allocate_descriptor_set(opaque_taa_pipeline.get_layout(1), {count}));
+    bindless_versions.push_back(target.images_version - 1);
+  }
+}
+
+void SceneRenderer::update_scene_textures() {
+  scene_textures.clear();
   scene_textures.reserve(target.textures.size());
   for (auto tex_desc : target.textures) {
     gpu::ImageViewRange range {VK_IMAGE_VIEW_TYPE_2D, 0, 1, 0, 1};
@@ -218,18 +270,20 @@ void SceneRenderer::init_pipeline(rendergraph::RenderGraph &graph, const Gbuffer
 
     scene_textures.push_back({img->get_view(range), target.samplers[tex_desc.sampler_index]});
   }
+}
 
-  uint32_t count = (uint32_t)scene_textures.size();
-  if (count == 0) {
-    count = 1;
+//called from task callbacks, the frame that used the set last time is already finished
+VkDescriptorSet SceneRenderer::get_bindless_textures(uint32_t frame_index) {
+  auto &set = bindless_textures.at(frame_index);
+  if (bindless_versions[frame_index] != target.images_version) {
+    update_scene_textures();
+    if (scene_textures.size()) {
+      gpu::write_set(set, 
+        gpu::ArrayOfImagesBinding {0, scene_textures});
+    }
+    bindless_versions[frame_index] = target.images_version;
   }
-
-  bindless_textures = gpu::allocate_descriptor_set(opaque_taa_pipeline.get_layout(1), {count});
-  
-  if (scene_textures.size()) {
-    gpu::write_set(bindless_textures, 
-      gpu::ArrayOfImagesBinding {0, scene_textures});
-  }  
+  return set;
 }
 
 static void node_process(const scene::CompiledScene &target, const scene::BaseNode &node, std::vector<SceneRenderer::DrawCall> &draw_calls, std::vector<glm::mat4> &transforms, const glm::mat4 &acc) {
@@ -269,6 +323,8 @@ struct PushData {
   uint32_t albedo_index;
   uint32_t mr_index;
   uint32_t flags;
+  glm::vec4 bounds_center;
+  glm::vec4 bounds_extent;
 };
 
 void SceneRenderer::draw_taa(rendergraph::RenderGraph &graph, const Gbuffer &gbuffer, const DrawTAAParams &params) {
@@ -317,7 +373,7 @@ void SceneRenderer::draw_taa(rendergraph::RenderGraph &graph, const Gbuffer &gbu
       cmd.bind_viewport(0.f, 0.f, gbuffer.w, gbuffer.h, 0.f, 1.f);
       cmd.bind_scissors(0, 0, gbuffer.w, gbuffer.h);
       cmd.bind_vertex_buffers(0, {vbuf}, {0ul});
-      cmd.bind_index_buffer(ibuf, 0, VK_INDEX_TYPE_UINT32);
+      VkIndexType index_type = VK_INDEX_TYPE_MAX_ENUM;
       
       auto blk = cmd.allocate_ubo<GbufConst>();
       *blk.ptr = consts;
@@ -329,7 +385,7 @@ void SceneRenderer::draw_taa(rendergraph::RenderGraph &graph, const Gbuffer &gbu
         gpu::SSBOBinding {1, resources.get_buffer(transform_buffer)});
 
       cmd.bind_descriptors_graphics(0, {set}, {blk.offset});
-      cmd.bind_descriptors_graphics(1, {bindless_textures}, {});
+      cmd.bind_descriptors_graphics(1, {get_bindless_textures(resources.get_frame_index())}, {});
 
       for (const auto &draw_call : draw_calls) {
         const auto &prim = target.primitives[draw_call.primitive];
@@ -340,8 +396,14 @@ void SceneRenderer::draw_taa(rendergraph::RenderGraph &graph, const Gbuffer &gbu
         pc.albedo_index = (material.albedo_tex_index < scene_textures.size())? material.albedo_tex_index : scene::INVALID_TEXTURE;
         pc.mr_index = (material.metalic_roughness_index < scene_textures.size())? material.metalic_roughness_index : scene::INVALID_TEXTURE;
         pc.flags = material.clip_alpha? 0xff : 0;
+        pc.bounds_center = glm::vec4 {prim.bounds_center, 0.f};
+        pc.bounds_extent = glm::vec4 {prim.bounds_extent, 0.f};
         
         cmd.push_constants_graphics(VK_SHADER_STAGE_VERTEX_BIT|VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(PushData), &pc);
+        if (scene::get_index_type(prim) != index_type) {
+          index_type = scene::get_index_type(prim);
+          cmd.bind_index_buffer(ibuf, 0, index_type);
+        }
         cmd.draw_indexed(prim.index_count, 1, prim.index_offset, prim.vertex_offset, 0);
       }
 
@@ -350,30 +412,85 @@ void SceneRenderer::draw_taa(rendergraph::RenderGraph &graph, const Gbuffer &gbu
     });
 }
 
+//normalized planes, inside if dot(plane.xyz, p) + plane.w >= 0. Vulkan clip space depth is [0, 1]
+static void get_frustum_planes(const glm::mat4 &m, glm::vec4 planes[6]) {
+  auto row = [&](int i) { return glm::vec4 {m[0][i], m[1][i], m[2][i], m[3][i]}; };
+  planes[0] = row(3) + row(0);
+  planes[1] = row(3) - row(0);
+  planes[2] = row(3) + row(1);
+  planes[3] = row(3) - row(1);
+  planes[4] = row(2);
+  planes[5] = row(3) - row(2);
+
+  for (int i = 0; i < 6; i++) {
+    planes[i] /= glm::length(glm::vec3 {planes[i]});
+  }
+}
+
 void SceneRenderer::rasterize_triange_id(rendergraph::RenderGraph &graph, const Gbuffer &gbuffer, const DrawTAAParams &params) {
   struct Data {
     rendergraph::ImageViewId depth;
     rendergraph::ImageViewId triangle_id;
   };
-  
-  struct PushData {
-    uint32_t transform_index;
-    uint32_t drawcall_index;
-    uint32_t alpha_tex_index;
-  };
 
   struct GbufConst {
     glm::mat4 view_projection;
     glm::vec4 jitter;
   };
   
+  struct CullConst {
+    glm::vec4 frustum_planes[6];
+    glm::vec4 camera_pos;
+  };
+
+  struct CullPushData {
+    uint32_t drawcall_count;
+    uint32_t max_draws[2];
+  };
+
   GbufConst consts {params.mvp, params.jitter};
+  
+  CullConst cull_consts {};
+  get_frustum_planes(params.mvp, cull_consts.frustum_planes);
+  cull_consts.camera_pos = glm::inverse(params.camera)[3];
+
+  CullPushData cull_pc {uint32_t(draw_calls.size()), {max_meshlet_draws[0], max_meshlet_draws[1]}};
+  
+  buffer_clear(graph, meshlet_draws, 0);
+
+  struct Nil {};
+  graph.add_task<Nil>("MeshletCull",
+    [&](Nil &, rendergraph::RenderGraphBuilder &builder){
+      builder.use_storage_buffer(transform_buffer, VK_SHADER_STAGE_COMPUTE_BIT);
+      builder.use_storage_buffer(drawcall_buffer, VK_SHADER_STAGE_COMPUTE_BIT);
+      builder.use_storage_buffer(meshlet_draws, VK_SHADER_STAGE_COMPUTE_BIT, false);
+    },
+    [=](Nil &, rendergraph::RenderResources &resources, gpu::CmdContext &cmd){
+      auto blk = cmd.allocate_ubo<CullConst>();
+      *blk.ptr = cull_consts;
+
+      auto set = resources.allocate_set(meshlet_cull_pipeline, 0);
+      gpu::write_set(set,
+        gpu::UBOBinding {0, cmd.get_ubo_pool(), blk},
+        gpu::SSBOBinding {1, resources.get_buffer(transform_buffer)},
+        gpu::SSBOBinding {2, resources.get_buffer(drawcall_buffer)},
+        gpu::SSBOBinding {3, target.primitive_buffer},
+        gpu::SSBOBinding {4, target.meshlet_buffer},
+        gpu::SSBOBinding {5, resources.get_buffer(meshlet_draws)});
+
+      cmd.bind_pipeline(meshlet_cull_pipeline);
+      cmd.bind_descriptors_compute(0, {set}, {blk.offset});
+      cmd.push_constants_compute(0, sizeof(cull_pc), &cull_pc);
+      cmd.dispatch((max_primitive_meshlets + 63)/64, cull_pc.drawcall_count, 1);
+    });
 
   graph.add_task<Data>("TriangleIdPass",
     [&](Data &input, rendergraph::RenderGraphBuilder &builder){
       input.depth = builder.use_depth_attachment(gbuffer.depth, 0, 0);
       input.triangle_id = builder.use_color_attachment(gbuffer.triangle_id, 0, 0);
       builder.use_storage_buffer(transform_buffer, VK_SHADER_STAGE_VERTEX_BIT);
+      builder.use_storage_buffer(drawcall_buffer, VK_SHADER_STAGE_VERTEX_BIT);
+      builder.use_indirect_buffer(meshlet_draws);
     },
     [=](Data &input, rendergraph::RenderResources &resources, gpu::CmdContext &cmd){
       cmd.set_framebuffer(gbuffer.w, gbuffer.h, {
@@ -394,31 +511,32 @@ void SceneRenderer::rasterize_triange_id(rendergraph::RenderGraph &graph, const
 
       gpu::write_set(set, 
         gpu::SSBOBinding {0, resources.get_buffer(transform_buffer)},
-        gpu::UBOBinding {1, cmd.get_ubo_pool(), blk});
+        gpu::UBOBinding {1, cmd.get_ubo_pool(), blk},
+        gpu::SSBOBinding {2, resources.get_buffer(drawcall_buffer)},
+        gpu::SSBOBinding {3, target.primitive_buffer},
+        gpu::SSBOBinding {4, target.material_buffer});
 
       cmd.bind_descriptors_graphics(0, {set}, {blk.offset});
-      cmd.bind_descriptors_graphics(1, {bindless_textures}, {});
+      cmd.bind_descriptors_graphics(1, {get_bindless_textures(resources.get_frame_index())}, {});
       cmd.bind_vertex_buffers(0, {target.vertex_buffer->api_buffer()}, {0ul});
-      cmd.bind_index_buffer(target.index_buffer->api_buffer(), 0, VK_INDEX_TYPE_UINT32);
-
-      uint32_t drawcall_id = 0;
-
-      for (const auto &draw_call : draw_calls) {
-        const auto &prim = target.primitives[draw_call.primitive];
-        const auto &mat = target.materials[prim.material_index];
 
-        PushData pc {};
-        pc.transform_index = draw_call.transform;
-        pc.drawcall_index = drawcall_id;
-        pc.alpha_tex_index = mat.clip_alpha? mat.albedo_tex_index : 0xffffffff;
-
-        cmd.push_constants_graphics(VK_SHADER_STAGE_VERTEX_BIT|VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(PushData), &pc);
-        cmd.draw_indexed(prim.index_count, 1, prim.index_offset, prim.vertex_offset, 0);
-        drawcall_id++;
+      //one list per index type, see meshlet_cull.comp
+      auto draws = resources.get_buffer(meshlet_draws)->api_buffer();
+      const uint64_t list_size = sizeof(VkDrawIndexedIndirectCommand) * cull_pc.max_draws[0];
+      const uint64_t lists_offset[2] {4 * sizeof(uint32_t), 4 * sizeof(uint32_t) + list_size};
+      const VkIndexType index_types[2] {VK_INDEX_TYPE_UINT32, VK_INDEX_TYPE_UINT16};
+      const bool use_draw_count = gpu::app_device().supports_draw_indirect_count();
+
+      for (uint32_t list = 0; list < 2; list++) {
+        cmd.bind_index_buffer(target.index_buffer->api_buffer(), 0, index_types[list]);
+        if (use_draw_count) {
+          cmd.draw_indexed_indirect_count(draws, lists_offset[list], draws, list * sizeof(uint32_t), cull_pc.max_draws[list]);
+        } else {
+          //the lists are cleared every frame, slots past the draw count are empty draws
+          cmd.draw_indexed_indirect(draws, lists_offset[list], cull_pc.max_draws[list]);
+        }
       }
-
       cmd.end_renderpass();
-      
     });
 
 }
@@ -440,9 +558,14 @@ void SceneRenderer::reconstruct_gbuffer(rendergraph::RenderGraph &graph, const G
     glm::mat4 prev_view_projection;
     glm::vec4 jitter;
     glm::vec4 fovy_aspect_znear_zfar;
+    glm::uvec4 feedback_pixel;
   };
   
-  UniformConst consts {params.camera, params.mvp, params.prev_mvp, params.jitter, params.fovy_aspect_znear_zfar};
+  //one pixel of every 8x8 tile writes texture feedback, the pixel walks over the tile in 64 frames
+  const uint32_t feedback_index = (feedback_frame++ * 37u) & 63u;
+  const glm::uvec4 feedback_pixel {feedback_index & 7u, feedback_index >> 3u, 0u, 0u};
+
+  UniformConst consts {params.camera, params.mvp, params.prev_mvp, params.jitter, params.fovy_aspect_znear_zfar, feedback_pixel};
 
   graph.add_task<Data>("GbufferReconstructPass",
     [&](Data &input, rendergraph::RenderGraphBuilder &builder){
@@ -456,6 +579,7 @@ void SceneRenderer::reconstruct_gbuffer(rendergraph::RenderGraph &graph, const G
 
       builder.use_storage_buffer(transform_buffer, VK_SHADER_STAGE_COMPUTE_BIT);
       builder.use_storage_buffer(drawcall_buffer, VK_SHADER_STAGE_COMPUTE_BIT);
+      builder.use_storage_buffer(texture_feedback, VK_SHADER_STAGE_COMPUTE_BIT, false);
     },
     [=](Data &input, rendergraph::RenderResources &resources, gpu::CmdContext &cmd){
       auto blk = cmd.allocate_ubo<UniformConst>(); 
@@ -475,14 +599,16 @@ void SceneRenderer::reconstruct_gbuffer(rendergraph::RenderGraph &graph, const G
         gpu::StorageTextureBinding {9, resources.get_view(input.normal)},
         gpu::StorageTextureBinding {10, resources.get_view(input.material)},
         gpu::StorageTextureBinding {11, resources.get_view(input.velocity)},
-        gpu::SSBOBinding {12, resources.get_buffer(drawcall_buffer)}
+        gpu::SSBOBinding {12, resources.get_buffer(drawcall_buffer)},
+        gpu::SSBOBinding {13, target.meshlet_buffer},
+        gpu::SSBOBinding {14, resources.get_buffer(texture_feedback)}
       );
 
       auto extent = resources.get_image(input.albedo)->get_extent();
 
       cmd.bind_pipeline(reconstruct_pipeline);
       cmd.bind_descriptors_compute(0, {set}, {blk.offset});
-      cmd.bind_descriptors_compute(1, {bindless_textures}, {});
+      cmd.bind_descriptors_compute(1, {get_bindless_textures(resources.get_frame_index())}, {});
       cmd.dispatch((extent.width + 7)/8, (extent.height + 3)/4, 1);
     });
 }
\ No newline at end of file
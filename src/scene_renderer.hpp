@@ -82,14 +82,19 @@ struct SceneRenderer {
   rendergraph::BufferResourceId get_drawcalls_buffer() const { return drawcall_buffer; }
   
   const scene::CompiledScene &get_target() const { return target; }
+  //per texture minimum of uv derivatives written by reconstruct_gbuffer as uint bits, ~0u if the texture was not sampled
+  rendergraph::BufferResourceId get_texture_feedback() const { return texture_feedback; }
 
 private:
   scene::CompiledScene &target;
   gpu::GraphicsPipeline opaque_taa_pipeline;
   gpu::GraphicsPipeline triangle_id_pipeline;
   gpu::ComputePipeline reconstruct_pipeline;
+  gpu::ComputePipeline meshlet_cull_pipeline;
 
-  gpu::ManagedDescriptorSet bindless_textures {}; 
+  //one set per frame in flight, rewritten when target.images_version changes
+  std::vector<gpu::ManagedDescriptorSet> bindless_textures; 
+  std::vector<uint32_t> bindless_versions;
 
   std::vector<std::pair<VkImageView, VkSampler>> scene_textures;
   std::vector<DrawCall> draw_calls;
@@ -98,6 +103,16 @@ private:
 
   rendergraph::BufferResourceId transform_buffer;
   rendergraph::BufferResourceId drawcall_buffer;
+  //32 bit and 16 bit index draw counts, 2 pads, then max_meshlet_draws of VkDrawIndexedIndirectCommand for each index type
+  rendergraph::BufferResourceId meshlet_draws;
+  uint32_t max_meshlet_draws[2] {0, 0}; //meshlets of all scene drawcalls, nodes are not added after load
+  uint32_t max_primitive_meshlets = 0;
+
+  rendergraph::BufferResourceId texture_feedback;
+  uint32_t feedback_frame = 0;
+
+  void update_scene_textures();
+  VkDescriptorSet get_bindless_textures(uint32_t frame_index);
 };
 
 
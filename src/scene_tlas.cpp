@@ -0,0 +1,272 @@
+#include "scene_tlas.hpp"
+#include "gpu_transfer.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+
+static float surface_area(const glm::vec3 &bmin, const glm::vec3 &bmax) {
+  glm::vec3 d = glm::max(bmax - bmin, glm::vec3 {0.f});
+  return 2.f * (d.x * d.y + d.y * d.z + d.z * d.x);
+}
+
+SceneTLAS::SceneTLAS(rendergraph::RenderGraph &graph, scene::CompiledScene &scene, const scene::SceneAccelerationStructure &scene_as) {
+  //BLASes are built over the primitives of a root mesh in mesh space
+  mesh_bounds.reserve(scene.root_meshes.size());
+  for (const auto &mesh : scene.root_meshes) {
+    Bounds bounds {glm::vec3 {1e30f}, glm::vec3 {-1e30f}};
+    for (auto prim_index : mesh.primitive_indexes) {
+      const auto &prim = scene.primitives.at(prim_index);
+      bounds.min = glm::min(bounds.min, prim.bounds_center - prim.bounds_extent);
+      bounds.max = glm::max(bounds.max, prim.bounds_center + prim.bounds_extent);
+    }
+    mesh_bounds.push_back(bounds);
+  }
+
+  for (auto &node : scene.base_nodes) {
+    add_nodes(node, -1, scene_as);
+  }
+
+  if (instances.empty()) {
+    throw std::runtime_error {"SceneTLAS without instances"};
+  }
+
+  const uint32_t count = instances.size();
+  dirty_nodes.assign(nodes.size(), 1);
+  has_dirty_nodes = true;
+  pending.assign(count, 0);
+  current_bounds.resize(count);
+  build_bounds.resize(count);
+  union_area.assign(count, 0.f);
+
+  auto vk_device = gpu::app_device().api_device();
+
+  instance_buffer = graph.create_buffer(VMA_MEMORY_USAGE_GPU_ONLY, sizeof(VkAccelerationStructureInstanceKHR) * count,
+    VK_BUFFER_USAGE_TRANSFER_DST_BIT|VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT|VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR);
+
+  VkAccelerationStructureGeometryKHR geometry {};
+  geometry.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR;
+  geometry.geometryType = VK_GEOMETRY_TYPE_INSTANCES_KHR;
+  geometry.flags = VK_GEOMETRY_OPAQUE_BIT_KHR;
+  geometry.geometry.instances.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_INSTANCES_DATA_KHR;
+  geometry.geometry.instances.arrayOfPointers = VK_FALSE;
+
+  VkAccelerationStructureBuildGeometryInfoKHR build_geometry {};
+  build_geometry.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR;
+  build_geometry.type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR;
+  build_geometry.flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR|VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR;
+  build_geometry.geometryCount = 1;
+  build_geometry.pGeometries = &geometry;
+
+  VkAccelerationStructureBuildSizesInfoKHR build_sizes {};
+  build_sizes.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR;
+  vkGetAccelerationStructureBuildSizesKHR(vk_device, VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR, &build_geometry, &count, &build_sizes);
+
+  std::cout << "Dynamic TLAS : " << count << " instances of " << nodes.size() << " nodes, " << build_sizes.accelerationStructureSize
+    << " BuildScratch " << build_sizes.buildScratchSize << " UpdateScratch " << build_sizes.updateScratchSize << "\n";
+
+  storage = as_memory::allocate_storage(ASCategory::SceneTLAS, build_sizes.accelerationStructureSize);
+  //one refit or rebuild per frame
+  scratch_size = std::max(build_sizes.buildScratchSize, build_sizes.updateScratchSize);
+  as_memory::reserve_scratch(ASCategory::SceneTLAS, scratch_size);
+
+  VkAccelerationStructureCreateInfoKHR create_info {
+    .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR,
+    .pNext = nullptr,
+    .createFlags = 0,
+    .buffer = storage.api_buffer(),
+    .offset = storage.offset,
+    .size = build_sizes.accelerationStructureSize,
+    .type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR,
+    .deviceAddress = 0
+  };
+
+  VKCHECK(vkCreateAccelerationStructureKHR(vk_device, &create_info, nullptr, &tlas));
+}
+
+SceneTLAS::~SceneTLAS() {
+  if (tlas) {
+    vkDestroyAccelerationStructureKHR(gpu::app_device().api_device(), tlas, nullptr);
+  }
+  as_memory::free_storage(storage);
+  as_memory::release_scratch(ASCategory::SceneTLAS, scratch_size);
+}
+
+void SceneTLAS::add_nodes(scene::BaseNode &node, int32_t parent, const scene::SceneAccelerationStructure &scene_as) {
+  const int32_t index = nodes.size();
+  nodes.push_back(Node {&node, parent, -1, glm::mat4 {1.f}});
+
+  if (node.mesh_index >= 0) {
+    VkAccelerationStructureDeviceAddressInfoKHR address_info {
+      .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_DEVICE_ADDRESS_INFO_KHR,
+      .pNext = nullptr,
+      .accelerationStructure = scene_as.blas_array.at(node.mesh_index)
+    };
+
+    //custom index is the transform of SceneRenderer
+    VkAccelerationStructureInstanceKHR instance {};
+    instance.instanceCustomIndex = std::max(node.transform_index, 0);
+    instance.mask = 0xFF;
+    instance.instanceShaderBindingTableRecordOffset = 0;
+    instance.flags = VK_GEOMETRY_INSTANCE_TRIANGLE_FACING_CULL_DISABLE_BIT_KHR;
+    instance.accelerationStructureReference = vkGetAccelerationStructureDeviceAddressKHR(gpu::app_device().api_device(), &address_info);
+
+    nodes[index].instance = instances.size();
+    instances.push_back(instance);
+    instance_nodes.push_back(index);
+  }
+
+  for (auto &child : node.children) {
+    add_nodes(child, index, scene_as);
+  }
+}
+
+void SceneTLAS::set_node_transform(uint32_t node, const glm::mat4 &transform) {
+  nodes.at(node).node->transform = transform;
+  dirty_nodes[node] = 1;
+  has_dirty_nodes = true;
+}
+
+void SceneTLAS::update_bounds(uint32_t instance) {
+  const auto &node = nodes[instance_nodes[instance]];
+  const auto &local = mesh_bounds[node.node->mesh_index];
+
+  //AABB of the transformed AABB
+  const glm::vec3 center = 0.5f * (local.min + local.max);
+  const glm::vec3 extent = 0.5f * (local.max - local.min);
+  const glm::vec3 world_center {node.world * glm::vec4 {center, 1.f}};
+  glm::vec3 world_extent {0.f};
+  for (uint32_t axis = 0; axis < 3; axis++) {
+    world_extent += glm::abs(glm::vec3 {node.world[axis]}) * extent[axis];
+  }
+  current_bounds[instance] = Bounds {world_center - world_extent, world_center + world_extent};
+
+  const auto &built_bounds = build_bounds[instance];
+  float area = surface_area(glm::min(built_bounds.min, current_bounds[instance].min), glm::max(built_bounds.max, current_bounds[instance].max));
+  union_area_sum += double(area) - double(union_area[instance]);
+  union_area[instance] = area;
+}
+
+void SceneTLAS::update() {
+  if (has_dirty_nodes) {
+    //parents come first, so world transforms of changed subtrees are recomputed in one pass
+    for (uint32_t i = 0; i < nodes.size(); i++) {
+      auto &node = nodes[i];
+      if (node.parent >= 0 && dirty_nodes[node.parent]) {
+        dirty_nodes[i] = 1;
+      }
+      if (!dirty_nodes[i]) {
+        continue;
+      }
+
+      node.world = (node.parent >= 0)? nodes[node.parent].world * node.node->transform : node.node->transform;
+      if (node.instance >= 0 && !pending[node.instance]) {
+        pending[node.instance] = 1;
+        pending_list.push_back(node.instance);
+      }
+    }
+    std::fill(dirty_nodes.begin(), dirty_nodes.end(), 0);
+    has_dirty_nodes = false;
+  }
+
+  const uint32_t upload_count = std::min<uint32_t>(pending_list.size(), MAX_UPLOAD_INSTANCES);
+  std::vector<uint32_t> uploads(pending_list.begin(), pending_list.begin() + upload_count);
+  pending_list.erase(pending_list.begin(), pending_list.begin() + upload_count);
+  std::sort(uploads.begin(), uploads.end());
+
+  for (auto instance : uploads) {
+    const auto &world = nodes[instance_nodes[instance]].world;
+    for (uint32_t y = 0; y < 3; y++) {
+      for (uint32_t x = 0; x < 4; x++) {
+        instances[instance].transform.matrix[y][x] = world[x][y];
+      }
+    }
+    pending[instance] = 0;
+    update_bounds(instance);
+  }
+
+  //contiguous instances go in one copy
+  for (uint32_t first = 0; first < uploads.size();) {
+    uint32_t last = first;
+    while (last + 1 < uploads.size() && uploads[last + 1] == uploads[last] + 1) {
+      last++;
+    }
+    const uint32_t run = last - first + 1;
+    gpu_transfer::write_buffer(instance_buffer, sizeof(VkAccelerationStructureInstanceKHR) * uploads[first],
+      sizeof(VkAccelerationStructureInstanceKHR) * run, instances.data() + uploads[first]);
+    first = last + 1;
+  }
+
+  stats.uploaded_instances = upload_count;
+  stats.pending_instances = pending_list.size();
+}
+
+void SceneTLAS::build(rendergraph::RenderGraph &graph) {
+  //the first build needs every instance
+  if (!built && !pending_list.empty()) {
+    return;
+  }
+
+  stats.bounds_growth = (build_area_sum > 0.0)? float(union_area_sum/build_area_sum - 1.0) : 0.f;
+  const bool do_rebuild = rebuild || !built || stats.bounds_growth > max_bounds_growth;
+  stats.rebuilt = do_rebuild;
+
+  if (!do_rebuild && !stats.uploaded_instances) {
+    return;
+  }
+
+  if (do_rebuild) {
+    build_area_sum = 0.0;
+    for (uint32_t i = 0; i < instances.size(); i++) {
+      build_bounds[i] = current_bounds[i];
+      union_area[i] = surface_area(current_bounds[i].min, current_bounds[i].max);
+      build_area_sum += union_area[i];
+    }
+    union_area_sum = build_area_sum;
+    stats.bounds_growth = 0.f;
+  }
+
+  rebuild = false;
+  built = true;
+
+  const uint32_t count = instances.size();
+  const VkDeviceAddress instances_address = graph.get_buffer(instance_buffer)->device_address();
+
+  struct Nil {};
+  graph.add_task<Nil>("SceneTLASUpdate",
+  [&](Nil &, rendergraph::RenderGraphBuilder &){},
+  [=](Nil &, rendergraph::RenderResources &, gpu::CmdContext &cmd){
+    VkAccelerationStructureGeometryKHR geometry {};
+    geometry.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR;
+    geometry.geometryType = VK_GEOMETRY_TYPE_INSTANCES_KHR;
+    geometry.flags = VK_GEOMETRY_OPAQUE_BIT_KHR;
+    geometry.geometry.instances.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_INSTANCES_DATA_KHR;
+    geometry.geometry.instances.arrayOfPointers = VK_FALSE;
+    geometry.geometry.instances.data = VkDeviceOrHostAddressConstKHR {.deviceAddress = instances_address};
+
+    auto api_cmd = cmd.get_command_buffer();
+    VkAccelerationStructureBuildGeometryInfoKHR build_geometry {};
+    build_geometry.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR;
+    build_geometry.type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR;
+    build_geometry.flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR|VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR;
+    build_geometry.mode = do_rebuild? VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR : VK_BUILD_ACCELERATION_STRUCTURE_MODE_UPDATE_KHR;
+    build_geometry.srcAccelerationStructure = do_rebuild? nullptr : tlas;
+    build_geometry.dstAccelerationStructure = tlas;
+    build_geometry.geometryCount = 1;
+    build_geometry.pGeometries = &geometry;
+    build_geometry.scratchData.deviceAddress = as_memory::allocate_scratch(api_cmd, scratch_size);
+
+    VkAccelerationStructureBuildRangeInfoKHR build_range {
+      .primitiveCount = count,
+      .primitiveOffset = 0,
+      .firstVertex = 0,
+      .transformOffset = 0
+    };
+    auto range_ptr = &build_range;
+
+    //instance uploads of gpu_transfer and traces of the previous frame
+    gpu::push_wr_barrier(api_cmd);
+    vkCmdBuildAccelerationStructuresKHR(api_cmd, 1, &build_geometry, &range_ptr);
+    gpu::push_wr_barrier(api_cmd);
+  });
+}
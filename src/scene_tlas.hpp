@@ -0,0 +1,92 @@
+#ifndef SCENE_TLAS_HPP_INCLUDED
+#define SCENE_TLAS_HPP_INCLUDED
+
+#include "scene/scene_as.hpp"
+#include "rendergraph/rendergraph.hpp"
+#include "as_memory.hpp"
+
+#include <vector>
+
+struct SceneTLASStats {
+  uint32_t uploaded_instances = 0; //by the last update()
+  uint32_t pending_instances = 0;  //dirty instances over the upload budget, uploaded by the next update()
+  bool rebuilt = false;            //last build() was a rebuild
+  float bounds_growth = 0.f;       //of the instance AABBs since the last rebuild
+};
+
+//TLAS over the node hierarchy of a scene with node transforms editable at runtime.
+//Nodes are numbered in pre-order over scene.base_nodes and must not be added or removed after construction.
+//set_node_transform writes BaseNode::transform, so SceneRenderer draws the same transforms.
+//Instances of changed subtrees are uploaded through gpu_transfer, the TLAS is refit every frame
+//and rebuilt once the summed surface area of instance AABBs (union with their AABBs at the last rebuild) grew by max_bounds_growth
+struct SceneTLAS {
+  //at most MAX_UPLOAD_INSTANCES per update, gpu_transfer has MAX_TRANSFER_SIZE per frame for everything
+  static constexpr uint32_t MAX_UPLOAD_INSTANCES = 8192;
+
+  SceneTLAS(rendergraph::RenderGraph &graph, scene::CompiledScene &scene, const scene::SceneAccelerationStructure &scene_as);
+  ~SceneTLAS();
+
+  uint32_t get_nodes_count() const { return nodes.size(); }
+  //local transform
+  const glm::mat4 &get_node_transform(uint32_t node) const { return nodes.at(node).node->transform; }
+  void set_node_transform(uint32_t node, const glm::mat4 &transform);
+  //next build() is a rebuild
+  void force_rebuild() { rebuild = true; }
+
+  //flattens changed nodes and queues instance uploads, call before gpu_transfer::process_requests
+  void update();
+  //refit or rebuild task, after gpu_transfer::process_requests. The TLAS is valid after the first build() without pending instances
+  void build(rendergraph::RenderGraph &graph);
+
+  bool is_ready() const { return built; }
+  VkAccelerationStructureKHR get_tlas() const { return tlas; }
+  //world space, as uploaded, for TLASBuilder
+  const std::vector<VkAccelerationStructureInstanceKHR> &get_instances() const { return instances; }
+  const SceneTLASStats &get_stats() const { return stats; }
+
+  float max_bounds_growth = 0.25f;
+
+private:
+  struct Node {
+    scene::BaseNode *node;
+    int32_t parent;   //-1 for roots, parents come first
+    int32_t instance; //-1 without a mesh
+    glm::mat4 world;
+  };
+
+  struct Bounds {
+    glm::vec3 min;
+    glm::vec3 max;
+  };
+
+  void add_nodes(scene::BaseNode &node, int32_t parent, const scene::SceneAccelerationStructure &scene_as);
+  void update_bounds(uint32_t instance);
+
+  std::vector<Node> nodes;
+  std::vector<uint8_t> dirty_nodes;
+  bool has_dirty_nodes = false;
+
+  std::vector<VkAccelerationStructureInstanceKHR> instances;
+  std::vector<int32_t> instance_nodes;
+  std::vector<Bounds> mesh_bounds;
+  std::vector<uint8_t> pending;
+  std::vector<uint32_t> pending_list;
+
+  //AABB of the uploaded instance, its AABB at the last rebuild and the union of both
+  std::vector<Bounds> current_bounds;
+  std::vector<Bounds> build_bounds;
+  std::vector<float> union_area;
+  double build_area_sum = 0.0;
+  double union_area_sum = 0.0;
+
+  VkAccelerationStructureKHR tlas {nullptr};
+  ASAllocation storage;
+  uint64_t scratch_size = 0; //reserved in as_memory
+  rendergraph::BufferResourceId instance_buffer;
+
+  bool built = false;
+  bool rebuild = true;
+  SceneTLASStats stats;
+};
+
+#endif
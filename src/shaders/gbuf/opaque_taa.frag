@@ -19,6 +19,8 @@ layout (push_constant) uniform push_data {
   uint albedo_index;
   uint mr_index;
   uint flags;
+  vec4 bounds_center;
+  vec4 bounds_extent;
 };
 
 #define INVALID_INDEX (~0u)
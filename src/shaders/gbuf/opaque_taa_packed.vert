@@ -0,0 +1,3 @@
+#version 460 core
+#define PACKED_VERTICES
+#include "opaque_taa_vert.glsl"
@@ -3,26 +3,22 @@
 
 #extension GL_EXT_nonuniform_qualifier : enable
 
-layout (location = 0) flat in uint DRAWCALL_INDEX;
-layout (location = 1) in vec2 IN_UV;
+layout (location = 0) flat in uint MESHLET_ID;
+layout (location = 1) flat in uint ALPHA_TEX_INDEX;
+layout (location = 2) in vec2 IN_UV;
 
 layout (location = 0) out uint OUT_TRIANGLE_ID;
 
-layout (push_constant) uniform PushConstants {
-  uint transform_index;
-  uint drawcall_index;
-  uint alpha_tex_index;
-};
-
 layout (set = 1, binding = 0) uniform sampler2D material_textures[];
 
 void main() {
-  if (alpha_tex_index != 0xffffffff) {
-    float alpha = texture(material_textures[alpha_tex_index], IN_UV).a;
+  if (ALPHA_TEX_INDEX != 0xffffffff) {
+    float alpha = texture(material_textures[nonuniformEXT(ALPHA_TEX_INDEX)], IN_UV).a;
     if (alpha < 0.5f)
       discard;
   }
 
+  //gl_PrimitiveID restarts for every meshlet draw
   uint id = uint(gl_PrimitiveID);
-  OUT_TRIANGLE_ID = pack_triangle_id(DRAWCALL_INDEX, id);
-}
\ No newline at end of file
+  OUT_TRIANGLE_ID = pack_triangle_id(MESHLET_ID, id);
+}
@@ -0,0 +1,3 @@
+#version 460
+#define PACKED_VERTICES
+#include "triangle_id_vert.glsl"
@@ -0,0 +1,55 @@
+#include "../include/triangle_id.glsl"
+
+//drawn with one indirect command per visible meshlet, firstInstance is the meshlet id
+
+layout (set = 0, binding = 0, std430) readonly buffer TransformBuffer {
+  Transform TRANSFORMS[];
+};
+
+layout (set = 0, binding = 1) uniform GbufConst {
+  mat4 view_projection;
+  vec4 jitter;
+};
+
+layout (set = 0, binding = 2, std430) readonly buffer DrawcallsBuffer {
+  uint DRAWCALLS[];
+};
+
+layout (set = 0, binding = 3, std430) readonly buffer PrimitiveBuffer {
+  Primitive PRIMITIVES[];
+};
+
+layout (set = 0, binding = 4, std430) readonly buffer MaterialBuffer {
+  Material MATERIALS[];
+};
+
+#ifdef PACKED_VERTICES
+layout (location = 0) in vec4 in_packed_pos;
+#else
+layout (location = 0) in vec3 in_pos;
+#endif
+layout (location = 1) in vec2 in_uv;
+
+layout (location = 0) flat out uint OUT_MESHLET_ID;
+layout (location = 1) flat out uint OUT_ALPHA_TEX_INDEX;
+layout (location = 2) out vec2 OUT_UV;
+
+void main() {
+  uint meshlet_id = gl_InstanceIndex;
+  uint drawcall_index = meshlet_id >> MESHLET_BITS;
+  Drawcall drawcall = Drawcall(DRAWCALLS[2 * drawcall_index], DRAWCALLS[2 * drawcall_index + 1]);
+  Primitive prim = PRIMITIVES[drawcall.primitive_index];
+  Material material = MATERIALS[prim.material_index];
+
+#ifdef PACKED_VERTICES
+  vec3 in_pos = prim.bounds_center + in_packed_pos.xyz * prim.bounds_extent;
+#endif
+  vec4 pos = vec4(in_pos, 1);
+  mat4 transform = TRANSFORMS[drawcall.transform_index].model;
+  vec4 out_vector = view_projection * transform * pos;
+  
+  gl_Position = out_vector + out_vector.w * vec4(jitter.xy, 0, 0);
+  OUT_MESHLET_ID = meshlet_id;
+  OUT_ALPHA_TEX_INDEX = (material.flags != 0)? material.albedo_tex_index : 0xffffffff;
+  OUT_UV = in_uv;
+}
@@ -0,0 +1,23 @@
+#ifndef DEPTH_AS_TILES_GLSL_INCLUDED
+#define DEPTH_AS_TILES_GLSL_INCLUDED
+
+//DepthAs::MAX_TILES
+#define DEPTH_AS_MAX_TILES 4096
+
+//AABBs are stored tile by tile, see DepthAs::create
+uint depth_as_tile_index(uvec2 pixel, uvec2 tile_size, uint tiles_x) {
+  uvec2 tile = pixel/tile_size;
+  return tile.y * tiles_x + tile.x;
+}
+
+uint depth_as_primitive_slot(uvec2 pixel, uvec2 tile_size, uint tiles_x) {
+  uvec2 local = pixel % tile_size;
+  return depth_as_tile_index(pixel, tile_size, tiles_x) * tile_size.x * tile_size.y + local.y * tile_size.x + local.x;
+}
+
+//bits is mask[tile/128] of a uvec4 bitmask
+bool depth_as_tile_bit(uvec4 bits, uint tile) {
+  return ((bits[(tile >> 5) & 3] >> (tile & 31)) & 1) != 0;
+}
+
+#endif
@@ -0,0 +1,10 @@
+#ifndef TLAS_MASKS_GLSL_INCLUDED
+#define TLAS_MASKS_GLSL_INCLUDED
+
+//instance masks of TLASBuilder, TLAS_MASK_* of tlas_builder.hpp.
+//Instances of the per structure TLASes have mask 0xFF and pass any of them
+#define TLAS_MASK_SCENE 0x01
+#define TLAS_MASK_DEPTH_AS 0x02
+#define TLAS_MASK_TRIANGLE_AS 0x04
+
+#endif
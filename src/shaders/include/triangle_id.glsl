@@ -1,40 +1,41 @@
 #ifndef TRIANGLE_ID_GLSL_INCLUDED
 #define TRIANGLE_ID_GLSL_INCLUDED
 
-#define TRIANGLE_BITS 20
+//drawcall | meshlet of the drawcall primitive | triangle of the meshlet
+#define TRIANGLE_BITS 7
+#define MESHLET_BITS 13
 #define DRAWCALL_BITS 12
 
-#define TRIANGLE_MASK 0x000fffff
+#define TRIANGLE_MASK 0x0000007f
+#define MESHLET_MASK 0x000fff80
 #define DRAWCALL_MASK 0xfff00000 
 
 #define INVALID_TRIANGLE_ID ~0u
 
 struct TriangleID {
   uint drawcall_index;
+  uint meshlet_index;
   uint triangle_index;
 };
 
-uint pack_triangle_id(uint drawcall_index, uint triangle_index) {
-  uint res = 0;
-  res |= triangle_index & TRIANGLE_MASK;
-  res |= (drawcall_index << TRIANGLE_BITS) & DRAWCALL_MASK;
-  return res;
+//meshlet id is the triangle id without triangle bits, it is passed to the raster pass as firstInstance
+uint pack_meshlet_id(uint drawcall_index, uint meshlet_index) {
+  return (drawcall_index << MESHLET_BITS) | (meshlet_index & ((1 << MESHLET_BITS) - 1));
 }
 
-/*uint set_triangle_id(uint packed_id, uint triangle_index) {
-  packed_id = packed_id ^ (packed_id & TRIANGLE_MASK);
-  packed_id |= triangle_index & TRIANGLE_MASK;
-  return packed_id;
-}*/
+uint pack_triangle_id(uint meshlet_id, uint triangle_index) {
+  return (meshlet_id << TRIANGLE_BITS) | (triangle_index & TRIANGLE_MASK);
+}
 
 uint pack_triangle_id(TriangleID tid) {
-  return pack_triangle_id(tid.drawcall_index, tid.triangle_index);
+  return pack_triangle_id(pack_meshlet_id(tid.drawcall_index, tid.meshlet_index), tid.triangle_index);
 }
 
 TriangleID unpack_triangle_id(uint tid) {
-  TriangleID res = TriangleID(0, 0);
+  TriangleID res = TriangleID(0, 0, 0);
   res.triangle_index = tid & TRIANGLE_MASK;
-  res.drawcall_index = (tid >> TRIANGLE_BITS) & ((1 << DRAWCALL_BITS) - 1);
+  res.meshlet_index = (tid & MESHLET_MASK) >> TRIANGLE_BITS;
+  res.drawcall_index = (tid & DRAWCALL_MASK) >> (TRIANGLE_BITS + MESHLET_BITS);
   return res;
 }
 
@@ -87,15 +88,59 @@ struct Primitive {
   uint index_offset;
   uint index_count;
   uint material_index;
+  vec3 bounds_center;
+  uint vertex_count;
+  vec3 bounds_extent;
+  uint first_meshlet;
+  uint meshlet_count;
+  uint index_size;
+  uint pad0;
+  uint pad1;
+};
+
+//scene::Meshlet
+struct Meshlet {
+  uint primitive_index;
+  uint first_triangle;
+  uint triangle_count;
+  uint pad;
+  vec4 sphere;
+  vec4 cone;
 };
 
+#ifdef PACKED_VERTICES
+#include "octahedral.glsl"
+
+//scene::PackedVertex
+struct Vertex {
+  uint pos_xy;
+  uint pos_zw;
+  uint norm;
+  uint uv;
+};
+
+vec3 get_vertex_pos(in Vertex v, in Primitive prim) {
+  vec3 pos = vec3(unpackSnorm2x16(v.pos_xy), unpackSnorm2x16(v.pos_zw).x);
+  return prim.bounds_center + pos * prim.bounds_extent;
+}
+
+vec3 get_vertex_norm(in Vertex v) {
+  return oct_decode(unpackUnorm2x16(v.norm));
+}
+
+vec2 get_vertex_uv(in Vertex v) {
+  return unpackHalf2x16(v.uv);
+}
+
+#else
+
 struct Vertex {
   float pos_x, pos_y, pos_z;
   float norm_x, norm_y, norm_z;
   float u, v;
 };
 
-vec3 get_vertex_pos(in Vertex v) {
+vec3 get_vertex_pos(in Vertex v, in Primitive prim) {
   return vec3(v.pos_x, v.pos_y, v.pos_z);
 }
 
@@ -107,6 +152,8 @@ vec2 get_vertex_uv(in Vertex v) {
   return vec2(v.u, v.v);
 }
 
+#endif
+
 struct Transform {
   mat4 model;
   mat4 normal;
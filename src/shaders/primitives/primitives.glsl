@@ -0,0 +1,34 @@
+#ifndef PRIMITIVES_GLSL_INCLUDED
+#define PRIMITIVES_GLSL_INCLUDED
+
+//GpuPrimitives constants, gpu_primitives.hpp
+#define PRIMITIVES_GROUP_SIZE 256
+#define PRIMITIVES_ITEMS 4
+#define PRIMITIVES_BLOCK_SIZE (PRIMITIVES_GROUP_SIZE * PRIMITIVES_ITEMS)
+#define RADIX_BITS 8
+#define RADIX_SIZE 256
+#define RADIX_MASK 0xff
+
+shared uint SCAN_TEMP[PRIMITIVES_GROUP_SIZE];
+
+//exclusive scan of one value per invocation in invocation order, must be called by the whole group
+uint group_exclusive_scan(uint value, out uint total) {
+  const uint tid = gl_LocalInvocationIndex;
+  SCAN_TEMP[tid] = value;
+  barrier();
+
+  for (uint offset = 1; offset < PRIMITIVES_GROUP_SIZE; offset <<= 1) {
+    uint add = (tid >= offset)? SCAN_TEMP[tid - offset] : 0;
+    barrier();
+    SCAN_TEMP[tid] += add;
+    barrier();
+  }
+
+  total = SCAN_TEMP[PRIMITIVES_GROUP_SIZE - 1];
+  uint result = SCAN_TEMP[tid] - value;
+  //SCAN_TEMP is reused by the next call
+  barrier();
+  return result;
+}
+
+#endif
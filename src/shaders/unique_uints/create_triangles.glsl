@@ -0,0 +1,71 @@
+#include "triangle_fetch.glsl"
+
+layout (push_constant) uniform Constants {
+  mat4 CAMERA_MAT;
+  uint MAX_TRIANGLES; //capacity of OUT_TRIANGLE_VERTS, the dispatch covers all of it
+};
+
+layout (set = 0, binding = 4, std430) readonly buffer TriangleIds {
+  uint ID_COUNT;
+  uint TRIANGLE_IDS[];
+};
+
+struct IndirectArgs {
+  uint primitiveCount;
+  uint primitiveOffset;
+  uint firstVertex;
+  uint transformOffset;
+};
+
+layout (set = 0, binding = 5, std430) buffer BuildIndirectBuffer {
+  IndirectArgs args;
+};
+
+layout (set = 0, binding = 6, std430) buffer TriangleVertsBuffer {
+  float OUT_TRIANGLE_VERTS[];
+};
+
+layout (set = 0, binding = 9, std430) buffer StatsBuffer {
+  uint VISIBLE_TRIANGLES;
+  uint DROPPED_IDS;
+};
+
+const float NAN = 0.f/0.f;
+
+layout (local_size_x = 32) in;
+void main() {
+  uint index = gl_WorkGroupID.x * 32 + gl_LocalInvocationID.x;
+  uint triangles_count = min(ID_COUNT, MAX_TRIANGLES);
+
+  if (index == 0) {
+    args = IndirectArgs(triangles_count, 0, 0, 0);
+    VISIBLE_TRIANGLES = ID_COUNT;
+    atomicAdd(DROPPED_IDS, ID_COUNT - triangles_count);
+  }
+
+  if (index >= MAX_TRIANGLES)
+    return;
+
+  //padding for builds without the GPU count, NaN makes the triangle inactive
+  if (index >= triangles_count) {
+    OUT_TRIANGLE_VERTS[9 * index] = NAN;
+    return;
+  }
+
+  vec3 v0, v1, v2;
+  fetch_triangle(TRIANGLE_IDS[index], v0, v1, v2);
+
+  v0 = vec3(CAMERA_MAT * vec4(v0, 1));
+  v1 = vec3(CAMERA_MAT * vec4(v1, 1));
+  v2 = vec3(CAMERA_MAT * vec4(v2, 1));
+
+  OUT_TRIANGLE_VERTS[9 * index + 0] = v0.x;
+  OUT_TRIANGLE_VERTS[9 * index + 1] = v0.y;
+  OUT_TRIANGLE_VERTS[9 * index + 2] = v0.z;
+  OUT_TRIANGLE_VERTS[9 * index + 3] = v1.x;
+  OUT_TRIANGLE_VERTS[9 * index + 4] = v1.y;
+  OUT_TRIANGLE_VERTS[9 * index + 5] = v1.z;
+  OUT_TRIANGLE_VERTS[9 * index + 6] = v2.x;
+  OUT_TRIANGLE_VERTS[9 * index + 7] = v2.y;
+  OUT_TRIANGLE_VERTS[9 * index + 8] = v2.z;
+}
\ No newline at end of file
@@ -0,0 +1,11 @@
+#include <triangle_id.glsl>
+
+//persistent visible triangle cache of TriangleASBuilder.
+//Every slot owns one BLAS triangle, free slots keep a degenerate triangle so the active primitive set never changes and refit stays valid.
+//HASH_KEYS/HASH_SLOTS map packed triangle ids to slots with linear probing, evicted ids leave tombstones until the next rehash
+const uint CACHE_EMPTY = ~0u;
+const uint CACHE_TOMBSTONE = ~0u - 1u;
+
+uint cache_hash(uint id) {
+  return lowbias32(id);
+}
@@ -0,0 +1,91 @@
+#include "triangle_fetch.glsl"
+#include "triangle_cache.glsl"
+
+layout (set = 0, binding = 4, std430) readonly buffer NewIds {
+  uint NEW_COUNT;
+  uint NEW_IDS[];
+};
+
+layout (set = 0, binding = 5, std430) buffer HashKeys {
+  uint HASH_KEYS[];
+};
+
+layout (set = 0, binding = 6, std430) writeonly buffer HashSlots {
+  uint HASH_SLOTS[];
+};
+
+layout (set = 0, binding = 9, std430) writeonly buffer SlotIds {
+  uint SLOT_IDS[];
+};
+
+layout (set = 0, binding = 10, std430) writeonly buffer LastSeen {
+  uint LAST_SEEN[];
+};
+
+layout (set = 0, binding = 11, std430) buffer FreeList {
+  uint FREE_COUNT;
+  uint TAKEN;
+  uint FREE_SLOTS[];
+};
+
+layout (set = 0, binding = 12, std430) writeonly buffer TriangleVertsBuffer {
+  float OUT_TRIANGLE_VERTS[];
+};
+
+layout (set = 0, binding = 13, std430) buffer StatsBuffer {
+  uint LIVE_TRIANGLES;
+  uint INSERTED_TRIANGLES;
+  uint EVICTED_TRIANGLES;
+  uint DROPPED_TRIANGLES;
+};
+
+layout (push_constant) uniform PushConstants {
+  uint FRAME;
+  uint HASH_MASK;
+  uint CAPACITY;
+};
+
+layout (local_size_x = 32) in;
+void main() {
+  uint index = gl_WorkGroupID.x * 32 + gl_LocalInvocationID.x;
+  if (index >= min(NEW_COUNT, CAPACITY))
+    return;
+
+  //FREE_COUNT is updated by triangle_cache_finalize
+  uint taken = atomicAdd(TAKEN, 1);
+  if (taken >= FREE_COUNT) {
+    atomicAdd(DROPPED_TRIANGLES, 1);
+    return;
+  }
+
+  uint slot = FREE_SLOTS[FREE_COUNT - 1 - taken];
+  uint id = NEW_IDS[index];
+
+  //ids are unique, there is always a free bucket because the table is twice the capacity
+  uint bucket = cache_hash(id) & HASH_MASK;
+  for (uint i = 0; i <= HASH_MASK; i++) {
+    uint key = HASH_KEYS[bucket];
+    if ((key == CACHE_EMPTY || key == CACHE_TOMBSTONE) && atomicCompSwap(HASH_KEYS[bucket], key, id) == key) {
+      HASH_SLOTS[bucket] = slot;
+      break;
+    }
+    bucket = (bucket + 1) & HASH_MASK;
+  }
+
+  SLOT_IDS[slot] = id;
+  LAST_SEEN[slot] = FRAME;
+  atomicAdd(INSERTED_TRIANGLES, 1);
+
+  vec3 v0, v1, v2;
+  fetch_triangle(id, v0, v1, v2);
+
+  OUT_TRIANGLE_VERTS[9 * slot + 0] = v0.x;
+  OUT_TRIANGLE_VERTS[9 * slot + 1] = v0.y;
+  OUT_TRIANGLE_VERTS[9 * slot + 2] = v0.z;
+  OUT_TRIANGLE_VERTS[9 * slot + 3] = v1.x;
+  OUT_TRIANGLE_VERTS[9 * slot + 4] = v1.y;
+  OUT_TRIANGLE_VERTS[9 * slot + 5] = v1.z;
+  OUT_TRIANGLE_VERTS[9 * slot + 6] = v2.x;
+  OUT_TRIANGLE_VERTS[9 * slot + 7] = v2.y;
+  OUT_TRIANGLE_VERTS[9 * slot + 8] = v2.z;
+}
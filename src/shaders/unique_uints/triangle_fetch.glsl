@@ -0,0 +1,53 @@
+#include <triangle_id.glsl>
+
+//scene geometry of a triangle id, bindings 0-3, 7, 8 are shared by create_triangles and triangle_cache_insert
+layout (set = 0, binding = 0, std430) readonly buffer TransformBuffer {
+  Transform TRANSFORMS[];
+};
+
+layout (set = 0, binding = 1, std430) readonly buffer VertexBuffer {
+  Vertex VERTICES[];
+};
+
+layout (set = 0, binding = 2, std430) readonly buffer IndexBuffer {
+  uint INDEXES[];
+};
+
+//16 bit primitives keep two indexes in one uint
+uint load_index(in Primitive prim, uint i) {
+  uint index = prim.index_offset + i;
+  if (prim.index_size == 2) {
+    return (INDEXES[index >> 1] >> (16 * (index & 1))) & 0xffff;
+  }
+  return INDEXES[index];
+}
+
+layout (set = 0, binding = 3, std430) readonly buffer PrimitiveBuffer {
+  Primitive PRIMITIVES[];
+};
+
+layout (set = 0, binding = 7, std430) readonly buffer DrawcallsBuffer {
+  uint DRAWCALLS[];
+};
+
+layout (set = 0, binding = 8, std430) readonly buffer MeshletBuffer {
+  Meshlet MESHLETS[];
+};
+
+//world space
+void fetch_triangle(uint packed_id, out vec3 v0, out vec3 v1, out vec3 v2) {
+  TriangleID id = unpack_triangle_id(packed_id);
+  Drawcall drawcall = Drawcall(DRAWCALLS[2 * id.drawcall_index], DRAWCALLS[2 * id.drawcall_index + 1]);
+  Primitive primitive = PRIMITIVES[drawcall.primitive_index];
+  Meshlet meshlet = MESHLETS[primitive.first_meshlet + id.meshlet_index];
+  mat4 transform = TRANSFORMS[drawcall.transform_index].model;
+
+  uint vert_index = 3 * (meshlet.first_triangle + id.triangle_index);
+  v0 = get_vertex_pos(VERTICES[primitive.vertex_offset + load_index(primitive, vert_index + 0)], primitive);
+  v1 = get_vertex_pos(VERTICES[primitive.vertex_offset + load_index(primitive, vert_index + 1)], primitive);
+  v2 = get_vertex_pos(VERTICES[primitive.vertex_offset + load_index(primitive, vert_index + 2)], primitive);
+
+  v0 = vec3(transform * vec4(v0, 1));
+  v1 = vec3(transform * vec4(v1, 1));
+  v2 = vec3(transform * vec4(v2, 1));
+}
@@ -0,0 +1,279 @@
+#include "texture_streaming.hpp"
+#include "util_passes.hpp"
+#include "gpu/imgui_context.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+static uint64_t get_chain_size(const scene::StreamedImage &src, uint32_t first_mip) {
+  return scene::get_image_byte_size(src.format,
+    std::max(src.width >> first_mip, 1u),
+    std::max(src.height >> first_mip, 1u),
+    src.mip_levels - first_mip);
+}
+
+TextureStreamer::TextureStreamer(rendergraph::RenderGraph &graph, scene::CompiledScene &s, uint64_t budget_bytes)
+  : target {s}, budget {budget_bytes}
+{
+  states.reserve(target.streamed_images.size());
+  for (const auto &src : target.streamed_images) {
+    ImageState state {};
+    state.tail_mip = scene::get_streaming_tail_mip(src.width, src.height, src.mip_levels);
+    state.requested_mip = state.tail_mip;
+    states.push_back(state);
+    resident_size += get_chain_size(src, src.resident_mip);
+  }
+
+  for (uint32_t i = 0; i < graph.get_frames_count(); i++) {
+    staging.push_back(gpu::create_buffer(VMA_MEMORY_USAGE_CPU_TO_GPU, STAGING_SIZE, VK_BUFFER_USAGE_TRANSFER_SRC_BIT));
+  }
+}
+
+void TextureStreamer::apply_feedback(const ReadBackData &data) {
+  const uint32_t *feedback = reinterpret_cast<const uint32_t*>(data.bytes.get());
+  const uint32_t count = std::min<uint32_t>(data.width/sizeof(uint32_t), target.textures.size());
+
+  std::vector<float> footprints(states.size(), std::numeric_limits<float>::infinity());
+  for (uint32_t i = 0; i < count; i++) {
+    if (feedback[i] == ~0u) {
+      continue;
+    }
+    float footprint;
+    std::memcpy(&footprint, &feedback[i], sizeof(footprint));
+    auto &dst = footprints.at(target.textures[i].image_index);
+    dst = std::min(dst, footprint);
+  }
+
+  for (uint32_t i = 0; i < states.size(); i++) {
+    auto &state = states[i];
+    const auto &src = target.streamed_images[i];
+
+    if (std::isinf(footprints[i])) {
+      state.readbacks_unseen++;
+      if (state.readbacks_unseen > FEEDBACK_TIMEOUT) {
+        state.requested_mip = state.tail_mip;
+      }
+      continue;
+    }
+
+    //same lod selection as the sampler, footprint is in uv per pixel
+    float lod = std::log2(footprints[i] * std::max(src.width, src.height)) + mip_bias;
+    state.requested_mip = std::min(uint32_t(std::max(std::floor(lod), 0.f)), state.tail_mip);
+    state.readbacks_unseen = 0;
+  }
+}
+
+//drops top mips of the largest images until requested mips fit into the budget, tails are never dropped
+std::vector<uint32_t> TextureStreamer::fit_budget() const {
+  std::vector<uint32_t> target_mips(states.size());
+  uint64_t total = 0;
+  for (uint32_t i = 0; i < states.size(); i++) {
+    target_mips[i] = states[i].requested_mip;
+    total += get_chain_size(target.streamed_images[i], target_mips[i]);
+  }
+
+  while (total > budget) {
+    uint32_t largest = UINT32_MAX;
+    uint64_t largest_size = 0;
+    for (uint32_t i = 0; i < states.size(); i++) {
+      if (target_mips[i] >= states[i].tail_mip) {
+        continue;
+      }
+      const auto &src = target.streamed_images[i];
+      uint64_t size = scene::get_mip_byte_size(src.format, src.width, src.height, target_mips[i]);
+      if (size > largest_size) {
+        largest = i;
+        largest_size = size;
+      }
+    }
+
+    if (largest == UINT32_MAX) {
+      break;
+    }
+    target_mips[largest]++;
+    total -= largest_size;
+  }
+  return target_mips;
+}
+
+void TextureStreamer::update(rendergraph::RenderGraph &graph, ReadBackSystem &readback) {
+  frame++;
+  auto it = std::remove_if(retired_images.begin(), retired_images.end(), [&](const auto &elem) {
+    return elem.first <= frame;
+  });
+  retired_images.erase(it, retired_images.end());
+
+  if (feedback_readback != INVALID_READBACK && readback.is_data_available(feedback_readback)) {
+    apply_feedback(readback.get_data(feedback_readback));
+    feedback_readback = INVALID_READBACK;
+  }
+
+  auto target_mips = fit_budget();
+
+  uint64_t upgrade_size = 0;
+  for (uint32_t i = 0; i < states.size(); i++) {
+    const auto &src = target.streamed_images[i];
+    if (target_mips[i] < src.resident_mip) {
+      upgrade_size += get_chain_size(src, target_mips[i]) - get_chain_size(src, src.resident_mip);
+    }
+  }
+
+  //resident mips above the target are kept until they are needed for the budget
+  const bool evict = resident_size + upgrade_size > budget;
+
+  //evictions first, then images that miss most mips
+  std::vector<uint32_t> order;
+  for (uint32_t i = 0; i < states.size(); i++) {
+    const uint32_t resident = target.streamed_images[i].resident_mip;
+    if (target_mips[i] < resident || (evict && target_mips[i] > resident)) {
+      order.push_back(i);
+    }
+  }
+
+  auto priority = [&](uint32_t i) {
+    const int32_t missing = int32_t(target.streamed_images[i].resident_mip) - int32_t(target_mips[i]);
+    return (missing < 0)? INT32_MAX : missing;
+  };
+
+  std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+    return priority(a) > priority(b);
+  });
+
+  std::vector<Upload> uploads;
+  uint64_t staging_offset = 0;
+
+  for (auto index : order) {
+    auto &src = target.streamed_images[index];
+
+    //large chains are brought in a few mips at a time
+    uint32_t mip = target_mips[index];
+    while (mip < src.resident_mip && staging_offset + get_chain_size(src, mip) > STAGING_SIZE) {
+      mip++;
+    }
+
+    const uint64_t size = get_chain_size(src, mip);
+    if (mip == src.resident_mip || staging_offset + size > STAGING_SIZE) {
+      continue;
+    }
+
+    auto image = scene::create_streamed_image(src, mip);
+    uploads.push_back(Upload {image, scene::get_streamed_mip_data(src, mip), staging_offset, size});
+    staging_offset = (staging_offset + size + 15) & ~15ull;
+
+    resident_size = resident_size + size - get_chain_size(src, src.resident_mip);
+    retired_images.emplace_back(frame + graph.get_frames_count() + 1, std::move(target.images[index]));
+    target.images[index] = std::move(image);
+    src.resident_mip = mip;
+  }
+
+  last_uploads = uploads.size();
+  if (!uploads.empty()) {
+    target.images_version++;
+    record_uploads(graph, std::move(uploads));
+  }
+}
+
+void TextureStreamer::record_uploads(rendergraph::RenderGraph &graph, std::vector<Upload> &&uploads) {
+  struct Data {
+    std::vector<Upload> uploads;
+  };
+
+  graph.add_task<Data>("TextureStreaming",
+    [&](Data &input, rendergraph::RenderGraphBuilder &){
+      std::swap(input.uploads, uploads);
+    },
+    [=](Data &input, rendergraph::RenderResources &resources, gpu::CmdContext &cmd){
+      //the frame that used this staging buffer is finished
+      auto &src_buffer = staging.at(resources.get_frame_index());
+      auto ptr = static_cast<uint8_t*>(src_buffer->get_mapped_ptr());
+      for (const auto &upload : input.uploads) {
+        std::memcpy(ptr + upload.staging_offset, upload.data, upload.size);
+      }
+      src_buffer->flush();
+
+      std::vector<VkImageMemoryBarrier> barriers;
+      barriers.reserve(input.uploads.size());
+      for (auto &upload : input.uploads) {
+        barriers.push_back(VkImageMemoryBarrier {
+          .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+          .pNext = nullptr,
+          .srcAccessMask = 0,
+          .dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+          .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+          .newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+          .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+          .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+          .image = upload.image->api_image(),
+          .subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, upload.image->get_mip_levels(), 0, 1}
+        });
+      }
+
+      auto api_cmd = cmd.get_command_buffer();
+      vkCmdPipelineBarrier(api_cmd,
+        VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+        VK_PIPELINE_STAGE_TRANSFER_BIT,
+        0,
+        0, nullptr,
+        0, nullptr,
+        barriers.size(), barriers.data());
+
+      std::vector<VkBufferImageCopy> regions;
+      for (auto &upload : input.uploads) {
+        const auto &desc = upload.image->get_info();
+        uint64_t offset = upload.staging_offset;
+
+        regions.clear();
+        for (uint32_t mip = 0; mip < desc.mipLevels; mip++) {
+          regions.push_back(VkBufferImageCopy {
+            .bufferOffset = offset,
+            .bufferRowLength = 0,
+            .bufferImageHeight = 0,
+            .imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, mip, 0, 1},
+            .imageOffset = {0, 0, 0},
+            .imageExtent = {std::max(desc.extent.width >> mip, 1u), std::max(desc.extent.height >> mip, 1u), 1}
+          });
+          offset += scene::get_mip_byte_size(desc.format, desc.extent.width, desc.extent.height, mip);
+        }
+
+        vkCmdCopyBufferToImage(api_cmd, src_buffer->api_buffer(), upload.image->api_image(), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, regions.size(), regions.data());
+      }
+
+      for (auto &barrier : barriers) {
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+      }
+
+      vkCmdPipelineBarrier(api_cmd,
+        VK_PIPELINE_STAGE_TRANSFER_BIT,
+        VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT|VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        0,
+        0, nullptr,
+        0, nullptr,
+        barriers.size(), barriers.data());
+    });
+}
+
+void TextureStreamer::read_feedback(rendergraph::RenderGraph &graph, ReadBackSystem &readback, rendergraph::BufferResourceId feedback) {
+  if (feedback_readback != INVALID_READBACK) {
+    return;
+  }
+  feedback_readback = readback.read_buffer(graph, feedback);
+  buffer_clear(graph, feedback, ~0u);
+}
+
+void TextureStreamer::draw_ui() {
+  int budget_mb = budget >> 20;
+
+  ImGui::Begin("Texture streaming");
+  ImGui::Text("Resident %u MB", uint32_t(resident_size >> 20));
+  ImGui::Text("Uploads last frame %u", last_uploads);
+  if (ImGui::SliderInt("Budget MB", &budget_mb, 16, 4096)) {
+    budget = uint64_t(budget_mb) << 20;
+  }
+  ImGui::SliderFloat("Mip bias", &mip_bias, -2.f, 2.f);
+  ImGui::End();
+}
@@ -0,0 +1,59 @@
+#ifndef TEXTURE_STREAMING_HPP_INCLUDED
+#define TEXTURE_STREAMING_HPP_INCLUDED
+
+#include "scene/scene.hpp"
+#include "rendergraph/rendergraph.hpp"
+#include "image_readback.hpp"
+
+//Keeps mips of CompiledScene::streamed_images resident according to texture feedback of SceneRenderer::reconstruct_gbuffer.
+//Images are recreated with more or less mips and replaced in CompiledScene::images, old ones are released after frames in flight finish.
+struct TextureStreamer {
+  static constexpr uint64_t DEFAULT_BUDGET = 256ull << 20;
+  static constexpr uint64_t STAGING_SIZE = 16ull << 20; //upload limit per frame
+  static constexpr uint32_t FEEDBACK_TIMEOUT = 32; //readbacks without feedback before an image falls back to its mip tail
+
+  TextureStreamer(rendergraph::RenderGraph &graph, scene::CompiledScene &s, uint64_t budget = DEFAULT_BUDGET);
+
+  //applies the latest feedback and records uploads, call before the scene is rendered
+  void update(rendergraph::RenderGraph &graph, ReadBackSystem &readback);
+  //call after SceneRenderer::reconstruct_gbuffer, feedback is accumulated until the previous readback is consumed
+  void read_feedback(rendergraph::RenderGraph &graph, ReadBackSystem &readback, rendergraph::BufferResourceId feedback);
+  void draw_ui();
+
+  void set_budget(uint64_t bytes) { budget = bytes; }
+  uint64_t get_budget() const { return budget; }
+  uint64_t get_resident_size() const { return resident_size; }
+
+private:
+  struct ImageState {
+    uint32_t tail_mip;
+    uint32_t requested_mip;
+    uint32_t readbacks_unseen = 0;
+  };
+
+  struct Upload {
+    gpu::ImagePtr image;
+    const uint8_t *data;
+    uint64_t staging_offset;
+    uint64_t size;
+  };
+
+  scene::CompiledScene &target;
+  uint64_t budget;
+  uint64_t resident_size = 0;
+  float mip_bias = 0.f;
+
+  std::vector<ImageState> states;
+  std::vector<gpu::BufferPtr> staging; //one per frame in flight
+  std::vector<std::pair<uint64_t, gpu::ImagePtr>> retired_images; //frame when the image is no longer used
+  uint64_t frame = 0;
+  uint32_t last_uploads = 0;
+
+  ReadBackID feedback_readback = INVALID_READBACK;
+
+  void apply_feedback(const ReadBackData &data);
+  std::vector<uint32_t> fit_budget() const;
+  void record_uploads(rendergraph::RenderGraph &graph, std::vector<Upload> &&uploads);
+};
+
+#endif
@@ -0,0 +1,198 @@
+#include "tlas_builder.hpp"
+
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+static VkTransformMatrixKHR to_vk_transform(const glm::mat4 &transform) {
+  VkTransformMatrixKHR out {};
+  for (uint32_t y = 0; y < 3; y++) {
+    for (uint32_t x = 0; x < 4; x++) {
+      out.matrix[y][x] = transform[x][y];
+    }
+  }
+  return out;
+}
+
+static glm::mat4 from_vk_transform(const VkTransformMatrixKHR &transform) {
+  glm::mat4 out {1.f};
+  for (uint32_t y = 0; y < 3; y++) {
+    for (uint32_t x = 0; x < 4; x++) {
+      out[x][y] = transform.matrix[y][x];
+    }
+  }
+  return out;
+}
+
+static VkAccelerationStructureGeometryKHR make_instances_geometry(VkDeviceAddress instances) {
+  VkAccelerationStructureGeometryInstancesDataKHR instances_data {
+    .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_INSTANCES_DATA_KHR,
+    .pNext = nullptr,
+    .arrayOfPointers = VK_FALSE,
+    .data {.deviceAddress = instances}
+  };
+
+  return VkAccelerationStructureGeometryKHR {
+    .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR,
+    .pNext = nullptr,
+    .geometryType = VK_GEOMETRY_TYPE_INSTANCES_KHR,
+    .geometry {.instances = instances_data},
+    .flags = VK_GEOMETRY_OPAQUE_BIT_KHR
+  };
+}
+
+void TLASBuilder::create(rendergraph::RenderGraph &graph, uint32_t max_instances_count) {
+  close();
+  if (!max_instances_count) {
+    throw std::runtime_error {"TLASBuilder with zero capacity"};
+  }
+  max_instances = max_instances_count;
+
+  auto vk_device = gpu::app_device().api_device();
+  const uint64_t instances_size = sizeof(VkAccelerationStructureInstanceKHR) * max_instances;
+
+  instance_buffer = gpu::create_buffer(VMA_MEMORY_USAGE_CPU_TO_GPU, instances_size * graph.get_frames_count(),
+    VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT|VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR, 16);
+
+  auto geometry = make_instances_geometry(instance_buffer->device_address());
+  VkAccelerationStructureBuildGeometryInfoKHR build_info {
+    .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR,
+    .pNext = nullptr,
+    .type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR,
+    .flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR,
+    .mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR,
+    .srcAccelerationStructure = nullptr,
+    .dstAccelerationStructure = nullptr,
+    .geometryCount = 1,
+    .pGeometries = &geometry,
+    .ppGeometries = nullptr,
+    .scratchData {.hostAddress = nullptr}
+  };
+
+  VkAccelerationStructureBuildSizesInfoKHR sizes {VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR};
+  vkGetAccelerationStructureBuildSizesKHR(vk_device, VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR, &build_info, &max_instances, &sizes);
+  std::cout << "Unified TLAS = " << sizes.accelerationStructureSize << " BuildScratch " << sizes.buildScratchSize << " for " << max_instances << " instances\n";
+
+  storage = as_memory::allocate_storage(ASCategory::TLAS, sizes.accelerationStructureSize);
+  scratch_size = sizes.buildScratchSize;
+  as_memory::reserve_scratch(ASCategory::TLAS, scratch_size);
+
+  VkAccelerationStructureCreateInfoKHR create_info {
+    .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR,
+    .pNext = nullptr,
+    .createFlags = 0,
+    .buffer = storage.api_buffer(),
+    .offset = storage.offset,
+    .size = sizes.accelerationStructureSize,
+    .type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR,
+    .deviceAddress = 0
+  };
+
+  VKCHECK(vkCreateAccelerationStructureKHR(vk_device, &create_info, nullptr, &tlas));
+  instances.reserve(max_instances);
+}
+
+void TLASBuilder::close() {
+  if (tlas) {
+    vkDestroyAccelerationStructureKHR(gpu::app_device().api_device(), tlas, nullptr);
+  }
+  tlas = nullptr;
+  as_memory::free_storage(storage);
+  as_memory::release_scratch(ASCategory::TLAS, scratch_size);
+  scratch_size = 0;
+  instance_buffer.release();
+  instances.clear();
+  max_instances = 0;
+}
+
+void TLASBuilder::clear() {
+  instances.clear();
+}
+
+void TLASBuilder::add_instance(VkAccelerationStructureKHR blas, const glm::mat4 &transform, uint32_t custom_index, uint8_t mask, uint32_t sbt_offset, VkGeometryInstanceFlagsKHR flags) {
+  if (instances.size() >= max_instances) {
+    throw std::runtime_error {"TLASBuilder instances over capacity"};
+  }
+  if (custom_index >= (1u << 24u) || sbt_offset >= (1u << 24u)) {
+    throw std::runtime_error {"TLASBuilder instance custom index and SBT offset are 24 bit"};
+  }
+
+  VkAccelerationStructureDeviceAddressInfoKHR address_info {
+    .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_DEVICE_ADDRESS_INFO_KHR,
+    .pNext = nullptr,
+    .accelerationStructure = blas
+  };
+
+  VkAccelerationStructureInstanceKHR instance {
+    .transform = to_vk_transform(transform),
+    .instanceCustomIndex = custom_index,
+    .mask = mask,
+    .instanceShaderBindingTableRecordOffset = sbt_offset,
+    .flags = flags,
+    .accelerationStructureReference = vkGetAccelerationStructureDeviceAddressKHR(gpu::app_device().api_device(), &address_info)
+  };
+  instances.push_back(instance);
+}
+
+void TLASBuilder::add_instances(const std::vector<VkAccelerationStructureInstanceKHR> &src, const glm::mat4 &transform, uint8_t mask) {
+  if (instances.size() + src.size() > max_instances) {
+    throw std::runtime_error {"TLASBuilder instances over capacity"};
+  }
+
+  for (auto instance : src) {
+    instance.transform = to_vk_transform(transform * from_vk_transform(instance.transform));
+    instance.mask = mask;
+    instances.push_back(instance);
+  }
+}
+
+void TLASBuilder::build(rendergraph::RenderGraph &graph) {
+  //instances may change before the task runs
+  auto snapshot = instances;
+
+  struct Nil {};
+  graph.add_task<Nil>("BuildUnifiedTLAS",
+  [&](Nil &, rendergraph::RenderGraphBuilder &){},
+  [=](Nil &, rendergraph::RenderResources &res, gpu::CmdContext &cmd){
+    const uint64_t slice_size = sizeof(VkAccelerationStructureInstanceKHR) * max_instances;
+    const uint64_t slice_offset = res.get_frame_index() * slice_size;
+    const uint32_t count = snapshot.size();
+
+    //the frame fence is waited, so the slice of this frame is free
+    auto dst = static_cast<uint8_t *>(instance_buffer->get_mapped_ptr()) + slice_offset;
+    std::memcpy(dst, snapshot.data(), sizeof(VkAccelerationStructureInstanceKHR) * count);
+    if (!instance_buffer->is_coherent()) {
+      instance_buffer->flush(slice_offset, slice_size);
+    }
+
+    auto geometry = make_instances_geometry(instance_buffer->device_address() + slice_offset);
+    auto api_cmd = cmd.get_command_buffer();
+    VkAccelerationStructureBuildGeometryInfoKHR build_info {
+      .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR,
+      .pNext = nullptr,
+      .type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR,
+      .flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR,
+      .mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR,
+      .srcAccelerationStructure = nullptr,
+      .dstAccelerationStructure = tlas,
+      .geometryCount = 1,
+      .pGeometries = &geometry,
+      .ppGeometries = nullptr,
+      .scratchData {.deviceAddress = as_memory::allocate_scratch(api_cmd, scratch_size)}
+    };
+
+    VkAccelerationStructureBuildRangeInfoKHR range {
+      .primitiveCount = count,
+      .primitiveOffset = 0,
+      .firstVertex = 0,
+      .transformOffset = 0
+    };
+    auto range_ptr = &range;
+
+    //previous traces of the TLAS and BLAS builds of this frame
+    gpu::push_rw_barrier(api_cmd);
+    gpu::push_wr_barrier(api_cmd);
+    vkCmdBuildAccelerationStructuresKHR(api_cmd, 1, &build_info, &range_ptr);
+    gpu::push_wr_barrier(api_cmd);
+  });
+}
@@ -0,0 +1,48 @@
+#ifndef TLAS_BUILDER_HPP_INCLUDED
+#define TLAS_BUILDER_HPP_INCLUDED
+
+#include "rendergraph/rendergraph.hpp"
+#include "gpu/gpu.hpp"
+#include "as_memory.hpp"
+
+#include <glm/glm.hpp>
+#include <vector>
+
+//cull masks of the instances, TLAS_MASK_* of tlas_masks.glsl
+constexpr uint8_t TLAS_MASK_SCENE = 0x01;
+constexpr uint8_t TLAS_MASK_DEPTH_AS = 0x02;
+constexpr uint8_t TLAS_MASK_TRIANGLE_AS = 0x04;
+
+//One TLAS over heterogeneous instances, rebuilt every frame from the instances added since clear().
+//Instances of every frame in flight get their own slice of a mapped buffer, so the CPU never writes instances the GPU may still read.
+//All instances share one ray space: DepthAs BLASes are in screen space and can't be mixed with view or world space geometry in one traversal,
+//rays select the space with the cull mask
+struct TLASBuilder {
+  ~TLASBuilder() { close(); }
+
+  void create(rendergraph::RenderGraph &graph, uint32_t max_instances);
+  void close();
+
+  //starts a new set of instances, the TLAS keeps the last built set until the next build()
+  void clear();
+  void add_instance(VkAccelerationStructureKHR blas, const glm::mat4 &transform, uint32_t custom_index, uint8_t mask, uint32_t sbt_offset = 0, VkGeometryInstanceFlagsKHR flags = 0);
+  //transform is applied on top of the instance transforms, masks are replaced
+  void add_instances(const std::vector<VkAccelerationStructureInstanceKHR> &instances, const glm::mat4 &transform, uint8_t mask);
+  //BLASes must be built before this task
+  void build(rendergraph::RenderGraph &graph);
+
+  VkAccelerationStructureKHR get_tlas() const { return tlas; }
+  uint32_t get_instances_count() const { return instances.size(); }
+  uint32_t get_max_instances() const { return max_instances; }
+
+private:
+  VkAccelerationStructureKHR tlas {nullptr};
+  ASAllocation storage;
+  uint64_t scratch_size = 0; //reserved in as_memory
+  gpu::BufferPtr instance_buffer; //max_instances per frame in flight, CPU_TO_GPU
+
+  uint32_t max_instances = 0;
+  std::vector<VkAccelerationStructureInstanceKHR> instances;
+};
+
+#endif
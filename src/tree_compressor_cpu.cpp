@@ -0,0 +1,324 @@
+#include "tree_compressor_cpu.hpp"
+
+#include <glm/gtc/packing.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+static glm::vec2 sign_nz(const glm::vec2 &v) {
+  return glm::vec2{v.x >= 0.f? 1.f : -1.f, v.y >= 0.f? 1.f : -1.f};
+}
+
+glm::vec2 encode_normal(const glm::vec3 &v) {
+  float l1norm = std::abs(v.x) + std::abs(v.y) + std::abs(v.z);
+  glm::vec2 result = glm::vec2(v) * (1.f/l1norm);
+
+  if (v.z < 0.f) {
+    result = (1.f - glm::abs(glm::vec2{result.y, result.x})) * sign_nz(result);
+  }
+
+  return 0.5f * result + glm::vec2(0.5f, 0.5f);
+}
+
+glm::vec3 decode_normal(glm::vec2 uv) {
+  uv = 2.f * uv - glm::vec2(1.f, 1.f);
+  glm::vec3 v {uv.x, uv.y, 1.f - std::abs(uv.x) - std::abs(uv.y)};
+  if (v.z < 0.f) {
+    glm::vec2 xy = (1.f - glm::abs(glm::vec2{v.y, v.x})) * sign_nz(glm::vec2(v));
+    v.x = xy.x;
+    v.y = xy.y;
+  }
+  return glm::normalize(v);
+}
+
+namespace {
+  //one mip of GbufferCompressor::tree_levels, texels are (encoded normal, depth, 0) and depth < 0 marks an invalid node
+  struct TreeLevel {
+    glm::ivec2 size;
+    std::vector<glm::vec4> texels;
+
+    glm::vec4 &at(const glm::ivec2 &p) { return texels[p.y * size.x + p.x]; }
+    const glm::vec4 &at(const glm::ivec2 &p) const { return texels[p.y * size.x + p.x]; }
+  };
+
+  enum : uint32_t {
+    CHECK_GAPS = 1,
+    DO_NOT_COMPRESS = 2
+  };
+
+  //process_level.comp with its push constants
+  struct LevelProcessor {
+    const DepthAsParams &params;
+    const TreeCompressorThresholds &thresholds;
+    uint32_t flag;
+    uint32_t src_level;
+
+    glm::vec3 plane_intersection(const glm::vec3 &v, const glm::vec3 &plane_normal, const glm::vec3 &plane_point) const {
+      float dot_val = glm::dot(v, plane_normal);
+      const float t = glm::dot(plane_point, plane_normal)/dot_val;
+      return (std::abs(dot_val) > 0.01f)? v * t : glm::vec3(0, 0, 0);
+    }
+
+    glm::vec3 plane_intersection(const glm::vec2 &uv, const glm::vec3 &plane_normal, const glm::vec3 &plane_point) const {
+      glm::vec3 v = glm::normalize(reconstruct_view_vec(uv, 0, params));
+      return plane_intersection(v, plane_normal, plane_point);
+    }
+
+    //view space box like create_aabb of process_level.comp
+    VkAabbPositionsKHR create_aabb(const glm::vec3 &pos, const glm::vec3 &normal, const glm::vec2 &corner_uv, const glm::vec2 &step_uv) const {
+      float min_depth = 1.f;
+      float max_depth = 0.f;
+
+      for (int i = 0; i < 4; i++) {
+        glm::vec2 pos_uv = corner_uv + float(i >> 1) * glm::vec2(0, step_uv.y) + float(i & 1) * glm::vec2(step_uv.x, 0);
+        glm::vec3 v = plane_intersection(pos_uv, normal, pos);
+        float depth = encode_depth(v.z, params.znear, params.zfar);
+        min_depth = std::min(min_depth, depth);
+        max_depth = std::max(max_depth, depth);
+      }
+      glm::vec3 v0 = reconstruct_view_vec(corner_uv, min_depth, params);
+      glm::vec3 v1 = reconstruct_view_vec(corner_uv + step_uv, min_depth, params);
+      v1.z = linearize_depth2(max_depth, params.znear, params.zfar);
+
+      glm::vec3 min_vec = glm::min(v0, v1);
+      glm::vec3 max_vec = glm::max(v0, v1);
+      return VkAabbPositionsKHR {min_vec.x, min_vec.y, min_vec.z, max_vec.x, max_vec.y, max_vec.z};
+    }
+
+    //write_quad of process_level.comp, pixel corners projected on the plane
+    void write_quad(std::vector<glm::vec3> &out, const glm::vec3 &pos, const glm::vec3 &normal, const glm::vec2 &corner_uv, const glm::vec2 &step_uv) const {
+      glm::vec3 v00 = plane_intersection(corner_uv, normal, pos);
+      glm::vec3 v10 = plane_intersection(corner_uv + glm::vec2(step_uv.x, 0.f), normal, pos);
+      glm::vec3 v01 = plane_intersection(corner_uv + glm::vec2(0.f, step_uv.y), normal, pos);
+      glm::vec3 v11 = plane_intersection(corner_uv + step_uv, normal, pos);
+      out.insert(out.end(), {v00, v10, v11, v00, v11, v01});
+    }
+
+    bool check_gaps(const glm::vec3 positions[4], const glm::vec3 normals[4]) const {
+      float min_dot = 1.f;
+      for (uint32_t i = 0; i < 2; i++) {
+        for (uint32_t j = 0; j < 2; j++) {
+          glm::vec3 pos = positions[i * 2 + j];
+          glm::vec3 dy = positions[((i + 1) & 1) * 2 + j] - pos;
+          glm::vec3 dx = positions[i * 2 + ((j + 1) & 1)] - pos;
+          bool swp = i == j;
+          glm::vec3 reconstructed_normal = glm::normalize(glm::cross(swp? dx : dy, swp? dy : dx));
+          min_dot = std::min(glm::dot(reconstructed_normal, normals[i * 2 + j]), min_dot);
+        }
+      }
+      return min_dot < thresholds.gap_min_dot;
+    }
+
+    bool load_nodes(const TreeLevel &src, const glm::ivec2 &top_left, glm::vec3 normals[4], glm::vec3 positions[4], bool valid_nodes[4]) const {
+      bool all_nodes_valid = true;
+
+      for (int i = 0; i < 2; i++) {
+        for (int j = 0; j < 2; j++) {
+          uint32_t offset = i * 2 + j;
+          glm::ivec2 sample_pos = top_left + glm::ivec2(j, i);
+          glm::vec2 sample_uv = (glm::vec2(sample_pos) + glm::vec2(0.5, 0.5))/glm::vec2(src.size);
+
+          glm::vec4 encoded {0.f, 0.f, -1.f, 0.f};
+          if (glm::all(glm::lessThan(sample_pos, src.size))) {
+            encoded = src.at(sample_pos);
+          }
+
+          valid_nodes[offset] = (encoded.z >= 0.f);
+          all_nodes_valid = all_nodes_valid && valid_nodes[offset];
+          normals[offset] = valid_nodes[offset]? decode_normal(glm::vec2(encoded)) : glm::vec3(0, 0, 0);
+          positions[offset] = valid_nodes[offset]? reconstruct_view_vec(sample_uv, encoded.z, params) : glm::vec3(0, 0, 0);
+        }
+      }
+
+      return all_nodes_valid;
+    }
+
+    bool compress_nodes(const glm::ivec2 &top_left, const glm::ivec2 &src_tex_size, const glm::vec3 normals[4], const glm::vec3 positions[4], glm::vec3 &out_normal, glm::vec3 &out_pos, float &out_plane_dist) const {
+      const glm::vec3 node_normal = glm::normalize(0.25f * (normals[0] + normals[1] + normals[2] + normals[3]));
+
+      const glm::vec2 uv_step = 1.f/glm::vec2(src_tex_size);
+      const glm::vec2 top_left_uv = glm::vec2(top_left) * uv_step;
+
+      glm::ivec2 dst_tex_size = (src_tex_size + glm::ivec2(1, 1))/2;
+      const glm::vec2 center_uv = (0.5f * glm::vec2(top_left) + glm::vec2(0.5, 0.5))/glm::vec2(dst_tex_size);
+
+      const glm::vec3 node_view_vec = glm::normalize(reconstruct_view_vec(center_uv, 0.f, params));
+
+      //minimization
+      float dot_sum = 0.f;
+
+      for (int i = 0; i < 2; i++) {
+        for (int j = 0; j < 2; j++) {
+          glm::vec3 pos = positions[i * 2 + j];
+          glm::vec3 norm = normals[i * 2 + j];
+          glm::vec2 corner_uv = top_left_uv + float(i) * glm::vec2(0.f, uv_step.y) + float(j) * glm::vec2(uv_step.x, 0.f);
+
+          dot_sum += glm::dot(node_normal, plane_intersection(corner_uv, norm, pos));
+          dot_sum += glm::dot(node_normal, plane_intersection(corner_uv + glm::vec2(uv_step.x, 0), norm, pos));
+          dot_sum += glm::dot(node_normal, plane_intersection(corner_uv + glm::vec2(0, uv_step.y), norm, pos));
+          dot_sum += glm::dot(node_normal, plane_intersection(corner_uv + uv_step, norm, pos));
+        }
+      }
+
+      float t = dot_sum/(16.f * glm::dot(node_view_vec, node_normal));
+      glm::vec3 node_pos = t * node_view_vec;
+
+      float max_norm_angle = -1.f;
+      float max_plane_dist = 0.f;
+      for (int i = 0; i < 4; i++) {
+        max_norm_angle = std::max(max_norm_angle, 1 - glm::dot(node_normal, normals[i]));
+        max_plane_dist = std::max(max_plane_dist, std::abs(glm::dot(positions[i] - node_pos, node_normal)));
+      }
+
+      out_normal = node_normal;
+      out_pos = node_pos;
+      out_plane_dist = max_plane_dist;
+      return (max_plane_dist < thresholds.max_plane_distance && max_norm_angle < thresholds.max_normal_angle);
+    }
+
+    TreeCompressedPlane pack_plane(const glm::vec3 &pos, const glm::vec3 &norm) const {
+      uint32_t uint_depth = uint32_t(encode_depth(pos.z, params.znear, params.zfar) * ((1 << 24) - 1));
+
+      TreeCompressedPlane result;
+      result.packed_normal = glm::packUnorm2x16(encode_normal(norm));
+      std::memcpy(&result.pos_x, &pos.x, sizeof(float));
+      std::memcpy(&result.pos_y, &pos.y, sizeof(float));
+      result.size_depth = ((src_level & 0xff) << 24) | (uint_depth & 0x00ffffff);
+      return result;
+    }
+  };
+}
+
+//largest view space distance between level 0 pixels covered by a node and the node plane
+static float get_reprojection_error(const TreeLevel &level0, const DepthAsParams &params, const glm::ivec2 &node, uint32_t node_level, const glm::vec3 &pos, const glm::vec3 &norm) {
+  float max_error = 0.f;
+  const glm::ivec2 start = node << int(node_level);
+  const glm::ivec2 end = glm::min((node + 1) << int(node_level), level0.size);
+
+  for (int y = start.y; y < end.y; y++) {
+    for (int x = start.x; x < end.x; x++) {
+      const auto &texel = level0.at(glm::ivec2{x, y});
+      if (texel.z < 0.f) {
+        continue;
+      }
+
+      glm::vec2 uv = (glm::vec2(x, y) + glm::vec2(0.5f))/glm::vec2(level0.size);
+      glm::vec3 actual = reconstruct_view_vec(uv, texel.z, params);
+      glm::vec3 v = glm::normalize(reconstruct_view_vec(uv, 0.f, params));
+      float dot_val = glm::dot(v, norm);
+      if (std::abs(dot_val) <= 0.01f) {
+        continue;
+      }
+      glm::vec3 on_plane = v * (glm::dot(pos, norm)/dot_val);
+      max_error = std::max(max_error, glm::length(actual - on_plane));
+    }
+  }
+  return max_error;
+}
+
+TreeCompressorResult compress_gbuffer_tree(const DepthImage &depth, const std::vector<glm::vec3> &view_normals, const DepthAsParams &params, const TreeCompressorThresholds &thresholds) {
+  TreeCompressorResult result;
+  auto &stats = result.stats;
+  stats.pixels_count = depth.width * depth.height;
+
+  //same chain as the tree_levels image of GbufferCompressor
+  const uint32_t mips_count = uint32_t(std::floor(std::log2(std::max(depth.width, depth.height)))) + 1u;
+  if (mips_count < 2) {
+    throw std::runtime_error {"2 mips or more required"};
+  }
+
+  std::vector<TreeLevel> levels(mips_count);
+  for (uint32_t i = 0; i < mips_count; i++) {
+    levels[i].size = glm::ivec2{std::max(depth.width >> i, 1u), std::max(depth.height >> i, 1u)};
+    levels[i].texels.assign(levels[i].size.x * levels[i].size.y, glm::vec4{0.f, 0.f, -1.f, 0.f});
+  }
+
+  //init.comp
+  for (uint32_t y = 0; y < depth.height; y++) {
+    for (uint32_t x = 0; x < depth.width; x++) {
+      glm::vec2 normal = encode_normal(glm::normalize(view_normals[y * depth.width + x]));
+      levels[0].at(glm::ivec2(x, y)) = glm::vec4(normal, depth.fetch(x, y), 0.f);
+    }
+  }
+
+  const uint32_t last_src_mip = std::min(5u, mips_count - 2);
+  stats.levels = last_src_mip + 1;
+
+  for (uint32_t src_level = 0; src_level <= last_src_mip; src_level++) {
+    const uint32_t flag = (src_level == 0)? CHECK_GAPS : (src_level == last_src_mip)? DO_NOT_COMPRESS : 0u;
+    LevelProcessor processor {params, thresholds, flag, src_level};
+
+    const auto &src = levels[src_level];
+    auto &dst = levels[src_level + 1];
+
+    for (int py = 0; py < dst.size.y; py++) {
+      for (int px = 0; px < dst.size.x; px++) {
+        const glm::ivec2 pixel_pos {px, py};
+        bool compress = (flag != DO_NOT_COMPRESS);
+
+        glm::vec3 normals[4];
+        glm::vec3 positions[4];
+        bool valid_child_nodes[4];
+
+        bool all_nodes_valid = processor.load_nodes(src, 2 * pixel_pos, normals, positions, valid_child_nodes);
+        compress = compress && all_nodes_valid;
+
+        if (compress && flag == CHECK_GAPS) {
+          compress = compress && !processor.check_gaps(positions, normals);
+        }
+
+        glm::vec3 node_normal {0, 0, 0};
+        glm::vec3 node_pos {0, 0, 0};
+        float plane_dist = 0.f;
+
+        if (compress) {
+          compress = compress && processor.compress_nodes(2 * pixel_pos, src.size, normals, positions, node_normal, node_pos, plane_dist);
+        }
+
+        if (compress) {
+          stats.merged_per_level[src_level]++;
+          stats.max_plane_distance = std::max(stats.max_plane_distance, plane_dist);
+          dst.at(pixel_pos) = glm::vec4(encode_normal(node_normal), encode_depth(node_pos.z, params.znear, params.zfar), 0.f);
+          continue;
+        }
+
+        //push_aabbs
+        if (src_level < 2) {
+          for (uint32_t i = 0; i < 4; i++) {
+            stats.dropped_per_level[src_level] += valid_child_nodes[i]? 1u : 0u;
+          }
+          continue;
+        }
+
+        const glm::vec2 step_uv = 1.f/glm::vec2(src.size);
+        const glm::vec2 top_left_uv = glm::vec2(2 * pixel_pos) * step_uv;
+
+        for (int i = 0; i < 2; i++) {
+          for (int j = 0; j < 2; j++) {
+            uint32_t offset = i * 2 + j;
+            if (!valid_child_nodes[offset]) {
+              continue;
+            }
+
+            const glm::vec3 &norm = normals[offset];
+            const glm::vec3 &pos = positions[offset];
+            glm::vec2 corner_uv = top_left_uv + float(i) * glm::vec2(0.f, step_uv.y) + float(j) * glm::vec2(step_uv.x, 0.f);
+
+            result.planes.push_back(processor.pack_plane(pos, norm));
+            result.aabbs.push_back(processor.create_aabb(pos, norm, corner_uv, step_uv));
+            processor.write_quad(result.triangles, pos, norm, corner_uv, step_uv);
+            stats.aabbs_per_level[src_level]++;
+
+            float error = get_reprojection_error(levels[0], params, 2 * pixel_pos + glm::ivec2(j, i), src_level, pos, norm);
+            stats.max_reprojection_error = std::max(stats.max_reprojection_error, error);
+          }
+        }
+      }
+    }
+  }
+
+  stats.aabbs_count = result.aabbs.size();
+  return result;
+}
@@ -0,0 +1,48 @@
+#ifndef TREE_COMPRESSOR_CPU_HPP_INCLUDED
+#define TREE_COMPRESSOR_CPU_HPP_INCLUDED
+
+#include "depth_as_cpu.hpp"
+
+//CPU reference of GbufferCompressor::build_tree (tree_compressor/init.comp and process_level.comp)
+//AABBs and planes come in dispatch order instead of atomicAdd order, everything else follows the shaders
+struct TreeCompressorThresholds {
+  float max_plane_distance = 0.05f; //compress_nodes, view space
+  float max_normal_angle = 0.05f;   //compress_nodes, 1 - cos
+  float gap_min_dot = 0.5f;         //check_gaps
+};
+
+//compressed_plane.glsl
+struct TreeCompressedPlane {
+  uint32_t packed_normal;
+  uint32_t pos_x;
+  uint32_t pos_y;
+  uint32_t size_depth; //level << 24 | 24 bit depth
+};
+
+struct TreeCompressorStats {
+  static constexpr uint32_t MAX_LEVELS = 16;
+
+  uint32_t levels = 0;                          //processed source levels
+  uint32_t aabbs_per_level[MAX_LEVELS] {};      //by source level
+  uint32_t merged_per_level[MAX_LEVELS] {};     //nodes written to the next level
+  uint32_t dropped_per_level[MAX_LEVELS] {};    //valid nodes of failed merges below level 2, push_aabbs skips them
+  uint32_t aabbs_count = 0;
+  uint32_t pixels_count = 0;                    //AABBs of the per pixel DepthAs
+  float max_plane_distance = 0.f;               //largest accepted compress_nodes distance
+  float max_reprojection_error = 0.f;           //view space distance between level 0 pixels and their emitted planes
+};
+
+struct TreeCompressorResult {
+  std::vector<VkAabbPositionsKHR> aabbs;
+  std::vector<TreeCompressedPlane> planes;
+  std::vector<glm::vec3> triangles; //GbufferCompressor::Geometry::Triangles, 6 vertices per plane
+  TreeCompressorStats stats;
+};
+
+//view_normals are gbuffer normals already transformed by normal_mat, one per depth texel
+TreeCompressorResult compress_gbuffer_tree(const DepthImage &depth, const std::vector<glm::vec3> &view_normals, const DepthAsParams &params, const TreeCompressorThresholds &thresholds = {});
+
+glm::vec2 encode_normal(const glm::vec3 &v);
+glm::vec3 decode_normal(glm::vec2 uv);
+
+#endif